@@ -0,0 +1,67 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include<iostream>
+#include<chrono>
+
+#include"Map.h"
+#include"KeyFrameDatabase.h"
+#include"MapJournal.h"
+#include"MapSerializer.h"
+#include"VocabularyRegistry.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    if(argc != 4)
+    {
+        cerr << endl << "Usage: ./replay_journal path_to_vocabulary path_to_journal path_to_output_map" << endl;
+        return 1;
+    }
+
+    cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
+    std::shared_ptr<const ORB_SLAM2::ORBVocabulary> pVoc = ORB_SLAM2::VocabularyRegistry::Get(argv[1]);
+    if(!pVoc)
+    {
+        cerr << "Failed to open vocabulary at: " << argv[1] << endl;
+        return 1;
+    }
+    cout << "Vocabulary loaded!" << endl << endl;
+
+    ORB_SLAM2::Map map;
+    ORB_SLAM2::KeyFrameDatabase database(*pVoc);
+
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+    if(!ORB_SLAM2::MapJournal::Replay(argv[2],&map,&database,pVoc.get()))
+        return 1;
+
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    cout << "Replay time: " << std::chrono::duration_cast<std::chrono::duration<double> >(t2-t1).count() << " s" << endl;
+
+    if(!ORB_SLAM2::MapSerializer::Save(argv[3],&map,&database))
+        return 1;
+
+    cout << "Map saved to " << argv[3] << ", load it with System::LoadMap" << endl;
+
+    return 0;
+}
@@ -0,0 +1,275 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include<iostream>
+#include<fstream>
+#include<sstream>
+#include<chrono>
+#include<map>
+
+#include<opencv2/core/core.hpp>
+#include<opencv2/highgui/highgui.hpp>
+
+#include"Frame.h"
+#include"KeyFrame.h"
+#include"MapPoint.h"
+#include"Map.h"
+#include"KeyFrameDatabase.h"
+#include"ORBmatcher.h"
+#include"ORBextractor.h"
+
+using namespace std;
+
+void LoadImages(const string &strFile, vector<string> &vstrImageFilenames,
+                vector<double> &vTimestamps);
+
+struct BenchmarkResult
+{
+    BenchmarkResult() : tTransform(0), nTransforms(0), tMatching(0), nMatchings(0), nMatches(0),
+        tQuery(0), nQueries(0), nRecalled(0) {}
+
+    double tTransform;
+    int nTransforms;
+    double tMatching;
+    int nMatchings;
+    long nMatches;
+    double tQuery;
+    int nQueries;
+    int nRecalled;
+};
+
+class Benchmark
+{
+public:
+    Benchmark(const string &strSettingsFile, const string &strSequence, const int nKeyFrameStep);
+
+    // Every nKeyFrameStep-th image becomes a keyframe. All images are converted to BoW and
+    // matched against the last keyframe with SearchByBoW. Then the remaining images are used
+    // as relocalization queries: a query is recalled if a keyframe at most nKeyFrameStep
+    // images away is among the candidates.
+    BenchmarkResult Run(const ORB_SLAM2::ORBVocabulary &voc);
+
+protected:
+    ORB_SLAM2::Frame LoadFrame(const size_t ni, const ORB_SLAM2::ORBVocabulary &voc);
+
+    string mstrSequence;
+    vector<string> mvstrImageFilenames;
+    vector<double> mvTimestamps;
+    int mnKeyFrameStep;
+
+    ORB_SLAM2::ORBextractor* mpExtractor;
+    cv::Mat mK;
+    cv::Mat mDistCoef;
+};
+
+static double Elapsed(const std::chrono::steady_clock::time_point &t1)
+{
+    return std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now() - t1).count();
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 5 || argc > 6)
+    {
+        cerr << endl << "Usage: ./bench_vocabulary path_to_vocabulary path_to_compacted_vocabulary path_to_settings path_to_sequence [keyframe_step]" << endl;
+        return 1;
+    }
+
+    const int nKeyFrameStep = argc==6 ? max(1,atoi(argv[5])) : 10;
+
+    Benchmark benchmark(argv[3], argv[4], nKeyFrameStep);
+
+    for(int i=1; i<=2; i++)
+    {
+        ORB_SLAM2::ORBVocabulary voc;
+        if(!voc.loadFromTextFile(argv[i]) || voc.empty())
+        {
+            cerr << "Falied to open at: " << argv[i] << endl;
+            return 1;
+        }
+
+        BenchmarkResult r = benchmark.Run(voc);
+
+        cout << endl << "-------" << endl;
+        cout << argv[i] << " (" << voc.size() << " words)" << endl;
+        cout << "mean transform time: " << 1e3*r.tTransform/max(1,r.nTransforms) << " ms" << endl;
+        cout << "mean SearchByBoW time: " << 1e3*r.tMatching/max(1,r.nMatchings) << " ms, "
+             << (double)r.nMatches/max(1,r.nMatchings) << " matches" << endl;
+        cout << "mean relocalization query time: " << 1e3*r.tQuery/max(1,r.nQueries) << " ms" << endl;
+        cout << "relocalization recall: " << (double)r.nRecalled/max(1,r.nQueries) << " (" << r.nRecalled << "/" << r.nQueries << ")" << endl;
+    }
+
+    return 0;
+}
+
+Benchmark::Benchmark(const string &strSettingsFile, const string &strSequence, const int nKeyFrameStep):
+    mstrSequence(strSequence), mnKeyFrameStep(nKeyFrameStep)
+{
+    LoadImages(strSequence+"/rgb.txt", mvstrImageFilenames, mvTimestamps);
+
+    cv::FileStorage fSettings(strSettingsFile, cv::FileStorage::READ);
+    if(!fSettings.isOpened())
+    {
+       cerr << "Failed to open settings file at: " << strSettingsFile << endl;
+       exit(-1);
+    }
+
+    mK = cv::Mat::eye(3,3,CV_32F);
+    mK.at<float>(0,0) = fSettings["Camera.fx"];
+    mK.at<float>(1,1) = fSettings["Camera.fy"];
+    mK.at<float>(0,2) = fSettings["Camera.cx"];
+    mK.at<float>(1,2) = fSettings["Camera.cy"];
+
+    mDistCoef = cv::Mat(4,1,CV_32F);
+    mDistCoef.at<float>(0) = fSettings["Camera.k1"];
+    mDistCoef.at<float>(1) = fSettings["Camera.k2"];
+    mDistCoef.at<float>(2) = fSettings["Camera.p1"];
+    mDistCoef.at<float>(3) = fSettings["Camera.p2"];
+
+    int nFeatures = fSettings["ORBextractor.nFeatures"];
+    float fScaleFactor = fSettings["ORBextractor.scaleFactor"];
+    int nLevels = fSettings["ORBextractor.nLevels"];
+    int fIniThFAST = fSettings["ORBextractor.iniThFAST"];
+    int fMinThFAST = fSettings["ORBextractor.minThFAST"];
+    mpExtractor = new ORB_SLAM2::ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+}
+
+ORB_SLAM2::Frame Benchmark::LoadFrame(const size_t ni, const ORB_SLAM2::ORBVocabulary &voc)
+{
+    cv::Mat im = cv::imread(mstrSequence+"/"+mvstrImageFilenames[ni],CV_LOAD_IMAGE_GRAYSCALE);
+    if(im.empty())
+    {
+        cerr << "Failed to load image at: " << mstrSequence << "/" << mvstrImageFilenames[ni] << endl;
+        exit(-1);
+    }
+    const float bf = 0, thDepth = 0;
+    return ORB_SLAM2::Frame(im,mvTimestamps[ni],mpExtractor,&voc,mK,mDistCoef,bf,thDepth);
+}
+
+BenchmarkResult Benchmark::Run(const ORB_SLAM2::ORBVocabulary &voc)
+{
+    BenchmarkResult result;
+
+    ORB_SLAM2::Map map;
+    ORB_SLAM2::KeyFrameDatabase database(voc);
+    ORB_SLAM2::ORBmatcher matcher(0.7,true);
+
+    vector<ORB_SLAM2::KeyFrame*> vpKeyFrames;
+    vector<ORB_SLAM2::MapPoint*> vpMapPoints;
+    std::map<ORB_SLAM2::KeyFrame*,size_t> mKeyFrameImage;
+
+    ORB_SLAM2::KeyFrame* pLastKF = NULL;
+    for(size_t ni=0; ni<mvstrImageFilenames.size(); ni++)
+    {
+        ORB_SLAM2::Frame F = LoadFrame(ni,voc);
+
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        F.ComputeBoW();
+        result.tTransform += Elapsed(t1);
+        result.nTransforms++;
+
+        if(pLastKF)
+        {
+            vector<ORB_SLAM2::MapPoint*> vpMatches;
+            t1 = std::chrono::steady_clock::now();
+            result.nMatches += matcher.SearchByBoW(pLastKF,F,vpMatches);
+            result.tMatching += Elapsed(t1);
+            result.nMatchings++;
+        }
+
+        if(ni%mnKeyFrameStep!=0)
+            continue;
+
+        // SearchByBoW only matches keypoints with a map point, give one to each of them
+        ORB_SLAM2::KeyFrame* pKF = new ORB_SLAM2::KeyFrame(F,&map,&database);
+        for(int i=0; i<F.N; i++)
+        {
+            ORB_SLAM2::MapPoint* pMP = new ORB_SLAM2::MapPoint(cv::Mat::zeros(3,1,CV_32F),pKF,&map);
+            pKF->AddMapPoint(pMP,i);
+            vpMapPoints.push_back(pMP);
+        }
+        database.add(pKF);
+        vpKeyFrames.push_back(pKF);
+        mKeyFrameImage[pKF] = ni;
+        pLastKF = pKF;
+    }
+
+    for(size_t ni=0; ni<mvstrImageFilenames.size(); ni++)
+    {
+        if(ni%mnKeyFrameStep==0)
+            continue;
+
+        ORB_SLAM2::Frame F = LoadFrame(ni,voc);
+        F.ComputeBoW();
+
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        vector<ORB_SLAM2::KeyFrame*> vpCandidates = database.DetectRelocalizationCandidates(&F);
+        result.tQuery += Elapsed(t1);
+        result.nQueries++;
+
+        for(size_t i=0; i<vpCandidates.size(); i++)
+        {
+            const size_t nKFImage = mKeyFrameImage[vpCandidates[i]];
+            const size_t nDist = nKFImage>ni ? nKFImage-ni : ni-nKFImage;
+            if(nDist<=(size_t)mnKeyFrameStep)
+            {
+                result.nRecalled++;
+                break;
+            }
+        }
+    }
+
+    for(size_t i=0; i<vpMapPoints.size(); i++)
+        delete vpMapPoints[i];
+    for(size_t i=0; i<vpKeyFrames.size(); i++)
+        delete vpKeyFrames[i];
+
+    return result;
+}
+
+void LoadImages(const string &strFile, vector<string> &vstrImageFilenames, vector<double> &vTimestamps)
+{
+    ifstream f;
+    f.open(strFile.c_str());
+
+    // skip first three lines
+    string s0;
+    getline(f,s0);
+    getline(f,s0);
+    getline(f,s0);
+
+    while(!f.eof())
+    {
+        string s;
+        getline(f,s);
+        if(!s.empty())
+        {
+            stringstream ss;
+            ss << s;
+            double t;
+            string sRGB;
+            ss >> t;
+            vTimestamps.push_back(t);
+            ss >> sRGB;
+            vstrImageFilenames.push_back(sRGB);
+        }
+    }
+}
@@ -0,0 +1,146 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include<iostream>
+#include<fstream>
+#include<sstream>
+
+#include<opencv2/core/core.hpp>
+#include<opencv2/highgui/highgui.hpp>
+#include<opencv2/imgproc/imgproc.hpp>
+
+#include"ORBextractor.h"
+#include"Converter.h"
+#include"VocabularyCompactor.h"
+
+using namespace std;
+
+void LoadImages(const string &strFile, vector<string> &vstrImageFilenames,
+                vector<double> &vTimestamps);
+
+int main(int argc, char **argv)
+{
+    if(argc < 6)
+    {
+        cerr << endl << "Usage: ./compact_vocabulary path_to_vocabulary path_to_settings path_to_output min_usage path_to_sequence [path_to_sequence ...]" << endl;
+        return 1;
+    }
+
+    const string strOutput = argv[3];
+    const unsigned int nMinUsage = atoi(argv[4]);
+
+    cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
+    ORB_SLAM2::ORBVocabularyCompactor voc;
+    if(!voc.loadFromTextFile(argv[1]) || voc.empty())
+    {
+        cerr << "Falied to open at: " << argv[1] << endl;
+        return 1;
+    }
+    cout << "Vocabulary loaded: " << voc.size() << " words, " << voc.NodesInUse() << " nodes" << endl;
+
+    // Descriptors must be extracted exactly as Tracking does
+    cv::FileStorage fSettings(argv[2], cv::FileStorage::READ);
+    if(!fSettings.isOpened())
+    {
+       cerr << "Failed to open settings file at: " << argv[2] << endl;
+       return 1;
+    }
+    int nFeatures = fSettings["ORBextractor.nFeatures"];
+    float fScaleFactor = fSettings["ORBextractor.scaleFactor"];
+    int nLevels = fSettings["ORBextractor.nLevels"];
+    int fIniThFAST = fSettings["ORBextractor.iniThFAST"];
+    int fMinThFAST = fSettings["ORBextractor.minThFAST"];
+    ORB_SLAM2::ORBextractor extractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+
+    // Replay every image of every sequence
+    for(int s=5; s<argc; s++)
+    {
+        vector<string> vstrImageFilenames;
+        vector<double> vTimestamps;
+        LoadImages(string(argv[s])+"/rgb.txt", vstrImageFilenames, vTimestamps);
+
+        cout << "Replaying " << vstrImageFilenames.size() << " images of " << argv[s] << endl;
+
+        for(size_t ni=0; ni<vstrImageFilenames.size(); ni++)
+        {
+            cv::Mat im = cv::imread(string(argv[s])+"/"+vstrImageFilenames[ni],CV_LOAD_IMAGE_GRAYSCALE);
+            if(im.empty())
+            {
+                cerr << "Failed to load image at: " << argv[s] << "/" << vstrImageFilenames[ni] << endl;
+                return 1;
+            }
+
+            vector<cv::KeyPoint> vKeys;
+            cv::Mat descriptors;
+            extractor(im,cv::Mat(),vKeys,descriptors);
+            voc.AddDocument(ORB_SLAM2::Converter::toDescriptorVector(descriptors));
+        }
+    }
+
+    cout << "Replayed " << voc.DescriptorsInUse() << " descriptors from " << voc.DocumentsInUse() << " images" << endl;
+
+    // ORBmatcher::SearchByBoW works on nodes 4 levels above the words
+    if(!voc.Compact(nMinUsage, voc.getDepthLevels()-4))
+    {
+        cerr << "Nothing to compact, no image was replayed." << endl;
+        return 1;
+    }
+
+    cout << "Compacted vocabulary: " << voc.size() << " words, " << voc.NodesInUse() << " nodes" << endl;
+
+    if(!voc.SaveToTextFile(strOutput))
+    {
+        cerr << "Failed to write vocabulary at: " << strOutput << endl;
+        return 1;
+    }
+    cout << "Saved to " << strOutput << endl;
+
+    return 0;
+}
+
+void LoadImages(const string &strFile, vector<string> &vstrImageFilenames, vector<double> &vTimestamps)
+{
+    ifstream f;
+    f.open(strFile.c_str());
+
+    // skip first three lines
+    string s0;
+    getline(f,s0);
+    getline(f,s0);
+    getline(f,s0);
+
+    while(!f.eof())
+    {
+        string s;
+        getline(f,s);
+        if(!s.empty())
+        {
+            stringstream ss;
+            ss << s;
+            double t;
+            string sRGB;
+            ss >> t;
+            vTimestamps.push_back(t);
+            ss >> sRGB;
+            vstrImageFilenames.push_back(sRGB);
+        }
+    }
+}
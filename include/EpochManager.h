@@ -0,0 +1,90 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EPOCHMANAGER_H
+#define EPOCHMANAGER_H
+
+#include <vector>
+#include <deque>
+#include <mutex>
+
+namespace ORB_SLAM2
+{
+
+// Deferred reclamation of map objects (quiescent-state based).
+// Threads that use map objects register a slot and report a quiescent state at points where they
+// hold no pointer to objects that became bad before (once per loop iteration). Threads that keep
+// containers between iterations take the epoch with BeginQuiescent, drop the bad entries, and then
+// publish that epoch with EndQuiescent. A retired object is freed once every registered thread has
+// published an epoch taken after its retirement.
+class EpochManager
+{
+public:
+    EpochManager();
+    ~EpochManager();
+
+    // Returns the slot of the calling thread. The thread counts as quiescent at registration.
+    int RegisterThread();
+
+    // The thread stops taking part (e.g. when it finishes). It must not use map objects afterwards.
+    void UnregisterThread(const int nSlot);
+
+    // Epoch to publish once the bad entries seen from now on have been dropped.
+    // Objects retired meanwhile may still be referenced and are not covered by it.
+    unsigned long BeginQuiescent();
+
+    // The thread holds no pointer to objects retired before the matching BeginQuiescent
+    void EndQuiescent(const int nSlot, const unsigned long nEpoch);
+
+    // The thread holds no pointer to map objects at all
+    void Quiescent(const int nSlot);
+
+    // Schedules pfDelete(p) for when no registered thread can reference p anymore
+    void Retire(void* p, void (*pfDelete)(void*));
+
+    // Frees the retired objects that are safe. Returns how many were freed.
+    size_t Reclaim();
+
+    // Retired objects waiting for a quiescent state
+    size_t GetPending();
+
+protected:
+
+    struct Retired
+    {
+        void* p;
+        void (*pfDelete)(void*);
+        unsigned long nEpoch;
+    };
+
+    unsigned long mnEpoch;
+
+    // Epoch of the last quiescent state of each slot (free slots have the maximum value)
+    std::vector<unsigned long> mvnThreadEpochs;
+
+    // In retirement order, so epochs are non decreasing
+    std::deque<Retired> mdRetired;
+
+    std::mutex mMutex;
+};
+
+} //namespace ORB_SLAM
+
+#endif // EPOCHMANAGER_H
@@ -29,6 +29,7 @@
 #include "ORBVocabulary.h"
 #include "KeyFrame.h"
 #include "ORBextractor.h"
+#include "SharedVector.h"
 
 #include <opencv2/opencv.hpp>
 
@@ -40,22 +41,47 @@ namespace ORB_SLAM2
 class MapPoint;
 class KeyFrame;
 
+// Projection of a map point in a frame, used by the tracking to search the point in the frame.
+struct MapPointProjection
+{
+    MapPoint* pMP;
+    float u;
+    float v;
+    float uR;
+    int nLevel;
+    float viewCos;
+    float sigma; // pixels, -1 if the pose uncertainty is unknown
+};
+
 class Frame
 {
 public:
     Frame();
 
-    // Copy constructor.
+    // Copy constructor. The feature data (keypoints, depths, descriptors and grid) is shared.
     Frame(const Frame &frame);
 
+    // Copy assignment. The containers of this frame are reused, the descriptors are shared.
+    Frame& operator=(const Frame &frame);
+
+    Frame(Frame &&frame) = default;
+    Frame& operator=(Frame &&frame) = default;
+
+    // The image constructors take the containers of pRecycled (a frame no longer needed, left empty),
+    // so that the tracking loop does not allocate them for each new frame.
+
     // Constructor for stereo cameras.
-    Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
+    Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, const ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, Frame* pRecycled=NULL);
 
     // Constructor for RGB-D cameras.
-    Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
+    Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,const ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, Frame* pRecycled=NULL);
 
     // Constructor for Monocular cameras.
-    Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
+    Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,const ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, Frame* pRecycled=NULL);
+
+    // Constructor for frames tracked by optical flow. The keypoints are the (distorted) positions of
+    // mappoints of the last frame, which are associated to them. There are no descriptors.
+    Frame(const double &timeStamp, const Frame &lastFrame, const std::vector<cv::KeyPoint> &vKeys, const std::vector<MapPoint*> &vpMapPoints, Frame* pRecycled=NULL);
 
     // Extract ORB on the image. 0 for left image and 1 for right image.
     void ExtractORB(int flag, const cv::Mat &im);
@@ -80,13 +106,36 @@ public:
     }
 
     // Check if a MapPoint is in the frustum of the camera
-    // and fill variables of the MapPoint to be used by the tracking
-    bool isInFrustum(MapPoint* pMP, float viewingCosLimit);
+    // and fill its projection to be used by the tracking
+    bool isInFrustum(MapPoint* pMP, float viewingCosLimit, MapPointProjection &proj);
+
+    // Standard deviation (pixels) of the projection of a point in camera coordinates caused by
+    // the pose uncertainty, -1 if the pose covariance is unknown
+    float ProjectionSigma(const float x, const float y, const float z) const;
 
     // Compute the cell of a keypoint (return false if outside the grid)
     bool PosInGrid(const cv::KeyPoint &kp, int &posX, int &posY);
 
+    // Assign keypoints to the grid for speed up feature matching (called in the constructor).
+    void AssignFeaturesToGrid();
+
+    // Flat grid of undistorted keypoints with the given bounds (see mGridStart)
+    static void BuildGrid(const std::vector<cv::KeyPoint> &vKeysUn, const float minX, const float minY,
+                          const float gridElementWidthInv, const float gridElementHeightInv,
+                          std::vector<int> &vGridStart, std::vector<std::size_t> &vGridIndices);
+
+    // Keypoints of a grid cell
+    inline int GetGridCellSize(const int x, const int y) const {
+        return mGridStart[x*FRAME_GRID_ROWS+y+1]-mGridStart[x*FRAME_GRID_ROWS+y];
+    }
+    inline const std::size_t* GetGridCell(const int x, const int y) const {
+        return mGridIndices.data()+mGridStart[x*FRAME_GRID_ROWS+y];
+    }
+
     vector<size_t> GetFeaturesInArea(const float &x, const float  &y, const float  &r, const int minLevel=-1, const int maxLevel=-1) const;
+    // Same, filling a buffer of the caller (reused across calls to avoid allocations)
+    void GetFeaturesInArea(const float &x, const float  &y, const float  &r, vector<size_t> &vIndices,
+                           const int minLevel=-1, const int maxLevel=-1) const;
 
     // Search a match for each keypoint in the left image to a keypoint in the right image.
     // If there is a match, depth is computed and the right coordinate associated to the left keypoint is stored.
@@ -100,7 +149,7 @@ public:
 
 public:
     // Vocabulary used for relocalization.
-    ORBVocabulary* mpORBvocabulary;
+    const ORBVocabulary* mpORBvocabulary;
 
     // Feature extractor. The right is used only in the stereo case.
     ORBextractor* mpORBextractorLeft, *mpORBextractorRight;
@@ -134,19 +183,21 @@ public:
     // Vector of keypoints (original for visualization) and undistorted (actually used by the system).
     // In the stereo case, mvKeysUn is redundant as images must be rectified.
     // In the RGB-D case, RGB images can be distorted.
-    std::vector<cv::KeyPoint> mvKeys, mvKeysRight;
-    std::vector<cv::KeyPoint> mvKeysUn;
+    // The feature data is written only while the frame is built, and is shared with its copies
+    // and with the keyframe created from it.
+    SharedVector<cv::KeyPoint> mvKeys, mvKeysRight;
+    SharedVector<cv::KeyPoint> mvKeysUn;
 
     // Corresponding stereo coordinate and depth for each keypoint.
     // "Monocular" keypoints have a negative value.
-    std::vector<float> mvuRight;
-    std::vector<float> mvDepth;
+    SharedVector<float> mvuRight;
+    SharedVector<float> mvDepth;
 
     // Bag of Words Vector structures.
     DBoW2::BowVector mBowVec;
     DBoW2::FeatureVector mFeatVec;
 
-    // ORB descriptor, each row associated to a keypoint.
+    // ORB descriptor, each row associated to a keypoint. Never modified in place once extracted.
     cv::Mat mDescriptors, mDescriptorsRight;
 
     // MapPoints associated to keypoints, NULL pointer if no association.
@@ -156,13 +207,18 @@ public:
     std::vector<bool> mvbOutlier;
 
     // Keypoints are assigned to cells in a grid to reduce matching complexity when projecting MapPoints.
+    // The grid is flat: the keypoints of cell c=x*FRAME_GRID_ROWS+y are mGridIndices[mGridStart[c]] to mGridIndices[mGridStart[c+1]-1].
     static float mfGridElementWidthInv;
     static float mfGridElementHeightInv;
-    std::vector<std::size_t> mGrid[FRAME_GRID_COLS][FRAME_GRID_ROWS];
+    SharedVector<int> mGridStart;
+    SharedVector<std::size_t> mGridIndices;
 
     // Camera pose.
     cv::Mat mTcw;
 
+    // Covariance of the pose (6x6, rotation first, for a left perturbation as in g2o). Empty if unknown.
+    cv::Mat mPoseCov;
+
     // Current and Next Frame id.
     static long unsigned int nNextId;
     long unsigned int mnId;
@@ -198,8 +254,9 @@ private:
     // Computes image bounds for the undistorted image (called in the constructor).
     void ComputeImageBounds(const cv::Mat &imLeft);
 
-    // Assign keypoints to the grid for speed up feature matching (called in the constructor).
-    void AssignFeaturesToGrid();
+    // Takes (and clears) the containers of a frame no longer needed. Feature data still shared
+    // (e.g. with a keyframe) is left to its other owners.
+    void TakeBuffers(Frame &frame);
 
     // Rotation, translation and camera center
     cv::Mat mRcw;
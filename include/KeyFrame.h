@@ -28,8 +28,12 @@
 #include "ORBextractor.h"
 #include "Frame.h"
 #include "KeyFrameDatabase.h"
+#include "ObjectPool.h"
+#include "SharedVector.h"
 
 #include <mutex>
+#include <atomic>
+#include <chrono>
 
 
 namespace ORB_SLAM2
@@ -42,6 +46,10 @@ class KeyFrameDatabase;
 
 class KeyFrame
 {
+    friend class MapSerializer;
+    friend class MapJournal;
+    friend class KeyFramePager;
+
 public:
     KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB);
 
@@ -63,11 +71,16 @@ public:
     void UpdateConnections();
     void UpdateBestCovisibles();
     std::set<KeyFrame *> GetConnectedKeyFrames();
+    // Ordered by weight, only keyframes sharing at least 15 mappoints (or the best one if none does)
     std::vector<KeyFrame* > GetVectorCovisibleKeyFrames();
     std::vector<KeyFrame*> GetBestCovisibilityKeyFrames(const int &N);
     std::vector<KeyFrame*> GetCovisiblesByWeight(const int &w);
     int GetWeight(KeyFrame* pKF);
 
+    // Weights are kept up to date by the mappoints when observations are added or erased
+    void IncreaseCovisibility(KeyFrame* pKF);
+    void DecreaseCovisibility(KeyFrame* pKF);
+
     // Spanning tree functions
     void AddChild(KeyFrame* pKF);
     void EraseChild(KeyFrame* pKF);
@@ -87,11 +100,20 @@ public:
     void ReplaceMapPointMatch(const size_t &idx, MapPoint* pMP);
     std::set<MapPoint*> GetMapPoints();
     std::vector<MapPoint*> GetMapPointMatches();
+    // Increased on every change of the mappoint matches
+    unsigned long GetMapPointsVersion() const;
     int TrackedMapPoints(const int &minObs);
     MapPoint* GetMapPoint(const size_t &idx);
 
+    // Paging of the matching data (descriptors, feature vector, grid and distorted keypoints, see KeyFramePager).
+    // Pinned keyframes are not evicted, pinning an evicted keyframe reads its data back.
+    void PinFeatures();
+    void UnpinFeatures();
+
     // KeyPoint functions
     std::vector<size_t> GetFeaturesInArea(const float &x, const float  &y, const float  &r) const;
+    // Same, filling a buffer of the caller (reused across calls to avoid allocations)
+    void GetFeaturesInArea(const float &x, const float  &y, const float  &r, std::vector<size_t> &vIndices) const;
     cv::Mat UnprojectStereo(int i);
 
     // Image
@@ -116,6 +138,10 @@ public:
         return pKF1->mnId<pKF2->mnId;
     }
 
+    // KeyFrames are allocated from a pool
+    static void* operator new(size_t nSize);
+    static void operator delete(void* p, size_t nSize);
+
 
     // The following variables are accesed from only 1 thread or never change (no mutex needed).
 public:
@@ -132,26 +158,11 @@ public:
     const float mfGridElementWidthInv;
     const float mfGridElementHeightInv;
 
-    // Variables used by the tracking
-    long unsigned int mnTrackReferenceForFrame;
-    long unsigned int mnFuseTargetForKF;
-
-    // Variables used by the local mapping
-    long unsigned int mnBALocalForKF;
-    long unsigned int mnBAFixedForKF;
-
-    // Variables used by the keyframe database
-    long unsigned int mnLoopQuery;
-    int mnLoopWords;
-    float mLoopScore;
-    long unsigned int mnRelocQuery;
-    int mnRelocWords;
-    float mRelocScore;
-
     // Variables used by loop closing
     cv::Mat mTcwGBA;
     cv::Mat mTcwBefGBA;
-    long unsigned int mnBAGlobalForKF;
+
+    // Traversal marks are kept by each thread in MarkerSets indexed by mnId
 
     // Calibration parameters
     const float fx, fy, cx, cy, invfx, invfy, mbf, mb, mThDepth;
@@ -159,16 +170,17 @@ public:
     // Number of KeyPoints
     const int N;
 
-    // KeyPoints, stereo coordinate and descriptors (all associated by an index)
-    const std::vector<cv::KeyPoint> mvKeys;
-    const std::vector<cv::KeyPoint> mvKeysUn;
-    const std::vector<float> mvuRight; // negative value for monocular points
-    const std::vector<float> mvDepth; // negative value for monocular points
-    const cv::Mat mDescriptors;
+    // KeyPoints, stereo coordinate and descriptors (all associated by an index).
+    // Shared with the frame the keyframe was created from, never modified in place.
+    SharedVector<cv::KeyPoint> mvKeys; // paged if not shared with mvKeysUn
+    const SharedVector<cv::KeyPoint> mvKeysUn;
+    const SharedVector<float> mvuRight; // negative value for monocular points
+    const SharedVector<float> mvDepth; // negative value for monocular points
+    cv::Mat mDescriptors; // paged
 
     //BoW
     DBoW2::BowVector mBowVec;
-    DBoW2::FeatureVector mFeatVec;
+    DBoW2::FeatureVector mFeatVec; // paged
 
     // Pose relative to parent (this is computed when bad flag is activated)
     cv::Mat mTcp;
@@ -192,6 +204,8 @@ public:
     // The following variables need to be accessed trough a mutex to be thread safe.
 protected:
 
+    static ObjectPool mPool;
+
     // SE3 Pose and camera center
     cv::Mat Tcw;
     cv::Mat Twc;
@@ -199,19 +213,39 @@ protected:
 
     cv::Mat Cw; // Stereo middel point. Only for visualization
 
+    // Pose before the last commit that changed it, read by threads pinned to an older map version
+    // (see SnapshotManager)
+    cv::Mat mTcwOld;
+    cv::Mat mTwcOld;
+    cv::Mat mOwOld;
+    cv::Mat mCwOld;
+    unsigned long mnPoseVersion;
+
+    // mMutexPose must be locked
+    bool UseOldPose() const;
+
     // MapPoints associated to keypoints
     std::vector<MapPoint*> mvpMapPoints;
+    std::atomic<unsigned long> mnMapPointsVersion;
 
     // BoW
     KeyFrameDatabase* mpKeyFrameDB;
-    ORBVocabulary* mpORBvocabulary;
+    const ORBVocabulary* mpORBvocabulary;
 
-    // Grid over the image to speed up feature matching
-    std::vector< std::vector <std::vector<size_t> > > mGrid;
+    // Grid over the image to speed up feature matching, flat as in Frame (paged)
+    SharedVector<int> mGridStart;
+    SharedVector<size_t> mGridIndices;
 
+    // Number of shared mappoints with every covisible keyframe (always up to date)
     std::map<KeyFrame*,int> mConnectedKeyFrameWeights;
+
+    // Sorted on demand when the weights have changed
     std::vector<KeyFrame*> mvpOrderedConnectedKeyFrames;
     std::vector<int> mvOrderedWeights;
+    bool mbOrderedConnectionsDirty;
+
+    // Rebuilds the ordered connections if dirty (mMutexConnections must be locked)
+    void SortConnections();
 
     // Spanning Tree and Loop Edges
     bool mbFirstConnection;
@@ -231,6 +265,25 @@ protected:
     std::mutex mMutexPose;
     std::mutex mMutexConnections;
     std::mutex mMutexFeatures;
+
+    // Paging state
+    int mnFeaturePins;
+    bool mbFeaturesPagedOut;
+    long long mnPageOffset;
+    long long mnPageCapacity;
+    std::chrono::steady_clock::time_point mLastPinned;
+    std::mutex mMutexPaging;
+};
+
+// Keeps the matching data of a keyframe in memory while in scope
+class KeyFramePin
+{
+public:
+    KeyFramePin(KeyFrame* pKF): mpKF(pKF) { mpKF->PinFeatures(); }
+    ~KeyFramePin() { mpKF->UnpinFeatures(); }
+
+private:
+    KeyFrame* mpKF;
 };
 
 } //namespace ORB_SLAM
@@ -28,8 +28,11 @@
 #include "KeyFrame.h"
 #include "Frame.h"
 #include "ORBVocabulary.h"
+#include "SharedMutex.h"
+#include "ThreadPool.h"
 
 #include<mutex>
+#include<functional>
 
 
 namespace ORB_SLAM2
@@ -41,9 +44,12 @@ class Frame;
 
 class KeyFrameDatabase
 {
+    friend class MapSerializer;
+
 public:
 
     KeyFrameDatabase(const ORBVocabulary &voc);
+    ~KeyFrameDatabase();
 
    void add(KeyFrame* pKF);
 
@@ -57,16 +63,69 @@ public:
    // Relocalization
    std::vector<KeyFrame*> DetectRelocalizationCandidates(Frame* F);
 
+   // With nTopK>0 relocalization only scores the nTopK best keyframes, found with an upper-bound
+   // pruned search over the weighted postings (L1 scoring only), instead of every keyframe sharing
+   // enough words. A threshold factor above 1 prunes earlier, trading recall for latency.
+   // nTopK=0 restores the exhaustive search.
+   void SetRelocalizationRetrieval(const int nTopK, const float fThresholdFactor);
+
+   // Workers of the database, also used by the relocalization to verify the candidates
+   ThreadPool* GetThreadPool();
+
 protected:
 
+  struct Posting
+  {
+      unsigned int mnIndex;
+      float mWeight;
+  };
+
+  std::vector<KeyFrame*> DetectRelocalizationCandidatesTopK(Frame* F);
+
+  // Returns the compact index of the keyframe, or -1 if it is not in the database
+  int GetIndex(KeyFrame* pKF) const;
+
+  // Drops the postings of erased keyframes and renumbers the remaining ones.
+  // Called with mMutexWriters held. Queries keep running until the new index is swapped in.
+  void Compact();
+
+  // Calls f(i) for i in [0,n), in parallel if there are enough candidates
+  void ForEachCandidate(const size_t n, const std::function<void(size_t)> &f);
+
   // Associated vocabulary
   const ORBVocabulary* mpVoc;
 
-  // Inverted file
-  std::vector<list<KeyFrame*> > mvInvertedFile;
+  // Inverted file. For each word, the compact indices of the keyframes that contain it (increasing order)
+  // and the weight of the word in their BoW vector.
+  std::vector<std::vector<Posting> > mvInvertedFile;
+
+  // Upper bound of the weights in the postings of each word
+  std::vector<float> mvMaxWeights;
+
+  // Keyframe of each compact index. Erased keyframes stay as NULL until the next compaction.
+  std::vector<KeyFrame*> mvpKeyFrames;
+
+  // Number of postings of each compact index
+  std::vector<unsigned int> mvnPostings;
+
+  // Compact index of each keyframe indexed by KeyFrame::mnId (-1 if not in the database)
+  std::vector<int> mvKeyFrameIndices;
+
+  // Postings in the inverted file, and how many of them belong to erased keyframes
+  size_t mnPostings;
+  size_t mnErasedPostings;
+
+  // Queries take mMutex shared, so loop detection and relocalization run concurrently.
+  // Writers are serialized by mMutexWriters and take mMutex exclusively only for short updates.
+  SharedMutex mMutex;
+  std::mutex mMutexWriters;
+
+  // Workers for candidate scoring and covisibility accumulation
+  ThreadPool* mpThreadPool;
 
-  // Mutex
-  std::mutex mMutex;
+  // Top-k relocalization retrieval (0 = exhaustive)
+  int mnRelocTopK;
+  float mfRelocThresholdFactor;
 };
 
 } //namespace ORB_SLAM
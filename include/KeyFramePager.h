@@ -0,0 +1,118 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KEYFRAMEPAGER_H
+#define KEYFRAMEPAGER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <mutex>
+
+namespace ORB_SLAM2
+{
+
+class KeyFrame;
+
+// Out-of-core storage of the matching data of keyframes (descriptors, feature vector, grid, and the
+// distorted keypoints when they differ from the undistorted ones). Undistorted keypoints, stereo
+// coordinates, matches, BoW vector, poses and the graph stay in memory, so bundle adjustment, place
+// recognition scoring and the viewer never touch the disk. Mappoints are not paged either, the map
+// memory is only bounded in the matching data of its keyframes.
+// A background thread keeps at most a given number of keyframes resident, evicting the farthest
+// from the reference keyframe of the tracking, never its covisible keyframes, the most recent ones
+// or those used in the last second. Bad keyframes are evicted as soon as possible and forgotten.
+// Code using the matching data pins the keyframe (see KeyFramePin); evicted keyframes are read
+// back synchronously when pinned, or in the background when prefetched. The pages of forgotten
+// keyframes are reused, and the file is truncated when the map is cleared.
+class KeyFramePager
+{
+public:
+    KeyFramePager(const std::string &filename, const int nMaxResident);
+    ~KeyFramePager();
+
+    bool IsOpen();
+
+    // Main function
+    void Run();
+
+    void RequestFinish();
+    bool isFinished();
+
+    // Keyframes added to the map (see Map::AddKeyFrame)
+    void AddKeyFrame(KeyFrame* pKF);
+
+    // Forgets all keyframes before the map deletes them (see Map::clear)
+    void Clear();
+
+    // The keyframes around the reference keyframe of the tracking are kept in memory
+    void SetReferenceKeyFrame(KeyFrame* pKF);
+
+    // Reads evicted keyframes back in the background (local map, place recognition candidates)
+    void Prefetch(const std::vector<KeyFrame*> &vpKFs);
+
+    // Reads back the data of an evicted keyframe. Called by KeyFrame::PinFeatures with the paging mutex held.
+    void Load(KeyFrame* pKF);
+
+protected:
+
+    void AddNewKeyFrames();
+    void LoadPrefetched();
+    void EvictKeyFrames();
+    bool Evict(KeyFrame* pKF);
+
+    static void ResetGrid(KeyFrame* pKF);
+
+    // Page of at least nSize bytes, a free one if any fits (mMutexFile must be locked)
+    long long AllocatePage(const long long nSize, long long &nCapacity);
+
+    // The page of an evicted bad keyframe can be reused, the keyframe gets no data if pinned again
+    void FreePage(KeyFrame* pKF);
+
+    bool CheckFinish();
+    void SetFinish();
+    bool mbFinishRequested;
+    bool mbFinished;
+    std::mutex mMutexFinish;
+
+    std::string mFilename;
+    const int mnMaxResident;
+
+    // Keyframes managed by the pager, only used by its thread with mMutexPass held
+    std::vector<KeyFrame*> mvpKeyFrames;
+    std::mutex mMutexPass;
+
+    // Input from other threads
+    std::vector<KeyFrame*> mvpNewKeyFrames;
+    std::vector<KeyFrame*> mvpPrefetch;
+    KeyFrame* mpReferenceKF;
+    std::mutex mMutexInput;
+
+    std::fstream mFile;
+    long long mnFileEnd;
+    // Pages of forgotten keyframes, capacity to offset
+    std::multimap<long long,long long> mmFreePages;
+    std::mutex mMutexFile;
+};
+
+} //namespace ORB_SLAM
+
+#endif // KEYFRAMEPAGER_H
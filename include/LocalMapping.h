@@ -26,6 +26,7 @@
 #include "LoopClosing.h"
 #include "Tracking.h"
 #include "KeyFrameDatabase.h"
+#include "MarkerSet.h"
 
 #include <mutex>
 
@@ -83,6 +84,11 @@ protected:
 
     void KeyFrameCulling();
 
+    // Drops the bad mappoints kept between iterations, reports a quiescent state to the map
+    // and deletes the mappoints that no thread can reference anymore
+    void ReleaseBadMapPoints();
+    int mnEpochSlot;
+
     cv::Mat ComputeF12(KeyFrame* &pKF1, KeyFrame* &pKF2);
 
     cv::Mat SkewSymmetricMatrix(const cv::Mat &v);
@@ -110,6 +116,10 @@ protected:
 
     std::list<MapPoint*> mlpRecentAddedMapPoints;
 
+    // Scratch marks of the fusion (by mnId)
+    MarkerSet mFuseTargetMarks;
+    MarkerSet mFuseCandidateMarks;
+
     std::mutex mMutexNewKFs;
 
     bool mbAbortBA;
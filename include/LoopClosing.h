@@ -28,6 +28,7 @@
 #include "Tracking.h"
 
 #include "KeyFrameDatabase.h"
+#include "MarkerSet.h"
 
 #include <thread>
 #include <mutex>
@@ -52,7 +53,7 @@ public:
         Eigen::aligned_allocator<std::pair<KeyFrame *const, g2o::Sim3> > > KeyFrameAndPose;
 public:
 
-    LoopClosing(Map* pMap, KeyFrameDatabase* pDB, ORBVocabulary* pVoc,const bool bFixScale);
+    LoopClosing(Map* pMap, KeyFrameDatabase* pDB, const ORBVocabulary* pVoc,const bool bFixScale);
 
     void SetTracker(Tracking* pTracker);
 
@@ -109,7 +110,7 @@ protected:
     Tracking* mpTracker;
 
     KeyFrameDatabase* mpKeyFrameDB;
-    ORBVocabulary* mpORBVocabulary;
+    const ORBVocabulary* mpORBVocabulary;
 
     LocalMapping *mpLocalMapper;
 
@@ -128,11 +129,15 @@ protected:
     std::vector<KeyFrame*> mvpCurrentConnectedKFs;
     std::vector<MapPoint*> mvpCurrentMatchedPoints;
     std::vector<MapPoint*> mvpLoopMapPoints;
+    MarkerSet mLoopPointMarks;
     cv::Mat mScw;
     g2o::Sim3 mg2oScw;
 
     long unsigned int mLastLoopKFid;
 
+    // Mappoints corrected in the loop fusion, with the keyframe used for the correction (by mnId)
+    MarkerMap<long unsigned int> mCorrectedPointRefs;
+
     // Variables related to Global Bundle Adjustment
     bool mbRunningGBA;
     bool mbFinishedGBA;
@@ -23,9 +23,15 @@
 
 #include "MapPoint.h"
 #include "KeyFrame.h"
+#include "EpochManager.h"
+#include "SharedMutex.h"
+#include "SnapshotManager.h"
 #include <set>
+#include <unordered_map>
 
 #include <mutex>
+#include <atomic>
+#include <memory>
 
 
 
@@ -34,6 +40,17 @@ namespace ORB_SLAM2
 
 class MapPoint;
 class KeyFrame;
+class MapJournal;
+class KeyFramePager;
+class Frame;
+
+// Immutable copy of the map membership at a given version
+template<class T>
+struct MapSnapshot
+{
+    unsigned long mnVersion;
+    std::vector<T*> mvpItems;
+};
 
 class Map
 {
@@ -47,11 +64,19 @@ public:
     void SetReferenceMapPoints(const std::vector<MapPoint*> &vpMPs);
     void InformNewBigChange();
     int GetLastBigChangeIdx();
+    // Increased whenever a keyframe is added to or erased from the map
+    unsigned long GetKeyFramesVersion();
 
     std::vector<KeyFrame*> GetAllKeyFrames();
     std::vector<MapPoint*> GetAllMapPoints();
     std::vector<MapPoint*> GetReferenceMapPoints();
 
+    // Lock-free views of the map membership. The snapshot is shared and never modified,
+    // a new one is built (once) only after the map has changed.
+    std::shared_ptr<const std::vector<KeyFrame*> > GetKeyFramesSnapshot();
+    std::shared_ptr<const std::vector<MapPoint*> > GetMapPointsSnapshot();
+    std::shared_ptr<const std::vector<MapPoint*> > GetReferenceMapPointsSnapshot();
+
     long unsigned int MapPointsInMap();
     long unsigned  KeyFramesInMap();
 
@@ -59,18 +84,57 @@ public:
 
     void clear();
 
+    // Spatial index over the mappoint positions (hashed voxels of the given size).
+    // Changing the size rebuilds the index.
+    void SetVoxelSize(const float size);
+    float GetVoxelSize();
+
+    // Called when the position of a mappoint changes (see MapPoint::SetWorldPos)
+    void UpdateMapPointPosition(MapPoint* pMP);
+
+    // Mappoints closer than r to x3Dw
+    std::vector<MapPoint*> GetMapPointsInRadius(const cv::Mat &x3Dw, const float r);
+
+    // Mappoints that project inside the image of frame F (at its pose) closer than maxDepth.
+    // Only the voxels that intersect the frustum are looked up, keep maxDepth to the scene depth.
+    std::vector<MapPoint*> GetMapPointsInFrustum(const Frame &F, const float maxDepth);
+    std::vector<MapPoint*> GetMapPointsInFrustum(const cv::Mat &Tcw, const float maxDepth);
+
+    // Changes of the map, its keyframes and mappoints are reported to the journal (if any)
+    void SetJournal(MapJournal* pJournal);
+    MapJournal* GetJournal();
+
+    // Keyframes added to the map are paged by the pager (if any). Set it before adding keyframes.
+    void SetKeyFramePager(KeyFramePager* pPager);
+    KeyFramePager* GetKeyFramePager();
+
     vector<KeyFrame*> mvpKeyFrameOrigins;
 
-    std::mutex mMutexMapUpdate;
+    // Held shared by the tracking for a whole frame and exclusively by structural changes of the
+    // map (loop correction, global BA update, save). Local BA commits through mSnapshots instead.
+    SharedMutex mMutexMapUpdate;
+
+    // Map versions read by the tracking and committed by the local BA
+    SnapshotManager mSnapshots;
 
     // This avoid that two points are created simultaneously in separate threads (id conflict)
     std::mutex mMutexPointCreation;
 
+    // Erased mappoints are retired here and freed when no thread can reference them
+    EpochManager mEpochManager;
+
 protected:
     std::set<MapPoint*> mspMapPoints;
     std::set<KeyFrame*> mspKeyFrames;
 
-    std::vector<MapPoint*> mvpReferenceMapPoints;
+    // Published by the tracking on every frame
+    std::shared_ptr<const std::vector<MapPoint*> > mpReferenceMapPoints;
+
+    // Bumped under mMutexMap on every insertion/erasure
+    std::atomic<unsigned long> mnKeyFramesVersion;
+    std::atomic<unsigned long> mnMapPointsVersion;
+    std::shared_ptr<const MapSnapshot<KeyFrame> > mpKeyFramesSnapshot;
+    std::shared_ptr<const MapSnapshot<MapPoint> > mpMapPointsSnapshot;
 
     long unsigned int mnMaxKFid;
 
@@ -78,6 +142,40 @@ protected:
     int mnBigChangeIdx;
 
     std::mutex mMutexMap;
+
+    long long VoxelKey(const int x, const int y, const int z);
+    void VoxelCoords(const float x, const float y, const float z, int &vx, int &vy, int &vz);
+    void InsertInVoxelGrid(MapPoint* pMP);
+    void EraseFromVoxelGrid(MapPoint* pMP);
+    void RemoveFromVoxel(MapPoint* pMP);
+
+    // Camera frustum in camera coordinates, the side planes given by the normalized image bounds
+    struct VoxelFrustum
+    {
+        float R[3][3];
+        float t[3];
+        float minX, maxX, minY, maxY;
+        float maxDepth;
+    };
+
+    // The voxel may contain points inside the frustum (tested with its bounding sphere)
+    bool VoxelInFrustum(const VoxelFrustum &frustum, const int x, const int y, const int z);
+
+    // Collects the mappoints of the voxels in [min,max], or of all voxels if there are fewer.
+    // Voxels outside the frustum (if given) are skipped without being looked up.
+    void GetMapPointsInVoxels(const int minX, const int minY, const int minZ,
+                              const int maxX, const int maxY, const int maxZ,
+                              const VoxelFrustum* pFrustum, std::vector<MapPoint*> &vpMPs);
+
+    std::unordered_map<long long, std::vector<MapPoint*> > mmVoxels;
+    float mfVoxelSize;
+    float mfInvVoxelSize;
+    std::mutex mMutexVoxels;
+
+    // Read on every change, so it is not protected by mMutexMap
+    std::atomic<MapJournal*> mpJournal;
+
+    std::atomic<KeyFramePager*> mpKeyFramePager;
 };
 
 } //namespace ORB_SLAM
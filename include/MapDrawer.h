@@ -38,7 +38,8 @@ public:
 
     Map* mpMap;
 
-    void DrawMapPoints();
+    // With bOnlyInView only the mappoints in the frustum of the current camera are drawn (spatial index)
+    void DrawMapPoints(const bool bOnlyInView=false);
     void DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph);
     void DrawCurrentCamera(pangolin::OpenGlMatrix &Twc);
     void SetCurrentCameraPose(const cv::Mat &Tcw);
@@ -53,6 +54,7 @@ private:
     float mPointSize;
     float mCameraSize;
     float mCameraLineWidth;
+    float mViewDepth;
 
     cv::Mat mCameraPose;
 
@@ -0,0 +1,123 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPJOURNAL_H
+#define MAPJOURNAL_H
+
+#include <string>
+#include <fstream>
+#include <mutex>
+
+#include "MapSerializer.h"
+#include "ORBVocabulary.h"
+
+namespace ORB_SLAM2
+{
+
+class Map;
+class KeyFrame;
+class MapPoint;
+class KeyFrameDatabase;
+
+// Append-only log of map changes for crash recovery. The map, keyframes and mappoints report
+// every change (insertions, culling, bad flags, pose and position updates, observations,
+// spanning tree and loop edges) while the SLAM threads run. Events are appended to a memory
+// buffer and a background thread streams them to disk, so the hot threads never wait on I/O.
+// Replay rebuilds the map from the journal; a truncated tail (crash while writing) is ignored.
+class MapJournal
+{
+public:
+
+    enum eEvent{
+        CAMERA=0,
+        KEYFRAME_ADDED=1,
+        KEYFRAME_ERASED=2,
+        KEYFRAME_POSE=3,
+        KEYFRAME_PARENT=4,
+        KEYFRAME_LOOP_EDGE=5,
+        MAPPOINT_ADDED=6,
+        MAPPOINT_ERASED=7,
+        MAPPOINT_POSITION=8,
+        OBSERVATION_ADDED=9,
+        OBSERVATION_ERASED=10,
+        MAP_CLEARED=11
+    };
+
+    static const unsigned int VERSION = 1;
+
+    MapJournal(const std::string &filename, const ORBVocabulary* pVoc);
+
+    bool IsOpen();
+
+    // Main function of the writer thread
+    void Run();
+
+    void RequestFinish();
+    bool isFinished();
+
+    // Writes the current content of the map, so the journal can be started on a running system.
+    // Call it with the map update mutex held and Local Mapping stopped.
+    void WriteSnapshot(Map* pMap);
+
+    // Event hooks. They only serialize the event into the memory buffer.
+    void AddKeyFrame(KeyFrame* pKF);
+    void EraseKeyFrame(KeyFrame* pKF);
+    void SetKeyFramePose(KeyFrame* pKF, const cv::Mat &Tcw);
+    void ChangeParent(KeyFrame* pKF, KeyFrame* pParent);
+    void AddLoopEdge(KeyFrame* pKF, KeyFrame* pLoopKF);
+    void AddMapPoint(MapPoint* pMP);
+    void EraseMapPoint(MapPoint* pMP);
+    void SetMapPointPos(MapPoint* pMP, const cv::Mat &Pos);
+    void AddObservation(MapPoint* pMP, KeyFrame* pKF, const size_t idx);
+    void EraseObservation(MapPoint* pMP, KeyFrame* pKF);
+    void ClearMap();
+
+    // Rebuilds the map and the keyframe database from a journal. The map must be empty.
+    // Descriptors, normals and covisibility weights are recomputed from the replayed observations.
+    static bool Replay(const std::string &filename, Map* pMap, KeyFrameDatabase* pKFDB, const ORBVocabulary* pVoc);
+
+protected:
+
+    void Append(const eEvent event, const MapSerializer::Writer &record);
+
+    // Writes the buffered events to disk
+    bool Flush();
+
+    bool CheckFinish();
+    void SetFinish();
+
+    std::ofstream mFile;
+
+    // Events not yet written. The writer thread swaps it with an empty buffer.
+    MapSerializer::Writer mBuffer;
+    bool mbCameraWritten;
+    std::mutex mMutexBuffer;
+
+    // Only used by the writer thread
+    std::vector<char> mvWriting;
+
+    bool mbFinishRequested;
+    bool mbFinished;
+    std::mutex mMutexFinish;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPJOURNAL_H
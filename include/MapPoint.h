@@ -24,9 +24,12 @@
 #include"KeyFrame.h"
 #include"Frame.h"
 #include"Map.h"
+#include"ObservationList.h"
+#include"ObjectPool.h"
 
 #include<opencv2/core/core.hpp>
 #include<mutex>
+#include<atomic>
 
 namespace ORB_SLAM2
 {
@@ -38,17 +41,21 @@ class Frame;
 
 class MapPoint
 {
+    friend class MapSerializer;
+
 public:
     MapPoint(const cv::Mat &Pos, KeyFrame* pRefKF, Map* pMap);
     MapPoint(const cv::Mat &Pos,  Map* pMap, Frame* pFrame, const int &idxF);
 
+    // The position is read without locks (seqlock), so readers never wait for the optimizers
     void SetWorldPos(const cv::Mat &Pos);
     cv::Mat GetWorldPos();
+    void GetWorldPos(float* x3Dw);
 
     cv::Mat GetNormal();
     KeyFrame* GetReferenceKeyFrame();
 
-    std::map<KeyFrame*,size_t> GetObservations();
+    ObservationList GetObservations();
     int Observations();
 
     void AddObservation(KeyFrame* pKF,size_t idx);
@@ -88,37 +95,35 @@ public:
     long int mnFirstFrame;
     int nObs;
 
-    // Variables used by the tracking
-    float mTrackProjX;
-    float mTrackProjY;
-    float mTrackProjXR;
-    bool mbTrackInView;
-    int mnTrackScaleLevel;
-    float mTrackViewCos;
-    long unsigned int mnTrackReferenceForFrame;
-    long unsigned int mnLastFrameSeen;
-
-    // Variables used by local mapping
-    long unsigned int mnBALocalForKF;
-    long unsigned int mnFuseCandidateForKF;
-
     // Variables used by loop closing
-    long unsigned int mnLoopPointForKF;
-    long unsigned int mnCorrectedByKF;
-    long unsigned int mnCorrectedReference;    
     cv::Mat mPosGBA;
-    long unsigned int mnBAGlobalForKF;
 
+    // Traversal marks are kept by each thread in MarkerSets indexed by mnId
 
-    static std::mutex mGlobalMutex;
+    // Voxel of the map spatial index containing the point (protected by the map)
+    long long mnVoxelKey;
+    bool mbInVoxelGrid;
+
+    // MapPoints are allocated from a pool
+    static void* operator new(size_t nSize);
+    static void operator delete(void* p, size_t nSize);
 
 protected:    
 
-     // Position in absolute coordinates
-     cv::Mat mWorldPos;
+     static ObjectPool mPool;
+
+     // Position in absolute coordinates, for the last two map versions (see SnapshotManager).
+     // Odd sequence numbers mark a write in progress. Writers are serialized by mMutexPos.
+     std::atomic<float> mWorldPos[2][3];
+     std::atomic<unsigned long> mnPosVersion[2];
+     std::atomic<int> mnNewestPos;
+     std::atomic<unsigned int> mnPosSequence;
+
+     void InitWorldPos(const cv::Mat &Pos);
+     void StoreWorldPos(const cv::Mat &Pos);
 
      // Keyframes observing the point and associated index in keyframe
-     std::map<KeyFrame*,size_t> mObservations;
+     ObservationList mObservations;
 
      // Mean viewing direction
      cv::Mat mNormalVector;
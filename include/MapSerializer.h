@@ -0,0 +1,167 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MAPSERIALIZER_H
+#define MAPSERIALIZER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <cstring>
+
+#include "Map.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "KeyFrameDatabase.h"
+#include "ORBVocabulary.h"
+
+namespace ORB_SLAM2
+{
+
+class Map;
+class KeyFrame;
+class MapPoint;
+class KeyFrameDatabase;
+
+// Versioned binary map file. Sections follow the header in this order:
+// camera, keyframes, mappoints, keyframe graph (covisibility, spanning tree, loop edges),
+// map origins and keyframe database inverted file. Records store ids instead of pointers.
+// Bulk arrays (keypoints, descriptors, postings) are stored contiguously in native byte order
+// and are read straight from a memory mapping of the file when loading.
+class MapSerializer
+{
+public:
+
+    static const unsigned int VERSION = 1;
+
+    // Saves the map and the keyframe database. Local Mapping must be stopped by the caller.
+    // The map update mutex is held while saving. Returns false on I/O errors or empty maps.
+    static bool Save(const std::string &filename, Map* pMap, KeyFrameDatabase* pKFDB);
+
+    // Loads a map saved with Save into an empty map and database.
+    // Keyframes get the vocabulary, and the ids of new keyframes, mappoints and frames continue
+    // after the loaded ones. Returns false if the file is not valid for this vocabulary.
+    static bool Load(const std::string &filename, Map* pMap, KeyFrameDatabase* pKFDB, const ORBVocabulary* pVoc);
+
+    // Appends plain values and arrays to a memory buffer that is periodically flushed to a stream.
+    class Writer
+    {
+    public:
+        template<typename T> void Put(const T &v)
+        {
+            PutArray(&v,1);
+        }
+
+        template<typename T> void PutArray(const T* p, const size_t n)
+        {
+            const char* pc = reinterpret_cast<const char*>(p);
+            mvBuffer.insert(mvBuffer.end(),pc,pc+n*sizeof(T));
+        }
+
+        size_t Size() const { return mvBuffer.size(); }
+
+        // Writes the buffer to the stream and empties it
+        bool Flush(std::ofstream &f);
+
+        std::vector<char> mvBuffer;
+    };
+
+    // Read-only memory mapping of a whole file
+    class MappedFile
+    {
+    public:
+        MappedFile(const std::string &filename);
+        ~MappedFile();
+
+        bool IsOpen() const { return mpData!=NULL; }
+        const char* Data() const { return mpData; }
+        size_t Size() const { return mnSize; }
+
+    protected:
+        const char* mpData;
+        size_t mnSize;
+    };
+
+    // Reads values in place from a memory block (usually a file mapping).
+    // Reading past the end sets the failure flag and returns zeros.
+    class Reader
+    {
+    public:
+        Reader(const char* pData, const size_t size): mpData(pData), mnSize(size), mnPos(0), mbFailed(false){}
+
+        template<typename T> T Get()
+        {
+            T v;
+            const char* p = GetArray(sizeof(T));
+            if(p)
+                memcpy(&v,p,sizeof(T));
+            else
+                memset(&v,0,sizeof(T));
+            return v;
+        }
+
+        // Returns a pointer to the next nBytes bytes, or NULL if there are not enough
+        const char* GetArray(const size_t nBytes);
+
+        bool Failed() const { return mbFailed; }
+        bool AtEnd() const { return mnPos==mnSize; }
+
+    protected:
+        const char* mpData;
+        size_t mnSize;
+        size_t mnPos;
+        bool mbFailed;
+    };
+
+    // Record helpers, also used by the map journal
+    static void WriteCamera(Writer &w, KeyFrame* pKF);
+    static void WriteKeyFrame(Writer &w, KeyFrame* pKF);
+    static void WriteMapPoint(Writer &w, MapPoint* pMP);
+    static void WriteKeyFrameGraph(Writer &w, KeyFrame* pKF);
+
+    // Camera carrier: a frame holding the calibration and scale pyramid shared by all keyframes
+    static bool ReadCamera(Reader &r, Frame &F, const ORBVocabulary* pVoc);
+
+    // Fills the carrier with the next keyframe record and creates the keyframe from it
+    static KeyFrame* ReadKeyFrame(Reader &r, Frame &F, Map* pMap, KeyFrameDatabase* pKFDB);
+
+    // Creates the next mappoint and its observations. Observations of missing keyframes are dropped.
+    // Returns NULL for points left without observations.
+    static MapPoint* ReadMapPoint(Reader &r, Map* pMap, const std::map<long unsigned int, KeyFrame*> &mKFs);
+
+    // Restores the covisibility weights, parent and loop edges of the next keyframe graph record
+    static void ReadKeyFrameGraph(Reader &r, const std::map<long unsigned int, KeyFrame*> &mKFs);
+
+    // Keypoint records (also used by the keyframe pager)
+    static void WriteKeyPoints(Writer &w, const std::vector<cv::KeyPoint> &vKeys);
+    static void ReadKeyPoints(Reader &r, const int N, std::vector<cv::KeyPoint> &vKeys);
+
+protected:
+
+    static bool ReadMap(Reader &r, Map* pMap, KeyFrameDatabase* pKFDB, const ORBVocabulary* pVoc);
+
+    static bool WriteDatabase(Writer &w, std::ofstream &f, KeyFrameDatabase* pKFDB, const std::map<long unsigned int, KeyFrame*> &mKFs);
+    static bool ReadDatabase(Reader &r, KeyFrameDatabase* pKFDB, const std::map<long unsigned int, KeyFrame*> &mKFs);
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPSERIALIZER_H
@@ -0,0 +1,106 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MARKERSET_H
+#define MARKERSET_H
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+namespace ORB_SLAM2
+{
+
+// Scratch marks over objects with dense ids (mnId of mappoints and keyframes), used to visit
+// each object once in a traversal. Each thread owns its sets, so traversals of different threads
+// do not write to the shared objects. A new generation clears all the marks in O(1).
+class MarkerSet
+{
+public:
+    MarkerSet(): mnGeneration(1) {}
+
+    void NewGeneration()
+    {
+        if(++mnGeneration==0)
+        {
+            std::fill(mvStamps.begin(),mvStamps.end(),0);
+            mnGeneration = 1;
+        }
+    }
+
+    bool IsMarked(const size_t id) const
+    {
+        return id<mvStamps.size() && mvStamps[id]==mnGeneration;
+    }
+
+    // Returns false if it was already marked in this generation
+    bool Mark(const size_t id)
+    {
+        Reserve(id);
+        if(mvStamps[id]==mnGeneration)
+            return false;
+        mvStamps[id] = mnGeneration;
+        return true;
+    }
+
+    void Unmark(const size_t id)
+    {
+        if(id<mvStamps.size())
+            mvStamps[id] = 0;
+    }
+
+protected:
+    void Reserve(const size_t id)
+    {
+        if(id>=mvStamps.size())
+            mvStamps.resize(std::max(id+1,2*mvStamps.size()),0);
+    }
+
+    std::vector<unsigned int> mvStamps;
+    unsigned int mnGeneration;
+};
+
+// Marks carrying a value
+template<class T>
+class MarkerMap : public MarkerSet
+{
+public:
+    void Set(const size_t id, const T &value)
+    {
+        Reserve(id);
+        if(mvValues.size()<mvStamps.size())
+            mvValues.resize(mvStamps.size());
+        mvStamps[id] = mnGeneration;
+        mvValues[id] = value;
+    }
+
+    // Value of a marked id
+    const T& Get(const size_t id) const
+    {
+        return mvValues[id];
+    }
+
+protected:
+    std::vector<T> mvValues;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MARKERSET_H
@@ -60,25 +60,30 @@ public:
       std::vector<cv::KeyPoint>& keypoints,
       cv::OutputArray descriptors);
 
+    // Guides the next extraction only. The features of each level are taken mostly in windows
+    // around the predicted keypoints (position in the image and octave), and with a fraction
+    // fExploreRatio of the budget in the rest of the image, to find new points.
+    void SetPredictions(const std::vector<cv::KeyPoint> &vPredicted, const float fExploreRatio);
+
     int inline GetLevels(){
         return nlevels;}
 
     float inline GetScaleFactor(){
         return scaleFactor;}
 
-    std::vector<float> inline GetScaleFactors(){
+    inline const std::vector<float>& GetScaleFactors(){
         return mvScaleFactor;
     }
 
-    std::vector<float> inline GetInverseScaleFactors(){
+    inline const std::vector<float>& GetInverseScaleFactors(){
         return mvInvScaleFactor;
     }
 
-    std::vector<float> inline GetScaleSigmaSquares(){
+    inline const std::vector<float>& GetScaleSigmaSquares(){
         return mvLevelSigma2;
     }
 
-    std::vector<float> inline GetInverseScaleSigmaSquares(){
+    inline const std::vector<float>& GetInverseScaleSigmaSquares(){
         return mvInvLevelSigma2;
     }
 
@@ -91,6 +96,10 @@ protected:
     std::vector<cv::KeyPoint> DistributeOctTree(const std::vector<cv::KeyPoint>& vToDistributeKeys, const int &minX,
                                            const int &maxX, const int &minY, const int &maxY, const int &nFeatures, const int &level);
 
+    // Keeps the best keypoints of the predicted windows, and distributes the others with the exploration budget
+    std::vector<cv::KeyPoint> DistributeGuided(const std::vector<cv::KeyPoint>& vToDistributeKeys, const int &minX,
+                                           const int &maxX, const int &minY, const int &maxY, const int &level);
+
     void ComputeKeyPointsOld(std::vector<std::vector<cv::KeyPoint> >& allKeypoints);
     std::vector<cv::Point> pattern;
 
@@ -108,6 +117,10 @@ protected:
     std::vector<float> mvInvScaleFactor;    
     std::vector<float> mvLevelSigma2;
     std::vector<float> mvInvLevelSigma2;
+
+    // Predictions for the next extraction (see SetPredictions)
+    std::vector<cv::KeyPoint> mvPredicted;
+    float mfExploreRatio;
 };
 
 } //namespace ORB_SLAM
@@ -44,8 +44,8 @@ public:
     static int DescriptorDistance(const cv::Mat &a, const cv::Mat &b);
 
     // Search matches between Frame keypoints and projected MapPoints. Returns number of matches
-    // Used to track the local map (Tracking)
-    int SearchByProjection(Frame &F, const std::vector<MapPoint*> &vpMapPoints, const float th=3);
+    // Used to track the local map (Tracking), the projections come from Frame::isInFrustum
+    int SearchByProjection(Frame &F, const std::vector<MapPointProjection> &vProjections, const float th=3);
 
     // Project MapPoints tracked in last frame into the current frame and search matches.
     // Used to track from previous frame (Tracking)
@@ -55,6 +55,11 @@ public:
     // Used in relocalisation (Tracking)
     int SearchByProjection(Frame &CurrentFrame, KeyFrame* pKF, const std::set<MapPoint*> &sAlreadyFound, const float th, const int ORBdist);
 
+    // Project the given MapPoints (e.g. from the map spatial index) into the Frame and search matches.
+    // There is no reference keypoint, so the rotation consistency is not checked.
+    // Used in relocalisation (Tracking)
+    int SearchByProjection(Frame &CurrentFrame, const std::vector<MapPoint*> &vpMapPoints, const std::set<MapPoint*> &sAlreadyFound, const float th, const int ORBdist);
+
     // Project MapPoints using a Similarity Transformation and search matches.
     // Used in loop detection (Loop Closing)
      int SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const std::vector<MapPoint*> &vpPoints, std::vector<MapPoint*> &vpMatched, int th);
@@ -88,6 +93,12 @@ public:
     static const int TH_HIGH;
     static const int HISTO_LENGTH;
 
+    // Search windows derived from the pose uncertainty cover this many standard deviations
+    static const float TH_SIGMA;
+
+    // Descriptor distances computed by the projection searches of the tracking (last frame and local map)
+    int mnDescriptorComparisons;
+
 
 protected:
 
@@ -95,6 +106,11 @@ protected:
 
     float RadiusByViewingCos(const float &viewCos);
 
+    // Closest unmatched keypoint of the frame to the MapPoint projected with the frame pose (-1 if none).
+    // vIndices2 is a buffer of the caller for the keypoints of the search window.
+    int MatchProjectedPoint(Frame &CurrentFrame, MapPoint* pMP, const cv::Mat &Rcw, const cv::Mat &tcw, const cv::Mat &Ow,
+                            const float th, const int ORBdist, std::vector<size_t> &vIndices2);
+
     void ComputeThreeMaxima(std::vector<int>* histo, const int L, int &ind1, int &ind2, int &ind3);
 
     float mfNNratio;
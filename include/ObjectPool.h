@@ -0,0 +1,69 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <vector>
+#include <mutex>
+#include <cstddef>
+
+namespace ORB_SLAM2
+{
+
+// Fixed-size object allocator. Memory is taken from the heap in slabs of many objects and
+// freed objects go to a free list, so creating and deleting map objects does not fragment
+// the general heap and the memory of reclaimed objects is reused by new ones.
+// Slabs are only returned to the system when the pool is destroyed with no live objects.
+class ObjectPool
+{
+public:
+    ObjectPool(const size_t nObjectSize, const size_t nObjectsPerSlab);
+    ~ObjectPool();
+
+    void* Allocate();
+    void Free(void* p);
+
+    // Objects currently allocated and total capacity of the slabs
+    size_t GetAllocated();
+    size_t GetCapacity();
+
+protected:
+
+    struct FreeNode
+    {
+        FreeNode* next;
+    };
+
+    void AddSlab();
+
+    const size_t mnObjectSize;
+    const size_t mnObjectsPerSlab;
+
+    std::vector<char*> mvpSlabs;
+    FreeNode* mpFreeList;
+    size_t mnAllocated;
+
+    std::mutex mMutex;
+};
+
+} //namespace ORB_SLAM
+
+#endif // OBJECTPOOL_H
@@ -0,0 +1,85 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OBSERVATIONLIST_H
+#define OBSERVATIONLIST_H
+
+#include <utility>
+#include <cstddef>
+
+namespace ORB_SLAM2
+{
+
+class KeyFrame;
+
+// Observations of a mappoint: (keyframe, keypoint index) pairs sorted by keyframe id.
+// Up to INLINE_SIZE observations (most points) are stored inside the object, so copies are a
+// single memcpy-like loop without allocations and iteration walks contiguous memory.
+// The interface mirrors the subset of std::map<KeyFrame*,size_t> used by the system.
+class ObservationList
+{
+public:
+    typedef std::pair<KeyFrame*,size_t> value_type;
+    typedef value_type* iterator;
+    typedef const value_type* const_iterator;
+
+    static const size_t INLINE_SIZE = 8;
+
+    ObservationList();
+    ObservationList(const ObservationList &other);
+    ObservationList(ObservationList &&other);
+    ~ObservationList();
+
+    ObservationList& operator=(const ObservationList &other);
+    ObservationList& operator=(ObservationList &&other);
+
+    iterator begin() { return mpData; }
+    iterator end() { return mpData+mnSize; }
+    const_iterator begin() const { return mpData; }
+    const_iterator end() const { return mpData+mnSize; }
+
+    size_t size() const { return mnSize; }
+    bool empty() const { return mnSize==0; }
+
+    iterator find(KeyFrame* pKF);
+    const_iterator find(KeyFrame* pKF) const;
+    size_t count(KeyFrame* pKF) const { return find(pKF)!=end() ? 1 : 0; }
+
+    // Adds the observation keeping the order by keyframe id (replaces the index if already present)
+    void insert(KeyFrame* pKF, const size_t idx);
+    size_t erase(KeyFrame* pKF);
+    void clear();
+
+protected:
+
+    void Reserve(const size_t capacity);
+    void CopyFrom(const ObservationList &other);
+    void MoveFrom(ObservationList &other);
+    bool IsInline() const { return mpData==mInline; }
+
+    value_type* mpData;
+    size_t mnSize;
+    size_t mnCapacity;
+    value_type mInline[INLINE_SIZE];
+};
+
+} //namespace ORB_SLAM
+
+#endif // OBSERVATIONLIST_H
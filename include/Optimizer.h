@@ -26,6 +26,7 @@
 #include "KeyFrame.h"
 #include "LoopClosing.h"
 #include "Frame.h"
+#include "MarkerSet.h"
 
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
@@ -37,19 +38,28 @@ class LoopClosing;
 class Optimizer
 {
 public:
+    // If nLoopKF>0 the result is stored in mTcwGBA/mPosGBA and the updated keyframes/mappoints
+    // are marked in pKFMarks/pMPMarks (if given)
     void static BundleAdjustment(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP,
                                  int nIterations = 5, bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
-                                 const bool bRobust = true);
+                                 const bool bRobust = true, MarkerSet* pKFMarks=NULL, MarkerSet* pMPMarks=NULL);
     void static GlobalBundleAdjustemnt(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL,
-                                       const unsigned long nLoopKF=0, const bool bRobust = true);
-    void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, Map *pMap);
-    int static PoseOptimization(Frame* pFrame);
+                                       const unsigned long nLoopKF=0, const bool bRobust = true,
+                                       MarkerSet* pKFMarks=NULL, MarkerSet* pMPMarks=NULL);
+    // The observations found to be outliers are returned in vOutliers, the caller erases them
+    void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, Map *pMap,
+                                      std::vector<std::pair<KeyFrame*,MapPoint*> > &vOutliers);
+    // With bComputeCov also sets the pose covariance of the frame (from the Hessian of the inliers),
+    // otherwise releases it
+    int static PoseOptimization(Frame* pFrame, const bool bComputeCov=false);
 
     // if bFixScale is true, 6DoF optimization (stereo,rgbd), 7DoF otherwise (mono)
+    // CorrectedPointRefs holds the reference keyframe id of the mappoints corrected in the loop fusion
     void static OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
                                        const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
+                                       const MarkerMap<long unsigned int> &CorrectedPointRefs,
                                        const bool &bFixScale);
 
     // if bFixScale is true, optimize SE3 (stereo,rgbd), Sim3 otherwise (mono)
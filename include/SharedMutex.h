@@ -0,0 +1,70 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHAREDMUTEX_H
+#define SHAREDMUTEX_H
+
+#include <mutex>
+#include <condition_variable>
+
+namespace ORB_SLAM2
+{
+
+// Reader-writer mutex (std::shared_mutex is not available in C++11).
+// Writers have preference: once a writer is waiting, new readers wait for it,
+// so writers with short critical sections are never starved by a stream of readers.
+// Use unique_lock<SharedMutex> for exclusive access and SharedLock for shared access.
+class SharedMutex
+{
+public:
+    SharedMutex();
+
+    void lock();
+    void unlock();
+
+    void lock_shared();
+    void unlock_shared();
+
+protected:
+    std::mutex mMutex;
+    std::condition_variable mcvReaders;
+    std::condition_variable mcvWriters;
+    int mnReaders;
+    int mnWaitingWriters;
+    bool mbWriter;
+};
+
+// Scoped shared ownership of a SharedMutex
+class SharedLock
+{
+public:
+    explicit SharedLock(SharedMutex &mutex) : mMutex(mutex) { mMutex.lock_shared(); }
+    ~SharedLock() { mMutex.unlock_shared(); }
+
+protected:
+    SharedLock(const SharedLock&);
+    SharedLock& operator=(const SharedLock&);
+
+    SharedMutex &mMutex;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SHAREDMUTEX_H
@@ -0,0 +1,135 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHAREDVECTOR_H
+#define SHAREDVECTOR_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+namespace ORB_SLAM2
+{
+
+// Vector whose copies share the elements. It holds feature data that is written once when a frame
+// is built and then only read, so that copying the frame or creating a keyframe from it copies
+// no elements. Writes go through Mutable(), which first detaches a private copy if it is shared.
+template<class T>
+class SharedVector
+{
+public:
+    typedef typename std::vector<T>::const_iterator const_iterator;
+
+    SharedVector() {}
+
+    SharedVector& operator=(const std::vector<T> &v)
+    {
+        Mutable() = v;
+        return *this;
+    }
+
+    // Copies the elements into the own buffer, which keeps its capacity if not shared
+    void CopyFrom(const SharedVector &v)
+    {
+        if(v.mp==mp)
+            return;
+        if(v.empty())
+            clear();
+        else
+            Mutable() = *v.mp;
+    }
+
+    std::vector<T>& Mutable()
+    {
+        if(!mp)
+            mp = std::make_shared<std::vector<T> >();
+        else if(mp.use_count()>1)
+            mp = std::make_shared<std::vector<T> >(*mp);
+        return *mp;
+    }
+
+    // Keeps the capacity if not shared
+    void clear()
+    {
+        if(mp && mp.use_count()==1)
+            mp->clear();
+        else
+            mp.reset();
+    }
+
+    // Drops the elements and frees the buffer if not shared
+    void release()
+    {
+        mp.reset();
+    }
+
+    void swap(SharedVector &v)
+    {
+        mp.swap(v.mp);
+    }
+
+    const std::vector<T>& get() const
+    {
+        static const std::vector<T> vEmpty;
+        return mp ? *mp : vEmpty;
+    }
+
+    operator const std::vector<T>&() const
+    {
+        return get();
+    }
+
+    const T& operator[](const size_t i) const
+    {
+        return (*mp)[i];
+    }
+
+    size_t size() const
+    {
+        return mp ? mp->size() : 0;
+    }
+
+    bool empty() const
+    {
+        return size()==0;
+    }
+
+    const T* data() const
+    {
+        return mp ? mp->data() : NULL;
+    }
+
+    const_iterator begin() const
+    {
+        return get().begin();
+    }
+
+    const_iterator end() const
+    {
+        return get().end();
+    }
+
+protected:
+    std::shared_ptr<std::vector<T> > mp;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SHAREDVECTOR_H
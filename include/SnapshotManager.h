@@ -0,0 +1,121 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SNAPSHOTMANAGER_H
+#define SNAPSHOTMANAGER_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+namespace ORB_SLAM2
+{
+
+// Versions of the keyframe poses and mappoint positions (two per object).
+// An optimizer publishes its results as one commit, that gets a new map version. A reader pins the
+// last committed version and reads the poses and positions as of that version until it unpins, so
+// the results of a commit are seen all at once and never halfway. Unpinned threads read the latest
+// values. Writes outside a commit update the latest values in place.
+class SnapshotManager
+{
+public:
+    SnapshotManager();
+
+    // Returns the slot of the calling reader thread
+    int RegisterReader();
+    void UnregisterReader(const int nSlot);
+
+    // The calling thread reads the map as of the last commit until Unpin
+    void Pin(const int nSlot);
+    void Unpin(const int nSlot);
+
+    // Writes of the calling thread until EndCommit belong to a new version, published at EndCommit.
+    // Commits are serialized. Only two versions are kept, so a commit waits for the readers pinned
+    // before the previous commit to unpin (one frame at most).
+    void BeginCommit();
+    void EndCommit();
+
+    // Version read by the calling thread (the maximum value if not pinned)
+    static unsigned long GetReadVersion() { return mnThreadReadVersion; }
+
+    // Version being committed by the calling thread (0 if none)
+    static unsigned long GetCommitVersion() { return mnThreadCommitVersion; }
+
+    // Lets a helper thread read as of a version pinned by another thread (see SnapshotReadScope)
+    static void SetReadVersion(const unsigned long nVersion) { mnThreadReadVersion = nVersion; }
+
+protected:
+    static thread_local unsigned long mnThreadReadVersion;
+    static thread_local unsigned long mnThreadCommitVersion;
+
+    // Last committed version
+    unsigned long mnVersion;
+
+    // Version pinned by each reader (unpinned and free slots have the maximum value)
+    std::vector<unsigned long> mvnReaderVersions;
+    std::vector<bool> mvbFreeSlots;
+
+    std::mutex mMutex;
+    std::condition_variable mcvUnpinned;
+
+    std::mutex mMutexCommit;
+};
+
+// Pins the map version while in scope
+class SnapshotPin
+{
+public:
+    SnapshotPin(SnapshotManager &manager, const int nSlot): mManager(manager), mnSlot(nSlot) { mManager.Pin(mnSlot); }
+    ~SnapshotPin() { mManager.Unpin(mnSlot); }
+
+private:
+    SnapshotManager &mManager;
+    const int mnSlot;
+};
+
+// Makes the calling thread read as of nVersion while in scope. The thread that pinned the version
+// must stay pinned meanwhile (e.g. while it waits for the helper threads).
+class SnapshotReadScope
+{
+public:
+    SnapshotReadScope(const unsigned long nVersion): mnPrevious(SnapshotManager::GetReadVersion())
+    {
+        SnapshotManager::SetReadVersion(nVersion);
+    }
+    ~SnapshotReadScope() { SnapshotManager::SetReadVersion(mnPrevious); }
+
+private:
+    const unsigned long mnPrevious;
+};
+
+// Commits the writes done while in scope
+class MapCommit
+{
+public:
+    MapCommit(SnapshotManager &manager): mManager(manager) { mManager.BeginCommit(); }
+    ~MapCommit() { mManager.EndCommit(); }
+
+private:
+    SnapshotManager &mManager;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SNAPSHOTMANAGER_H
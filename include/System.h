@@ -24,6 +24,7 @@
 
 #include<string>
 #include<thread>
+#include<memory>
 #include<opencv2/core/core.hpp>
 
 #include "Tracking.h"
@@ -34,6 +35,10 @@
 #include "LoopClosing.h"
 #include "KeyFrameDatabase.h"
 #include "ORBVocabulary.h"
+#include "VocabularyRegistry.h"
+#include "MapSerializer.h"
+#include "MapJournal.h"
+#include "KeyFramePager.h"
 #include "Viewer.h"
 
 namespace ORB_SLAM2
@@ -59,8 +64,12 @@ public:
 public:
 
     // Initialize the SLAM system. It launches the Local Mapping, Loop Closing and Viewer threads.
+    // The vocabulary is taken from the VocabularyRegistry, so it is loaded only once per process.
     System(const string &strVocFile, const string &strSettingsFile, const eSensor sensor, const bool bUseViewer = true);
 
+    // Same as above but using a vocabulary already loaded by the caller (e.g. shared by several cameras).
+    System(const std::shared_ptr<const ORBVocabulary> &pVocabulary, const string &strSettingsFile, const eSensor sensor, const bool bUseViewer = true);
+
     // Proccess the given stereo frame. Images must be synchronized and rectified.
     // Input images: RGB (CV_8UC3) or grayscale (CV_8U). RGB is converted to grayscale.
     // Returns the camera pose (empty if tracking fails).
@@ -91,34 +100,43 @@ public:
 
     // All threads will be requested to finish.
     // It waits until all threads have finished.
-    // This function must be called before saving the trajectory.
     void Shutdown();
 
     // Save camera trajectory in the TUM RGB-D dataset format.
     // Only for stereo and RGB-D. This method does not work for monocular.
-    // Call first Shutdown()
+    // It can be called at any time, the frames are placed with the current keyframe poses.
     // See format details at: http://vision.in.tum.de/data/datasets/rgbd-dataset
     void SaveTrajectoryTUM(const string &filename);
 
     // Save keyframe poses in the TUM RGB-D dataset format.
     // This method works for all sensor input.
-    // Call first Shutdown()
+    // It can be called at any time.
     // See format details at: http://vision.in.tum.de/data/datasets/rgbd-dataset
     void SaveKeyFrameTrajectoryTUM(const string &filename);
 
     // Save camera trajectory in the KITTI dataset format.
     // Only for stereo and RGB-D. This method does not work for monocular.
-    // Call first Shutdown()
+    // It can be called at any time, the frames are placed with the current keyframe poses.
     // See format details at: http://www.cvlibs.net/datasets/kitti/eval_odometry.php
     void SaveTrajectoryKITTI(const string &filename);
 
-    // TODO: Save/Load functions
-    // SaveMap(const string &filename);
-    // LoadMap(const string &filename);
+    // Save the map (keyframes, mappoints, covisibility graph and place recognition database) in binary format.
+    // Local Mapping is paused while saving. It can be called before or after Shutdown().
+    bool SaveMap(const string &filename);
+
+    // Load a map saved with SaveMap. The current map must be empty (call it before tracking any frame).
+    // The camera is then relocalized in the loaded map. The vocabulary must be the one used to build it.
+    bool LoadMap(const string &filename);
+
+    // Start journaling every map change to the given file for crash recovery. The current map is written
+    // first. A background thread writes the journal, which is closed in Shutdown().
+    // Examples/Map/replay_journal rebuilds the map from the journal and saves it in the SaveMap format.
+    bool EnableMapJournal(const string &filename);
 
     // Information from most recent processed frame
     // You can call this right after TrackMonocular (or stereo or RGBD)
     int GetTrackingState();
+    // MapPoints are valid until the next call to TrackMonocular (or stereo or RGBD)
     std::vector<MapPoint*> GetTrackedMapPoints();
     std::vector<cv::KeyPoint> GetTrackedKeyPointsUn();
 
@@ -127,8 +145,15 @@ private:
     // Input sensor
     eSensor mSensor;
 
+    // Prints the welcome message and checks the settings file.
+    void CheckSettings(const string &strSettingsFile);
+
+    // Creates the map, the drawers and launches all threads.
+    void Initialize(const string &strSettingsFile, const bool bUseViewer);
+
     // ORB vocabulary used for place recognition and feature matching.
-    ORBVocabulary* mpVocabulary;
+    // It is immutable and can be shared with other System instances.
+    std::shared_ptr<const ORBVocabulary> mpVocabulary;
 
     // KeyFrame database for place recognition (relocalization and loop detection).
     KeyFrameDatabase* mpKeyFrameDatabase;
@@ -160,6 +185,17 @@ private:
     std::thread* mptLoopClosing;
     std::thread* mptViewer;
 
+    // Map journal and its writer thread (only if enabled)
+    MapJournal* mpMapJournal;
+    std::thread* mptMapJournal;
+
+    // Keyframe pager and its thread (only if enabled)
+    KeyFramePager* mpKeyFramePager;
+    std::thread* mptKeyFramePager;
+
+    // Thread spilling the trajectory log of the tracker to disk (only if enabled)
+    std::thread* mptTrajectoryLog;
+
     // Reset flag
     std::mutex mMutexReset;
     bool mbReset;
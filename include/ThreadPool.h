@@ -0,0 +1,75 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+namespace ORB_SLAM2
+{
+
+// Small pool of worker threads used to split independent loops (e.g. candidate scoring).
+// Several threads can call ParallelFor at the same time.
+class ThreadPool
+{
+public:
+    // nThreads workers are created. With 0 workers ParallelFor runs in the calling thread.
+    ThreadPool(const int nThreads);
+    ~ThreadPool();
+
+    // Calls f(i) for every i in [0,n). The calling thread also takes part in the work.
+    // Returns when all calls have finished.
+    void ParallelFor(const size_t n, const std::function<void(size_t)> &f);
+
+    int GetNumThreads() const;
+
+protected:
+
+    struct Job
+    {
+        const std::function<void(size_t)>* pf;
+        size_t n;
+        std::atomic<size_t> next;
+        int nRunning;
+    };
+
+    void Run();
+
+    static void Work(Job* pJob);
+
+    std::vector<std::thread> mvThreads;
+
+    std::mutex mMutexQueue;
+    std::condition_variable mcvQueue;
+    std::condition_variable mcvDone;
+    std::deque<Job*> mlpQueue;
+    bool mbFinish;
+};
+
+} //namespace ORB_SLAM
+
+#endif // THREADPOOL_H
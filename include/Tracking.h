@@ -37,8 +37,14 @@
 #include "Initializer.h"
 #include "MapDrawer.h"
 #include "System.h"
+#include "MarkerSet.h"
+#include "TrajectoryLog.h"
 
 #include <mutex>
+#include <memory>
+#include <chrono>
+#include <unordered_map>
+#include <atomic>
 
 namespace ORB_SLAM2
 {
@@ -49,12 +55,13 @@ class Map;
 class LocalMapping;
 class LoopClosing;
 class System;
+class PnPsolver;
 
 class Tracking
 {  
 
 public:
-    Tracking(System* pSys, ORBVocabulary* pVoc, FrameDrawer* pFrameDrawer, MapDrawer* pMapDrawer, Map* pMap,
+    Tracking(System* pSys, const ORBVocabulary* pVoc, FrameDrawer* pFrameDrawer, MapDrawer* pMapDrawer, Map* pMap,
              KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor);
 
     // Preprocess the input and call Track(). Extract features and performs stereo matching.
@@ -74,6 +81,37 @@ public:
     // Use this function if you have deactivated local mapping and you only want to localize the camera.
     void InformOnlyTracking(const bool &flag);
 
+    // Use this function after loading a map. The camera has to be relocalized in it.
+    void InformMapLoaded();
+
+    // Outcome of the local map search of the last tracked frame. With a frame deadline, a match quota
+    // or a candidate cap (Tracking.FrameDeadline, Tracking.LocalMapMatchQuota, Tracking.MaxLocalMapCandidates)
+    // the least useful points are dropped.
+    struct LocalMapSearchStats
+    {
+        int nCandidates; // local mappoints predicted in the frame
+        int nFrustumPoints; // mappoints of the frustum outside the local map (Tracking.FrustumLocalMap)
+        int nUnprojected; // local mappoints not projected before the deadline
+        int nSearched;
+        int nDropped;
+        int nMatches; // new matches
+        int nComparisons; // descriptor distances computed
+        bool bDeadline; // stopped by the deadline
+        bool bQuota; // stopped by the match quota
+    };
+    LocalMapSearchStats GetLocalMapSearchStats() const;
+
+    // Descriptor comparisons and matches of the projection searches since the start, to compare
+    // the windows of Tracking.AdaptiveSearch with the fixed ones.
+    struct SearchWindowStats
+    {
+        unsigned long nMotionModelComparisons;
+        unsigned long nMotionModelMatches;
+        unsigned long nLocalMapComparisons;
+        unsigned long nLocalMapMatches;
+    };
+    SearchWindowStats GetSearchWindowStats() const;
+
 
 public:
 
@@ -103,12 +141,9 @@ public:
     std::vector<cv::Point3f> mvIniP3D;
     Frame mInitialFrame;
 
-    // Lists used to recover the full camera trajectory at the end of the execution.
+    // Log used to recover the full camera trajectory (at any time).
     // Basically we store the reference keyframe for each frame and its relative transformation
-    list<cv::Mat> mlRelativeFramePoses;
-    list<KeyFrame*> mlpReferences;
-    list<double> mlFrameTimes;
-    list<bool> mlbLost;
+    TrajectoryLog mTrajectory;
 
     // True if local mapping is deactivated and we are performing only localization
     bool mbOnlyTracking;
@@ -120,6 +155,20 @@ protected:
     // Main tracking function. It is independent of the input sensor.
     void Track();
 
+    // Tracks the new image by optical flow of the mappoints of the last frame, without extracting
+    // features (Tracking.FlowFrames). Returns false if the frame must be fully processed by Track().
+    bool TrackFlowFrame(const double &timestamp);
+
+    // Velocity from the last to the current frame
+    void UpdateMotionModel();
+
+    // Passes to the extractor the projections of the local map points in the next image, predicted
+    // with the motion model (Tracking.GuidedExtraction)
+    void PredictKeyPoints();
+
+    // Appends the current frame to the trajectory log
+    void StoreFramePose();
+
     // Map initialization for stereo and RGB-D
     void StereoInitialization();
 
@@ -128,12 +177,29 @@ protected:
     void CreateInitialMapMonocular();
 
     void CheckReplacedInLastFrame();
+
+    // Drops the bad mappoints kept between frames and reports a quiescent state to the map,
+    // so that culled mappoints can be deleted. Called after each frame.
+    void ReleaseBadMapPoints();
     bool TrackReferenceKeyFrame();
     void UpdateLastFrame();
     bool TrackWithMotionModel();
 
     bool Relocalization();
 
+    // Relocalization candidate: BoW matches and RANSAC solver
+    struct RelocCandidate
+    {
+        KeyFrame* pKF;
+        std::vector<MapPoint*> vpMatches;
+        int nMatches;
+        std::unique_ptr<PnPsolver> pSolver;
+    };
+
+    // Runs RANSAC on the candidate until a pose supported by enough inliers is found (returns the
+    // refined frame in F), the RANSAC gives up or bStop is set
+    bool VerifyRelocCandidate(RelocCandidate &candidate, Frame &F, const std::atomic<bool> &bStop);
+
     void UpdateLocalMap();
     void UpdateLocalPoints();
     void UpdateLocalKeyFrames();
@@ -144,6 +210,13 @@ protected:
     bool NeedNewKeyFrame();
     void CreateNewKeyFrame();
 
+    // Ratio of the tracked points of the reference keyframe under which a new keyframe is needed
+    float KeyFrameRefRatio(const int nKFs);
+
+    // The next frame will probably become a keyframe: the inliers of the last frame are close to the
+    // keyframe threshold. Such frames are extracted fully (Tracking.GuidedExtraction).
+    bool KeyFrameLikely();
+
     // In case of performing only localization, this flag is true when there are no matches to
     // points in the map. Still tracking will continue if there are enough matches with temporal points.
     // In that case we are doing visual odometry. The system will try to do relocalization to recover
@@ -159,7 +232,7 @@ protected:
     ORBextractor* mpIniORBextractor;
 
     //BoW
-    ORBVocabulary* mpORBVocabulary;
+    const ORBVocabulary* mpORBVocabulary;
     KeyFrameDatabase* mpKeyFrameDB;
 
     // Initalization (only for monocular)
@@ -169,6 +242,51 @@ protected:
     KeyFrame* mpReferenceKF;
     std::vector<KeyFrame*> mvpLocalKeyFrames;
     std::vector<MapPoint*> mvpLocalMapPoints;
+
+    // The local map is kept from frame to frame and only updated with what changed.
+    // Each local keyframe remembers the mappoints it contributed (by mnId, they can be reclaimed),
+    // each mappoint counts the local keyframes contributing it and knows its place in mvpLocalMapPoints.
+    // mvnLocalMapPointIds holds the mnId of each entry of mvpLocalMapPoints, so removing one never
+    // dereferences a point.
+    struct LocalKeyFrame
+    {
+        unsigned long mnMapPointsVersion;
+        std::vector<long unsigned int> mvnMapPointIds;
+    };
+    std::unordered_map<KeyFrame*,LocalKeyFrame> mmLocalKeyFrames;
+    std::vector<int> mvnLocalPointRefs;
+    std::vector<int> mvnLocalPointIdx;
+    std::vector<long unsigned int> mvnLocalMapPointIds;
+
+    // Projections of the local mappoints visible in the current frame, filled by SearchLocalPoints
+    std::vector<MapPointProjection> mvLocalProjections;
+
+    // Votes of the last local keyframes update, and the map state it was done with
+    std::vector<KeyFrame*> mvpLocalVotingKFs;
+    unsigned long mnLocalMapKFsVersion;
+    int mnLocalMapBigChangeIdx;
+
+    // mvpLocalMapPoints changed since it was last shown
+    bool mbLocalMapChanged;
+
+    void AddLocalPoint(MapPoint* pMP);
+    void RemoveLocalPoint(const long unsigned int nId);
+    void EraseLocalPointAt(const size_t idx, const long unsigned int nId);
+    void ResetLocalMap();
+
+    // Local map search budget (disabled if not positive). The deadline is in ms since the image was grabbed.
+    float mfFrameDeadline;
+    int mnLocalMapMatchQuota;
+    int mnMaxLocalMapCandidates;
+    std::chrono::steady_clock::time_point mFrameStart;
+    LocalMapSearchStats mLocalMapSearchStats;
+    SearchWindowStats mSearchWindowStats;
+
+    // Scratch marks of the tracking thread (by mnId)
+    MarkerSet mSeenPointMarks; // mappoints already matched or discarded in the current frame
+    MarkerSet mLocalPointMarks;
+    MarkerSet mLocalKeyFrameMarks;
+    MarkerMap<int> mKeyFrameVotes;
     
     // System
     System* mpSystem;
@@ -180,6 +298,10 @@ protected:
 
     //Map
     Map* mpMap;
+    int mnEpochSlot;
+
+    // Reader slot in the map versions (see SnapshotManager)
+    int mnSnapshotSlot;
 
     //Calibration matrix
     cv::Mat mK;
@@ -210,6 +332,29 @@ protected:
     //Motion Model
     cv::Mat mVelocity;
 
+    // Search windows from the pose uncertainty (Tracking.AdaptiveSearch). The covariance of the
+    // motion model prediction is a running average of its errors.
+    bool mbAdaptiveSearch;
+
+    // Search also the mappoints of the spatial index in the frustum of the current pose
+    bool mbFrustumLocalMap;
+    cv::Mat mPredictedTcw;
+    cv::Mat mMotionModelCov;
+    int mnMotionModelSamples;
+    void UpdateMotionModelCovariance();
+
+    // Hybrid front-end: at most mnMaxFlowFrames frames in a row are tracked by optical flow
+    // (0 disables it). Keyframes are only decided on fully processed frames.
+    int mnMaxFlowFrames;
+    int mnFlowFramesInRow;
+    cv::Mat mPrevImGray;
+
+    // Guided extraction: fraction of the features of each level searched away from the predictions.
+    // Frames are fully extracted while tracking is not stable.
+    bool mbGuidedExtraction;
+    float mfGuidedExploreRatio;
+    std::vector<cv::KeyPoint> mvPredictedKeys;
+
     //Color order (true RGB, false BGR, ignored if grayscale)
     bool mbRGB;
 
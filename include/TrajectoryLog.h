@@ -0,0 +1,122 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRAJECTORYLOG_H
+#define TRAJECTORYLOG_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM2
+{
+
+class KeyFrame;
+
+// Pose of every tracked frame relative to its reference keyframe, to retrieve the complete camera
+// trajectory (the keyframes are corrected by BA and loop closing). Records are compact and grouped
+// in chunks. If a spill file is set, a background thread writes the full chunks to it and drops
+// them from memory, so that long runs use bounded memory. It can be read at any time.
+class TrajectoryLog
+{
+public:
+
+    struct Record
+    {
+        // Rows 0-2 of the pose of the frame relative to the reference keyframe
+        float mTcr[12];
+        KeyFrame* mpReference;
+        double mTimeStamp;
+        bool mbLost;
+
+        cv::Mat GetRelativePose() const;
+    };
+
+    static const size_t CHUNK_SIZE = 1024;
+
+    TrajectoryLog();
+
+    // Full chunks are written to this file by Run (it only holds records of this run).
+    // Call it before tracking starts.
+    bool SetSpillFile(const std::string &filename);
+
+    // Main function of the spill thread
+    void Run();
+
+    void RequestFinish();
+    bool isFinished();
+
+    // Called by the tracking thread
+    void Add(const cv::Mat &Tcr, KeyFrame* pReference, const double timeStamp, const bool bLost);
+
+    // Repeats the last record with a new lost flag (frame without pose)
+    void AddRepeat(const bool bLost);
+
+    bool empty();
+
+    cv::Mat GetLastRelativePose();
+
+    void Clear();
+
+    // Calls f on every record in order, those spilled to the file first
+    bool ForEach(const std::function<void(const Record&)> &f);
+
+protected:
+
+    typedef std::vector<Record> Chunk;
+
+    // Writes the oldest full chunk to the spill file. Returns false on error.
+    bool Spill();
+
+    bool CheckFinish();
+    void SetFinish();
+
+    void Push(const Record &record);
+
+    // Last record, only used by the tracking thread
+    Record mLast;
+
+    // Chunk being filled, and full chunks not yet spilled (never modified)
+    Chunk mvCurrent;
+    std::deque<std::shared_ptr<const Chunk> > mdFullChunks;
+    size_t mnRecords;
+    std::mutex mMutexChunks;
+
+    // Records written to the spill file
+    std::string mSpillFile;
+    std::ofstream mFile;
+    size_t mnSpilled;
+    bool mbSpillError;
+    std::mutex mMutexFile;
+
+    bool mbFinishRequested;
+    bool mbFinished;
+    std::mutex mMutexFinish;
+};
+
+} //namespace ORB_SLAM
+
+#endif // TRAJECTORYLOG_H
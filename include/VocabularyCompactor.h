@@ -0,0 +1,276 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VOCABULARYCOMPACTOR_H
+#define VOCABULARYCOMPACTOR_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+#include "ORBVocabulary.h"
+
+namespace ORB_SLAM2
+{
+
+// Offline helper that shrinks a vocabulary to the part actually used by a set of images.
+// Descriptors of the training images are replayed through the tree to collect node usage.
+// Subtrees never reached are pruned and subtrees rarely reached are merged into a single word.
+// IDF weights are then recomputed on the replayed images. The result is a regular vocabulary
+// that can be saved as a text file and loaded as an ORBVocabulary.
+template<class TDescriptor, class F>
+class TemplatedVocabularyCompactor : public DBoW2::TemplatedVocabulary<TDescriptor,F>
+{
+public:
+
+    typedef DBoW2::TemplatedVocabulary<TDescriptor,F> Base;
+    typedef typename Base::Node Node;
+
+    TemplatedVocabularyCompactor() : mnDescriptors(0) {}
+
+    // Replays the descriptors of one image (one document for the IDF computation)
+    void AddDocument(const std::vector<TDescriptor> &vFeatures);
+
+    // Removes the nodes no descriptor went through and turns every subtree reached by less than
+    // nMinUsage descriptors into a single word. No word is created above nMinLeafLevel, so that
+    // direct index nodes used by ORBmatcher::SearchByBoW (levelsup 4) still exist.
+    // Returns false if no document was added.
+    bool Compact(const unsigned int nMinUsage, const int nMinLeafLevel);
+
+    // Same text format as loadFromTextFile.
+    bool SaveToTextFile(const std::string &filename) const;
+
+    size_t DocumentsInUse() const { return mvDocumentLeaves.size(); }
+    size_t DescriptorsInUse() const { return mnDescriptors; }
+    size_t NodesInUse() const { return this->m_nodes.size(); }
+
+protected:
+
+    // Returns the leaf reached by the descriptor, counting usage along the path
+    unsigned int Descend(const TDescriptor &feature);
+
+    // Number of descriptors that went through each node
+    std::vector<unsigned int> mvNodeUsage;
+
+    // Distinct leaves reached by each document
+    std::vector<std::vector<unsigned int> > mvDocumentLeaves;
+
+    size_t mnDescriptors;
+};
+
+template<class TDescriptor, class F>
+unsigned int TemplatedVocabularyCompactor<TDescriptor,F>::Descend(const TDescriptor &feature)
+{
+    unsigned int nid = 0;
+    mvNodeUsage[nid]++;
+
+    while(!this->m_nodes[nid].isLeaf())
+    {
+        const std::vector<DBoW2::NodeId> &vChildren = this->m_nodes[nid].children;
+        unsigned int bestId = vChildren[0];
+        double bestDist = F::distance(feature, this->m_nodes[bestId].descriptor);
+        for(size_t i=1; i<vChildren.size(); i++)
+        {
+            const double dist = F::distance(feature, this->m_nodes[vChildren[i]].descriptor);
+            if(dist<bestDist)
+            {
+                bestDist = dist;
+                bestId = vChildren[i];
+            }
+        }
+        nid = bestId;
+        mvNodeUsage[nid]++;
+    }
+
+    return nid;
+}
+
+template<class TDescriptor, class F>
+void TemplatedVocabularyCompactor<TDescriptor,F>::AddDocument(const std::vector<TDescriptor> &vFeatures)
+{
+    if(this->empty())
+        return;
+
+    if(mvNodeUsage.size()!=this->m_nodes.size())
+        mvNodeUsage.assign(this->m_nodes.size(),0);
+
+    std::vector<unsigned int> vLeaves;
+    vLeaves.reserve(vFeatures.size());
+    for(size_t i=0; i<vFeatures.size(); i++)
+        vLeaves.push_back(Descend(vFeatures[i]));
+
+    std::sort(vLeaves.begin(),vLeaves.end());
+    vLeaves.erase(std::unique(vLeaves.begin(),vLeaves.end()),vLeaves.end());
+
+    mvDocumentLeaves.push_back(vLeaves);
+    mnDescriptors += vFeatures.size();
+}
+
+template<class TDescriptor, class F>
+bool TemplatedVocabularyCompactor<TDescriptor,F>::Compact(const unsigned int nMinUsage, const int nMinLeafLevel)
+{
+    if(mvDocumentLeaves.empty() || mvNodeUsage.size()!=this->m_nodes.size())
+        return false;
+
+    const unsigned int nOldNodes = this->m_nodes.size();
+    const int nNotKept = -1;
+    std::vector<int> vOldToNew(nOldNodes,nNotKept);
+    std::vector<int> vDepth(nOldNodes,0);
+
+    std::vector<Node> vNewNodes;
+    vNewNodes.reserve(nOldNodes);
+    vNewNodes.resize(1);
+    vNewNodes[0].id = 0;
+    vNewNodes[0].parent = 0;
+    vNewNodes[0].weight = 0;
+    vOldToNew[0] = 0;
+
+    // Breadth first, so that parents are always written before their children
+    std::vector<unsigned int> vQueue;
+    vQueue.reserve(nOldNodes);
+    vQueue.push_back(0);
+    for(size_t q=0; q<vQueue.size(); q++)
+    {
+        const unsigned int oldId = vQueue[q];
+        const Node &oldNode = this->m_nodes[oldId];
+
+        if(oldNode.isLeaf())
+            continue;
+
+        // Merge rarely used subtrees into a single word
+        if(oldId!=0 && vDepth[oldId]>=nMinLeafLevel && mvNodeUsage[oldId]<nMinUsage)
+            continue;
+
+        for(size_t i=0; i<oldNode.children.size(); i++)
+        {
+            const unsigned int childId = oldNode.children[i];
+            if(mvNodeUsage[childId]==0)
+                continue;
+
+            const int newId = vNewNodes.size();
+            vNewNodes.resize(newId+1);
+            Node &newNode = vNewNodes[newId];
+            newNode.id = newId;
+            newNode.parent = vOldToNew[oldId];
+            newNode.descriptor = this->m_nodes[childId].descriptor;
+            newNode.weight = 0;
+            vNewNodes[vOldToNew[oldId]].children.push_back(newId);
+
+            vOldToNew[childId] = newId;
+            vDepth[childId] = vDepth[oldId]+1;
+            vQueue.push_back(childId);
+        }
+    }
+
+    // Assign word ids to the new leaves
+    std::vector<int> vNewNodeToWord(vNewNodes.size(),-1);
+    int nWords = 0;
+    for(size_t i=1; i<vNewNodes.size(); i++)
+    {
+        if(vNewNodes[i].isLeaf())
+        {
+            vNewNodes[i].word_id = nWords;
+            vNewNodeToWord[i] = nWords;
+            nWords++;
+        }
+    }
+
+    // An old leaf belongs to the word of its closest kept ancestor
+    std::vector<int> vOldLeafToWord(nOldNodes,-1);
+    for(unsigned int i=0; i<nOldNodes; i++)
+    {
+        if(!this->m_nodes[i].isLeaf() || mvNodeUsage[i]==0)
+            continue;
+        unsigned int nid = i;
+        while(vOldToNew[nid]==nNotKept)
+            nid = this->m_nodes[nid].parent;
+        vOldLeafToWord[i] = vNewNodeToWord[vOldToNew[nid]];
+    }
+
+    // Recompute idf = log(N/Ni) on the replayed documents
+    const double NDocs = mvDocumentLeaves.size();
+    std::vector<unsigned int> vNi(nWords,0);
+    std::vector<int> vLastDoc(nWords,-1);
+    for(size_t d=0; d<mvDocumentLeaves.size(); d++)
+    {
+        const std::vector<unsigned int> &vLeaves = mvDocumentLeaves[d];
+        for(size_t j=0; j<vLeaves.size(); j++)
+        {
+            const int wid = vOldLeafToWord[vLeaves[j]];
+            if(vLastDoc[wid]!=(int)d)
+            {
+                vLastDoc[wid] = d;
+                vNi[wid]++;
+            }
+        }
+        mvDocumentLeaves[d].clear();
+    }
+
+    const bool bIdf = this->m_weighting==DBoW2::TF_IDF || this->m_weighting==DBoW2::IDF;
+    for(size_t i=1; i<vNewNodes.size(); i++)
+    {
+        if(vNewNodeToWord[i]<0)
+            continue;
+        const unsigned int Ni = vNi[vNewNodeToWord[i]];
+        vNewNodes[i].weight = (bIdf && Ni>0) ? std::log(NDocs/(double)Ni) : 1.0;
+    }
+
+    // Replace the tree. Usage statistics refer to the old tree and are dropped.
+    this->m_nodes.swap(vNewNodes);
+    this->m_words.resize(nWords);
+    for(size_t i=1; i<this->m_nodes.size(); i++)
+        if(this->m_nodes[i].isLeaf())
+            this->m_words[this->m_nodes[i].word_id] = &this->m_nodes[i];
+
+    mvNodeUsage.clear();
+    mvDocumentLeaves.clear();
+    mnDescriptors = 0;
+
+    return true;
+}
+
+template<class TDescriptor, class F>
+bool TemplatedVocabularyCompactor<TDescriptor,F>::SaveToTextFile(const std::string &filename) const
+{
+    std::ofstream f(filename.c_str());
+    if(!f.is_open())
+        return false;
+
+    f << this->m_k << " " << this->m_L << " " << " " << this->m_scoring << " " << this->m_weighting;
+
+    // loadFromTextFile reads until eof, so the file must not end with an empty line
+    for(size_t i=1; i<this->m_nodes.size(); i++)
+    {
+        const Node &node = this->m_nodes[i];
+        f << std::endl << node.parent << " " << (node.isLeaf() ? 1 : 0) << " "
+          << F::toString(node.descriptor) << " " << (double)node.weight;
+    }
+
+    return f.good();
+}
+
+typedef TemplatedVocabularyCompactor<DBoW2::FORB::TDescriptor, DBoW2::FORB>
+  ORBVocabularyCompactor;
+
+} //namespace ORB_SLAM
+
+#endif // VOCABULARYCOMPACTOR_H
@@ -0,0 +1,69 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VOCABULARYREGISTRY_H
+#define VOCABULARYREGISTRY_H
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "ORBVocabulary.h"
+
+namespace ORB_SLAM2
+{
+
+// Process-wide cache of loaded vocabularies. Each file is loaded once and shared as an
+// immutable object by every System created in the process. ORBVocabulary::transform and
+// score are const and keep no state, so concurrent calls from several pipelines are safe.
+class VocabularyRegistry
+{
+public:
+
+    // Returns the vocabulary stored at strVocFile, loading it on first request.
+    // Concurrent requests for the same file wait for a single load.
+    // Returns an empty pointer if the file could not be loaded.
+    static std::shared_ptr<const ORBVocabulary> Get(const std::string &strVocFile);
+
+    // Makes an already loaded vocabulary available under strVocFile.
+    // Returns false if a different vocabulary is already registered with that name.
+    static bool Register(const std::string &strVocFile, const std::shared_ptr<const ORBVocabulary> &pVoc);
+
+    // Drops the vocabularies no System is using anymore.
+    static void Purge();
+
+protected:
+
+    struct Entry
+    {
+        std::mutex mMutexLoad;
+        std::shared_ptr<const ORBVocabulary> mpVoc;
+    };
+
+    static std::string Canonical(const std::string &strVocFile);
+
+    static std::map<std::string, std::shared_ptr<Entry> > msEntries;
+    static std::mutex mMutexEntries;
+};
+
+} //namespace ORB_SLAM
+
+#endif // VOCABULARYREGISTRY_H
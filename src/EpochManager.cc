@@ -0,0 +1,129 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "EpochManager.h"
+
+#include <limits>
+
+namespace ORB_SLAM2
+{
+
+static const unsigned long FREE_SLOT = std::numeric_limits<unsigned long>::max();
+
+EpochManager::EpochManager(): mnEpoch(0)
+{
+}
+
+EpochManager::~EpochManager()
+{
+    // No thread is left, everything can be freed
+    for(size_t i=0; i<mdRetired.size(); i++)
+        mdRetired[i].pfDelete(mdRetired[i].p);
+}
+
+int EpochManager::RegisterThread()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    mnEpoch++;
+    for(size_t i=0; i<mvnThreadEpochs.size(); i++)
+    {
+        if(mvnThreadEpochs[i]==FREE_SLOT)
+        {
+            mvnThreadEpochs[i] = mnEpoch;
+            return i;
+        }
+    }
+
+    mvnThreadEpochs.push_back(mnEpoch);
+    return mvnThreadEpochs.size()-1;
+}
+
+void EpochManager::UnregisterThread(const int nSlot)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mvnThreadEpochs[nSlot] = FREE_SLOT;
+}
+
+unsigned long EpochManager::BeginQuiescent()
+{
+    // Objects retired before this call have a lower epoch, those retired after do not
+    std::unique_lock<std::mutex> lock(mMutex);
+    mnEpoch++;
+    return mnEpoch;
+}
+
+void EpochManager::EndQuiescent(const int nSlot, const unsigned long nEpoch)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mvnThreadEpochs[nSlot] = nEpoch;
+}
+
+void EpochManager::Quiescent(const int nSlot)
+{
+    // An object retired at epoch e is safe for this thread once its epoch is above e
+    std::unique_lock<std::mutex> lock(mMutex);
+    mnEpoch++;
+    mvnThreadEpochs[nSlot] = mnEpoch;
+}
+
+void EpochManager::Retire(void *p, void (*pfDelete)(void *))
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    Retired retired;
+    retired.p = p;
+    retired.pfDelete = pfDelete;
+    retired.nEpoch = mnEpoch;
+    mdRetired.push_back(retired);
+}
+
+size_t EpochManager::Reclaim()
+{
+    std::vector<Retired> vFree;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        unsigned long nMinEpoch = FREE_SLOT;
+        for(size_t i=0; i<mvnThreadEpochs.size(); i++)
+            if(mvnThreadEpochs[i]<nMinEpoch)
+                nMinEpoch = mvnThreadEpochs[i];
+
+        while(!mdRetired.empty() && mdRetired.front().nEpoch<nMinEpoch)
+        {
+            vFree.push_back(mdRetired.front());
+            mdRetired.pop_front();
+        }
+    }
+
+    // Deleters run without the lock, they may take object mutexes
+    for(size_t i=0; i<vFree.size(); i++)
+        vFree[i].pfDelete(vFree[i].p);
+
+    return vFree.size();
+}
+
+size_t EpochManager::GetPending()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mdRetired.size();
+}
+
+} //namespace ORB_SLAM
@@ -38,30 +38,118 @@ Frame::Frame()
 //Copy Constructor
 Frame::Frame(const Frame &frame)
     :mpORBvocabulary(frame.mpORBvocabulary), mpORBextractorLeft(frame.mpORBextractorLeft), mpORBextractorRight(frame.mpORBextractorRight),
-     mTimeStamp(frame.mTimeStamp), mK(frame.mK.clone()), mDistCoef(frame.mDistCoef.clone()),
+     mTimeStamp(frame.mTimeStamp), mK(frame.mK), mDistCoef(frame.mDistCoef),
      mbf(frame.mbf), mb(frame.mb), mThDepth(frame.mThDepth), N(frame.N), mvKeys(frame.mvKeys),
      mvKeysRight(frame.mvKeysRight), mvKeysUn(frame.mvKeysUn),  mvuRight(frame.mvuRight),
      mvDepth(frame.mvDepth), mBowVec(frame.mBowVec), mFeatVec(frame.mFeatVec),
-     mDescriptors(frame.mDescriptors.clone()), mDescriptorsRight(frame.mDescriptorsRight.clone()),
-     mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier), mnId(frame.mnId),
+     mDescriptors(frame.mDescriptors), mDescriptorsRight(frame.mDescriptorsRight),
+     mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier), mGridStart(frame.mGridStart),
+     mGridIndices(frame.mGridIndices), mPoseCov(frame.mPoseCov.clone()), mnId(frame.mnId),
      mpReferenceKF(frame.mpReferenceKF), mnScaleLevels(frame.mnScaleLevels),
      mfScaleFactor(frame.mfScaleFactor), mfLogScaleFactor(frame.mfLogScaleFactor),
      mvScaleFactors(frame.mvScaleFactors), mvInvScaleFactors(frame.mvInvScaleFactors),
      mvLevelSigma2(frame.mvLevelSigma2), mvInvLevelSigma2(frame.mvInvLevelSigma2)
 {
-    for(int i=0;i<FRAME_GRID_COLS;i++)
-        for(int j=0; j<FRAME_GRID_ROWS; j++)
-            mGrid[i][j]=frame.mGrid[i][j];
+    if(!frame.mTcw.empty())
+        SetPose(frame.mTcw);
+}
+
+Frame& Frame::operator=(const Frame &frame)
+{
+    if(this==&frame)
+        return *this;
+
+    mpORBvocabulary = frame.mpORBvocabulary;
+    mpORBextractorLeft = frame.mpORBextractorLeft;
+    mpORBextractorRight = frame.mpORBextractorRight;
+    mTimeStamp = frame.mTimeStamp;
+    // The calibration is never modified in place, it is shared
+    mK = frame.mK;
+    mDistCoef = frame.mDistCoef;
+    mbf = frame.mbf;
+    mb = frame.mb;
+    mThDepth = frame.mThDepth;
+    N = frame.N;
+
+    // Vectors keep their capacity and matrices their buffer if the size does not change.
+    // The feature data is copied rather than shared, so that the next frame can reuse the
+    // buffers of this one (see TakeBuffers).
+    mvKeys.CopyFrom(frame.mvKeys);
+    mvKeysRight.CopyFrom(frame.mvKeysRight);
+    mvKeysUn.CopyFrom(frame.mvKeysUn);
+    mvuRight.CopyFrom(frame.mvuRight);
+    mvDepth.CopyFrom(frame.mvDepth);
+    mBowVec = frame.mBowVec;
+    mFeatVec = frame.mFeatVec;
+    mDescriptors = frame.mDescriptors;
+    mDescriptorsRight = frame.mDescriptorsRight;
+    mvpMapPoints = frame.mvpMapPoints;
+    mvbOutlier = frame.mvbOutlier;
+    mGridStart.CopyFrom(frame.mGridStart);
+    mGridIndices.CopyFrom(frame.mGridIndices);
+    frame.mPoseCov.copyTo(mPoseCov);
+
+    mnId = frame.mnId;
+    mpReferenceKF = frame.mpReferenceKF;
+    mnScaleLevels = frame.mnScaleLevels;
+    mfScaleFactor = frame.mfScaleFactor;
+    mfLogScaleFactor = frame.mfLogScaleFactor;
+    mvScaleFactors = frame.mvScaleFactors;
+    mvInvScaleFactors = frame.mvInvScaleFactors;
+    mvLevelSigma2 = frame.mvLevelSigma2;
+    mvInvLevelSigma2 = frame.mvInvLevelSigma2;
 
     if(!frame.mTcw.empty())
         SetPose(frame.mTcw);
+    else
+    {
+        mTcw.release();
+        mRcw.release();
+        mtcw.release();
+        mRwc.release();
+        mOw.release();
+    }
+
+    return *this;
+}
+
+void Frame::TakeBuffers(Frame &frame)
+{
+    mvKeys.swap(frame.mvKeys);
+    mvKeysRight.swap(frame.mvKeysRight);
+    mvKeysUn.swap(frame.mvKeysUn);
+    mvuRight.swap(frame.mvuRight);
+    mvDepth.swap(frame.mvDepth);
+    mvpMapPoints.swap(frame.mvpMapPoints);
+    mvbOutlier.swap(frame.mvbOutlier);
+    mGridStart.swap(frame.mGridStart);
+    mGridIndices.swap(frame.mGridIndices);
+    mvScaleFactors.swap(frame.mvScaleFactors);
+    mvInvScaleFactors.swap(frame.mvInvScaleFactors);
+    mvLevelSigma2.swap(frame.mvLevelSigma2);
+    mvInvLevelSigma2.swap(frame.mvInvLevelSigma2);
+
+    // Only the capacity is taken, and the frame is left consistently empty
+    mvKeys.clear();
+    mvKeysRight.clear();
+    mvKeysUn.clear();
+    mvuRight.clear();
+    mvDepth.clear();
+    mvpMapPoints.clear();
+    mvbOutlier.clear();
+    mGridStart.clear();
+    mGridIndices.clear();
+    frame.N = 0;
 }
 
 
-Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
-    :mpORBvocabulary(voc),mpORBextractorLeft(extractorLeft),mpORBextractorRight(extractorRight), mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
+Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, const ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, Frame* pRecycled)
+    :mpORBvocabulary(voc),mpORBextractorLeft(extractorLeft),mpORBextractorRight(extractorRight), mTimeStamp(timeStamp), mK(K),mDistCoef(distCoef), mbf(bf), mThDepth(thDepth),
      mpReferenceKF(static_cast<KeyFrame*>(NULL))
 {
+    if(pRecycled)
+        TakeBuffers(*pRecycled);
+
     // Frame ID
     mnId=nNextId++;
 
@@ -89,8 +177,8 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
 
     ComputeStereoMatches();
 
-    mvpMapPoints = vector<MapPoint*>(N,static_cast<MapPoint*>(NULL));    
-    mvbOutlier = vector<bool>(N,false);
+    mvpMapPoints.assign(N,static_cast<MapPoint*>(NULL));    
+    mvbOutlier.assign(N,false);
 
 
     // This is done only for the first Frame (or after a change in the calibration)
@@ -116,10 +204,13 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     AssignFeaturesToGrid();
 }
 
-Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
+Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,const ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, Frame* pRecycled)
     :mpORBvocabulary(voc),mpORBextractorLeft(extractor),mpORBextractorRight(static_cast<ORBextractor*>(NULL)),
-     mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth)
+     mTimeStamp(timeStamp), mK(K),mDistCoef(distCoef), mbf(bf), mThDepth(thDepth)
 {
+    if(pRecycled)
+        TakeBuffers(*pRecycled);
+
     // Frame ID
     mnId=nNextId++;
 
@@ -144,8 +235,8 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
 
     ComputeStereoFromRGBD(imDepth);
 
-    mvpMapPoints = vector<MapPoint*>(N,static_cast<MapPoint*>(NULL));
-    mvbOutlier = vector<bool>(N,false);
+    mvpMapPoints.assign(N,static_cast<MapPoint*>(NULL));
+    mvbOutlier.assign(N,false);
 
     // This is done only for the first Frame (or after a change in the calibration)
     if(mbInitialComputations)
@@ -171,10 +262,13 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
 }
 
 
-Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
+Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,const ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, Frame* pRecycled)
     :mpORBvocabulary(voc),mpORBextractorLeft(extractor),mpORBextractorRight(static_cast<ORBextractor*>(NULL)),
-     mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth)
+     mTimeStamp(timeStamp), mK(K),mDistCoef(distCoef), mbf(bf), mThDepth(thDepth)
 {
+    if(pRecycled)
+        TakeBuffers(*pRecycled);
+
     // Frame ID
     mnId=nNextId++;
 
@@ -198,11 +292,11 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
     UndistortKeyPoints();
 
     // Set no stereo information
-    mvuRight = vector<float>(N,-1);
-    mvDepth = vector<float>(N,-1);
+    mvuRight.Mutable().assign(N,-1);
+    mvDepth.Mutable().assign(N,-1);
 
-    mvpMapPoints = vector<MapPoint*>(N,static_cast<MapPoint*>(NULL));
-    mvbOutlier = vector<bool>(N,false);
+    mvpMapPoints.assign(N,static_cast<MapPoint*>(NULL));
+    mvbOutlier.assign(N,false);
 
     // This is done only for the first Frame (or after a change in the calibration)
     if(mbInitialComputations)
@@ -227,29 +321,93 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
     AssignFeaturesToGrid();
 }
 
+Frame::Frame(const double &timeStamp, const Frame &lastFrame, const vector<cv::KeyPoint> &vKeys, const vector<MapPoint*> &vpMapPoints, Frame* pRecycled)
+    :mpORBvocabulary(lastFrame.mpORBvocabulary),mpORBextractorLeft(lastFrame.mpORBextractorLeft),mpORBextractorRight(lastFrame.mpORBextractorRight),
+     mTimeStamp(timeStamp), mK(lastFrame.mK), mDistCoef(lastFrame.mDistCoef), mbf(lastFrame.mbf), mb(lastFrame.mb), mThDepth(lastFrame.mThDepth),
+     mpReferenceKF(static_cast<KeyFrame*>(NULL))
+{
+    if(pRecycled)
+        TakeBuffers(*pRecycled);
+
+    // Frame ID
+    mnId=nNextId++;
+
+    // Scale Level Info
+    mnScaleLevels = lastFrame.mnScaleLevels;
+    mfScaleFactor = lastFrame.mfScaleFactor;
+    mfLogScaleFactor = lastFrame.mfLogScaleFactor;
+    mvScaleFactors = lastFrame.mvScaleFactors;
+    mvInvScaleFactors = lastFrame.mvInvScaleFactors;
+    mvLevelSigma2 = lastFrame.mvLevelSigma2;
+    mvInvLevelSigma2 = lastFrame.mvInvLevelSigma2;
+
+    mvKeys = vKeys;
+    N = mvKeys.size();
+
+    UndistortKeyPoints();
+
+    // No stereo information, the points are used as monocular observations
+    mvuRight.Mutable().assign(N,-1);
+    mvDepth.Mutable().assign(N,-1);
+
+    mvpMapPoints = vpMapPoints;
+    mvbOutlier.assign(N,false);
+
+    AssignFeaturesToGrid();
+}
+
 void Frame::AssignFeaturesToGrid()
 {
-    int nReserve = 0.5f*N/(FRAME_GRID_COLS*FRAME_GRID_ROWS);
-    for(unsigned int i=0; i<FRAME_GRID_COLS;i++)
-        for (unsigned int j=0; j<FRAME_GRID_ROWS;j++)
-            mGrid[i][j].reserve(nReserve);
+    BuildGrid(mvKeysUn,mnMinX,mnMinY,mfGridElementWidthInv,mfGridElementHeightInv,mGridStart.Mutable(),mGridIndices.Mutable());
+}
+
+void Frame::BuildGrid(const vector<cv::KeyPoint> &vKeysUn, const float minX, const float minY,
+                      const float gridElementWidthInv, const float gridElementHeightInv,
+                      vector<int> &vGridStart, vector<size_t> &vGridIndices)
+{
+    // Counting sort of the keypoints by cell (cell of -1 if outside the grid)
+    const int nCells = FRAME_GRID_COLS*FRAME_GRID_ROWS;
+    const int nKeys = vKeysUn.size();
+    vGridStart.assign(nCells+1,0);
 
-    for(int i=0;i<N;i++)
+    // The cells are computed twice rather than stored, to need no other buffer
+    for(int pass=0; pass<2; pass++)
     {
-        const cv::KeyPoint &kp = mvKeysUn[i];
+        for(int i=0;i<nKeys;i++)
+        {
+            const cv::KeyPoint &kp = vKeysUn[i];
+            const int nGridPosX = round((kp.pt.x-minX)*gridElementWidthInv);
+            const int nGridPosY = round((kp.pt.y-minY)*gridElementHeightInv);
+            if(nGridPosX<0 || nGridPosX>=FRAME_GRID_COLS || nGridPosY<0 || nGridPosY>=FRAME_GRID_ROWS)
+                continue;
+
+            const int c = nGridPosX*FRAME_GRID_ROWS+nGridPosY;
+            if(pass==0)
+                vGridStart[c+1]++;
+            else
+                vGridIndices[vGridStart[c]++] = i;
+        }
 
-        int nGridPosX, nGridPosY;
-        if(PosInGrid(kp,nGridPosX,nGridPosY))
-            mGrid[nGridPosX][nGridPosY].push_back(i);
+        if(pass==0)
+        {
+            for(int c=0; c<nCells; c++)
+                vGridStart[c+1] += vGridStart[c];
+            vGridIndices.resize(vGridStart[nCells]);
+        }
     }
+
+    // Filling advanced each start to the next one, shift them back
+    for(int c=nCells; c>0; c--)
+        vGridStart[c] = vGridStart[c-1];
+    vGridStart[0] = 0;
 }
 
 void Frame::ExtractORB(int flag, const cv::Mat &im)
 {
     if(flag==0)
-        (*mpORBextractorLeft)(im,cv::Mat(),mvKeys,mDescriptors);
+        (*mpORBextractorLeft)(im,cv::Mat(),mvKeys.Mutable(),mDescriptors);
     else
-        (*mpORBextractorRight)(im,cv::Mat(),mvKeysRight,mDescriptorsRight);
+        (*mpORBextractorRight)(im,cv::Mat(),mvKeysRight.Mutable(),mDescriptorsRight);
 }
 
 void Frame::SetPose(cv::Mat Tcw)
@@ -266,10 +424,8 @@ void Frame::UpdatePoseMatrices()
     mOw = -mRcw.t()*mtcw;
 }
 
-bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
+bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit, MapPointProjection &proj)
 {
-    pMP->mbTrackInView = false;
-
     // 3D in absolute coordinates
     cv::Mat P = pMP->GetWorldPos(); 
 
@@ -314,36 +470,81 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
     const int nPredictedLevel = pMP->PredictScale(dist,this);
 
     // Data used by the tracking
-    pMP->mbTrackInView = true;
-    pMP->mTrackProjX = u;
-    pMP->mTrackProjXR = u - mbf*invz;
-    pMP->mTrackProjY = v;
-    pMP->mnTrackScaleLevel= nPredictedLevel;
-    pMP->mTrackViewCos = viewCos;
+    proj.pMP = pMP;
+    proj.u = u;
+    proj.uR = u - mbf*invz;
+    proj.v = v;
+    proj.nLevel = nPredictedLevel;
+    proj.viewCos = viewCos;
+    proj.sigma = mPoseCov.empty() ? -1.0f : ProjectionSigma(PcX,PcY,PcZ);
 
     return true;
 }
 
+float Frame::ProjectionSigma(const float x, const float y, const float z) const
+{
+    if(mPoseCov.empty())
+        return -1.0f;
+
+    // Jacobian of the projection w.r.t. the pose: d(u,v)/dPc * [-[Pc]x | I]
+    const float invz = 1.0f/z;
+    const float a = fx*invz;
+    const float b = -fx*x*invz*invz;
+    const float c = fy*invz;
+    const float d = -fy*y*invz*invz;
+    const float J[2][6] = {{b*y, a*z-b*x, -a*y, a, 0, b},
+                           {d*y-c*z, -d*x, c*x, 0, c, d}};
+
+    // Projected covariance J*Cov*J'
+    float S[2][2] = {{0,0},{0,0}};
+    for(int i=0; i<6; i++)
+    {
+        const float* Ci = mPoseCov.ptr<float>(i);
+        for(int j=0; j<6; j++)
+        {
+            S[0][0] += J[0][i]*Ci[j]*J[0][j];
+            S[0][1] += J[0][i]*Ci[j]*J[1][j];
+            S[1][1] += J[1][i]*Ci[j]*J[1][j];
+        }
+    }
+
+    // Largest eigenvalue
+    const float m = 0.5f*(S[0][0]+S[1][1]);
+    const float h = 0.5f*(S[0][0]-S[1][1]);
+    return sqrt(m+sqrt(h*h+S[0][1]*S[0][1]));
+}
+
 vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const float  &r, const int minLevel, const int maxLevel) const
 {
     vector<size_t> vIndices;
-    vIndices.reserve(N);
+    GetFeaturesInArea(x,y,r,vIndices,minLevel,maxLevel);
+    return vIndices;
+}
+
+void Frame::GetFeaturesInArea(const float &x, const float  &y, const float  &r, vector<size_t> &vIndices,
+                              const int minLevel, const int maxLevel) const
+{
+    vIndices.clear();
+
+    // Frames without keypoints have no grid
+    if(mGridIndices.empty())
+        return;
 
     const int nMinCellX = max(0,(int)floor((x-mnMinX-r)*mfGridElementWidthInv));
     if(nMinCellX>=FRAME_GRID_COLS)
-        return vIndices;
+        return;
 
     const int nMaxCellX = min((int)FRAME_GRID_COLS-1,(int)ceil((x-mnMinX+r)*mfGridElementWidthInv));
     if(nMaxCellX<0)
-        return vIndices;
+        return;
 
     const int nMinCellY = max(0,(int)floor((y-mnMinY-r)*mfGridElementHeightInv));
     if(nMinCellY>=FRAME_GRID_ROWS)
-        return vIndices;
+        return;
 
     const int nMaxCellY = min((int)FRAME_GRID_ROWS-1,(int)ceil((y-mnMinY+r)*mfGridElementHeightInv));
     if(nMaxCellY<0)
-        return vIndices;
+        return;
 
     const bool bCheckLevels = (minLevel>0) || (maxLevel>=0);
 
@@ -351,13 +552,14 @@ vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const f
     {
         for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
         {
-            const vector<size_t> vCell = mGrid[ix][iy];
-            if(vCell.empty())
+            const int nCell = GetGridCellSize(ix,iy);
+            if(nCell==0)
                 continue;
 
-            for(size_t j=0, jend=vCell.size(); j<jend; j++)
+            const size_t* pCell = GetGridCell(ix,iy);
+            for(int j=0; j<nCell; j++)
             {
-                const cv::KeyPoint &kpUn = mvKeysUn[vCell[j]];
+                const cv::KeyPoint &kpUn = mvKeysUn[pCell[j]];
                 if(bCheckLevels)
                 {
                     if(kpUn.octave<minLevel)
@@ -371,12 +573,10 @@ vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const f
                 const float disty = kpUn.pt.y-y;
 
                 if(fabs(distx)<r && fabs(disty)<r)
-                    vIndices.push_back(vCell[j]);
+                    vIndices.push_back(pCell[j]);
             }
         }
     }
-
-    return vIndices;
 }
 
 bool Frame::PosInGrid(const cv::KeyPoint &kp, int &posX, int &posY)
@@ -423,13 +623,14 @@ void Frame::UndistortKeyPoints()
     mat=mat.reshape(1);
 
     // Fill undistorted keypoint vector
-    mvKeysUn.resize(N);
+    vector<cv::KeyPoint> &vKeysUn = mvKeysUn.Mutable();
+    vKeysUn.resize(N);
     for(int i=0; i<N; i++)
     {
         cv::KeyPoint kp = mvKeys[i];
         kp.pt.x=mat.at<float>(i,0);
         kp.pt.y=mat.at<float>(i,1);
-        mvKeysUn[i]=kp;
+        vKeysUn[i]=kp;
     }
 }
 
@@ -465,8 +666,10 @@ void Frame::ComputeImageBounds(const cv::Mat &imLeft)
 
 void Frame::ComputeStereoMatches()
 {
-    mvuRight = vector<float>(N,-1.0f);
-    mvDepth = vector<float>(N,-1.0f);
+    vector<float> &vuRight = mvuRight.Mutable();
+    vector<float> &vDepth = mvDepth.Mutable();
+    vuRight.assign(N,-1.0f);
+    vDepth.assign(N,-1.0f);
 
     const int thOrbDist = (ORBmatcher::TH_HIGH+ORBmatcher::TH_LOW)/2;
 
@@ -616,8 +819,8 @@ void Frame::ComputeStereoMatches()
                     disparity=0.01;
                     bestuR = uL-0.01;
                 }
-                mvDepth[iL]=mbf/disparity;
-                mvuRight[iL] = bestuR;
+                vDepth[iL]=mbf/disparity;
+                vuRight[iL] = bestuR;
                 vDistIdx.push_back(pair<int,int>(bestDist,iL));
             }
         }
@@ -633,8 +836,8 @@ void Frame::ComputeStereoMatches()
             break;
         else
         {
-            mvuRight[vDistIdx[i].second]=-1;
-            mvDepth[vDistIdx[i].second]=-1;
+            vuRight[vDistIdx[i].second]=-1;
+            vDepth[vDistIdx[i].second]=-1;
         }
     }
 }
@@ -642,8 +845,10 @@ void Frame::ComputeStereoMatches()
 
 void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth)
 {
-    mvuRight = vector<float>(N,-1);
-    mvDepth = vector<float>(N,-1);
+    vector<float> &vuRight = mvuRight.Mutable();
+    vector<float> &vDepth = mvDepth.Mutable();
+    vuRight.assign(N,-1);
+    vDepth.assign(N,-1);
 
     for(int i=0; i<N; i++)
     {
@@ -657,8 +862,8 @@ void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth)
 
         if(d>0)
         {
-            mvDepth[i] = d;
-            mvuRight[i] = kpU.pt.x-mbf/d;
+            vDepth[i] = d;
+            vuRight[i] = kpU.pt.x-mbf/d;
         }
     }
 }
@@ -21,43 +21,59 @@
 #include "KeyFrame.h"
 #include "Converter.h"
 #include "ORBmatcher.h"
+#include "MapJournal.h"
+#include "KeyFramePager.h"
 #include<mutex>
 
 namespace ORB_SLAM2
 {
 
 long unsigned int KeyFrame::nNextId=0;
+ObjectPool KeyFrame::mPool(sizeof(KeyFrame),256);
+
+void* KeyFrame::operator new(size_t nSize)
+{
+    if(nSize!=sizeof(KeyFrame))
+        return ::operator new(nSize);
+    return mPool.Allocate();
+}
+
+void KeyFrame::operator delete(void *p, size_t nSize)
+{
+    if(!p)
+        return;
+    if(nSize!=sizeof(KeyFrame))
+        ::operator delete(p);
+    else
+        mPool.Free(p);
+}
 
 KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
     mfGridElementWidthInv(F.mfGridElementWidthInv), mfGridElementHeightInv(F.mfGridElementHeightInv),
-    mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
-    mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0),
     fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), invfx(F.invfx), invfy(F.invfy),
     mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn),
-    mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors.clone()),
-    mBowVec(F.mBowVec), mFeatVec(F.mFeatVec), mnScaleLevels(F.mnScaleLevels), mfScaleFactor(F.mfScaleFactor),
+    mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors), mnScaleLevels(F.mnScaleLevels), mfScaleFactor(F.mfScaleFactor),
     mfLogScaleFactor(F.mfLogScaleFactor), mvScaleFactors(F.mvScaleFactors), mvLevelSigma2(F.mvLevelSigma2),
     mvInvLevelSigma2(F.mvInvLevelSigma2), mnMinX(F.mnMinX), mnMinY(F.mnMinY), mnMaxX(F.mnMaxX),
-    mnMaxY(F.mnMaxY), mK(F.mK), mvpMapPoints(F.mvpMapPoints), mpKeyFrameDB(pKFDB),
-    mpORBvocabulary(F.mpORBvocabulary), mbFirstConnection(true), mpParent(NULL), mbNotErase(false),
-    mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb/2), mpMap(pMap)
+    mnMaxY(F.mnMaxY), mK(F.mK), mnPoseVersion(0), mvpMapPoints(F.mvpMapPoints), mnMapPointsVersion(0),
+    mpKeyFrameDB(pKFDB), mpORBvocabulary(F.mpORBvocabulary), mGridStart(F.mGridStart),
+    mGridIndices(F.mGridIndices), mbOrderedConnectionsDirty(false),
+    mbFirstConnection(true), mpParent(NULL), mbNotErase(false), mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb/2), mpMap(pMap), mnFeaturePins(0),
+    mbFeaturesPagedOut(false), mnPageOffset(-1), mnPageCapacity(0), mLastPinned(chrono::steady_clock::now())
 {
     mnId=nNextId++;
 
-    mGrid.resize(mnGridCols);
-    for(int i=0; i<mnGridCols;i++)
-    {
-        mGrid[i].resize(mnGridRows);
-        for(int j=0; j<mnGridRows; j++)
-            mGrid[i][j] = F.mGrid[i][j];
-    }
+    // The feature data is shared with the frame and the BoW taken from it, nothing is copied
+    mBowVec.swap(F.mBowVec);
+    mFeatVec.swap(F.mFeatVec);
 
     SetPose(F.mTcw);    
 }
 
 void KeyFrame::ComputeBoW()
 {
+    KeyFramePin pin(this);
     if(mBowVec.empty() || mFeatVec.empty())
     {
         vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
@@ -70,6 +86,18 @@ void KeyFrame::ComputeBoW()
 void KeyFrame::SetPose(const cv::Mat &Tcw_)
 {
     unique_lock<mutex> lock(mMutexPose);
+
+    // The first change of a commit keeps the previous pose for pinned readers
+    const unsigned long nCommit = SnapshotManager::GetCommitVersion();
+    if(nCommit>mnPoseVersion && !Tcw.empty())
+    {
+        mTcwOld = Tcw.clone();
+        mTwcOld = Twc;
+        mOwOld = Ow;
+        mCwOld = Cw;
+        mnPoseVersion = nCommit;
+    }
+
     Tcw_.copyTo(Tcw);
     cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
     cv::Mat tcw = Tcw.rowRange(0,3).col(3);
@@ -81,79 +109,134 @@ void KeyFrame::SetPose(const cv::Mat &Tcw_)
     Ow.copyTo(Twc.rowRange(0,3).col(3));
     cv::Mat center = (cv::Mat_<float>(4,1) << mHalfBaseline, 0 , 0, 1);
     Cw = Twc*center;
+
+    MapJournal* pJournal = mpMap->GetJournal();
+    if(pJournal)
+        pJournal->SetKeyFramePose(this,Tcw);
+}
+
+bool KeyFrame::UseOldPose() const
+{
+    return mnPoseVersion>SnapshotManager::GetReadVersion() && !mTcwOld.empty();
 }
 
 cv::Mat KeyFrame::GetPose()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Tcw.clone();
+    return UseOldPose() ? mTcwOld.clone() : Tcw.clone();
 }
 
 cv::Mat KeyFrame::GetPoseInverse()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Twc.clone();
+    return UseOldPose() ? mTwcOld.clone() : Twc.clone();
 }
 
 cv::Mat KeyFrame::GetCameraCenter()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Ow.clone();
+    return UseOldPose() ? mOwOld.clone() : Ow.clone();
 }
 
 cv::Mat KeyFrame::GetStereoCenter()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Cw.clone();
+    return UseOldPose() ? mCwOld.clone() : Cw.clone();
 }
 
 
 cv::Mat KeyFrame::GetRotation()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Tcw.rowRange(0,3).colRange(0,3).clone();
+    const cv::Mat &T = UseOldPose() ? mTcwOld : Tcw;
+    return T.rowRange(0,3).colRange(0,3).clone();
 }
 
 cv::Mat KeyFrame::GetTranslation()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Tcw.rowRange(0,3).col(3).clone();
+    const cv::Mat &T = UseOldPose() ? mTcwOld : Tcw;
+    return T.rowRange(0,3).col(3).clone();
 }
 
 void KeyFrame::AddConnection(KeyFrame *pKF, const int &weight)
 {
+    unique_lock<mutex> lock(mMutexConnections);
+    int &w = mConnectedKeyFrameWeights[pKF];
+    if(w!=weight)
     {
-        unique_lock<mutex> lock(mMutexConnections);
-        if(!mConnectedKeyFrameWeights.count(pKF))
-            mConnectedKeyFrameWeights[pKF]=weight;
-        else if(mConnectedKeyFrameWeights[pKF]!=weight)
-            mConnectedKeyFrameWeights[pKF]=weight;
-        else
-            return;
+        w=weight;
+        mbOrderedConnectionsDirty=true;
     }
+}
 
-    UpdateBestCovisibles();
+void KeyFrame::IncreaseCovisibility(KeyFrame *pKF)
+{
+    unique_lock<mutex> lock(mMutexConnections);
+    mConnectedKeyFrameWeights[pKF]++;
+    mbOrderedConnectionsDirty=true;
+}
+
+void KeyFrame::DecreaseCovisibility(KeyFrame *pKF)
+{
+    unique_lock<mutex> lock(mMutexConnections);
+    map<KeyFrame*,int>::iterator mit = mConnectedKeyFrameWeights.find(pKF);
+    if(mit==mConnectedKeyFrameWeights.end())
+        return;
+
+    if(--mit->second<=0)
+        mConnectedKeyFrameWeights.erase(mit);
+    mbOrderedConnectionsDirty=true;
 }
 
 void KeyFrame::UpdateBestCovisibles()
 {
     unique_lock<mutex> lock(mMutexConnections);
+    mbOrderedConnectionsDirty=true;
+}
+
+void KeyFrame::SortConnections()
+{
+    if(!mbOrderedConnectionsDirty)
+        return;
+
+    //Keyframes sharing at least th mappoints are ordered by weight
+    //In case no keyframe is over threshold keep the one with maximum weight
+    //This is the list UpdateConnections used to build for a new keyframe, which is the one local
+    //mapping, local BA and loop detection query. Weak edges to older keyframes, that the list also
+    //got once a later keyframe connected, are left out so that all keyframes follow the same rule.
+    int nmax=0;
+    KeyFrame* pKFmax=NULL;
+    int th = 15;
+
     vector<pair<int,KeyFrame*> > vPairs;
     vPairs.reserve(mConnectedKeyFrameWeights.size());
     for(map<KeyFrame*,int>::iterator mit=mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
-       vPairs.push_back(make_pair(mit->second,mit->first));
+    {
+        if(mit->second>nmax)
+        {
+            nmax=mit->second;
+            pKFmax=mit->first;
+        }
+        if(mit->second>=th)
+            vPairs.push_back(make_pair(mit->second,mit->first));
+    }
+
+    if(vPairs.empty() && pKFmax)
+        vPairs.push_back(make_pair(nmax,pKFmax));
 
     sort(vPairs.begin(),vPairs.end());
-    list<KeyFrame*> lKFs;
-    list<int> lWs;
-    for(size_t i=0, iend=vPairs.size(); i<iend;i++)
+
+    const size_t n = vPairs.size();
+    mvpOrderedConnectedKeyFrames.resize(n);
+    mvOrderedWeights.resize(n);
+    for(size_t i=0; i<n; i++)
     {
-        lKFs.push_front(vPairs[i].second);
-        lWs.push_front(vPairs[i].first);
+        mvpOrderedConnectedKeyFrames[i] = vPairs[n-1-i].second;
+        mvOrderedWeights[i] = vPairs[n-1-i].first;
     }
 
-    mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
-    mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());    
+    mbOrderedConnectionsDirty=false;
 }
 
 set<KeyFrame*> KeyFrame::GetConnectedKeyFrames()
@@ -168,12 +251,14 @@ set<KeyFrame*> KeyFrame::GetConnectedKeyFrames()
 vector<KeyFrame*> KeyFrame::GetVectorCovisibleKeyFrames()
 {
     unique_lock<mutex> lock(mMutexConnections);
+    SortConnections();
     return mvpOrderedConnectedKeyFrames;
 }
 
 vector<KeyFrame*> KeyFrame::GetBestCovisibilityKeyFrames(const int &N)
 {
     unique_lock<mutex> lock(mMutexConnections);
+    SortConnections();
     if((int)mvpOrderedConnectedKeyFrames.size()<N)
         return mvpOrderedConnectedKeyFrames;
     else
@@ -184,6 +269,7 @@ vector<KeyFrame*> KeyFrame::GetBestCovisibilityKeyFrames(const int &N)
 vector<KeyFrame*> KeyFrame::GetCovisiblesByWeight(const int &w)
 {
     unique_lock<mutex> lock(mMutexConnections);
+    SortConnections();
 
     if(mvpOrderedConnectedKeyFrames.empty())
         return vector<KeyFrame*>();
@@ -201,8 +287,9 @@ vector<KeyFrame*> KeyFrame::GetCovisiblesByWeight(const int &w)
 int KeyFrame::GetWeight(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexConnections);
-    if(mConnectedKeyFrameWeights.count(pKF))
-        return mConnectedKeyFrameWeights[pKF];
+    map<KeyFrame*,int>::iterator mit = mConnectedKeyFrameWeights.find(pKF);
+    if(mit!=mConnectedKeyFrameWeights.end())
+        return mit->second;
     else
         return 0;
 }
@@ -211,25 +298,31 @@ void KeyFrame::AddMapPoint(MapPoint *pMP, const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
     mvpMapPoints[idx]=pMP;
+    mnMapPointsVersion++;
 }
 
 void KeyFrame::EraseMapPointMatch(const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
     mvpMapPoints[idx]=static_cast<MapPoint*>(NULL);
+    mnMapPointsVersion++;
 }
 
 void KeyFrame::EraseMapPointMatch(MapPoint* pMP)
 {
     int idx = pMP->GetIndexInKeyFrame(this);
     if(idx>=0)
+    {
         mvpMapPoints[idx]=static_cast<MapPoint*>(NULL);
+        mnMapPointsVersion++;
+    }
 }
 
 
 void KeyFrame::ReplaceMapPointMatch(const size_t &idx, MapPoint* pMP)
 {
     mvpMapPoints[idx]=pMP;
+    mnMapPointsVersion++;
 }
 
 set<MapPoint*> KeyFrame::GetMapPoints()
@@ -280,6 +373,11 @@ vector<MapPoint*> KeyFrame::GetMapPointMatches()
     return mvpMapPoints;
 }
 
+unsigned long KeyFrame::GetMapPointsVersion() const
+{
+    return mnMapPointsVersion;
+}
+
 MapPoint* KeyFrame::GetMapPoint(const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
@@ -288,93 +386,24 @@ MapPoint* KeyFrame::GetMapPoint(const size_t &idx)
 
 void KeyFrame::UpdateConnections()
 {
-    map<KeyFrame*,int> KFcounter;
-
-    vector<MapPoint*> vpMP;
-
-    {
-        unique_lock<mutex> lockMPs(mMutexFeatures);
-        vpMP = mvpMapPoints;
-    }
-
-    //For all map points in keyframe check in which other keyframes are they seen
-    //Increase counter for those keyframes
-    for(vector<MapPoint*>::iterator vit=vpMP.begin(), vend=vpMP.end(); vit!=vend; vit++)
-    {
-        MapPoint* pMP = *vit;
-
-        if(!pMP)
-            continue;
-
-        if(pMP->isBad())
-            continue;
-
-        map<KeyFrame*,size_t> observations = pMP->GetObservations();
-
-        for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-        {
-            if(mit->first->mnId==mnId)
-                continue;
-            KFcounter[mit->first]++;
-        }
-    }
+    // The weights are maintained by the mappoints (see MapPoint::AddObservation),
+    // here only the spanning tree is updated
+    unique_lock<mutex> lockCon(mMutexConnections);
 
     // This should not happen
-    if(KFcounter.empty())
+    if(mConnectedKeyFrameWeights.empty())
         return;
 
-    //If the counter is greater than threshold add connection
-    //In case no keyframe counter is over threshold add the one with maximum counter
-    int nmax=0;
-    KeyFrame* pKFmax=NULL;
-    int th = 15;
-
-    vector<pair<int,KeyFrame*> > vPairs;
-    vPairs.reserve(KFcounter.size());
-    for(map<KeyFrame*,int>::iterator mit=KFcounter.begin(), mend=KFcounter.end(); mit!=mend; mit++)
-    {
-        if(mit->second>nmax)
-        {
-            nmax=mit->second;
-            pKFmax=mit->first;
-        }
-        if(mit->second>=th)
-        {
-            vPairs.push_back(make_pair(mit->second,mit->first));
-            (mit->first)->AddConnection(this,mit->second);
-        }
-    }
-
-    if(vPairs.empty())
+    if(mbFirstConnection && mnId!=0)
     {
-        vPairs.push_back(make_pair(nmax,pKFmax));
-        pKFmax->AddConnection(this,nmax);
-    }
-
-    sort(vPairs.begin(),vPairs.end());
-    list<KeyFrame*> lKFs;
-    list<int> lWs;
-    for(size_t i=0; i<vPairs.size();i++)
-    {
-        lKFs.push_front(vPairs[i].second);
-        lWs.push_front(vPairs[i].first);
-    }
-
-    {
-        unique_lock<mutex> lockCon(mMutexConnections);
-
-        // mspConnectedKeyFrames = spConnectedKeyFrames;
-        mConnectedKeyFrameWeights = KFcounter;
-        mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
-        mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
-
-        if(mbFirstConnection && mnId!=0)
-        {
-            mpParent = mvpOrderedConnectedKeyFrames.front();
-            mpParent->AddChild(this);
-            mbFirstConnection = false;
-        }
-
+        SortConnections();
+        mpParent = mvpOrderedConnectedKeyFrames.front();
+        mpParent->AddChild(this);
+        mbFirstConnection = false;
+
+        MapJournal* pJournal = mpMap->GetJournal();
+        if(pJournal)
+            pJournal->ChangeParent(this,mpParent);
     }
 }
 
@@ -395,6 +424,10 @@ void KeyFrame::ChangeParent(KeyFrame *pKF)
     unique_lock<mutex> lockCon(mMutexConnections);
     mpParent = pKF;
     pKF->AddChild(this);
+
+    MapJournal* pJournal = mpMap->GetJournal();
+    if(pJournal)
+        pJournal->ChangeParent(this,pKF);
 }
 
 set<KeyFrame*> KeyFrame::GetChilds()
@@ -420,6 +453,10 @@ void KeyFrame::AddLoopEdge(KeyFrame *pKF)
     unique_lock<mutex> lockCon(mMutexConnections);
     mbNotErase = true;
     mspLoopEdges.insert(pKF);
+
+    MapJournal* pJournal = mpMap->GetJournal();
+    if(pJournal)
+        pJournal->AddLoopEdge(this,pKF);
 }
 
 set<KeyFrame*> KeyFrame::GetLoopEdges()
@@ -463,18 +500,31 @@ void KeyFrame::SetBadFlag()
         }
     }
 
-    for(map<KeyFrame*,int>::iterator mit = mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
-        mit->first->EraseConnection(this);
-
+    // Erasing the observations removes the weights shared through them, other connections are erased after
     for(size_t i=0; i<mvpMapPoints.size(); i++)
         if(mvpMapPoints[i])
             mvpMapPoints[i]->EraseObservation(this);
+
+    map<KeyFrame*,int> connections;
+    {
+        unique_lock<mutex> lock(mMutexConnections);
+        connections = mConnectedKeyFrameWeights;
+    }
+
+    for(map<KeyFrame*,int>::iterator mit = connections.begin(), mend=connections.end(); mit!=mend; mit++)
+        mit->first->EraseConnection(this);
     {
         unique_lock<mutex> lock(mMutexConnections);
         unique_lock<mutex> lock1(mMutexFeatures);
 
         mConnectedKeyFrameWeights.clear();
         mvpOrderedConnectedKeyFrames.clear();
+        mvOrderedWeights.clear();
+        mbOrderedConnectionsDirty=false;
+
+        // Bad keyframes keep no mappoints, so that culled mappoints can be reclaimed
+        fill(mvpMapPoints.begin(),mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+        mnMapPointsVersion++;
 
         // Update Spanning Tree
         set<KeyFrame*> sParentCandidates;
@@ -552,59 +602,76 @@ bool KeyFrame::isBad()
 
 void KeyFrame::EraseConnection(KeyFrame* pKF)
 {
-    bool bUpdate = false;
+    unique_lock<mutex> lock(mMutexConnections);
+    if(mConnectedKeyFrameWeights.erase(pKF))
+        mbOrderedConnectionsDirty=true;
+}
+
+void KeyFrame::PinFeatures()
+{
+    unique_lock<mutex> lock(mMutexPaging);
+    if(mbFeaturesPagedOut)
     {
-        unique_lock<mutex> lock(mMutexConnections);
-        if(mConnectedKeyFrameWeights.count(pKF))
-        {
-            mConnectedKeyFrameWeights.erase(pKF);
-            bUpdate=true;
-        }
+        // Only keyframes of a map with a pager are evicted
+        mpMap->GetKeyFramePager()->Load(this);
+        mbFeaturesPagedOut = false;
     }
+    mnFeaturePins++;
+    mLastPinned = chrono::steady_clock::now();
+}
 
-    if(bUpdate)
-        UpdateBestCovisibles();
+void KeyFrame::UnpinFeatures()
+{
+    unique_lock<mutex> lock(mMutexPaging);
+    mnFeaturePins--;
 }
 
 vector<size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y, const float &r) const
 {
     vector<size_t> vIndices;
-    vIndices.reserve(N);
+    GetFeaturesInArea(x,y,r,vIndices);
+    return vIndices;
+}
+
+void KeyFrame::GetFeaturesInArea(const float &x, const float &y, const float &r, vector<size_t> &vIndices) const
+{
+    vIndices.clear();
+
+    if(mGridIndices.empty())
+        return;
 
     const int nMinCellX = max(0,(int)floor((x-mnMinX-r)*mfGridElementWidthInv));
     if(nMinCellX>=mnGridCols)
-        return vIndices;
+        return;
 
     const int nMaxCellX = min((int)mnGridCols-1,(int)ceil((x-mnMinX+r)*mfGridElementWidthInv));
     if(nMaxCellX<0)
-        return vIndices;
+        return;
 
     const int nMinCellY = max(0,(int)floor((y-mnMinY-r)*mfGridElementHeightInv));
     if(nMinCellY>=mnGridRows)
-        return vIndices;
+        return;
 
     const int nMaxCellY = min((int)mnGridRows-1,(int)ceil((y-mnMinY+r)*mfGridElementHeightInv));
     if(nMaxCellY<0)
-        return vIndices;
+        return;
 
     for(int ix = nMinCellX; ix<=nMaxCellX; ix++)
     {
         for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
         {
-            const vector<size_t> vCell = mGrid[ix][iy];
-            for(size_t j=0, jend=vCell.size(); j<jend; j++)
+            const int c = ix*mnGridRows+iy;
+            for(int j=mGridStart[c], jend=mGridStart[c+1]; j<jend; j++)
             {
-                const cv::KeyPoint &kpUn = mvKeysUn[vCell[j]];
+                const cv::KeyPoint &kpUn = mvKeysUn[mGridIndices[j]];
                 const float distx = kpUn.pt.x-x;
                 const float disty = kpUn.pt.y-y;
 
                 if(fabs(distx)<r && fabs(disty)<r)
-                    vIndices.push_back(vCell[j]);
+                    vIndices.push_back(mGridIndices[j]);
             }
         }
     }
-
-    return vIndices;
 }
 
 bool KeyFrame::IsInImage(const float &x, const float &y) const
@@ -617,6 +684,7 @@ cv::Mat KeyFrame::UnprojectStereo(int i)
     const float z = mvDepth[i];
     if(z>0)
     {
+        KeyFramePin pin(this);
         const float u = mvKeys[i].pt.x;
         const float v = mvKeys[i].pt.y;
         const float x = (u-cx)*z*invfx;
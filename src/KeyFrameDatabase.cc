@@ -24,6 +24,7 @@
 #include "Thirdparty/DBoW2/DBoW2/BowVector.h"
 
 #include<mutex>
+#include<algorithm>
 
 using namespace std;
 
@@ -31,145 +32,278 @@ namespace ORB_SLAM2
 {
 
 KeyFrameDatabase::KeyFrameDatabase (const ORBVocabulary &voc):
-    mpVoc(&voc)
+    mpVoc(&voc), mnPostings(0), mnErasedPostings(0), mnRelocTopK(0), mfRelocThresholdFactor(1.0f)
 {
     mvInvertedFile.resize(voc.size());
+    mvMaxWeights.resize(voc.size(),0);
+
+    // Tracking, Local Mapping, Loop Closing and Viewer already have their own thread
+    const int nCores = thread::hardware_concurrency();
+    mpThreadPool = new ThreadPool(max(0,min(3,nCores-1)));
+}
+
+KeyFrameDatabase::~KeyFrameDatabase()
+{
+    delete mpThreadPool;
 }
 
 
 void KeyFrameDatabase::add(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutex);
+    unique_lock<mutex> lockWriters(mMutexWriters);
+    unique_lock<SharedMutex> lock(mMutex);
+
+    if(GetIndex(pKF)>=0)
+        return;
 
+    const unsigned int idx = mvpKeyFrames.size();
+    mvpKeyFrames.push_back(pKF);
+    mvnPostings.push_back(pKF->mBowVec.size());
+
+    if(pKF->mnId>=mvKeyFrameIndices.size())
+        mvKeyFrameIndices.resize(pKF->mnId+1,-1);
+    mvKeyFrameIndices[pKF->mnId] = idx;
+
+    // New keyframes get the highest index, so posting lists stay sorted
     for(DBoW2::BowVector::const_iterator vit= pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
-        mvInvertedFile[vit->first].push_back(pKF);
+    {
+        Posting posting;
+        posting.mnIndex = idx;
+        posting.mWeight = vit->second;
+        mvInvertedFile[vit->first].push_back(posting);
+        mvMaxWeights[vit->first] = max(mvMaxWeights[vit->first],posting.mWeight);
+    }
+
+    mnPostings += pKF->mBowVec.size();
 }
 
 void KeyFrameDatabase::erase(KeyFrame* pKF)
 {
-    unique_lock<mutex> lock(mMutex);
+    unique_lock<mutex> lockWriters(mMutexWriters);
 
-    // Erase elements in the Inverse File for the entry
-    for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
     {
-        // List of keyframes that share the word
-        list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+        unique_lock<SharedMutex> lock(mMutex);
 
-        for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+        const int idx = GetIndex(pKF);
+        if(idx<0)
+            return;
+
+        // Leave a tombstone, postings are dropped in the next compaction
+        mvpKeyFrames[idx] = NULL;
+        mvKeyFrameIndices[pKF->mnId] = -1;
+        mnErasedPostings += mvnPostings[idx];
+    }
+
+    if(mnErasedPostings*4>mnPostings)
+        Compact();
+}
+
+void KeyFrameDatabase::clear()
+{
+    unique_lock<mutex> lockWriters(mMutexWriters);
+    unique_lock<SharedMutex> lock(mMutex);
+
+    mvInvertedFile.clear();
+    mvInvertedFile.resize(mpVoc->size());
+    mvMaxWeights.assign(mpVoc->size(),0);
+    mvpKeyFrames.clear();
+    mvnPostings.clear();
+    mvKeyFrameIndices.clear();
+    mnPostings = 0;
+    mnErasedPostings = 0;
+}
+
+int KeyFrameDatabase::GetIndex(KeyFrame* pKF) const
+{
+    if(pKF->mnId>=mvKeyFrameIndices.size())
+        return -1;
+    return mvKeyFrameIndices[pKF->mnId];
+}
+
+void KeyFrameDatabase::Compact()
+{
+    // Only writers modify the index and they are serialized, so it can be read here
+    // without blocking the queries. The new index is built aside and swapped at the end.
+
+    // Old compact index -> new compact index, keeping the relative order
+    const int nErased = -1;
+    vector<int> vNewIndices(mvpKeyFrames.size(),nErased);
+    vector<KeyFrame*> vpKeyFrames;
+    vector<unsigned int> vnPostings;
+    vpKeyFrames.reserve(mvpKeyFrames.size());
+    vnPostings.reserve(mvpKeyFrames.size());
+    for(size_t i=0; i<mvpKeyFrames.size(); i++)
+    {
+        if(!mvpKeyFrames[i])
+            continue;
+        vNewIndices[i] = vpKeyFrames.size();
+        vpKeyFrames.push_back(mvpKeyFrames[i]);
+        vnPostings.push_back(mvnPostings[i]);
+    }
+
+    // Upper bounds are also tightened, erased keyframes could hold the maximum weight
+    vector<vector<Posting> > vInvertedFile(mvInvertedFile.size());
+    vector<float> vMaxWeights(mvInvertedFile.size(),0);
+    for(size_t w=0; w<mvInvertedFile.size(); w++)
+    {
+        const vector<Posting> &vPostings = mvInvertedFile[w];
+        vector<Posting> &vNewPostings = vInvertedFile[w];
+        vNewPostings.reserve(vPostings.size());
+        for(size_t i=0; i<vPostings.size(); i++)
         {
-            if(pKF==*lit)
+            const int newIdx = vNewIndices[vPostings[i].mnIndex];
+            if(newIdx!=nErased)
             {
-                lKFs.erase(lit);
-                break;
+                vNewPostings.push_back(vPostings[i]);
+                vNewPostings.back().mnIndex = newIdx;
+                vMaxWeights[w] = max(vMaxWeights[w],vPostings[i].mWeight);
             }
         }
     }
+
+    unique_lock<SharedMutex> lock(mMutex);
+
+    mvInvertedFile.swap(vInvertedFile);
+    mvMaxWeights.swap(vMaxWeights);
+    mvpKeyFrames.swap(vpKeyFrames);
+    mvnPostings.swap(vnPostings);
+    for(size_t i=0; i<mvpKeyFrames.size(); i++)
+        mvKeyFrameIndices[mvpKeyFrames[i]->mnId] = i;
+
+    mnPostings -= mnErasedPostings;
+    mnErasedPostings = 0;
 }
 
-void KeyFrameDatabase::clear()
+ThreadPool* KeyFrameDatabase::GetThreadPool()
 {
-    mvInvertedFile.clear();
-    mvInvertedFile.resize(mpVoc->size());
+    return mpThreadPool;
+}
+
+void KeyFrameDatabase::ForEachCandidate(const size_t n, const std::function<void(size_t)> &f)
+{
+    // Below this size splitting the work costs more than it saves
+    const size_t nMinParallel = 32;
+
+    if(n<nMinParallel)
+    {
+        for(size_t i=0; i<n; i++)
+            f(i);
+    }
+    else
+        mpThreadPool->ParallelFor(n,f);
 }
 
 
 vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float minScore)
 {
     set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
-    list<KeyFrame*> lKFsSharingWords;
+
+    SharedLock lock(mMutex);
+
+    // Query-local counters indexed by compact index
+    const size_t N = mvpKeyFrames.size();
+    vector<unsigned int> vnCommonWords(N,0);
+    vector<unsigned int> vSharingWords;
 
     // Search all keyframes that share a word with current keyframes
-    // Discard keyframes connected to the query keyframe
+    for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
     {
-        unique_lock<mutex> lock(mMutex);
+        const vector<Posting> &vPostings = mvInvertedFile[vit->first];
 
-        for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
+        for(size_t i=0, iend=vPostings.size(); i<iend; i++)
         {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
-
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
-            {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnLoopQuery!=pKF->mnId)
-                {
-                    pKFi->mnLoopWords=0;
-                    if(!spConnectedKeyFrames.count(pKFi))
-                    {
-                        pKFi->mnLoopQuery=pKF->mnId;
-                        lKFsSharingWords.push_back(pKFi);
-                    }
-                }
-                pKFi->mnLoopWords++;
-            }
+            const unsigned int idx = vPostings[i].mnIndex;
+            if(vnCommonWords[idx]==0)
+                vSharingWords.push_back(idx);
+            vnCommonWords[idx]++;
         }
     }
 
-    if(lKFsSharingWords.empty())
-        return vector<KeyFrame*>();
+    // Discard erased keyframes and keyframes connected to the query keyframe
+    size_t nSharing = 0;
+    for(size_t i=0; i<vSharingWords.size(); i++)
+    {
+        KeyFrame* pKFi = mvpKeyFrames[vSharingWords[i]];
+        if(pKFi && pKFi!=pKF && !spConnectedKeyFrames.count(pKFi))
+            vSharingWords[nSharing++] = vSharingWords[i];
+    }
+    vSharingWords.resize(nSharing);
 
-    list<pair<float,KeyFrame*> > lScoreAndMatch;
+    if(vSharingWords.empty())
+        return vector<KeyFrame*>();
 
     // Only compare against those keyframes that share enough words
-    int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    unsigned int maxCommonWords=0;
+    for(size_t i=0; i<vSharingWords.size(); i++)
     {
-        if((*lit)->mnLoopWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnLoopWords;
+        if(vnCommonWords[vSharingWords[i]]>maxCommonWords)
+            maxCommonWords=vnCommonWords[vSharingWords[i]];
     }
 
-    int minCommonWords = maxCommonWords*0.8f;
+    const unsigned int minCommonWords = maxCommonWords*0.8f;
 
-    int nscores=0;
-
-    // Compute similarity score. Retain the matches whose score is higher than minScore
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    vector<unsigned int> vToScore;
+    vToScore.reserve(vSharingWords.size());
+    for(size_t i=0; i<vSharingWords.size(); i++)
     {
-        KeyFrame* pKFi = *lit;
-
-        if(pKFi->mnLoopWords>minCommonWords)
-        {
-            nscores++;
+        if(vnCommonWords[vSharingWords[i]]>minCommonWords)
+            vToScore.push_back(vSharingWords[i]);
+    }
 
-            float si = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
+    // Compute similarity score (negative if not compared)
+    vector<float> vScores(N,-1.0f);
+    ForEachCandidate(vToScore.size(), [&](size_t i)
+    {
+        const unsigned int idx = vToScore[i];
+        vScores[idx] = mpVoc->score(pKF->mBowVec,mvpKeyFrames[idx]->mBowVec);
+    });
 
-            pKFi->mLoopScore = si;
-            if(si>=minScore)
-                lScoreAndMatch.push_back(make_pair(si,pKFi));
-        }
+    // Retain the matches whose score is higher than minScore
+    vector<pair<float,KeyFrame*> > vScoreAndMatch;
+    for(size_t i=0; i<vToScore.size(); i++)
+    {
+        const unsigned int idx = vToScore[i];
+        if(vScores[idx]>=minScore)
+            vScoreAndMatch.push_back(make_pair(vScores[idx],mvpKeyFrames[idx]));
     }
 
-    if(lScoreAndMatch.empty())
+    if(vScoreAndMatch.empty())
         return vector<KeyFrame*>();
 
-    list<pair<float,KeyFrame*> > lAccScoreAndMatch;
-    float bestAccScore = minScore;
+    vector<pair<float,KeyFrame*> > vAccScoreAndMatch(vScoreAndMatch.size());
 
     // Lets now accumulate score by covisibility
-    for(list<pair<float,KeyFrame*> >::iterator it=lScoreAndMatch.begin(), itend=lScoreAndMatch.end(); it!=itend; it++)
+    ForEachCandidate(vScoreAndMatch.size(), [&](size_t i)
     {
-        KeyFrame* pKFi = it->second;
+        KeyFrame* pKFi = vScoreAndMatch[i].second;
         vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
 
-        float bestScore = it->first;
-        float accScore = it->first;
+        float bestScore = vScoreAndMatch[i].first;
+        float accScore = bestScore;
         KeyFrame* pBestKF = pKFi;
         for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
         {
             KeyFrame* pKF2 = *vit;
-            if(pKF2->mnLoopQuery==pKF->mnId && pKF2->mnLoopWords>minCommonWords)
+            const int idx2 = GetIndex(pKF2);
+            if(idx2<0 || vScores[idx2]<0)
+                continue;
+
+            accScore+=vScores[idx2];
+            if(vScores[idx2]>bestScore)
             {
-                accScore+=pKF2->mLoopScore;
-                if(pKF2->mLoopScore>bestScore)
-                {
-                    pBestKF=pKF2;
-                    bestScore = pKF2->mLoopScore;
-                }
+                pBestKF=pKF2;
+                bestScore = vScores[idx2];
             }
         }
 
-        lAccScoreAndMatch.push_back(make_pair(accScore,pBestKF));
-        if(accScore>bestAccScore)
-            bestAccScore=accScore;
+        vAccScoreAndMatch[i] = make_pair(accScore,pBestKF);
+    });
+
+    float bestAccScore = minScore;
+    for(size_t i=0; i<vAccScoreAndMatch.size(); i++)
+    {
+        if(vAccScoreAndMatch[i].first>bestAccScore)
+            bestAccScore=vAccScoreAndMatch[i].first;
     }
 
     // Return all those keyframes with a score higher than 0.75*bestScore
@@ -177,13 +311,13 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
 
     set<KeyFrame*> spAlreadyAddedKF;
     vector<KeyFrame*> vpLoopCandidates;
-    vpLoopCandidates.reserve(lAccScoreAndMatch.size());
+    vpLoopCandidates.reserve(vAccScoreAndMatch.size());
 
-    for(list<pair<float,KeyFrame*> >::iterator it=lAccScoreAndMatch.begin(), itend=lAccScoreAndMatch.end(); it!=itend; it++)
+    for(size_t i=0; i<vAccScoreAndMatch.size(); i++)
     {
-        if(it->first>minScoreToRetain)
+        if(vAccScoreAndMatch[i].first>minScoreToRetain)
         {
-            KeyFrame* pKFi = it->second;
+            KeyFrame* pKFi = vAccScoreAndMatch[i].second;
             if(!spAlreadyAddedKF.count(pKFi))
             {
                 vpLoopCandidates.push_back(pKFi);
@@ -198,105 +332,295 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
 
 vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F)
 {
-    list<KeyFrame*> lKFsSharingWords;
+    if(mnRelocTopK>0)
+        return DetectRelocalizationCandidatesTopK(F);
+
+    SharedLock lock(mMutex);
+
+    // Query-local counters indexed by compact index
+    const size_t N = mvpKeyFrames.size();
+    vector<unsigned int> vnCommonWords(N,0);
+    vector<unsigned int> vSharingWords;
 
     // Search all keyframes that share a word with current frame
+    for(DBoW2::BowVector::const_iterator vit=F->mBowVec.begin(), vend=F->mBowVec.end(); vit != vend; vit++)
+    {
+        const vector<Posting> &vPostings = mvInvertedFile[vit->first];
+
+        for(size_t i=0, iend=vPostings.size(); i<iend; i++)
+        {
+            const unsigned int idx = vPostings[i].mnIndex;
+            if(vnCommonWords[idx]==0)
+                vSharingWords.push_back(idx);
+            vnCommonWords[idx]++;
+        }
+    }
+
+    // Discard erased keyframes
+    size_t nSharing = 0;
+    for(size_t i=0; i<vSharingWords.size(); i++)
+    {
+        if(mvpKeyFrames[vSharingWords[i]])
+            vSharingWords[nSharing++] = vSharingWords[i];
+    }
+    vSharingWords.resize(nSharing);
+
+    if(vSharingWords.empty())
+        return vector<KeyFrame*>();
+
+    // Only compare against those keyframes that share enough words
+    unsigned int maxCommonWords=0;
+    for(size_t i=0; i<vSharingWords.size(); i++)
+    {
+        if(vnCommonWords[vSharingWords[i]]>maxCommonWords)
+            maxCommonWords=vnCommonWords[vSharingWords[i]];
+    }
+
+    const unsigned int minCommonWords = maxCommonWords*0.8f;
+
+    vector<unsigned int> vToScore;
+    vToScore.reserve(vSharingWords.size());
+    for(size_t i=0; i<vSharingWords.size(); i++)
+    {
+        if(vnCommonWords[vSharingWords[i]]>minCommonWords)
+            vToScore.push_back(vSharingWords[i]);
+    }
+
+    // Compute similarity score (negative if not compared)
+    vector<float> vScores(N,-1.0f);
+    ForEachCandidate(vToScore.size(), [&](size_t i)
+    {
+        const unsigned int idx = vToScore[i];
+        vScores[idx] = mpVoc->score(F->mBowVec,mvpKeyFrames[idx]->mBowVec);
+    });
+
+    vector<pair<float,KeyFrame*> > vScoreAndMatch;
+    vScoreAndMatch.reserve(vToScore.size());
+    for(size_t i=0; i<vToScore.size(); i++)
+        vScoreAndMatch.push_back(make_pair(vScores[vToScore[i]],mvpKeyFrames[vToScore[i]]));
+
+    if(vScoreAndMatch.empty())
+        return vector<KeyFrame*>();
+
+    vector<pair<float,KeyFrame*> > vAccScoreAndMatch(vScoreAndMatch.size());
+
+    // Lets now accumulate score by covisibility
+    ForEachCandidate(vScoreAndMatch.size(), [&](size_t i)
     {
-        unique_lock<mutex> lock(mMutex);
+        KeyFrame* pKFi = vScoreAndMatch[i].second;
+        vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
 
-        for(DBoW2::BowVector::const_iterator vit=F->mBowVec.begin(), vend=F->mBowVec.end(); vit != vend; vit++)
+        float bestScore = vScoreAndMatch[i].first;
+        float accScore = bestScore;
+        KeyFrame* pBestKF = pKFi;
+        for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
         {
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
+            KeyFrame* pKF2 = *vit;
+            const int idx2 = GetIndex(pKF2);
+            if(idx2<0 || vScores[idx2]<0)
+                continue;
 
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+            accScore+=vScores[idx2];
+            if(vScores[idx2]>bestScore)
             {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnRelocQuery!=F->mnId)
-                {
-                    pKFi->mnRelocWords=0;
-                    pKFi->mnRelocQuery=F->mnId;
-                    lKFsSharingWords.push_back(pKFi);
-                }
-                pKFi->mnRelocWords++;
+                pBestKF=pKF2;
+                bestScore = vScores[idx2];
             }
+
         }
+        vAccScoreAndMatch[i] = make_pair(accScore,pBestKF);
+    });
+
+    float bestAccScore = 0;
+    for(size_t i=0; i<vAccScoreAndMatch.size(); i++)
+    {
+        if(vAccScoreAndMatch[i].first>bestAccScore)
+            bestAccScore=vAccScoreAndMatch[i].first;
     }
-    if(lKFsSharingWords.empty())
-        return vector<KeyFrame*>();
 
-    // Only compare against those keyframes that share enough words
-    int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    // Return all those keyframes with a score higher than 0.75*bestScore
+    float minScoreToRetain = 0.75f*bestAccScore;
+    set<KeyFrame*> spAlreadyAddedKF;
+    vector<KeyFrame*> vpRelocCandidates;
+    vpRelocCandidates.reserve(vAccScoreAndMatch.size());
+    for(size_t i=0; i<vAccScoreAndMatch.size(); i++)
     {
-        if((*lit)->mnRelocWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnRelocWords;
+        const float &si = vAccScoreAndMatch[i].first;
+        if(si>minScoreToRetain)
+        {
+            KeyFrame* pKFi = vAccScoreAndMatch[i].second;
+            if(!spAlreadyAddedKF.count(pKFi))
+            {
+                vpRelocCandidates.push_back(pKFi);
+                spAlreadyAddedKF.insert(pKFi);
+            }
+        }
     }
 
-    int minCommonWords = maxCommonWords*0.8f;
+    return vpRelocCandidates;
+}
 
-    list<pair<float,KeyFrame*> > lScoreAndMatch;
+void KeyFrameDatabase::SetRelocalizationRetrieval(const int nTopK, const float fThresholdFactor)
+{
+    unique_lock<mutex> lockWriters(mMutexWriters);
+    unique_lock<SharedMutex> lock(mMutex);
 
-    int nscores=0;
+    // Scores are accumulated from the postings as sum(min(v_i,w_i)), which is the L1 score
+    if(nTopK>0 && mpVoc->getScoringType()!=DBoW2::L1_NORM)
+    {
+        cerr << "Top-k relocalization retrieval needs a vocabulary with L1 scoring, using exhaustive search." << endl;
+        mnRelocTopK = 0;
+        return;
+    }
 
-    // Compute similarity score.
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    mnRelocTopK = max(0,nTopK);
+    mfRelocThresholdFactor = max(1.0f,fThresholdFactor);
+}
+
+vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidatesTopK(Frame *F)
+{
+    SharedLock lock(mMutex);
+
+    const size_t N = mvpKeyFrames.size();
+    const size_t K = mnRelocTopK;
+
+    // Query words sorted by the maximum score they can contribute
+    vector<pair<float,pair<unsigned int,float> > > vTerms;
+    vTerms.reserve(F->mBowVec.size());
+    for(DBoW2::BowVector::const_iterator vit=F->mBowVec.begin(), vend=F->mBowVec.end(); vit != vend; vit++)
     {
-        KeyFrame* pKFi = *lit;
+        if(mvInvertedFile[vit->first].empty())
+            continue;
+        const float ub = min((float)vit->second,mvMaxWeights[vit->first]);
+        vTerms.push_back(make_pair(ub,make_pair(vit->first,(float)vit->second)));
+    }
+    sort(vTerms.begin(),vTerms.end(),greater<pair<float,pair<unsigned int,float> > >());
+
+    // vRemaining[j]: maximum score a keyframe can still get from words j..end
+    vector<float> vRemaining(vTerms.size()+1,0);
+    for(int j=vTerms.size()-1; j>=0; j--)
+        vRemaining[j] = vRemaining[j+1]+vTerms[j].first;
+
+    // Query-local accumulators indexed by compact index. State: 0 unseen, 1 candidate, 2 erased
+    vector<float> vScores(N,0);
+    vector<char> vState(N,0);
+    vector<unsigned int> vCandidates;
+    vector<float> vPartial;
+
+    // Once the best possible score of an unseen keyframe is below the k-th best partial score,
+    // no new keyframe can enter the top k. Remaining words are skipped and the survivors rescored.
+    const size_t nCheckPeriod = 16;
+    float theta = 0;
+    size_t j=0;
+    for(; j<vTerms.size(); j++)
+    {
+        if(j%nCheckPeriod==0 && vCandidates.size()>=K)
+        {
+            vPartial.resize(vCandidates.size());
+            for(size_t i=0; i<vCandidates.size(); i++)
+                vPartial[i] = vScores[vCandidates[i]];
+            nth_element(vPartial.begin(),vPartial.begin()+(K-1),vPartial.end(),greater<float>());
+            theta = vPartial[K-1];
+
+            if(vRemaining[j]<=mfRelocThresholdFactor*theta)
+                break;
+        }
 
-        if(pKFi->mnRelocWords>minCommonWords)
+        const vector<Posting> &vPostings = mvInvertedFile[vTerms[j].second.first];
+        const float qw = vTerms[j].second.second;
+        for(size_t i=0, iend=vPostings.size(); i<iend; i++)
         {
-            nscores++;
-            float si = mpVoc->score(F->mBowVec,pKFi->mBowVec);
-            pKFi->mRelocScore=si;
-            lScoreAndMatch.push_back(make_pair(si,pKFi));
+            const unsigned int idx = vPostings[i].mnIndex;
+            if(vState[idx]==0)
+            {
+                vState[idx] = mvpKeyFrames[idx] ? 1 : 2;
+                if(vState[idx]==1)
+                    vCandidates.push_back(idx);
+            }
+            if(vState[idx]==1)
+                vScores[idx] += min(qw,vPostings[i].mWeight);
         }
     }
 
-    if(lScoreAndMatch.empty())
+    if(vCandidates.empty())
         return vector<KeyFrame*>();
 
-    list<pair<float,KeyFrame*> > lAccScoreAndMatch;
-    float bestAccScore = 0;
+    // Keep the candidates that can still reach the top k and complete their score
+    const bool bComplete = j==vTerms.size();
+    vector<unsigned int> vSurvivors;
+    vSurvivors.reserve(vCandidates.size());
+    for(size_t i=0; i<vCandidates.size(); i++)
+    {
+        if(bComplete || vScores[vCandidates[i]]+vRemaining[j]>=theta)
+            vSurvivors.push_back(vCandidates[i]);
+    }
 
-    // Lets now accumulate score by covisibility
-    for(list<pair<float,KeyFrame*> >::iterator it=lScoreAndMatch.begin(), itend=lScoreAndMatch.end(); it!=itend; it++)
+    if(!bComplete)
     {
-        KeyFrame* pKFi = it->second;
+        ForEachCandidate(vSurvivors.size(), [&](size_t i)
+        {
+            const unsigned int idx = vSurvivors[i];
+            vScores[idx] = mpVoc->score(F->mBowVec,mvpKeyFrames[idx]->mBowVec);
+        });
+    }
+
+    vector<pair<float,unsigned int> > vScoreAndIndex;
+    vScoreAndIndex.reserve(vSurvivors.size());
+    for(size_t i=0; i<vSurvivors.size(); i++)
+        vScoreAndIndex.push_back(make_pair(vScores[vSurvivors[i]],vSurvivors[i]));
+
+    const size_t nTop = min(K,vScoreAndIndex.size());
+    partial_sort(vScoreAndIndex.begin(),vScoreAndIndex.begin()+nTop,vScoreAndIndex.end(),greater<pair<float,unsigned int> >());
+    vScoreAndIndex.resize(nTop);
+
+    // Only the top k are considered when accumulating by covisibility
+    vector<float> vTopScores(N,-1.0f);
+    for(size_t i=0; i<nTop; i++)
+        vTopScores[vScoreAndIndex[i].second] = vScoreAndIndex[i].first;
+
+    vector<pair<float,KeyFrame*> > vAccScoreAndMatch(nTop);
+    ForEachCandidate(nTop, [&](size_t i)
+    {
+        KeyFrame* pKFi = mvpKeyFrames[vScoreAndIndex[i].second];
         vector<KeyFrame*> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
 
-        float bestScore = it->first;
+        float bestScore = vScoreAndIndex[i].first;
         float accScore = bestScore;
         KeyFrame* pBestKF = pKFi;
         for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
         {
             KeyFrame* pKF2 = *vit;
-            if(pKF2->mnRelocQuery!=F->mnId)
+            const int idx2 = GetIndex(pKF2);
+            if(idx2<0 || vTopScores[idx2]<0)
                 continue;
 
-            accScore+=pKF2->mRelocScore;
-            if(pKF2->mRelocScore>bestScore)
+            accScore+=vTopScores[idx2];
+            if(vTopScores[idx2]>bestScore)
             {
                 pBestKF=pKF2;
-                bestScore = pKF2->mRelocScore;
+                bestScore = vTopScores[idx2];
             }
-
         }
-        lAccScoreAndMatch.push_back(make_pair(accScore,pBestKF));
-        if(accScore>bestAccScore)
-            bestAccScore=accScore;
+        vAccScoreAndMatch[i] = make_pair(accScore,pBestKF);
+    });
+
+    float bestAccScore = 0;
+    for(size_t i=0; i<vAccScoreAndMatch.size(); i++)
+    {
+        if(vAccScoreAndMatch[i].first>bestAccScore)
+            bestAccScore=vAccScoreAndMatch[i].first;
     }
 
     // Return all those keyframes with a score higher than 0.75*bestScore
     float minScoreToRetain = 0.75f*bestAccScore;
     set<KeyFrame*> spAlreadyAddedKF;
     vector<KeyFrame*> vpRelocCandidates;
-    vpRelocCandidates.reserve(lAccScoreAndMatch.size());
-    for(list<pair<float,KeyFrame*> >::iterator it=lAccScoreAndMatch.begin(), itend=lAccScoreAndMatch.end(); it!=itend; it++)
+    vpRelocCandidates.reserve(vAccScoreAndMatch.size());
+    for(size_t i=0; i<vAccScoreAndMatch.size(); i++)
     {
-        const float &si = it->first;
-        if(si>minScoreToRetain)
+        if(vAccScoreAndMatch[i].first>minScoreToRetain)
         {
-            KeyFrame* pKFi = it->second;
+            KeyFrame* pKFi = vAccScoreAndMatch[i].second;
             if(!spAlreadyAddedKF.count(pKFi))
             {
                 vpRelocCandidates.push_back(pKFi);
@@ -0,0 +1,433 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "KeyFramePager.h"
+#include "KeyFrame.h"
+#include "MapSerializer.h"
+
+#include <stdint.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cfloat>
+#include <chrono>
+#include <algorithm>
+
+#include<mutex>
+
+namespace ORB_SLAM2
+{
+
+// Keyframes used less than this ago are not evicted (seconds)
+static const double PAGER_GRACE_PERIOD = 1.0;
+
+// The most recent keyframes are still processed by Local Mapping and Loop Closing
+static const unsigned long PAGER_RECENT_KEYFRAMES = 20;
+
+KeyFramePager::KeyFramePager(const string &filename, const int nMaxResident):
+    mbFinishRequested(false), mbFinished(false), mFilename(filename), mnMaxResident(nMaxResident),
+    mpReferenceKF(static_cast<KeyFrame*>(NULL)), mnFileEnd(0)
+{
+    mFile.open(filename.c_str(), ios::in | ios::out | ios::binary | ios::trunc);
+}
+
+KeyFramePager::~KeyFramePager()
+{
+    mFile.close();
+    remove(mFilename.c_str());
+}
+
+bool KeyFramePager::IsOpen()
+{
+    return mFile.is_open() && mFile.good();
+}
+
+void KeyFramePager::Run()
+{
+    int nCycle = 0;
+
+    while(1)
+    {
+        {
+            unique_lock<mutex> lock(mMutexPass);
+            AddNewKeyFrames();
+            LoadPrefetched();
+
+            // Eviction every 100ms, prefetching every 5ms
+            if(++nCycle>=20)
+            {
+                EvictKeyFrames();
+                nCycle = 0;
+            }
+        }
+
+        if(CheckFinish())
+            break;
+
+        usleep(5000);
+    }
+
+    SetFinish();
+}
+
+void KeyFramePager::RequestFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mbFinishRequested = true;
+}
+
+bool KeyFramePager::CheckFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinishRequested;
+}
+
+void KeyFramePager::SetFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mbFinished = true;
+}
+
+bool KeyFramePager::isFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+void KeyFramePager::AddKeyFrame(KeyFrame *pKF)
+{
+    unique_lock<mutex> lock(mMutexInput);
+    mvpNewKeyFrames.push_back(pKF);
+}
+
+void KeyFramePager::Clear()
+{
+    // Waits for the current pass, so the pager holds no keyframe afterwards
+    unique_lock<mutex> lock(mMutexPass);
+    unique_lock<mutex> lock2(mMutexInput);
+    mvpKeyFrames.clear();
+    mvpNewKeyFrames.clear();
+    mvpPrefetch.clear();
+    mpReferenceKF = static_cast<KeyFrame*>(NULL);
+
+    // No page is read anymore
+    unique_lock<mutex> lock3(mMutexFile);
+    mFile.close();
+    mFile.open(mFilename.c_str(), ios::in | ios::out | ios::binary | ios::trunc);
+    mnFileEnd = 0;
+    mmFreePages.clear();
+}
+
+void KeyFramePager::SetReferenceKeyFrame(KeyFrame *pKF)
+{
+    unique_lock<mutex> lock(mMutexInput);
+    mpReferenceKF = pKF;
+}
+
+void KeyFramePager::Prefetch(const vector<KeyFrame*> &vpKFs)
+{
+    unique_lock<mutex> lock(mMutexInput);
+    mvpPrefetch.insert(mvpPrefetch.end(),vpKFs.begin(),vpKFs.end());
+}
+
+void KeyFramePager::AddNewKeyFrames()
+{
+    unique_lock<mutex> lock(mMutexInput);
+    mvpKeyFrames.insert(mvpKeyFrames.end(),mvpNewKeyFrames.begin(),mvpNewKeyFrames.end());
+    mvpNewKeyFrames.clear();
+}
+
+void KeyFramePager::LoadPrefetched()
+{
+    vector<KeyFrame*> vpKFs;
+    {
+        unique_lock<mutex> lock(mMutexInput);
+        vpKFs.swap(mvpPrefetch);
+    }
+
+    // Pinning reads back evicted keyframes
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        vpKFs[i]->PinFeatures();
+        vpKFs[i]->UnpinFeatures();
+    }
+}
+
+void KeyFramePager::EvictKeyFrames()
+{
+    // Bad keyframes are not matched anymore, once evicted they leave the list
+    int nResident = 0;
+    unsigned long nMaxId = 0;
+    size_t nKept = 0;
+    for(size_t i=0; i<mvpKeyFrames.size(); i++)
+    {
+        KeyFrame* pKF = mvpKeyFrames[i];
+        nMaxId = max(nMaxId,pKF->mnId);
+
+        const bool bBad = pKF->isBad();
+        if(bBad)
+            Evict(pKF);
+
+        bool bPagedOut;
+        {
+            unique_lock<mutex> lock(pKF->mMutexPaging);
+            bPagedOut = pKF->mbFeaturesPagedOut;
+        }
+
+        if(bPagedOut && bBad)
+        {
+            FreePage(pKF);
+            continue;
+        }
+
+        if(!bPagedOut)
+            nResident++;
+
+        mvpKeyFrames[nKept++] = pKF;
+    }
+    mvpKeyFrames.resize(nKept);
+
+    if(nResident<=mnMaxResident)
+        return;
+
+    KeyFrame* pRefKF;
+    {
+        unique_lock<mutex> lock(mMutexInput);
+        pRefKF = mpReferenceKF;
+    }
+
+    // The local map of the tracking stays in memory
+    set<KeyFrame*> spProtected;
+    cv::Mat Ow;
+    if(pRefKF)
+    {
+        vector<KeyFrame*> vpCovisibles = pRefKF->GetVectorCovisibleKeyFrames();
+        spProtected.insert(vpCovisibles.begin(),vpCovisibles.end());
+        spProtected.insert(pRefKF);
+        Ow = pRefKF->GetCameraCenter();
+    }
+
+    const chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+    // Bad keyframes that were pinned first, then the farthest (or the least recently used without reference)
+    vector<pair<double,KeyFrame*> > vCandidates;
+    vCandidates.reserve(mvpKeyFrames.size());
+    for(size_t i=0; i<mvpKeyFrames.size(); i++)
+    {
+        KeyFrame* pKF = mvpKeyFrames[i];
+        if(pKF->mnId+PAGER_RECENT_KEYFRAMES>nMaxId || spProtected.count(pKF))
+            continue;
+
+        double age;
+        {
+            unique_lock<mutex> lock(pKF->mMutexPaging);
+            if(pKF->mbFeaturesPagedOut)
+                continue;
+            age = chrono::duration_cast<chrono::duration<double> >(now-pKF->mLastPinned).count();
+        }
+
+        if(age<PAGER_GRACE_PERIOD)
+            continue;
+
+        double score;
+        if(pKF->isBad())
+            score = DBL_MAX;
+        else if(!Ow.empty())
+            score = cv::norm(pKF->GetCameraCenter()-Ow);
+        else
+            score = age;
+
+        vCandidates.push_back(make_pair(score,pKF));
+    }
+
+    sort(vCandidates.begin(),vCandidates.end());
+
+    for(vector<pair<double,KeyFrame*> >::reverse_iterator rit=vCandidates.rbegin(); rit!=vCandidates.rend() && nResident>mnMaxResident; rit++)
+    {
+        if(Evict(rit->second))
+            nResident--;
+    }
+}
+
+bool KeyFramePager::Evict(KeyFrame *pKF)
+{
+    unique_lock<mutex> lock(pKF->mMutexPaging);
+    if(pKF->mnFeaturePins>0 || pKF->mbFeaturesPagedOut)
+        return false;
+
+    // The data does not change once the keyframe is in the map, so it is written only once
+    if(pKF->mnPageOffset<0)
+    {
+        MapSerializer::Writer w;
+        const cv::Mat &D = pKF->mDescriptors;
+        w.Put<int32_t>(D.rows);
+        w.Put<int32_t>(D.cols);
+        for(int i=0; i<D.rows; i++)
+            w.PutArray(D.ptr<unsigned char>(i),D.cols);
+
+        w.Put<uint32_t>(pKF->mFeatVec.size());
+        for(DBoW2::FeatureVector::const_iterator fit=pKF->mFeatVec.begin(), fend=pKF->mFeatVec.end(); fit!=fend; fit++)
+        {
+            w.Put<uint32_t>(fit->first);
+            w.Put<uint32_t>(fit->second.size());
+            w.PutArray(fit->second.data(),fit->second.size());
+        }
+
+        // Without distortion the keypoints share the buffer of the undistorted ones and stay
+        const bool bKeys = pKF->mvKeys.data()!=pKF->mvKeysUn.data();
+        w.Put<uint32_t>(bKeys ? pKF->mvKeys.size() : 0);
+        if(bKeys)
+            MapSerializer::WriteKeyPoints(w,pKF->mvKeys);
+
+        unique_lock<mutex> lock2(mMutexFile);
+        const uint32_t nSize = w.Size();
+        long long nCapacity;
+        const long long nOffset = AllocatePage(sizeof(nSize)+nSize,nCapacity);
+        mFile.seekp(nOffset);
+        mFile.write(reinterpret_cast<const char*>(&nSize),sizeof(nSize));
+        mFile.write(w.mvBuffer.data(),nSize);
+        mFile.flush();
+        if(!mFile.good())
+        {
+            cerr << "Error writing the keyframe paging file, keyframes are kept in memory." << endl;
+            mFile.clear();
+            mmFreePages.insert(make_pair(nCapacity,nOffset));
+            return false;
+        }
+
+        pKF->mnPageOffset = nOffset;
+        pKF->mnPageCapacity = nCapacity;
+    }
+
+    if(pKF->mvKeys.data()!=pKF->mvKeysUn.data())
+        pKF->mvKeys.release();
+    pKF->mDescriptors.release();
+    pKF->mFeatVec.clear();
+    pKF->mGridStart.release();
+    pKF->mGridIndices.release();
+    pKF->mbFeaturesPagedOut = true;
+
+    return true;
+}
+
+void KeyFramePager::Load(KeyFrame *pKF)
+{
+    vector<char> vBuffer;
+    if(pKF->mnPageOffset>=0)
+    {
+        unique_lock<mutex> lock(mMutexFile);
+        uint32_t nSize = 0;
+        mFile.seekg(pKF->mnPageOffset);
+        mFile.read(reinterpret_cast<char*>(&nSize),sizeof(nSize));
+        vBuffer.resize(nSize);
+        mFile.read(vBuffer.data(),nSize);
+        if(!mFile.good())
+        {
+            mFile.clear();
+            vBuffer.clear();
+        }
+    }
+
+    MapSerializer::Reader r(vBuffer.data(),vBuffer.size());
+    const int nRows = r.Get<int32_t>();
+    const int nCols = r.Get<int32_t>();
+    const char* pDesc = r.GetArray(max(nRows,0)*max(nCols,0));
+
+    if(!r.Failed() && nRows==pKF->N)
+        pKF->mDescriptors = cv::Mat(nRows,nCols,CV_8U,const_cast<char*>(pDesc)).clone();
+
+    const unsigned int nNodes = r.Get<uint32_t>();
+    for(unsigned int i=0; i<nNodes && !r.Failed(); i++)
+    {
+        const DBoW2::NodeId nodeId = r.Get<uint32_t>();
+        const unsigned int nFeatures = r.Get<uint32_t>();
+        const char* pFeatures = r.GetArray(nFeatures*sizeof(uint32_t));
+        if(!pFeatures)
+            break;
+        vector<unsigned int> vFeatures(nFeatures);
+        memcpy(vFeatures.data(),pFeatures,nFeatures*sizeof(uint32_t));
+        pKF->mFeatVec.insert(pKF->mFeatVec.end(),make_pair(nodeId,vFeatures));
+    }
+
+    const unsigned int nKeys = r.Get<uint32_t>();
+    if(nKeys>0 && !r.Failed())
+    {
+        vector<cv::KeyPoint> vKeys;
+        MapSerializer::ReadKeyPoints(r,nKeys,vKeys);
+        if(vKeys.size()==static_cast<size_t>(pKF->N))
+            pKF->mvKeys.Mutable().swap(vKeys);
+    }
+
+    // Without its data the keyframe gets no matches, but it stays consistent
+    if(r.Failed() || pKF->mDescriptors.empty())
+    {
+        cerr << "Error reading keyframe " << pKF->mnId << " from the paging file." << endl;
+        pKF->mFeatVec.clear();
+    }
+
+    // The undistorted keypoints stand in for the distorted ones if these could not be read
+    if(pKF->mvKeys.size()!=static_cast<size_t>(pKF->N))
+        pKF->mvKeys = pKF->mvKeysUn;
+
+    ResetGrid(pKF);
+}
+
+long long KeyFramePager::AllocatePage(const long long nSize, long long &nCapacity)
+{
+    multimap<long long,long long>::iterator mit = mmFreePages.lower_bound(nSize);
+    if(mit!=mmFreePages.end())
+    {
+        nCapacity = mit->first;
+        const long long nOffset = mit->second;
+        mmFreePages.erase(mit);
+        return nOffset;
+    }
+
+    nCapacity = nSize;
+    const long long nOffset = mnFileEnd;
+    mnFileEnd += nSize;
+    return nOffset;
+}
+
+void KeyFramePager::FreePage(KeyFrame *pKF)
+{
+    unique_lock<mutex> lock(pKF->mMutexPaging);
+    if(!pKF->mbFeaturesPagedOut || pKF->mnPageOffset<0)
+        return;
+
+    unique_lock<mutex> lock2(mMutexFile);
+    mmFreePages.insert(make_pair(pKF->mnPageCapacity,pKF->mnPageOffset));
+    pKF->mnPageOffset = -1;
+    pKF->mnPageCapacity = 0;
+}
+
+void KeyFramePager::ResetGrid(KeyFrame *pKF)
+{
+    pKF->mGridStart.clear();
+    pKF->mGridIndices.clear();
+
+    // Without descriptors the grid stays empty
+    if(pKF->mDescriptors.empty())
+        return;
+
+    Frame::BuildGrid(pKF->mvKeysUn,pKF->mnMinX,pKF->mnMinY,pKF->mfGridElementWidthInv,pKF->mfGridElementHeightInv,
+                     pKF->mGridStart.Mutable(),pKF->mGridIndices.Mutable());
+}
+
+} //namespace ORB_SLAM
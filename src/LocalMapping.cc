@@ -49,6 +49,8 @@ void LocalMapping::Run()
 
     mbFinished = false;
 
+    mnEpochSlot = mpMap->mEpochManager.RegisterThread();
+
     while(1)
     {
         // Tracking will see that Local Mapping is busy
@@ -78,7 +80,19 @@ void LocalMapping::Run()
             {
                 // Local BA
                 if(mpMap->KeyFramesInMap()>2)
-                    Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame,&mbAbortBA, mpMap);
+                {
+                    vector<pair<KeyFrame*,MapPoint*> > vOutliers;
+                    Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame,&mbAbortBA, mpMap, vOutliers);
+
+                    // As in the culling, mappoints made bad are retired and the tracking is not blocked
+                    for(size_t i=0; i<vOutliers.size(); i++)
+                    {
+                        KeyFrame* pKFi = vOutliers[i].first;
+                        MapPoint* pMPi = vOutliers[i].second;
+                        pKFi->EraseMapPointMatch(pMPi);
+                        pMPi->EraseObservation(pKFi);
+                    }
+                }
 
                 // Check redundant local Keyframes
                 KeyFrameCulling();
@@ -91,6 +105,7 @@ void LocalMapping::Run()
             // Safe area to stop
             while(isStopped() && !CheckFinish())
             {
+                ReleaseBadMapPoints();
                 usleep(3000);
             }
             if(CheckFinish())
@@ -105,12 +120,49 @@ void LocalMapping::Run()
         if(CheckFinish())
             break;
 
+        ReleaseBadMapPoints();
+
         usleep(3000);
     }
 
+    mpMap->mEpochManager.UnregisterThread(mnEpochSlot);
+
     SetFinish();
 }
 
+void LocalMapping::ReleaseBadMapPoints()
+{
+    // Points retired while scrubbing are not seen as bad here, they must stay alive until the next iteration
+    const unsigned long nEpoch = mpMap->mEpochManager.BeginQuiescent();
+
+    for(list<MapPoint*>::iterator lit=mlpRecentAddedMapPoints.begin(); lit!=mlpRecentAddedMapPoints.end();)
+    {
+        if((*lit)->isBad())
+            lit = mlpRecentAddedMapPoints.erase(lit);
+        else
+            lit++;
+    }
+
+    // Keyframes waiting in the queue are not connected yet, so their matches are not erased when a point is culled
+    {
+        unique_lock<mutex> lock(mMutexNewKFs);
+        for(list<KeyFrame*>::iterator lit=mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
+        {
+            KeyFrame* pKF = *lit;
+            const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
+            for(size_t i=0; i<vpMapPoints.size(); i++)
+            {
+                MapPoint* pMP = vpMapPoints[i];
+                if(pMP && pMP->isBad())
+                    pKF->EraseMapPointMatch(i);
+            }
+        }
+    }
+
+    mpMap->mEpochManager.EndQuiescent(mnEpochSlot,nEpoch);
+    mpMap->mEpochManager.Reclaim();
+}
+
 void LocalMapping::InsertKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexNewKFs);
@@ -459,20 +511,20 @@ void LocalMapping::SearchInNeighbors()
         nn=20;
     const vector<KeyFrame*> vpNeighKFs = mpCurrentKeyFrame->GetBestCovisibilityKeyFrames(nn);
     vector<KeyFrame*> vpTargetKFs;
+    mFuseTargetMarks.NewGeneration();
     for(vector<KeyFrame*>::const_iterator vit=vpNeighKFs.begin(), vend=vpNeighKFs.end(); vit!=vend; vit++)
     {
         KeyFrame* pKFi = *vit;
-        if(pKFi->isBad() || pKFi->mnFuseTargetForKF == mpCurrentKeyFrame->mnId)
+        if(pKFi->isBad() || !mFuseTargetMarks.Mark(pKFi->mnId))
             continue;
         vpTargetKFs.push_back(pKFi);
-        pKFi->mnFuseTargetForKF = mpCurrentKeyFrame->mnId;
 
         // Extend to some second neighbors
         const vector<KeyFrame*> vpSecondNeighKFs = pKFi->GetBestCovisibilityKeyFrames(5);
         for(vector<KeyFrame*>::const_iterator vit2=vpSecondNeighKFs.begin(), vend2=vpSecondNeighKFs.end(); vit2!=vend2; vit2++)
         {
             KeyFrame* pKFi2 = *vit2;
-            if(pKFi2->isBad() || pKFi2->mnFuseTargetForKF==mpCurrentKeyFrame->mnId || pKFi2->mnId==mpCurrentKeyFrame->mnId)
+            if(pKFi2->isBad() || mFuseTargetMarks.IsMarked(pKFi2->mnId) || pKFi2->mnId==mpCurrentKeyFrame->mnId)
                 continue;
             vpTargetKFs.push_back(pKFi2);
         }
@@ -492,6 +544,7 @@ void LocalMapping::SearchInNeighbors()
     // Search matches by projection from target KFs in current KF
     vector<MapPoint*> vpFuseCandidates;
     vpFuseCandidates.reserve(vpTargetKFs.size()*vpMapPointMatches.size());
+    mFuseCandidateMarks.NewGeneration();
 
     for(vector<KeyFrame*>::iterator vitKF=vpTargetKFs.begin(), vendKF=vpTargetKFs.end(); vitKF!=vendKF; vitKF++)
     {
@@ -504,9 +557,8 @@ void LocalMapping::SearchInNeighbors()
             MapPoint* pMP = *vitMP;
             if(!pMP)
                 continue;
-            if(pMP->isBad() || pMP->mnFuseCandidateForKF == mpCurrentKeyFrame->mnId)
+            if(pMP->isBad() || !mFuseCandidateMarks.Mark(pMP->mnId))
                 continue;
-            pMP->mnFuseCandidateForKF = mpCurrentKeyFrame->mnId;
             vpFuseCandidates.push_back(pMP);
         }
     }
@@ -665,9 +717,9 @@ void LocalMapping::KeyFrameCulling()
                     if(pMP->Observations()>thObs)
                     {
                         const int &scaleLevel = pKF->mvKeysUn[i].octave;
-                        const map<KeyFrame*, size_t> observations = pMP->GetObservations();
+                        const ObservationList observations = pMP->GetObservations();
                         int nObs=0;
-                        for(map<KeyFrame*, size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+                        for(ObservationList::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
                         {
                             KeyFrame* pKFi = mit->first;
                             if(pKFi==pKF)
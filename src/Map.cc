@@ -19,52 +19,148 @@
 */
 
 #include "Map.h"
+#include "MapJournal.h"
+#include "KeyFramePager.h"
 
 #include<mutex>
+#include<cmath>
 
 namespace ORB_SLAM2
 {
 
-Map::Map():mnMaxKFid(0),mnBigChangeIdx(0)
+Map::Map():mpReferenceMapPoints(make_shared<const vector<MapPoint*> >()),mnKeyFramesVersion(0),mnMapPointsVersion(0),
+    mnMaxKFid(0),mnBigChangeIdx(0),mfVoxelSize(0.2f),mfInvVoxelSize(5.0f),
+    mpJournal(static_cast<MapJournal*>(NULL)), mpKeyFramePager(static_cast<KeyFramePager*>(NULL))
 {
 }
 
+// Returns the published snapshot if it is up to date, otherwise builds and publishes a new one.
+// Versions only change under mMutex, so the rebuild sees a consistent set.
+template<class T>
+static shared_ptr<const vector<T*> > GetSnapshot(shared_ptr<const MapSnapshot<T> > &pSnapshot, const atomic<unsigned long> &nVersion,
+                                                 const set<T*> &sItems, mutex &mMutex)
+{
+    shared_ptr<const MapSnapshot<T> > pCurrent = atomic_load(&pSnapshot);
+    if(!pCurrent || pCurrent->mnVersion!=nVersion)
+    {
+        unique_lock<mutex> lock(mMutex);
+        pCurrent = atomic_load(&pSnapshot);
+        if(!pCurrent || pCurrent->mnVersion!=nVersion)
+        {
+            shared_ptr<MapSnapshot<T> > pNew = make_shared<MapSnapshot<T> >();
+            pNew->mnVersion = nVersion;
+            pNew->mvpItems.assign(sItems.begin(),sItems.end());
+            pCurrent = pNew;
+            atomic_store(&pSnapshot,pCurrent);
+        }
+    }
+
+    // Shares ownership with the snapshot
+    return shared_ptr<const vector<T*> >(pCurrent,&pCurrent->mvpItems);
+}
+
 void Map::AddKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexMap);
-    mspKeyFrames.insert(pKF);
-    if(pKF->mnId>mnMaxKFid)
-        mnMaxKFid=pKF->mnId;
+    {
+        unique_lock<mutex> lock(mMutexMap);
+        if(mspKeyFrames.insert(pKF).second)
+            mnKeyFramesVersion++;
+        if(pKF->mnId>mnMaxKFid)
+            mnMaxKFid=pKF->mnId;
+    }
+
+    KeyFramePager* pPager = mpKeyFramePager;
+    if(pPager)
+        pPager->AddKeyFrame(pKF);
+
+    MapJournal* pJournal = mpJournal;
+    if(pJournal)
+        pJournal->AddKeyFrame(pKF);
 }
 
 void Map::AddMapPoint(MapPoint *pMP)
 {
-    unique_lock<mutex> lock(mMutexMap);
-    mspMapPoints.insert(pMP);
+    {
+        unique_lock<mutex> lock(mMutexMap);
+        if(mspMapPoints.insert(pMP).second)
+            mnMapPointsVersion++;
+        InsertInVoxelGrid(pMP);
+    }
+
+    MapJournal* pJournal = mpJournal;
+    if(pJournal)
+        pJournal->AddMapPoint(pMP);
+}
+
+static void DeleteMapPoint(void* p)
+{
+    delete static_cast<MapPoint*>(p);
 }
 
 void Map::EraseMapPoint(MapPoint *pMP)
 {
-    unique_lock<mutex> lock(mMutexMap);
-    mspMapPoints.erase(pMP);
+    bool bErased;
+    {
+        unique_lock<mutex> lock(mMutexMap);
+        bErased = mspMapPoints.erase(pMP)>0;
+        if(bErased)
+        {
+            mnMapPointsVersion++;
+            EraseFromVoxelGrid(pMP);
+        }
+    }
 
-    // TODO: This only erase the pointer.
-    // Delete the MapPoint
+    if(!bErased)
+        return;
+
+    MapJournal* pJournal = mpJournal;
+    if(pJournal)
+        pJournal->EraseMapPoint(pMP);
+
+    // Other threads may still hold the pointer, it is deleted when all of them are quiescent
+    mEpochManager.Retire(pMP,DeleteMapPoint);
 }
 
 void Map::EraseKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexMap);
-    mspKeyFrames.erase(pKF);
+    {
+        unique_lock<mutex> lock(mMutexMap);
+        if(mspKeyFrames.erase(pKF))
+            mnKeyFramesVersion++;
+    }
+
+    MapJournal* pJournal = mpJournal;
+    if(pJournal)
+        pJournal->EraseKeyFrame(pKF);
 
     // TODO: This only erase the pointer.
     // Delete the MapPoint
 }
 
+void Map::SetJournal(MapJournal *pJournal)
+{
+    mpJournal = pJournal;
+}
+
+MapJournal* Map::GetJournal()
+{
+    return mpJournal;
+}
+
+void Map::SetKeyFramePager(KeyFramePager *pPager)
+{
+    mpKeyFramePager = pPager;
+}
+
+KeyFramePager* Map::GetKeyFramePager()
+{
+    return mpKeyFramePager;
+}
+
 void Map::SetReferenceMapPoints(const vector<MapPoint *> &vpMPs)
 {
-    unique_lock<mutex> lock(mMutexMap);
-    mvpReferenceMapPoints = vpMPs;
+    shared_ptr<const vector<MapPoint*> > pMPs = make_shared<const vector<MapPoint*> >(vpMPs);
+    atomic_store(&mpReferenceMapPoints,pMPs);
 }
 
 void Map::InformNewBigChange()
@@ -79,16 +175,34 @@ int Map::GetLastBigChangeIdx()
     return mnBigChangeIdx;
 }
 
+unsigned long Map::GetKeyFramesVersion()
+{
+    return mnKeyFramesVersion;
+}
+
 vector<KeyFrame*> Map::GetAllKeyFrames()
 {
-    unique_lock<mutex> lock(mMutexMap);
-    return vector<KeyFrame*>(mspKeyFrames.begin(),mspKeyFrames.end());
+    return *GetKeyFramesSnapshot();
 }
 
 vector<MapPoint*> Map::GetAllMapPoints()
 {
-    unique_lock<mutex> lock(mMutexMap);
-    return vector<MapPoint*>(mspMapPoints.begin(),mspMapPoints.end());
+    return *GetMapPointsSnapshot();
+}
+
+shared_ptr<const vector<KeyFrame*> > Map::GetKeyFramesSnapshot()
+{
+    return GetSnapshot(mpKeyFramesSnapshot,mnKeyFramesVersion,mspKeyFrames,mMutexMap);
+}
+
+shared_ptr<const vector<MapPoint*> > Map::GetMapPointsSnapshot()
+{
+    return GetSnapshot(mpMapPointsSnapshot,mnMapPointsVersion,mspMapPoints,mMutexMap);
+}
+
+shared_ptr<const vector<MapPoint*> > Map::GetReferenceMapPointsSnapshot()
+{
+    return atomic_load(&mpReferenceMapPoints);
 }
 
 long unsigned int Map::MapPointsInMap()
@@ -105,8 +219,7 @@ long unsigned int Map::KeyFramesInMap()
 
 vector<MapPoint*> Map::GetReferenceMapPoints()
 {
-    unique_lock<mutex> lock(mMutexMap);
-    return mvpReferenceMapPoints;
+    return *GetReferenceMapPointsSnapshot();
 }
 
 long unsigned int Map::GetMaxKFid()
@@ -117,17 +230,309 @@ long unsigned int Map::GetMaxKFid()
 
 void Map::clear()
 {
+    KeyFramePager* pPager = mpKeyFramePager;
+    if(pPager)
+        pPager->Clear();
+
     for(set<MapPoint*>::iterator sit=mspMapPoints.begin(), send=mspMapPoints.end(); sit!=send; sit++)
         delete *sit;
 
     for(set<KeyFrame*>::iterator sit=mspKeyFrames.begin(), send=mspKeyFrames.end(); sit!=send; sit++)
         delete *sit;
 
+    {
+        unique_lock<mutex> lock(mMutexVoxels);
+        mmVoxels.clear();
+    }
+
     mspMapPoints.clear();
     mspKeyFrames.clear();
     mnMaxKFid = 0;
-    mvpReferenceMapPoints.clear();
+    mnKeyFramesVersion++;
+    mnMapPointsVersion++;
+    atomic_store(&mpKeyFramesSnapshot,shared_ptr<const MapSnapshot<KeyFrame> >());
+    atomic_store(&mpMapPointsSnapshot,shared_ptr<const MapSnapshot<MapPoint> >());
+    atomic_store(&mpReferenceMapPoints,make_shared<const vector<MapPoint*> >());
     mvpKeyFrameOrigins.clear();
+
+    MapJournal* pJournal = mpJournal;
+    if(pJournal)
+        pJournal->ClearMap();
+}
+
+long long Map::VoxelKey(const int x, const int y, const int z)
+{
+    // 21 bits per coordinate
+    const long long mask = (1LL<<21)-1;
+    return ((x & mask)<<42) | ((y & mask)<<21) | (z & mask);
+}
+
+void Map::VoxelCoords(const float x, const float y, const float z, int &vx, int &vy, int &vz)
+{
+    vx = floor(x*mfInvVoxelSize);
+    vy = floor(y*mfInvVoxelSize);
+    vz = floor(z*mfInvVoxelSize);
+}
+
+void Map::InsertInVoxelGrid(MapPoint *pMP)
+{
+    unique_lock<mutex> lock(mMutexVoxels);
+    if(pMP->mbInVoxelGrid)
+        return;
+
+    const cv::Mat x3Dw = pMP->GetWorldPos();
+    int vx, vy, vz;
+    VoxelCoords(x3Dw.at<float>(0),x3Dw.at<float>(1),x3Dw.at<float>(2),vx,vy,vz);
+    pMP->mnVoxelKey = VoxelKey(vx,vy,vz);
+    pMP->mbInVoxelGrid = true;
+    mmVoxels[pMP->mnVoxelKey].push_back(pMP);
+}
+
+void Map::EraseFromVoxelGrid(MapPoint *pMP)
+{
+    unique_lock<mutex> lock(mMutexVoxels);
+    if(!pMP->mbInVoxelGrid)
+        return;
+
+    RemoveFromVoxel(pMP);
+    pMP->mbInVoxelGrid = false;
+}
+
+void Map::RemoveFromVoxel(MapPoint *pMP)
+{
+    unordered_map<long long, vector<MapPoint*> >::iterator vit = mmVoxels.find(pMP->mnVoxelKey);
+    if(vit!=mmVoxels.end())
+    {
+        vector<MapPoint*> &vpMPs = vit->second;
+        vector<MapPoint*>::iterator it = find(vpMPs.begin(),vpMPs.end(),pMP);
+        if(it!=vpMPs.end())
+        {
+            *it = vpMPs.back();
+            vpMPs.pop_back();
+        }
+        if(vpMPs.empty())
+            mmVoxels.erase(vit);
+    }
+}
+
+void Map::UpdateMapPointPosition(MapPoint *pMP)
+{
+    unique_lock<mutex> lock(mMutexVoxels);
+
+    // Points not in the map (yet or anymore) are not indexed
+    if(!pMP->mbInVoxelGrid)
+        return;
+
+    // The position is read under the index mutex, so the last update always wins
+    const cv::Mat x3Dw = pMP->GetWorldPos();
+    int vx, vy, vz;
+    VoxelCoords(x3Dw.at<float>(0),x3Dw.at<float>(1),x3Dw.at<float>(2),vx,vy,vz);
+    const long long key = VoxelKey(vx,vy,vz);
+    if(key==pMP->mnVoxelKey)
+        return;
+
+    RemoveFromVoxel(pMP);
+    pMP->mnVoxelKey = key;
+    mmVoxels[key].push_back(pMP);
+}
+
+void Map::SetVoxelSize(const float size)
+{
+    if(size<=0)
+        return;
+
+    unique_lock<mutex> lock(mMutexVoxels);
+    vector<MapPoint*> vpMPs;
+    for(unordered_map<long long, vector<MapPoint*> >::iterator vit=mmVoxels.begin(), vend=mmVoxels.end(); vit!=vend; vit++)
+        vpMPs.insert(vpMPs.end(),vit->second.begin(),vit->second.end());
+
+    mfVoxelSize = size;
+    mfInvVoxelSize = 1.0f/size;
+    mmVoxels.clear();
+
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        const cv::Mat x3Dw = pMP->GetWorldPos();
+        int vx, vy, vz;
+        VoxelCoords(x3Dw.at<float>(0),x3Dw.at<float>(1),x3Dw.at<float>(2),vx,vy,vz);
+        pMP->mnVoxelKey = VoxelKey(vx,vy,vz);
+        mmVoxels[pMP->mnVoxelKey].push_back(pMP);
+    }
+}
+
+float Map::GetVoxelSize()
+{
+    unique_lock<mutex> lock(mMutexVoxels);
+    return mfVoxelSize;
+}
+
+bool Map::VoxelInFrustum(const VoxelFrustum &frustum, const int x, const int y, const int z)
+{
+    // Center and bounding sphere radius of the voxel
+    const float w[3] = {(x+0.5f)*mfVoxelSize, (y+0.5f)*mfVoxelSize, (z+0.5f)*mfVoxelSize};
+    const float r = 0.8660254f*mfVoxelSize;
+
+    float c[3];
+    for(int i=0; i<3; i++)
+        c[i] = frustum.R[i][0]*w[0]+frustum.R[i][1]*w[1]+frustum.R[i][2]*w[2]+frustum.t[i];
+
+    if(c[2]<-r || c[2]>frustum.maxDepth+r)
+        return false;
+
+    // Signed distances to the side planes
+    if(c[0]-frustum.minX*c[2]<-r*sqrt(1.0f+frustum.minX*frustum.minX))
+        return false;
+    if(frustum.maxX*c[2]-c[0]<-r*sqrt(1.0f+frustum.maxX*frustum.maxX))
+        return false;
+    if(c[1]-frustum.minY*c[2]<-r*sqrt(1.0f+frustum.minY*frustum.minY))
+        return false;
+    if(frustum.maxY*c[2]-c[1]<-r*sqrt(1.0f+frustum.maxY*frustum.maxY))
+        return false;
+
+    return true;
+}
+
+// Inverse of the 21 bits encoding of a coordinate in VoxelKey
+static int VoxelKeyCoord(const long long key, const int shift)
+{
+    const int v = (key>>shift) & ((1LL<<21)-1);
+    return v>=(1<<20) ? v-(1<<21) : v;
+}
+
+void Map::GetMapPointsInVoxels(const int minX, const int minY, const int minZ,
+                               const int maxX, const int maxY, const int maxZ,
+                               const VoxelFrustum* pFrustum, vector<MapPoint*> &vpMPs)
+{
+    const double nVoxels = double(maxX-minX+1)*double(maxY-minY+1)*double(maxZ-minZ+1);
+
+    if(nVoxels<=mmVoxels.size())
+    {
+        for(int x=minX; x<=maxX; x++)
+            for(int y=minY; y<=maxY; y++)
+                for(int z=minZ; z<=maxZ; z++)
+                {
+                    if(pFrustum && !VoxelInFrustum(*pFrustum,x,y,z))
+                        continue;
+                    unordered_map<long long, vector<MapPoint*> >::iterator vit = mmVoxels.find(VoxelKey(x,y,z));
+                    if(vit!=mmVoxels.end())
+                        vpMPs.insert(vpMPs.end(),vit->second.begin(),vit->second.end());
+                }
+    }
+    else
+    {
+        // The range is larger than the occupied space, the points are checked by the caller anyway
+        for(unordered_map<long long, vector<MapPoint*> >::iterator vit=mmVoxels.begin(), vend=mmVoxels.end(); vit!=vend; vit++)
+        {
+            if(pFrustum && !VoxelInFrustum(*pFrustum,VoxelKeyCoord(vit->first,42),VoxelKeyCoord(vit->first,21),VoxelKeyCoord(vit->first,0)))
+                continue;
+            vpMPs.insert(vpMPs.end(),vit->second.begin(),vit->second.end());
+        }
+    }
+}
+
+vector<MapPoint*> Map::GetMapPointsInRadius(const cv::Mat &x3Dw, const float r)
+{
+    const float x = x3Dw.at<float>(0);
+    const float y = x3Dw.at<float>(1);
+    const float z = x3Dw.at<float>(2);
+
+    vector<MapPoint*> vpCandidates;
+    vector<MapPoint*> vpMPs;
+
+    unique_lock<mutex> lock(mMutexVoxels);
+
+    int minX, minY, minZ, maxX, maxY, maxZ;
+    VoxelCoords(x-r,y-r,z-r,minX,minY,minZ);
+    VoxelCoords(x+r,y+r,z+r,maxX,maxY,maxZ);
+    GetMapPointsInVoxels(minX,minY,minZ,maxX,maxY,maxZ,static_cast<VoxelFrustum*>(NULL),vpCandidates);
+
+    const float r2 = r*r;
+    for(size_t i=0; i<vpCandidates.size(); i++)
+    {
+        const cv::Mat P = vpCandidates[i]->GetWorldPos();
+        const float dx = P.at<float>(0)-x;
+        const float dy = P.at<float>(1)-y;
+        const float dz = P.at<float>(2)-z;
+        if(dx*dx+dy*dy+dz*dz<=r2)
+            vpMPs.push_back(vpCandidates[i]);
+    }
+
+    return vpMPs;
+}
+
+vector<MapPoint*> Map::GetMapPointsInFrustum(const Frame &F, const float maxDepth)
+{
+    return GetMapPointsInFrustum(F.mTcw,maxDepth);
+}
+
+vector<MapPoint*> Map::GetMapPointsInFrustum(const cv::Mat &Tcw, const float maxDepth)
+{
+    const cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
+    const cv::Mat tcw = Tcw.rowRange(0,3).col(3);
+    const cv::Mat Rwc = Rcw.t();
+    const cv::Mat Ow = -Rwc*tcw;
+
+    // Bounding box of the frustum: camera center and image corners at the maximum depth
+    float minBox[3], maxBox[3];
+    for(int j=0; j<3; j++)
+        minBox[j] = maxBox[j] = Ow.at<float>(j);
+
+    const float us[2] = {Frame::mnMinX, Frame::mnMaxX};
+    const float vs[2] = {Frame::mnMinY, Frame::mnMaxY};
+    for(int iu=0; iu<2; iu++)
+        for(int iv=0; iv<2; iv++)
+        {
+            const cv::Mat xc = (cv::Mat_<float>(3,1) << (us[iu]-Frame::cx)*Frame::invfx*maxDepth,
+                                                        (vs[iv]-Frame::cy)*Frame::invfy*maxDepth, maxDepth);
+            const cv::Mat xw = Rwc*xc+Ow;
+            for(int j=0; j<3; j++)
+            {
+                minBox[j] = min(minBox[j],xw.at<float>(j));
+                maxBox[j] = max(maxBox[j],xw.at<float>(j));
+            }
+        }
+
+    VoxelFrustum frustum;
+    for(int i=0; i<3; i++)
+    {
+        for(int j=0; j<3; j++)
+            frustum.R[i][j] = Rcw.at<float>(i,j);
+        frustum.t[i] = tcw.at<float>(i);
+    }
+    frustum.minX = (Frame::mnMinX-Frame::cx)*Frame::invfx;
+    frustum.maxX = (Frame::mnMaxX-Frame::cx)*Frame::invfx;
+    frustum.minY = (Frame::mnMinY-Frame::cy)*Frame::invfy;
+    frustum.maxY = (Frame::mnMaxY-Frame::cy)*Frame::invfy;
+    frustum.maxDepth = maxDepth;
+
+    vector<MapPoint*> vpCandidates;
+    vector<MapPoint*> vpMPs;
+
+    unique_lock<mutex> lock(mMutexVoxels);
+
+    int minX, minY, minZ, maxX, maxY, maxZ;
+    VoxelCoords(minBox[0],minBox[1],minBox[2],minX,minY,minZ);
+    VoxelCoords(maxBox[0],maxBox[1],maxBox[2],maxX,maxY,maxZ);
+    GetMapPointsInVoxels(minX,minY,minZ,maxX,maxY,maxZ,&frustum,vpCandidates);
+
+    for(size_t i=0; i<vpCandidates.size(); i++)
+    {
+        const cv::Mat Pc = Rcw*vpCandidates[i]->GetWorldPos()+tcw;
+        const float PcZ = Pc.at<float>(2);
+        if(PcZ<=0.0f || PcZ>maxDepth)
+            continue;
+
+        const float invz = 1.0f/PcZ;
+        const float u = Frame::fx*Pc.at<float>(0)*invz+Frame::cx;
+        const float v = Frame::fy*Pc.at<float>(1)*invz+Frame::cy;
+        if(u<Frame::mnMinX || u>Frame::mnMaxX || v<Frame::mnMinY || v>Frame::mnMaxY)
+            continue;
+
+        vpMPs.push_back(vpCandidates[i]);
+    }
+
+    return vpMPs;
 }
 
 } //namespace ORB_SLAM
@@ -38,13 +38,32 @@ MapDrawer::MapDrawer(Map* pMap, const string &strSettingPath):mpMap(pMap)
     mPointSize = fSettings["Viewer.PointSize"];
     mCameraSize = fSettings["Viewer.CameraSize"];
     mCameraLineWidth = fSettings["Viewer.CameraLineWidth"];
+    mViewDepth = fSettings["Viewer.ViewDepth"];
+    if(mViewDepth<=0)
+        mViewDepth = 5.0f;
 
 }
 
-void MapDrawer::DrawMapPoints()
+void MapDrawer::DrawMapPoints(const bool bOnlyInView)
 {
-    const vector<MapPoint*> &vpMPs = mpMap->GetAllMapPoints();
-    const vector<MapPoint*> &vpRefMPs = mpMap->GetReferenceMapPoints();
+    // Snapshots are only rebuilt when the map changes, not on every tick
+    shared_ptr<const vector<MapPoint*> > pMPs = mpMap->GetMapPointsSnapshot();
+    const shared_ptr<const vector<MapPoint*> > pRefMPs = mpMap->GetReferenceMapPointsSnapshot();
+
+    if(bOnlyInView)
+    {
+        cv::Mat Tcw;
+        {
+            unique_lock<mutex> lock(mMutexCamera);
+            Tcw = mCameraPose.clone();
+        }
+        if(Tcw.empty())
+            return;
+        pMPs = make_shared<const vector<MapPoint*> >(mpMap->GetMapPointsInFrustum(Tcw,mViewDepth));
+    }
+
+    const vector<MapPoint*> &vpMPs = *pMPs;
+    const vector<MapPoint*> &vpRefMPs = *pRefMPs;
 
     set<MapPoint*> spRefMPs(vpRefMPs.begin(), vpRefMPs.end());
 
@@ -59,8 +78,9 @@ void MapDrawer::DrawMapPoints()
     {
         if(vpMPs[i]->isBad() || spRefMPs.count(vpMPs[i]))
             continue;
-        cv::Mat pos = vpMPs[i]->GetWorldPos();
-        glVertex3f(pos.at<float>(0),pos.at<float>(1),pos.at<float>(2));
+        float pos[3];
+        vpMPs[i]->GetWorldPos(pos);
+        glVertex3f(pos[0],pos[1],pos[2]);
     }
     glEnd();
 
@@ -72,8 +92,9 @@ void MapDrawer::DrawMapPoints()
     {
         if((*sit)->isBad())
             continue;
-        cv::Mat pos = (*sit)->GetWorldPos();
-        glVertex3f(pos.at<float>(0),pos.at<float>(1),pos.at<float>(2));
+        float pos[3];
+        (*sit)->GetWorldPos(pos);
+        glVertex3f(pos[0],pos[1],pos[2]);
 
     }
 
@@ -86,7 +107,8 @@ void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph)
     const float h = w*0.75;
     const float z = w*0.6;
 
-    const vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+    const shared_ptr<const vector<KeyFrame*> > pKFs = mpMap->GetKeyFramesSnapshot();
+    const vector<KeyFrame*> &vpKFs = *pKFs;
 
     if(bDrawKF)
     {
@@ -0,0 +1,574 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MapJournal.h"
+#include "Map.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "KeyFrameDatabase.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include<mutex>
+
+namespace ORB_SLAM2
+{
+
+const unsigned int MapJournal::VERSION;
+
+static const char JOURNAL_FILE_MAGIC[8] = {'O','R','B','2','J','R','N','L'};
+
+MapJournal::MapJournal(const string &filename, const ORBVocabulary *pVoc):
+    mbCameraWritten(false), mbFinishRequested(false), mbFinished(false)
+{
+    mFile.open(filename.c_str(), ios::out | ios::binary | ios::trunc);
+
+    mBuffer.PutArray(JOURNAL_FILE_MAGIC,8);
+    mBuffer.Put<uint32_t>(VERSION);
+    mBuffer.Put<uint32_t>(pVoc->size());
+    Flush();
+}
+
+bool MapJournal::IsOpen()
+{
+    return mFile.is_open() && mFile.good();
+}
+
+void MapJournal::Run()
+{
+    bool bError = false;
+
+    while(1)
+    {
+        if(!Flush() && !bError)
+        {
+            cerr << "Error writing the map journal, later events are lost." << endl;
+            bError = true;
+        }
+
+        if(CheckFinish())
+            break;
+
+        usleep(5000);
+    }
+
+    Flush();
+    mFile.close();
+
+    SetFinish();
+}
+
+bool MapJournal::Flush()
+{
+    // Double buffering: events keep being appended while the previous batch is written
+    {
+        unique_lock<mutex> lock(mMutexBuffer);
+        mvWriting.swap(mBuffer.mvBuffer);
+    }
+
+    if(mvWriting.empty())
+        return mFile.good();
+
+    mFile.write(mvWriting.data(),mvWriting.size());
+    mFile.flush();
+    mvWriting.clear();
+
+    return mFile.good();
+}
+
+void MapJournal::RequestFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mbFinishRequested = true;
+}
+
+bool MapJournal::CheckFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinishRequested;
+}
+
+void MapJournal::SetFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mbFinished = true;
+}
+
+bool MapJournal::isFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+// Event layout: type (1 byte), record size (4 bytes), record
+static void PutEvent(MapSerializer::Writer &buffer, const MapJournal::eEvent event, const MapSerializer::Writer &record)
+{
+    buffer.Put<uint8_t>(event);
+    buffer.Put<uint32_t>(record.Size());
+    buffer.PutArray(record.mvBuffer.data(),record.Size());
+}
+
+void MapJournal::Append(const eEvent event, const MapSerializer::Writer &record)
+{
+    unique_lock<mutex> lock(mMutexBuffer);
+    PutEvent(mBuffer,event,record);
+}
+
+void MapJournal::WriteSnapshot(Map *pMap)
+{
+    vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
+    sort(vpKFs.begin(),vpKFs.end(),KeyFrame::lId);
+    for(size_t i=0; i<vpKFs.size(); i++)
+        if(!vpKFs[i]->isBad())
+            AddKeyFrame(vpKFs[i]);
+
+    vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
+    for(size_t i=0; i<vpMPs.size(); i++)
+        if(!vpMPs[i]->isBad())
+            AddMapPoint(vpMPs[i]);
+
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        if(vpKFs[i]->isBad())
+            continue;
+        set<KeyFrame*> sLoopEdges = vpKFs[i]->GetLoopEdges();
+        for(set<KeyFrame*>::iterator sit=sLoopEdges.begin(), send=sLoopEdges.end(); sit!=send; sit++)
+            AddLoopEdge(vpKFs[i],*sit);
+    }
+}
+
+void MapJournal::AddKeyFrame(KeyFrame *pKF)
+{
+    MapSerializer::Writer w;
+    MapSerializer::WriteKeyFrame(w,pKF);
+
+    // The parent and the associations are usually set before the keyframe enters the map
+    KeyFrame* pParent = pKF->GetParent();
+    w.Put<int64_t>(pParent ? static_cast<int64_t>(pParent->mnId) : -1);
+
+    vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+    vector<pair<uint32_t,uint64_t> > vMatches;
+    for(size_t i=0; i<vpMPs.size(); i++)
+        if(vpMPs[i] && !vpMPs[i]->isBad())
+            vMatches.push_back(make_pair(i,vpMPs[i]->mnId));
+    w.Put<uint32_t>(vMatches.size());
+    for(size_t i=0; i<vMatches.size(); i++)
+    {
+        w.Put<uint32_t>(vMatches[i].first);
+        w.Put<uint64_t>(vMatches[i].second);
+    }
+
+    unique_lock<mutex> lock(mMutexBuffer);
+    if(!mbCameraWritten)
+    {
+        MapSerializer::Writer wc;
+        MapSerializer::WriteCamera(wc,pKF);
+        PutEvent(mBuffer,CAMERA,wc);
+        mbCameraWritten = true;
+    }
+    PutEvent(mBuffer,KEYFRAME_ADDED,w);
+}
+
+void MapJournal::EraseKeyFrame(KeyFrame *pKF)
+{
+    MapSerializer::Writer w;
+    w.Put<uint64_t>(pKF->mnId);
+    Append(KEYFRAME_ERASED,w);
+}
+
+void MapJournal::SetKeyFramePose(KeyFrame *pKF, const cv::Mat &Tcw)
+{
+    MapSerializer::Writer w;
+    w.Put<uint64_t>(pKF->mnId);
+    for(int i=0; i<4; i++)
+        w.PutArray(Tcw.ptr<float>(i),4);
+    Append(KEYFRAME_POSE,w);
+}
+
+void MapJournal::ChangeParent(KeyFrame *pKF, KeyFrame *pParent)
+{
+    MapSerializer::Writer w;
+    w.Put<uint64_t>(pKF->mnId);
+    w.Put<uint64_t>(pParent->mnId);
+    Append(KEYFRAME_PARENT,w);
+}
+
+void MapJournal::AddLoopEdge(KeyFrame *pKF, KeyFrame *pLoopKF)
+{
+    MapSerializer::Writer w;
+    w.Put<uint64_t>(pKF->mnId);
+    w.Put<uint64_t>(pLoopKF->mnId);
+    Append(KEYFRAME_LOOP_EDGE,w);
+}
+
+void MapJournal::AddMapPoint(MapPoint *pMP)
+{
+    MapSerializer::Writer w;
+    w.Put<uint64_t>(pMP->mnId);
+    w.Put<int64_t>(pMP->mnFirstKFid);
+    w.Put<int64_t>(pMP->mnFirstFrame);
+
+    KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+    w.Put<int64_t>(pRefKF ? static_cast<int64_t>(pRefKF->mnId) : -1);
+
+    cv::Mat Pos = pMP->GetWorldPos();
+    w.PutArray(Pos.ptr<float>(0),3);
+
+    ObservationList observations = pMP->GetObservations();
+    w.Put<uint32_t>(observations.size());
+    for(ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    {
+        w.Put<uint64_t>(mit->first->mnId);
+        w.Put<uint32_t>(mit->second);
+    }
+
+    Append(MAPPOINT_ADDED,w);
+}
+
+void MapJournal::EraseMapPoint(MapPoint *pMP)
+{
+    MapSerializer::Writer w;
+    w.Put<uint64_t>(pMP->mnId);
+    Append(MAPPOINT_ERASED,w);
+}
+
+void MapJournal::SetMapPointPos(MapPoint *pMP, const cv::Mat &Pos)
+{
+    MapSerializer::Writer w;
+    w.Put<uint64_t>(pMP->mnId);
+    w.PutArray(Pos.ptr<float>(0),3);
+    Append(MAPPOINT_POSITION,w);
+}
+
+void MapJournal::AddObservation(MapPoint *pMP, KeyFrame *pKF, const size_t idx)
+{
+    MapSerializer::Writer w;
+    w.Put<uint64_t>(pMP->mnId);
+    w.Put<uint64_t>(pKF->mnId);
+    w.Put<uint32_t>(idx);
+    Append(OBSERVATION_ADDED,w);
+}
+
+void MapJournal::EraseObservation(MapPoint *pMP, KeyFrame *pKF)
+{
+    MapSerializer::Writer w;
+    w.Put<uint64_t>(pMP->mnId);
+    w.Put<uint64_t>(pKF->mnId);
+    Append(OBSERVATION_ERASED,w);
+}
+
+void MapJournal::ClearMap()
+{
+    Append(MAP_CLEARED,MapSerializer::Writer());
+}
+
+// Mappoints are kept as plain records during the replay and created at the end,
+// once the observations are final.
+struct ReplayPoint
+{
+    long int mnFirstKFid;
+    long int mnFirstFrame;
+    int64_t mnRefKFid;
+    float mPos[3];
+    map<long unsigned int,size_t> mObservations;
+};
+
+bool MapJournal::Replay(const string &filename, Map *pMap, KeyFrameDatabase *pKFDB, const ORBVocabulary *pVoc)
+{
+    if(pMap->KeyFramesInMap()>0)
+    {
+        cerr << "The journal can only be replayed into an empty map." << endl;
+        return false;
+    }
+
+    MapSerializer::MappedFile file(filename);
+    if(!file.IsOpen())
+    {
+        cerr << "Failed to open journal at: " << filename << endl;
+        return false;
+    }
+
+    MapSerializer::Reader r(file.Data(),file.Size());
+
+    const char* pMagic = r.GetArray(8);
+    if(!pMagic || memcmp(pMagic,JOURNAL_FILE_MAGIC,8)!=0)
+    {
+        cerr << "Not an ORB-SLAM2 map journal." << endl;
+        return false;
+    }
+
+    const unsigned int nVersion = r.Get<uint32_t>();
+    if(nVersion!=VERSION)
+    {
+        cerr << "Unsupported journal version " << nVersion << " (expected " << VERSION << ")." << endl;
+        return false;
+    }
+
+    if(r.Get<uint32_t>()!=pVoc->size())
+    {
+        cerr << "The journal was written with a different vocabulary." << endl;
+        return false;
+    }
+
+    Frame F;
+    bool bCamera = false;
+    map<long unsigned int, KeyFrame*> mKFs;
+    map<long unsigned int, int64_t> mParents;
+    map<long unsigned int, set<long unsigned int> > mLoopEdges;
+    map<long unsigned int, ReplayPoint> mMPs;
+    size_t nEvents = 0;
+
+    while(!r.AtEnd())
+    {
+        const unsigned int event = r.Get<uint8_t>();
+        const unsigned int size = r.Get<uint32_t>();
+        const char* pRecord = r.GetArray(size);
+        if(!pRecord)
+        {
+            cout << "The journal ends with a truncated event, it is ignored." << endl;
+            break;
+        }
+
+        MapSerializer::Reader e(pRecord,size);
+        nEvents++;
+
+        switch(event)
+        {
+        case CAMERA:
+            bCamera = MapSerializer::ReadCamera(e,F,pVoc);
+            break;
+        case KEYFRAME_ADDED:
+        {
+            KeyFrame* pKF = bCamera ? MapSerializer::ReadKeyFrame(e,F,pMap,pKFDB) : NULL;
+            if(!pKF)
+                break;
+            if(mKFs.count(pKF->mnId))
+            {
+                delete pKF;
+                break;
+            }
+            mKFs[pKF->mnId] = pKF;
+            mParents[pKF->mnId] = e.Get<int64_t>();
+            const unsigned int nMatches = e.Get<uint32_t>();
+            for(unsigned int i=0; i<nMatches && !e.Failed(); i++)
+            {
+                const size_t idx = e.Get<uint32_t>();
+                map<long unsigned int, ReplayPoint>::iterator mit = mMPs.find(e.Get<uint64_t>());
+                if(mit!=mMPs.end())
+                    mit->second.mObservations[pKF->mnId] = idx;
+            }
+            break;
+        }
+        case KEYFRAME_ERASED:
+        {
+            const long unsigned int nId = e.Get<uint64_t>();
+            map<long unsigned int, KeyFrame*>::iterator mit = mKFs.find(nId);
+            if(mit!=mKFs.end())
+            {
+                delete mit->second;
+                mKFs.erase(mit);
+                mParents.erase(nId);
+                mLoopEdges.erase(nId);
+            }
+            break;
+        }
+        case KEYFRAME_POSE:
+        {
+            map<long unsigned int, KeyFrame*>::iterator mit = mKFs.find(e.Get<uint64_t>());
+            const char* pTcw = e.GetArray(16*sizeof(float));
+            if(mit!=mKFs.end() && pTcw)
+            {
+                cv::Mat Tcw(4,4,CV_32F);
+                memcpy(Tcw.data,pTcw,16*sizeof(float));
+                mit->second->SetPose(Tcw);
+            }
+            break;
+        }
+        case KEYFRAME_PARENT:
+        {
+            const long unsigned int nId = e.Get<uint64_t>();
+            const int64_t nParentId = e.Get<uint64_t>();
+            if(!e.Failed() && mKFs.count(nId))
+                mParents[nId] = nParentId;
+            break;
+        }
+        case KEYFRAME_LOOP_EDGE:
+        {
+            const long unsigned int nId = e.Get<uint64_t>();
+            const long unsigned int nLoopId = e.Get<uint64_t>();
+            if(!e.Failed() && mKFs.count(nId))
+                mLoopEdges[nId].insert(nLoopId);
+            break;
+        }
+        case MAPPOINT_ADDED:
+        {
+            const long unsigned int nId = e.Get<uint64_t>();
+            ReplayPoint point;
+            point.mnFirstKFid = e.Get<int64_t>();
+            point.mnFirstFrame = e.Get<int64_t>();
+            point.mnRefKFid = e.Get<int64_t>();
+            const char* pPos = e.GetArray(3*sizeof(float));
+            const unsigned int nObs = e.Get<uint32_t>();
+            for(unsigned int i=0; i<nObs && !e.Failed(); i++)
+            {
+                const long unsigned int nKFid = e.Get<uint64_t>();
+                point.mObservations[nKFid] = e.Get<uint32_t>();
+            }
+            if(e.Failed())
+                break;
+            memcpy(point.mPos,pPos,3*sizeof(float));
+            mMPs[nId] = point;
+            break;
+        }
+        case MAPPOINT_ERASED:
+            mMPs.erase(e.Get<uint64_t>());
+            break;
+        case MAPPOINT_POSITION:
+        {
+            map<long unsigned int, ReplayPoint>::iterator mit = mMPs.find(e.Get<uint64_t>());
+            const char* pPos = e.GetArray(3*sizeof(float));
+            if(mit!=mMPs.end() && pPos)
+                memcpy(mit->second.mPos,pPos,3*sizeof(float));
+            break;
+        }
+        case OBSERVATION_ADDED:
+        {
+            map<long unsigned int, ReplayPoint>::iterator mit = mMPs.find(e.Get<uint64_t>());
+            const long unsigned int nKFid = e.Get<uint64_t>();
+            const size_t idx = e.Get<uint32_t>();
+            if(mit!=mMPs.end() && !e.Failed())
+                mit->second.mObservations[nKFid] = idx;
+            break;
+        }
+        case OBSERVATION_ERASED:
+        {
+            map<long unsigned int, ReplayPoint>::iterator mit = mMPs.find(e.Get<uint64_t>());
+            const long unsigned int nKFid = e.Get<uint64_t>();
+            if(mit!=mMPs.end() && !e.Failed())
+                mit->second.mObservations.erase(nKFid);
+            break;
+        }
+        case MAP_CLEARED:
+            for(map<long unsigned int, KeyFrame*>::iterator mit=mKFs.begin(), mend=mKFs.end(); mit!=mend; mit++)
+                delete mit->second;
+            mKFs.clear();
+            mParents.clear();
+            mLoopEdges.clear();
+            mMPs.clear();
+            break;
+        default:
+            // Events from newer versions are skipped
+            break;
+        }
+    }
+
+    if(mKFs.empty())
+    {
+        cerr << "The journal does not contain any keyframe." << endl;
+        return false;
+    }
+
+    // The spanning tree comes from the journal, not from the first covisibility connection
+    for(map<long unsigned int, KeyFrame*>::iterator mit=mKFs.begin(), mend=mKFs.end(); mit!=mend; mit++)
+    {
+        unique_lock<mutex> lock(mit->second->mMutexConnections);
+        mit->second->mbFirstConnection = false;
+    }
+
+    vector<MapPoint*> vpMPs;
+    long unsigned int nMaxMPid = 0;
+    for(map<long unsigned int, ReplayPoint>::iterator mit=mMPs.begin(), mend=mMPs.end(); mit!=mend; mit++)
+    {
+        const ReplayPoint &point = mit->second;
+
+        vector<pair<KeyFrame*,size_t> > vObservations;
+        for(map<long unsigned int,size_t>::const_iterator oit=point.mObservations.begin(); oit!=point.mObservations.end(); oit++)
+        {
+            map<long unsigned int, KeyFrame*>::iterator kit = mKFs.find(oit->first);
+            if(kit==mKFs.end() || oit->second>=static_cast<size_t>(kit->second->N) || kit->second->GetMapPoint(oit->second))
+                continue;
+            vObservations.push_back(make_pair(kit->second,oit->second));
+        }
+
+        if(vObservations.empty())
+            continue;
+
+        KeyFrame* pRefKF = vObservations[0].first;
+        if(point.mnRefKFid>=0 && mKFs.count(point.mnRefKFid))
+            pRefKF = mKFs[point.mnRefKFid];
+
+        cv::Mat Pos(3,1,CV_32F);
+        memcpy(Pos.data,point.mPos,3*sizeof(float));
+
+        MapPoint* pMP = new MapPoint(Pos,pRefKF,pMap);
+        pMP->mnId = mit->first;
+        pMP->mnFirstKFid = point.mnFirstKFid;
+        pMP->mnFirstFrame = point.mnFirstFrame;
+        for(size_t i=0; i<vObservations.size(); i++)
+        {
+            pMP->AddObservation(vObservations[i].first,vObservations[i].second);
+            vObservations[i].first->AddMapPoint(pMP,vObservations[i].second);
+        }
+        pMP->ComputeDistinctiveDescriptors();
+        pMP->UpdateNormalAndDepth();
+
+        vpMPs.push_back(pMP);
+        nMaxMPid = max(nMaxMPid,pMP->mnId);
+    }
+
+    long unsigned int nMaxFrameId = 0;
+    for(map<long unsigned int, KeyFrame*>::iterator mit=mKFs.begin(), mend=mKFs.end(); mit!=mend; mit++)
+    {
+        KeyFrame* pKF = mit->second;
+        pKF->UpdateConnections();
+
+        map<long unsigned int, KeyFrame*>::iterator pit = mParents[pKF->mnId]>=0 ? mKFs.find(mParents[pKF->mnId]) : mend;
+        if(pit!=mend && pit->second!=pKF)
+            pKF->ChangeParent(pit->second);
+
+        const set<long unsigned int> &sLoopEdges = mLoopEdges[pKF->mnId];
+        for(set<long unsigned int>::const_iterator sit=sLoopEdges.begin(); sit!=sLoopEdges.end(); sit++)
+            if(mKFs.count(*sit))
+                pKF->AddLoopEdge(mKFs[*sit]);
+
+        pKFDB->add(pKF);
+        pMap->AddKeyFrame(pKF);
+        nMaxFrameId = max(nMaxFrameId,pKF->mnFrameId);
+    }
+
+    for(size_t i=0; i<vpMPs.size(); i++)
+        pMap->AddMapPoint(vpMPs[i]);
+
+    pMap->mvpKeyFrameOrigins.push_back(mKFs.begin()->second);
+
+    KeyFrame::nNextId = mKFs.rbegin()->first+1;
+    {
+        unique_lock<mutex> lock(pMap->mMutexPointCreation);
+        MapPoint::nNextId = nMaxMPid+1;
+    }
+    Frame::nNextId = max(Frame::nNextId,nMaxFrameId+1);
+
+    cout << "Replayed " << nEvents << " events: " << mKFs.size() << " keyframes and " << vpMPs.size() << " mappoints" << endl;
+
+    return true;
+}
+
+} //namespace ORB_SLAM
@@ -20,6 +20,7 @@
 
 #include "MapPoint.h"
 #include "ORBmatcher.h"
+#include "MapJournal.h"
 
 #include<mutex>
 
@@ -27,15 +28,32 @@ namespace ORB_SLAM2
 {
 
 long unsigned int MapPoint::nNextId=0;
-mutex MapPoint::mGlobalMutex;
+ObjectPool MapPoint::mPool(sizeof(MapPoint),1024);
+
+void* MapPoint::operator new(size_t nSize)
+{
+    if(nSize!=sizeof(MapPoint))
+        return ::operator new(nSize);
+    return mPool.Allocate();
+}
+
+void MapPoint::operator delete(void *p, size_t nSize)
+{
+    if(!p)
+        return;
+    if(nSize!=sizeof(MapPoint))
+        ::operator delete(p);
+    else
+        mPool.Free(p);
+}
 
 MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
-    mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),
-    mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
-    mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(pRefKF), mnVisible(1), mnFound(1), mbBad(false),
+    mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnVoxelKey(0), mbInVoxelGrid(false),
+    mnPosSequence(0),
+    mpRefKF(pRefKF), mnVisible(1), mnFound(1), mbBad(false),
     mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap)
 {
-    Pos.copyTo(mWorldPos);
+    InitWorldPos(Pos);
     mNormalVector = cv::Mat::zeros(3,1,CV_32F);
 
     // MapPoints can be created from Tracking and Local Mapping. This mutex avoid conflicts with id.
@@ -44,14 +62,13 @@ MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
 }
 
 MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF):
-    mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnTrackReferenceForFrame(0), mnLastFrameSeen(0),
-    mnBALocalForKF(0), mnFuseCandidateForKF(0),mnLoopPointForKF(0), mnCorrectedByKF(0),
-    mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1),
-    mnFound(1), mbBad(false), mpReplaced(NULL), mpMap(pMap)
+    mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnVoxelKey(0), mbInVoxelGrid(false),
+    mnPosSequence(0),
+    mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1), mnFound(1), mbBad(false), mpReplaced(NULL), mpMap(pMap)
 {
-    Pos.copyTo(mWorldPos);
+    InitWorldPos(Pos);
     cv::Mat Ow = pFrame->GetCameraCenter();
-    mNormalVector = mWorldPos - Ow;
+    mNormalVector = Pos - Ow;
     mNormalVector = mNormalVector/cv::norm(mNormalVector);
 
     cv::Mat PC = Pos - Ow;
@@ -70,17 +87,74 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF
     mnId=nNextId++;
 }
 
+void MapPoint::InitWorldPos(const cv::Mat &Pos)
+{
+    for(int j=0; j<2; j++)
+    {
+        for(int i=0; i<3; i++)
+            mWorldPos[j][i].store(Pos.at<float>(i),memory_order_relaxed);
+        mnPosVersion[j].store(0,memory_order_relaxed);
+    }
+    mnNewestPos.store(0,memory_order_relaxed);
+}
+
+void MapPoint::StoreWorldPos(const cv::Mat &Pos)
+{
+    const unsigned int seq = mnPosSequence.load(memory_order_relaxed);
+    mnPosSequence.store(seq+1,memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    // A commit writes the older slot, pinned readers keep reading the other one
+    int n = mnNewestPos.load(memory_order_relaxed);
+    const unsigned long nCommit = SnapshotManager::GetCommitVersion();
+    if(nCommit>mnPosVersion[n].load(memory_order_relaxed))
+    {
+        n = 1-n;
+        mnPosVersion[n].store(nCommit,memory_order_relaxed);
+        mnNewestPos.store(n,memory_order_relaxed);
+    }
+
+    for(int i=0; i<3; i++)
+        mWorldPos[n][i].store(Pos.at<float>(i),memory_order_relaxed);
+    mnPosSequence.store(seq+2,memory_order_release);
+}
+
 void MapPoint::SetWorldPos(const cv::Mat &Pos)
 {
-    unique_lock<mutex> lock2(mGlobalMutex);
-    unique_lock<mutex> lock(mMutexPos);
-    Pos.copyTo(mWorldPos);
+    {
+        unique_lock<mutex> lock(mMutexPos);
+        StoreWorldPos(Pos);
+
+        MapJournal* pJournal = mpMap->GetJournal();
+        if(pJournal)
+            pJournal->SetMapPointPos(this,Pos);
+    }
+
+    mpMap->UpdateMapPointPosition(this);
+}
+
+void MapPoint::GetWorldPos(float *x3Dw)
+{
+    const unsigned long nVersion = SnapshotManager::GetReadVersion();
+    unsigned int seq0, seq1;
+    do
+    {
+        seq0 = mnPosSequence.load(memory_order_acquire);
+        int n = mnNewestPos.load(memory_order_relaxed);
+        if(mnPosVersion[n].load(memory_order_relaxed)>nVersion)
+            n = 1-n;
+        for(int i=0; i<3; i++)
+            x3Dw[i] = mWorldPos[n][i].load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        seq1 = mnPosSequence.load(memory_order_relaxed);
+    } while((seq0 & 1) || seq0!=seq1);
 }
 
 cv::Mat MapPoint::GetWorldPos()
 {
-    unique_lock<mutex> lock(mMutexPos);
-    return mWorldPos.clone();
+    cv::Mat Pos(3,1,CV_32F);
+    GetWorldPos(Pos.ptr<float>(0));
+    return Pos;
 }
 
 cv::Mat MapPoint::GetNormal()
@@ -95,17 +169,56 @@ KeyFrame* MapPoint::GetReferenceKeyFrame()
     return mpRefKF;
 }
 
+// Updates the covisibility weights between pKF and the other observers. It is done under the
+// mappoint mutex, so that the updates of the same pair are applied in order.
+static void UpdateCovisibility(KeyFrame* pKF, const ObservationList &observations, const bool bIncrease)
+{
+    for(ObservationList::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    {
+        KeyFrame* pKFi = mit->first;
+        if(pKFi==pKF)
+            continue;
+
+        if(bIncrease)
+        {
+            pKF->IncreaseCovisibility(pKFi);
+            pKFi->IncreaseCovisibility(pKF);
+        }
+        else
+        {
+            pKF->DecreaseCovisibility(pKFi);
+            pKFi->DecreaseCovisibility(pKF);
+        }
+    }
+}
+
+// Removes the covisibility weights of every pair of observers
+static void EraseCovisibility(const ObservationList &observations)
+{
+    for(ObservationList::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        for(ObservationList::const_iterator mit2=mit+1; mit2!=mend; mit2++)
+        {
+            mit->first->DecreaseCovisibility(mit2->first);
+            mit2->first->DecreaseCovisibility(mit->first);
+        }
+}
+
 void MapPoint::AddObservation(KeyFrame* pKF, size_t idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
     if(mObservations.count(pKF))
         return;
-    mObservations[pKF]=idx;
+    mObservations.insert(pKF,idx);
+    UpdateCovisibility(pKF,mObservations,true);
 
     if(pKF->mvuRight[idx]>=0)
         nObs+=2;
     else
         nObs++;
+
+    MapJournal* pJournal = mpMap->GetJournal();
+    if(pJournal)
+        pJournal->AddObservation(this,pKF,idx);
 }
 
 void MapPoint::EraseObservation(KeyFrame* pKF)
@@ -113,15 +226,21 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
     bool bBad=false;
     {
         unique_lock<mutex> lock(mMutexFeatures);
-        if(mObservations.count(pKF))
+        ObservationList::iterator it = mObservations.find(pKF);
+        if(it!=mObservations.end())
         {
-            int idx = mObservations[pKF];
+            int idx = it->second;
             if(pKF->mvuRight[idx]>=0)
                 nObs-=2;
             else
                 nObs--;
 
             mObservations.erase(pKF);
+            UpdateCovisibility(pKF,mObservations,false);
+
+            MapJournal* pJournal = mpMap->GetJournal();
+            if(pJournal)
+                pJournal->EraseObservation(this,pKF);
 
             if(mpRefKF==pKF)
                 mpRefKF=mObservations.begin()->first;
@@ -136,7 +255,7 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
         SetBadFlag();
 }
 
-map<KeyFrame*, size_t> MapPoint::GetObservations()
+ObservationList MapPoint::GetObservations()
 {
     unique_lock<mutex> lock(mMutexFeatures);
     return mObservations;
@@ -150,15 +269,16 @@ int MapPoint::Observations()
 
 void MapPoint::SetBadFlag()
 {
-    map<KeyFrame*,size_t> obs;
+    ObservationList obs;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
         mbBad=true;
         obs = mObservations;
         mObservations.clear();
+        EraseCovisibility(obs);
     }
-    for(map<KeyFrame*,size_t>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    for(ObservationList::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
         pKF->EraseMapPointMatch(mit->second);
@@ -180,19 +300,20 @@ void MapPoint::Replace(MapPoint* pMP)
         return;
 
     int nvisible, nfound;
-    map<KeyFrame*,size_t> obs;
+    ObservationList obs;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
         obs=mObservations;
         mObservations.clear();
+        EraseCovisibility(obs);
         mbBad=true;
         nvisible = mnVisible;
         nfound = mnFound;
         mpReplaced = pMP;
     }
 
-    for(map<KeyFrame*,size_t>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    for(ObservationList::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
         // Replace measurement in keyframe
         KeyFrame* pKF = mit->first;
@@ -244,7 +365,7 @@ void MapPoint::ComputeDistinctiveDescriptors()
     // Retrieve all observed descriptors
     vector<cv::Mat> vDescriptors;
 
-    map<KeyFrame*,size_t> observations;
+    ObservationList observations;
 
     {
         unique_lock<mutex> lock1(mMutexFeatures);
@@ -258,12 +379,18 @@ void MapPoint::ComputeDistinctiveDescriptors()
 
     vDescriptors.reserve(observations.size());
 
-    for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    for(ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
 
         if(!pKF->isBad())
-            vDescriptors.push_back(pKF->mDescriptors.row(mit->second));
+        {
+            // The row shares the data, it stays valid if the keyframe is evicted afterwards
+            KeyFramePin pin(pKF);
+            // A keyframe that could not be read back from the paging file has no descriptors
+            if(!pKF->mDescriptors.empty())
+                vDescriptors.push_back(pKF->mDescriptors.row(mit->second));
+        }
     }
 
     if(vDescriptors.empty())
@@ -315,8 +442,9 @@ cv::Mat MapPoint::GetDescriptor()
 int MapPoint::GetIndexInKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    if(mObservations.count(pKF))
-        return mObservations[pKF];
+    ObservationList::const_iterator it = mObservations.find(pKF);
+    if(it!=mObservations.end())
+        return it->second;
     else
         return -1;
 }
@@ -329,9 +457,8 @@ bool MapPoint::IsInKeyFrame(KeyFrame *pKF)
 
 void MapPoint::UpdateNormalAndDepth()
 {
-    map<KeyFrame*,size_t> observations;
+    ObservationList observations;
     KeyFrame* pRefKF;
-    cv::Mat Pos;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
@@ -339,26 +466,27 @@ void MapPoint::UpdateNormalAndDepth()
             return;
         observations=mObservations;
         pRefKF=mpRefKF;
-        Pos = mWorldPos.clone();
     }
+    const cv::Mat Pos = GetWorldPos();
 
     if(observations.empty())
         return;
 
     cv::Mat normal = cv::Mat::zeros(3,1,CV_32F);
     int n=0;
-    for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    for(ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
         cv::Mat Owi = pKF->GetCameraCenter();
-        cv::Mat normali = mWorldPos - Owi;
+        cv::Mat normali = Pos - Owi;
         normal = normal + normali/cv::norm(normali);
         n++;
     }
 
     cv::Mat PC = Pos - pRefKF->GetCameraCenter();
     const float dist = cv::norm(PC);
-    const int level = pRefKF->mvKeysUn[observations[pRefKF]].octave;
+    ObservationList::const_iterator rit = observations.find(pRefKF);
+    const int level = pRefKF->mvKeysUn[rit!=observations.end() ? rit->second : 0].octave;
     const float levelScaleFactor =  pRefKF->mvScaleFactors[level];
     const int nLevels = pRefKF->mnScaleLevels;
 
@@ -0,0 +1,824 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MapSerializer.h"
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include<mutex>
+
+namespace ORB_SLAM2
+{
+
+const unsigned int MapSerializer::VERSION;
+
+static const char MAP_FILE_MAGIC[8] = {'O','R','B','S','L','A','M','2'};
+
+// Keep memory usage bounded while writing large maps
+static const size_t FLUSH_SIZE = 1<<24;
+
+bool MapSerializer::Writer::Flush(std::ofstream &f)
+{
+    if(!mvBuffer.empty())
+        f.write(mvBuffer.data(),mvBuffer.size());
+    mvBuffer.clear();
+    return f.good();
+}
+
+const char* MapSerializer::Reader::GetArray(const size_t nBytes)
+{
+    if(mbFailed || nBytes>mnSize-mnPos)
+    {
+        mbFailed = true;
+        return NULL;
+    }
+    const char* p = mpData+mnPos;
+    mnPos += nBytes;
+    return p;
+}
+
+bool MapSerializer::Save(const string &filename, Map *pMap, KeyFrameDatabase *pKFDB)
+{
+    // Tracking and Loop Closing cannot change the map while it is written
+    unique_lock<SharedMutex> lock(pMap->mMutexMapUpdate);
+
+    vector<KeyFrame*> vpKFs;
+    vector<KeyFrame*> vpAllKFs = pMap->GetAllKeyFrames();
+    sort(vpAllKFs.begin(),vpAllKFs.end(),KeyFrame::lId);
+    map<long unsigned int, KeyFrame*> mKFs;
+    for(size_t i=0; i<vpAllKFs.size(); i++)
+    {
+        if(vpAllKFs[i]->isBad())
+            continue;
+        vpKFs.push_back(vpAllKFs[i]);
+        mKFs[vpAllKFs[i]->mnId] = vpAllKFs[i];
+    }
+
+    if(vpKFs.empty())
+    {
+        cerr << "Map is empty, nothing to save." << endl;
+        return false;
+    }
+
+    vector<MapPoint*> vpMPs;
+    vector<MapPoint*> vpAllMPs = pMap->GetAllMapPoints();
+    for(size_t i=0; i<vpAllMPs.size(); i++)
+        if(!vpAllMPs[i]->isBad())
+            vpMPs.push_back(vpAllMPs[i]);
+
+    ofstream f(filename.c_str(), ios::out | ios::binary | ios::trunc);
+    if(!f.is_open())
+    {
+        cerr << "Failed to open map file for writing at: " << filename << endl;
+        return false;
+    }
+
+    Writer w;
+    w.PutArray(MAP_FILE_MAGIC,8);
+    w.Put<uint32_t>(VERSION);
+    w.Put<uint32_t>(pKFDB->mpVoc->size());
+
+    WriteCamera(w,vpKFs[0]);
+
+    w.Put<uint64_t>(vpKFs.size());
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        WriteKeyFrame(w,vpKFs[i]);
+        if(w.Size()>FLUSH_SIZE && !w.Flush(f))
+            break;
+    }
+
+    w.Put<uint64_t>(vpMPs.size());
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        WriteMapPoint(w,vpMPs[i]);
+        if(w.Size()>FLUSH_SIZE && !w.Flush(f))
+            break;
+    }
+
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        WriteKeyFrameGraph(w,vpKFs[i]);
+        if(w.Size()>FLUSH_SIZE && !w.Flush(f))
+            break;
+    }
+
+    vector<uint64_t> vOrigins;
+    for(size_t i=0; i<pMap->mvpKeyFrameOrigins.size(); i++)
+        if(mKFs.count(pMap->mvpKeyFrameOrigins[i]->mnId))
+            vOrigins.push_back(pMap->mvpKeyFrameOrigins[i]->mnId);
+    w.Put<uint32_t>(vOrigins.size());
+    w.PutArray(vOrigins.data(),vOrigins.size());
+
+    bool bOK = WriteDatabase(w,f,pKFDB,mKFs) && w.Flush(f);
+    f.close();
+    bOK = bOK && !f.fail();
+
+    if(!bOK)
+        cerr << "Error writing map file: " << filename << endl;
+    else
+        cout << "Saved " << vpKFs.size() << " keyframes and " << vpMPs.size() << " mappoints" << endl;
+
+    return bOK;
+}
+
+MapSerializer::MappedFile::MappedFile(const string &filename): mpData(NULL), mnSize(0)
+{
+    const int fd = open(filename.c_str(),O_RDONLY);
+    if(fd<0)
+        return;
+
+    struct stat st;
+    if(fstat(fd,&st)==0 && st.st_size>0)
+    {
+        void* pData = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        if(pData!=MAP_FAILED)
+        {
+            // Files are parsed front to back, let the kernel read ahead aggressively
+            madvise(pData,st.st_size,MADV_SEQUENTIAL);
+            mpData = static_cast<const char*>(pData);
+            mnSize = st.st_size;
+        }
+    }
+    close(fd);
+}
+
+MapSerializer::MappedFile::~MappedFile()
+{
+    if(mpData)
+        munmap(const_cast<char*>(mpData),mnSize);
+}
+
+bool MapSerializer::Load(const string &filename, Map *pMap, KeyFrameDatabase *pKFDB, const ORBVocabulary *pVoc)
+{
+    MappedFile file(filename);
+    if(!file.IsOpen())
+    {
+        cerr << "Failed to open map file at: " << filename << endl;
+        return false;
+    }
+
+    Reader r(file.Data(),file.Size());
+    return ReadMap(r,pMap,pKFDB,pVoc);
+}
+
+bool MapSerializer::ReadMap(Reader &r, Map *pMap, KeyFrameDatabase *pKFDB, const ORBVocabulary *pVoc)
+{
+    const char* pMagic = r.GetArray(8);
+    if(!pMagic || memcmp(pMagic,MAP_FILE_MAGIC,8)!=0)
+    {
+        cerr << "Not an ORB-SLAM2 map file." << endl;
+        return false;
+    }
+
+    const unsigned int nVersion = r.Get<uint32_t>();
+    if(nVersion!=VERSION)
+    {
+        cerr << "Unsupported map file version " << nVersion << " (expected " << VERSION << ")." << endl;
+        return false;
+    }
+
+    const unsigned int nWords = r.Get<uint32_t>();
+    if(nWords!=pVoc->size())
+    {
+        cerr << "The map was built with a different vocabulary (" << nWords << " words)." << endl;
+        return false;
+    }
+
+    Frame F;
+    if(!ReadCamera(r,F,pVoc))
+    {
+        cerr << "Corrupted camera section in map file." << endl;
+        return false;
+    }
+
+    map<long unsigned int, KeyFrame*> mKFs;
+    vector<KeyFrame*> vpKFs;
+    vector<MapPoint*> vpMPs;
+    long unsigned int nMaxKFid = 0;
+    long unsigned int nMaxFrameId = 0;
+    long unsigned int nMaxMPid = 0;
+    bool bOK = true;
+
+    const uint64_t nKFs = r.Get<uint64_t>();
+    for(uint64_t i=0; i<nKFs && bOK; i++)
+    {
+        KeyFrame* pKF = ReadKeyFrame(r,F,pMap,pKFDB);
+        if(!pKF)
+        {
+            bOK = false;
+            break;
+        }
+        vpKFs.push_back(pKF);
+        mKFs[pKF->mnId] = pKF;
+        nMaxKFid = max(nMaxKFid,pKF->mnId);
+        nMaxFrameId = max(nMaxFrameId,pKF->mnFrameId);
+    }
+
+    const uint64_t nMPs = bOK ? r.Get<uint64_t>() : 0;
+    for(uint64_t i=0; i<nMPs && bOK; i++)
+    {
+        MapPoint* pMP = ReadMapPoint(r,pMap,mKFs);
+        if(r.Failed())
+            bOK = false;
+        if(pMP)
+        {
+            vpMPs.push_back(pMP);
+            nMaxMPid = max(nMaxMPid,pMP->mnId);
+        }
+    }
+
+    for(uint64_t i=0; i<nKFs && bOK; i++)
+    {
+        ReadKeyFrameGraph(r,mKFs);
+        bOK = !r.Failed();
+    }
+
+    vector<KeyFrame*> vpOrigins;
+    if(bOK)
+    {
+        const unsigned int nOrigins = r.Get<uint32_t>();
+        for(unsigned int i=0; i<nOrigins; i++)
+        {
+            map<long unsigned int, KeyFrame*>::const_iterator mit = mKFs.find(r.Get<uint64_t>());
+            if(mit!=mKFs.end())
+                vpOrigins.push_back(mit->second);
+        }
+        bOK = !r.Failed();
+    }
+
+    bOK = bOK && ReadDatabase(r,pKFDB,mKFs);
+
+    if(!bOK)
+    {
+        cerr << "Corrupted map file." << endl;
+        pKFDB->clear();
+        for(size_t i=0; i<vpMPs.size(); i++)
+            delete vpMPs[i];
+        for(size_t i=0; i<vpKFs.size(); i++)
+            delete vpKFs[i];
+        return false;
+    }
+
+    // Keyframes that were waiting for Loop Closing when the map was saved
+    for(size_t i=0; i<vpKFs.size(); i++)
+        if(pKFDB->GetIndex(vpKFs[i])<0)
+            pKFDB->add(vpKFs[i]);
+
+    for(size_t i=0; i<vpKFs.size(); i++)
+        pMap->AddKeyFrame(vpKFs[i]);
+    for(size_t i=0; i<vpMPs.size(); i++)
+        pMap->AddMapPoint(vpMPs[i]);
+    pMap->mvpKeyFrameOrigins = vpOrigins;
+
+    // New keyframes, mappoints and frames continue the numbering of the loaded map
+    KeyFrame::nNextId = nMaxKFid+1;
+    {
+        unique_lock<mutex> lock(pMap->mMutexPointCreation);
+        MapPoint::nNextId = nMaxMPid+1;
+    }
+    Frame::nNextId = max(Frame::nNextId,nMaxFrameId+1);
+
+    cout << "Loaded " << vpKFs.size() << " keyframes and " << vpMPs.size() << " mappoints" << endl;
+
+    return true;
+}
+
+void MapSerializer::WriteCamera(Writer &w, KeyFrame *pKF)
+{
+    const float calib[9] = {pKF->fx, pKF->fy, pKF->cx, pKF->cy, pKF->invfx, pKF->invfy, pKF->mbf, pKF->mb, pKF->mThDepth};
+    w.PutArray(calib,9);
+
+    cv::Mat K;
+    pKF->mK.convertTo(K,CV_32F);
+    w.PutArray(K.ptr<float>(0),9);
+
+    const float bounds[4] = {static_cast<float>(pKF->mnMinX), static_cast<float>(pKF->mnMinY),
+                             static_cast<float>(pKF->mnMaxX), static_cast<float>(pKF->mnMaxY)};
+    w.PutArray(bounds,4);
+
+    w.Put<int32_t>(pKF->mnGridCols);
+    w.Put<int32_t>(pKF->mnGridRows);
+    w.Put<float>(pKF->mfGridElementWidthInv);
+    w.Put<float>(pKF->mfGridElementHeightInv);
+
+    w.Put<int32_t>(pKF->mnScaleLevels);
+    w.Put<float>(pKF->mfScaleFactor);
+    w.Put<float>(pKF->mfLogScaleFactor);
+    w.PutArray(pKF->mvScaleFactors.data(),pKF->mnScaleLevels);
+    w.PutArray(pKF->mvLevelSigma2.data(),pKF->mnScaleLevels);
+    w.PutArray(pKF->mvInvLevelSigma2.data(),pKF->mnScaleLevels);
+}
+
+bool MapSerializer::ReadCamera(Reader &r, Frame &F, const ORBVocabulary *pVoc)
+{
+    const char* pCalib = r.GetArray(9*sizeof(float));
+    const char* pK = r.GetArray(9*sizeof(float));
+    const char* pBounds = r.GetArray(4*sizeof(float));
+    const int nGridCols = r.Get<int32_t>();
+    const int nGridRows = r.Get<int32_t>();
+    const float fGridElementWidthInv = r.Get<float>();
+    const float fGridElementHeightInv = r.Get<float>();
+    const int nLevels = r.Get<int32_t>();
+    const float fScaleFactor = r.Get<float>();
+    const float fLogScaleFactor = r.Get<float>();
+
+    if(r.Failed() || nGridCols!=FRAME_GRID_COLS || nGridRows!=FRAME_GRID_ROWS || nLevels<=0 || nLevels>64)
+        return false;
+
+    const char* pScales = r.GetArray(3*nLevels*sizeof(float));
+    if(!pScales)
+        return false;
+
+    float calib[9], bounds[4];
+    memcpy(calib,pCalib,sizeof(calib));
+    memcpy(bounds,pBounds,sizeof(bounds));
+
+    // Keyframes take the calibration from the Frame static members
+    Frame::fx = calib[0];
+    Frame::fy = calib[1];
+    Frame::cx = calib[2];
+    Frame::cy = calib[3];
+    Frame::invfx = calib[4];
+    Frame::invfy = calib[5];
+    Frame::mnMinX = bounds[0];
+    Frame::mnMinY = bounds[1];
+    Frame::mnMaxX = bounds[2];
+    Frame::mnMaxY = bounds[3];
+    Frame::mfGridElementWidthInv = fGridElementWidthInv;
+    Frame::mfGridElementHeightInv = fGridElementHeightInv;
+
+    F.mpORBvocabulary = pVoc;
+    F.mbf = calib[6];
+    F.mb = calib[7];
+    F.mThDepth = calib[8];
+    F.mK = cv::Mat(3,3,CV_32F);
+    memcpy(F.mK.data,pK,9*sizeof(float));
+
+    F.mnScaleLevels = nLevels;
+    F.mfScaleFactor = fScaleFactor;
+    F.mfLogScaleFactor = fLogScaleFactor;
+    F.mvScaleFactors.resize(nLevels);
+    F.mvLevelSigma2.resize(nLevels);
+    F.mvInvLevelSigma2.resize(nLevels);
+    memcpy(F.mvScaleFactors.data(),pScales,nLevels*sizeof(float));
+    memcpy(F.mvLevelSigma2.data(),pScales+nLevels*sizeof(float),nLevels*sizeof(float));
+    memcpy(F.mvInvLevelSigma2.data(),pScales+2*nLevels*sizeof(float),nLevels*sizeof(float));
+    F.mvInvScaleFactors.resize(nLevels);
+    for(int i=0; i<nLevels; i++)
+        F.mvInvScaleFactors[i] = 1.0f/F.mvScaleFactors[i];
+
+    return true;
+}
+
+void MapSerializer::WriteKeyPoints(Writer &w, const vector<cv::KeyPoint> &vKeys)
+{
+    for(size_t i=0; i<vKeys.size(); i++)
+    {
+        const cv::KeyPoint &kp = vKeys[i];
+        const float values[5] = {kp.pt.x, kp.pt.y, kp.size, kp.angle, kp.response};
+        w.PutArray(values,5);
+        w.Put<int32_t>(kp.octave);
+        w.Put<int32_t>(kp.class_id);
+    }
+}
+
+void MapSerializer::ReadKeyPoints(Reader &r, const int N, vector<cv::KeyPoint> &vKeys)
+{
+    const size_t nRecord = 5*sizeof(float)+2*sizeof(int32_t);
+    const char* p = r.GetArray(N*nRecord);
+    if(!p)
+        return;
+
+    vKeys.resize(N);
+    for(int i=0; i<N; i++, p+=nRecord)
+    {
+        float values[5];
+        int32_t levels[2];
+        memcpy(values,p,sizeof(values));
+        memcpy(levels,p+sizeof(values),sizeof(levels));
+        vKeys[i] = cv::KeyPoint(values[0],values[1],values[2],values[3],values[4],levels[0],levels[1]);
+    }
+}
+
+void MapSerializer::WriteKeyFrame(Writer &w, KeyFrame *pKF)
+{
+    KeyFramePin pin(pKF);
+
+    w.Put<uint64_t>(pKF->mnId);
+    w.Put<uint64_t>(pKF->mnFrameId);
+    w.Put<double>(pKF->mTimeStamp);
+
+    cv::Mat Tcw = pKF->GetPose();
+    w.PutArray(Tcw.ptr<float>(0),16);
+
+    const int N = pKF->N;
+    w.Put<int32_t>(N);
+    WriteKeyPoints(w,pKF->mvKeys);
+    WriteKeyPoints(w,pKF->mvKeysUn);
+    w.PutArray(pKF->mvuRight.data(),N);
+    w.PutArray(pKF->mvDepth.data(),N);
+
+    const cv::Mat &D = pKF->mDescriptors;
+    w.Put<int32_t>(D.cols);
+    for(int i=0; i<N; i++)
+        w.PutArray(D.ptr<unsigned char>(i),D.cols);
+
+    w.Put<uint32_t>(pKF->mBowVec.size());
+    for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
+    {
+        w.Put<uint32_t>(vit->first);
+        w.Put<double>(vit->second);
+    }
+
+    w.Put<uint32_t>(pKF->mFeatVec.size());
+    for(DBoW2::FeatureVector::const_iterator fit=pKF->mFeatVec.begin(), fend=pKF->mFeatVec.end(); fit!=fend; fit++)
+    {
+        w.Put<uint32_t>(fit->first);
+        w.Put<uint32_t>(fit->second.size());
+        w.PutArray(fit->second.data(),fit->second.size());
+    }
+}
+
+KeyFrame* MapSerializer::ReadKeyFrame(Reader &r, Frame &F, Map *pMap, KeyFrameDatabase *pKFDB)
+{
+    const long unsigned int nId = r.Get<uint64_t>();
+    F.mnId = r.Get<uint64_t>();
+    F.mTimeStamp = r.Get<double>();
+    const char* pTcw = r.GetArray(16*sizeof(float));
+    const int N = r.Get<int32_t>();
+    if(r.Failed() || N<0)
+        return NULL;
+
+    F.N = N;
+    ReadKeyPoints(r,N,F.mvKeys.Mutable());
+    ReadKeyPoints(r,N,F.mvKeysUn.Mutable());
+
+    const char* puRight = r.GetArray(N*sizeof(float));
+    const char* pDepth = r.GetArray(N*sizeof(float));
+    const int nDescCols = r.Get<int32_t>();
+    const char* pDesc = r.GetArray(N*max(nDescCols,0));
+    if(r.Failed() || nDescCols<=0)
+        return NULL;
+
+    vector<float> &vuRight = F.mvuRight.Mutable();
+    vector<float> &vDepth = F.mvDepth.Mutable();
+    vuRight.resize(N);
+    vDepth.resize(N);
+    memcpy(vuRight.data(),puRight,N*sizeof(float));
+    memcpy(vDepth.data(),pDepth,N*sizeof(float));
+
+    // The keyframe shares the descriptors of the frame, they are copied out of the mapped file
+    F.mDescriptors = cv::Mat(N,nDescCols,CV_8U,const_cast<char*>(pDesc)).clone();
+
+    F.mBowVec.clear();
+    const unsigned int nBow = r.Get<uint32_t>();
+    for(unsigned int i=0; i<nBow && !r.Failed(); i++)
+    {
+        const DBoW2::WordId wordId = r.Get<uint32_t>();
+        const DBoW2::WordValue value = r.Get<double>();
+        F.mBowVec.insert(F.mBowVec.end(),make_pair(wordId,value));
+    }
+
+    F.mFeatVec.clear();
+    const unsigned int nNodes = r.Get<uint32_t>();
+    for(unsigned int i=0; i<nNodes && !r.Failed(); i++)
+    {
+        const DBoW2::NodeId nodeId = r.Get<uint32_t>();
+        const unsigned int nFeatures = r.Get<uint32_t>();
+        const char* pFeatures = r.GetArray(nFeatures*sizeof(uint32_t));
+        if(!pFeatures)
+            break;
+        vector<unsigned int> vFeatures(nFeatures);
+        memcpy(vFeatures.data(),pFeatures,nFeatures*sizeof(uint32_t));
+        F.mFeatVec.insert(F.mFeatVec.end(),make_pair(nodeId,vFeatures));
+    }
+
+    if(r.Failed())
+        return NULL;
+
+    // The grid is not stored, it is rebuilt from the undistorted keypoints
+    F.AssignFeaturesToGrid();
+
+    F.mvpMapPoints.assign(N,static_cast<MapPoint*>(NULL));
+
+    cv::Mat Tcw(4,4,CV_32F);
+    memcpy(Tcw.data,pTcw,16*sizeof(float));
+    F.SetPose(Tcw);
+
+    KeyFrame* pKF = new KeyFrame(F,pMap,pKFDB);
+    pKF->mnId = nId;
+
+    return pKF;
+}
+
+void MapSerializer::WriteMapPoint(Writer &w, MapPoint *pMP)
+{
+    w.Put<uint64_t>(pMP->mnId);
+    w.Put<int64_t>(pMP->mnFirstKFid);
+    w.Put<int64_t>(pMP->mnFirstFrame);
+
+    cv::Mat Pos = pMP->GetWorldPos();
+    cv::Mat Normal = pMP->GetNormal();
+    w.PutArray(Pos.ptr<float>(0),3);
+    w.PutArray(Normal.ptr<float>(0),3);
+
+    cv::Mat D = pMP->GetDescriptor();
+    w.Put<int32_t>(D.cols);
+    if(!D.empty())
+        w.PutArray(D.ptr<unsigned char>(0),D.cols);
+
+    KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
+    w.Put<int64_t>(pRefKF ? static_cast<int64_t>(pRefKF->mnId) : -1);
+
+    {
+        unique_lock<mutex> lock(pMP->mMutexPos);
+        w.Put<float>(pMP->mfMinDistance);
+        w.Put<float>(pMP->mfMaxDistance);
+    }
+    {
+        unique_lock<mutex> lock(pMP->mMutexFeatures);
+        w.Put<int32_t>(pMP->mnVisible);
+        w.Put<int32_t>(pMP->mnFound);
+    }
+
+    ObservationList observations = pMP->GetObservations();
+    w.Put<uint32_t>(observations.size());
+    for(ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    {
+        w.Put<uint64_t>(mit->first->mnId);
+        w.Put<uint32_t>(mit->second);
+    }
+}
+
+MapPoint* MapSerializer::ReadMapPoint(Reader &r, Map *pMap, const map<long unsigned int, KeyFrame *> &mKFs)
+{
+    const long unsigned int nId = r.Get<uint64_t>();
+    const long int nFirstKFid = r.Get<int64_t>();
+    const long int nFirstFrame = r.Get<int64_t>();
+    const char* pPos = r.GetArray(3*sizeof(float));
+    const char* pNormal = r.GetArray(3*sizeof(float));
+    const int nDescCols = r.Get<int32_t>();
+    const char* pDesc = r.GetArray(max(nDescCols,0));
+    const int64_t nRefKFid = r.Get<int64_t>();
+    const float fMinDistance = r.Get<float>();
+    const float fMaxDistance = r.Get<float>();
+    const int nVisible = r.Get<int32_t>();
+    const int nFound = r.Get<int32_t>();
+
+    vector<pair<KeyFrame*,size_t> > vObservations;
+    const unsigned int nObs = r.Get<uint32_t>();
+    for(unsigned int i=0; i<nObs && !r.Failed(); i++)
+    {
+        map<long unsigned int, KeyFrame*>::const_iterator mit = mKFs.find(r.Get<uint64_t>());
+        const size_t idx = r.Get<uint32_t>();
+        if(mit!=mKFs.end() && idx<static_cast<size_t>(mit->second->N))
+            vObservations.push_back(make_pair(mit->second,idx));
+    }
+
+    if(r.Failed() || vObservations.empty())
+        return NULL;
+
+    KeyFrame* pRefKF = vObservations[0].first;
+    if(nRefKFid>=0)
+    {
+        map<long unsigned int, KeyFrame*>::const_iterator mit = mKFs.find(nRefKFid);
+        if(mit!=mKFs.end())
+            pRefKF = mit->second;
+    }
+
+    cv::Mat Pos(3,1,CV_32F);
+    memcpy(Pos.data,pPos,3*sizeof(float));
+
+    MapPoint* pMP = new MapPoint(Pos,pRefKF,pMap);
+    pMP->mnId = nId;
+    pMP->mnFirstKFid = nFirstKFid;
+    pMP->mnFirstFrame = nFirstFrame;
+    memcpy(pMP->mNormalVector.data,pNormal,3*sizeof(float));
+    if(nDescCols>0)
+        pMP->mDescriptor = cv::Mat(1,nDescCols,CV_8U,const_cast<char*>(pDesc)).clone();
+    pMP->mfMinDistance = fMinDistance;
+    pMP->mfMaxDistance = fMaxDistance;
+    pMP->mnVisible = nVisible;
+    pMP->mnFound = nFound;
+
+    for(size_t i=0; i<vObservations.size(); i++)
+    {
+        pMP->AddObservation(vObservations[i].first,vObservations[i].second);
+        vObservations[i].first->AddMapPoint(pMP,vObservations[i].second);
+    }
+
+    return pMP;
+}
+
+void MapSerializer::WriteKeyFrameGraph(Writer &w, KeyFrame *pKF)
+{
+    w.Put<uint64_t>(pKF->mnId);
+
+    KeyFrame* pParent = pKF->GetParent();
+    w.Put<int64_t>(pParent ? static_cast<int64_t>(pParent->mnId) : -1);
+
+    set<KeyFrame*> sConnected = pKF->GetConnectedKeyFrames();
+    w.Put<uint32_t>(sConnected.size());
+    for(set<KeyFrame*>::iterator sit=sConnected.begin(), send=sConnected.end(); sit!=send; sit++)
+    {
+        w.Put<uint64_t>((*sit)->mnId);
+        w.Put<int32_t>(pKF->GetWeight(*sit));
+    }
+
+    set<KeyFrame*> sLoopEdges = pKF->GetLoopEdges();
+    w.Put<uint32_t>(sLoopEdges.size());
+    for(set<KeyFrame*>::iterator sit=sLoopEdges.begin(), send=sLoopEdges.end(); sit!=send; sit++)
+        w.Put<uint64_t>((*sit)->mnId);
+}
+
+void MapSerializer::ReadKeyFrameGraph(Reader &r, const map<long unsigned int, KeyFrame *> &mKFs)
+{
+    map<long unsigned int, KeyFrame*>::const_iterator mend = mKFs.end();
+    map<long unsigned int, KeyFrame*>::const_iterator mit = mKFs.find(r.Get<uint64_t>());
+    KeyFrame* pKF = mit!=mend ? mit->second : NULL;
+
+    const int64_t nParentId = r.Get<int64_t>();
+
+    // The weights were rebuilt by the observations of the mappoints, the saved ones are skipped
+    const unsigned int nConnections = r.Get<uint32_t>();
+    for(unsigned int i=0; i<nConnections && !r.Failed(); i++)
+    {
+        r.Get<uint64_t>();
+        r.Get<int32_t>();
+    }
+
+    vector<KeyFrame*> vpLoopEdges;
+    const unsigned int nLoopEdges = r.Get<uint32_t>();
+    for(unsigned int i=0; i<nLoopEdges && !r.Failed(); i++)
+    {
+        mit = mKFs.find(r.Get<uint64_t>());
+        if(mit!=mend)
+            vpLoopEdges.push_back(mit->second);
+    }
+
+    if(!pKF || r.Failed())
+        return;
+
+    {
+        unique_lock<mutex> lock(pKF->mMutexConnections);
+        pKF->mbFirstConnection = false;
+    }
+
+    if(nParentId>=0)
+    {
+        mit = mKFs.find(nParentId);
+        if(mit!=mend)
+            pKF->ChangeParent(mit->second);
+    }
+
+    for(size_t i=0; i<vpLoopEdges.size(); i++)
+        pKF->AddLoopEdge(vpLoopEdges[i]);
+}
+
+bool MapSerializer::WriteDatabase(Writer &w, ofstream &f, KeyFrameDatabase *pKFDB, const map<long unsigned int, KeyFrame *> &mKFs)
+{
+    // Writers are blocked, the index does not change while it is written
+    unique_lock<mutex> lockWriters(pKFDB->mMutexWriters);
+
+    // Erased keyframes are dropped and the remaining ones renumbered, as in a compaction
+    vector<int> vNewIndices(pKFDB->mvpKeyFrames.size(),-1);
+    vector<uint64_t> vIds;
+    for(size_t i=0; i<pKFDB->mvpKeyFrames.size(); i++)
+    {
+        KeyFrame* pKF = pKFDB->mvpKeyFrames[i];
+        if(pKF && mKFs.count(pKF->mnId))
+        {
+            vNewIndices[i] = vIds.size();
+            vIds.push_back(pKF->mnId);
+        }
+    }
+
+    w.Put<uint32_t>(vIds.size());
+    w.PutArray(vIds.data(),vIds.size());
+
+    const vector<vector<KeyFrameDatabase::Posting> > &vInvertedFile = pKFDB->mvInvertedFile;
+
+    unsigned int nWords = 0;
+    for(size_t wid=0; wid<vInvertedFile.size(); wid++)
+    {
+        for(size_t i=0; i<vInvertedFile[wid].size(); i++)
+        {
+            if(vNewIndices[vInvertedFile[wid][i].mnIndex]>=0)
+            {
+                nWords++;
+                break;
+            }
+        }
+    }
+    w.Put<uint32_t>(nWords);
+
+    vector<KeyFrameDatabase::Posting> vPostings;
+    for(size_t wid=0; wid<vInvertedFile.size(); wid++)
+    {
+        vPostings.clear();
+        for(size_t i=0; i<vInvertedFile[wid].size(); i++)
+        {
+            const int newIdx = vNewIndices[vInvertedFile[wid][i].mnIndex];
+            if(newIdx>=0)
+            {
+                vPostings.push_back(vInvertedFile[wid][i]);
+                vPostings.back().mnIndex = newIdx;
+            }
+        }
+        if(vPostings.empty())
+            continue;
+
+        w.Put<uint32_t>(wid);
+        w.Put<uint32_t>(vPostings.size());
+        w.PutArray(vPostings.data(),vPostings.size());
+
+        if(w.Size()>FLUSH_SIZE && !w.Flush(f))
+            return false;
+    }
+
+    return true;
+}
+
+bool MapSerializer::ReadDatabase(Reader &r, KeyFrameDatabase *pKFDB, const map<long unsigned int, KeyFrame *> &mKFs)
+{
+    const unsigned int nKFs = r.Get<uint32_t>();
+    const char* pIds = r.GetArray(nKFs*sizeof(uint64_t));
+    if(!pIds)
+        return false;
+
+    unique_lock<mutex> lockWriters(pKFDB->mMutexWriters);
+    unique_lock<SharedMutex> lock(pKFDB->mMutex);
+
+    vector<KeyFrame*> &vpKeyFrames = pKFDB->mvpKeyFrames;
+    vpKeyFrames.assign(nKFs,static_cast<KeyFrame*>(NULL));
+    pKFDB->mvnPostings.assign(nKFs,0);
+    for(unsigned int i=0; i<nKFs; i++)
+    {
+        uint64_t nId;
+        memcpy(&nId,pIds+i*sizeof(uint64_t),sizeof(uint64_t));
+        map<long unsigned int, KeyFrame*>::const_iterator mit = mKFs.find(nId);
+        if(mit==mKFs.end())
+            continue;
+        vpKeyFrames[i] = mit->second;
+        if(nId>=pKFDB->mvKeyFrameIndices.size())
+            pKFDB->mvKeyFrameIndices.resize(nId+1,-1);
+        pKFDB->mvKeyFrameIndices[nId] = i;
+    }
+
+    // Posting lists are copied in bulk from the mapping
+    const unsigned int nWords = r.Get<uint32_t>();
+    for(unsigned int i=0; i<nWords && !r.Failed(); i++)
+    {
+        const unsigned int wid = r.Get<uint32_t>();
+        const unsigned int nPostings = r.Get<uint32_t>();
+        const char* pPostings = r.GetArray(nPostings*sizeof(KeyFrameDatabase::Posting));
+        if(!pPostings || wid>=pKFDB->mvInvertedFile.size())
+            return false;
+
+        vector<KeyFrameDatabase::Posting> &vPostings = pKFDB->mvInvertedFile[wid];
+        vPostings.resize(nPostings);
+        memcpy(vPostings.data(),pPostings,nPostings*sizeof(KeyFrameDatabase::Posting));
+
+        float maxWeight = 0;
+        for(size_t j=0; j<vPostings.size(); j++)
+        {
+            if(vPostings[j].mnIndex>=nKFs)
+                return false;
+            pKFDB->mvnPostings[vPostings[j].mnIndex]++;
+            maxWeight = max(maxWeight,vPostings[j].mWeight);
+        }
+        pKFDB->mvMaxWeights[wid] = maxWeight;
+        pKFDB->mnPostings += nPostings;
+    }
+
+    // Postings of keyframes missing from the map are dropped in the next compaction
+    for(unsigned int i=0; i<nKFs; i++)
+        if(!vpKeyFrames[i])
+            pKFDB->mnErasedPostings += pKFDB->mvnPostings[i];
+
+    return !r.Failed();
+}
+
+} //namespace ORB_SLAM
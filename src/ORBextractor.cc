@@ -73,6 +73,11 @@ const int PATCH_SIZE = 31;
 const int HALF_PATCH_SIZE = 15;
 const int EDGE_THRESHOLD = 19;
 
+// Guided extraction: cells (in pixels of each level) marked around the predictions, and
+// keypoints kept in each of them
+const int GUIDED_CELL = 15;
+const int GUIDED_PER_CELL = 2;
+
 
 static float IC_Angle(const Mat& image, Point2f pt,  const vector<int> & u_max)
 {
@@ -410,7 +415,7 @@ static int bit_pattern_31_[256*4] =
 ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels,
          int _iniThFAST, int _minThFAST):
     nfeatures(_nfeatures), scaleFactor(_scaleFactor), nlevels(_nlevels),
-    iniThFAST(_iniThFAST), minThFAST(_minThFAST)
+    iniThFAST(_iniThFAST), minThFAST(_minThFAST), mfExploreRatio(1.0f)
 {
     mvScaleFactor.resize(nlevels);
     mvLevelSigma2.resize(nlevels);
@@ -831,8 +836,12 @@ void ORBextractor::ComputeKeyPointsOctTree(vector<vector<KeyPoint> >& allKeypoin
         vector<KeyPoint> & keypoints = allKeypoints[level];
         keypoints.reserve(nfeatures);
 
-        keypoints = DistributeOctTree(vToDistributeKeys, minBorderX, maxBorderX,
-                                      minBorderY, maxBorderY,mnFeaturesPerLevel[level], level);
+        if(mvPredicted.empty())
+            keypoints = DistributeOctTree(vToDistributeKeys, minBorderX, maxBorderX,
+                                          minBorderY, maxBorderY,mnFeaturesPerLevel[level], level);
+        else
+            keypoints = DistributeGuided(vToDistributeKeys, minBorderX, maxBorderX,
+                                         minBorderY, maxBorderY, level);
 
         const int scaledPatchSize = PATCH_SIZE*mvScaleFactor[level];
 
@@ -852,6 +861,74 @@ void ORBextractor::ComputeKeyPointsOctTree(vector<vector<KeyPoint> >& allKeypoin
         computeOrientation(mvImagePyramid[level], allKeypoints[level], umax);
 }
 
+void ORBextractor::SetPredictions(const vector<KeyPoint> &vPredicted, const float fExploreRatio)
+{
+    mvPredicted = vPredicted;
+    mfExploreRatio = max(0.0f,min(1.0f,fExploreRatio));
+}
+
+vector<cv::KeyPoint> ORBextractor::DistributeGuided(const vector<cv::KeyPoint>& vToDistributeKeys, const int &minX,
+                                                    const int &maxX, const int &minY, const int &maxY, const int &level)
+{
+    const int nFeatures = mnFeaturesPerLevel[level];
+    const int nExplore = cvRound(mfExploreRatio*nFeatures);
+    const int nGuided = nFeatures-nExplore;
+
+    // Mark the cells around the predictions matched at this level (the searches use the
+    // predicted octave and the one below). Keypoints are relative to (minX,minY).
+    const int nCellsX = (maxX-minX)/GUIDED_CELL+1;
+    const int nCellsY = (maxY-minY)/GUIDED_CELL+1;
+    vector<int> vnCellKeys(nCellsX*nCellsY,-1);
+
+    const float scale = mvInvScaleFactor[level];
+    for(size_t i=0; i<mvPredicted.size(); i++)
+    {
+        const KeyPoint &pred = mvPredicted[i];
+        if(pred.octave!=level && pred.octave!=level+1)
+            continue;
+
+        const int cx = floor((pred.pt.x*scale-minX)/GUIDED_CELL);
+        const int cy = floor((pred.pt.y*scale-minY)/GUIDED_CELL);
+        for(int x=max(cx-1,0); x<=min(cx+1,nCellsX-1); x++)
+            for(int y=max(cy-1,0); y<=min(cy+1,nCellsY-1); y++)
+                vnCellKeys[y*nCellsX+x] = 0;
+    }
+
+    // Best keypoints of each marked cell, the others are left to the exploration
+    vector<pair<float,int> > vOrder(vToDistributeKeys.size());
+    for(size_t i=0; i<vToDistributeKeys.size(); i++)
+        vOrder[i] = make_pair(vToDistributeKeys[i].response,i);
+    sort(vOrder.begin(),vOrder.end(),greater<pair<float,int> >());
+
+    vector<cv::KeyPoint> vResultKeys;
+    vResultKeys.reserve(nFeatures);
+    vector<cv::KeyPoint> vToExplore;
+    vToExplore.reserve(vToDistributeKeys.size());
+    for(size_t i=0; i<vOrder.size(); i++)
+    {
+        const KeyPoint &kp = vToDistributeKeys[vOrder[i].second];
+        const int cx = min(max(0,(int)(kp.pt.x/GUIDED_CELL)),nCellsX-1);
+        const int cy = min(max(0,(int)(kp.pt.y/GUIDED_CELL)),nCellsY-1);
+        int &nCellKeys = vnCellKeys[cy*nCellsX+cx];
+
+        if(nCellKeys>=0 && nCellKeys<GUIDED_PER_CELL && (int)vResultKeys.size()<nGuided)
+        {
+            vResultKeys.push_back(kp);
+            nCellKeys++;
+        }
+        else if(nCellKeys<0)
+            vToExplore.push_back(kp);
+    }
+
+    if(nExplore>0 && !vToExplore.empty())
+    {
+        vector<cv::KeyPoint> vExploreKeys = DistributeOctTree(vToExplore, minX, maxX, minY, maxY, nExplore, level);
+        vResultKeys.insert(vResultKeys.end(),vExploreKeys.begin(),vExploreKeys.end());
+    }
+
+    return vResultKeys;
+}
+
 void ORBextractor::ComputeKeyPointsOld(std::vector<std::vector<KeyPoint> > &allKeypoints)
 {
     allKeypoints.resize(nlevels);
@@ -1056,6 +1133,9 @@ void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPo
     ComputeKeyPointsOctTree(allKeypoints);
     //ComputeKeyPointsOld(allKeypoints);
 
+    // Predictions only guide one extraction
+    mvPredicted.clear();
+
     Mat descriptors;
 
     int nkeypoints = 0;
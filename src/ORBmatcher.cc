@@ -37,36 +37,43 @@ namespace ORB_SLAM2
 const int ORBmatcher::TH_HIGH = 100;
 const int ORBmatcher::TH_LOW = 50;
 const int ORBmatcher::HISTO_LENGTH = 30;
+const float ORBmatcher::TH_SIGMA = 3.0f;
 
-ORBmatcher::ORBmatcher(float nnratio, bool checkOri): mfNNratio(nnratio), mbCheckOrientation(checkOri)
+ORBmatcher::ORBmatcher(float nnratio, bool checkOri): mnDescriptorComparisons(0), mfNNratio(nnratio), mbCheckOrientation(checkOri)
 {
 }
 
-int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoints, const float th)
+int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPointProjection> &vProjections, const float th)
 {
+    vector<size_t> vIndices;
     int nmatches=0;
 
     const bool bFactor = th!=1.0;
 
-    for(size_t iMP=0; iMP<vpMapPoints.size(); iMP++)
+    for(size_t iMP=0; iMP<vProjections.size(); iMP++)
     {
-        MapPoint* pMP = vpMapPoints[iMP];
-        if(!pMP->mbTrackInView)
-            continue;
+        const MapPointProjection &proj = vProjections[iMP];
+        MapPoint* pMP = proj.pMP;
 
         if(pMP->isBad())
             continue;
 
-        const int &nPredictedLevel = pMP->mnTrackScaleLevel;
+        const int &nPredictedLevel = proj.nLevel;
 
         // The size of the window will depend on the viewing direction
-        float r = RadiusByViewingCos(pMP->mTrackViewCos);
+        float r = RadiusByViewingCos(proj.viewCos);
 
         if(bFactor)
             r*=th;
 
-        const vector<size_t> vIndices =
-                F.GetFeaturesInArea(pMP->mTrackProjX,pMP->mTrackProjY,r*F.mvScaleFactors[nPredictedLevel],nPredictedLevel-1,nPredictedLevel);
+        float radius = r*F.mvScaleFactors[nPredictedLevel];
+
+        // With a known pose uncertainty the window covers the predicted projection error and the keypoint
+        // noise. It is never larger than the fixed window, and never smaller than the keypoint noise of the level.
+        if(proj.sigma>=0)
+            radius = min(radius,TH_SIGMA*sqrt(proj.sigma*proj.sigma+F.mvLevelSigma2[nPredictedLevel]));
+
+        F.GetFeaturesInArea(proj.u,proj.v,radius,vIndices,nPredictedLevel-1,nPredictedLevel);
 
         if(vIndices.empty())
             continue;
@@ -90,14 +97,15 @@ int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoint
 
             if(F.mvuRight[idx]>0)
             {
-                const float er = fabs(pMP->mTrackProjXR-F.mvuRight[idx]);
-                if(er>r*F.mvScaleFactors[nPredictedLevel])
+                const float er = fabs(proj.uR-F.mvuRight[idx]);
+                if(er>radius)
                     continue;
             }
 
             const cv::Mat &d = F.mDescriptors.row(idx);
 
             const int dist = DescriptorDistance(MPdescriptor,d);
+            mnDescriptorComparisons++;
 
             if(dist<bestDist)
             {
@@ -158,6 +166,8 @@ bool ORBmatcher::CheckDistEpipolarLine(const cv::KeyPoint &kp1,const cv::KeyPoin
 
 int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPointMatches)
 {
+    KeyFramePin pin(pKF);
+
     const vector<MapPoint*> vpMapPointsKF = pKF->GetMapPointMatches();
 
     vpMapPointMatches = vector<MapPoint*>(F.N,static_cast<MapPoint*>(NULL));
@@ -289,6 +299,9 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
 
 int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapPoint*> &vpPoints, vector<MapPoint*> &vpMatched, int th)
 {
+    vector<size_t> vIndices;
+    KeyFramePin pin(pKF);
+
     // Get Calibration Parameters for later projection
     const float &fx = pKF->fx;
     const float &fy = pKF->fy;
@@ -359,7 +372,7 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
         // Search in a radius
         const float radius = th*pKF->mvScaleFactors[nPredictedLevel];
 
-        const vector<size_t> vIndices = pKF->GetFeaturesInArea(u,v,radius);
+        pKF->GetFeaturesInArea(u,v,radius,vIndices);
 
         if(vIndices.empty())
             continue;
@@ -404,6 +417,7 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
 
 int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f> &vbPrevMatched, vector<int> &vnMatches12, int windowSize)
 {
+    vector<size_t> vIndices2;
     int nmatches=0;
     vnMatches12 = vector<int>(F1.mvKeysUn.size(),-1);
 
@@ -422,7 +436,7 @@ int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f
         if(level1>0)
             continue;
 
-        vector<size_t> vIndices2 = F2.GetFeaturesInArea(vbPrevMatched[i1].x,vbPrevMatched[i1].y, windowSize,level1,level1);
+        F2.GetFeaturesInArea(vbPrevMatched[i1].x,vbPrevMatched[i1].y,windowSize,vIndices2,level1,level1);
 
         if(vIndices2.empty())
             continue;
@@ -521,6 +535,9 @@ int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f
 
 int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &vpMatches12)
 {
+    KeyFramePin pin1(pKF1);
+    KeyFramePin pin2(pKF2);
+
     const vector<cv::KeyPoint> &vKeysUn1 = pKF1->mvKeysUn;
     const DBoW2::FeatureVector &vFeatVec1 = pKF1->mFeatVec;
     const vector<MapPoint*> vpMapPoints1 = pKF1->GetMapPointMatches();
@@ -657,6 +674,9 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
 int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F12,
                                        vector<pair<size_t, size_t> > &vMatchedPairs, const bool bOnlyStereo)
 {    
+    KeyFramePin pin1(pKF1);
+    KeyFramePin pin2(pKF2);
+
     const DBoW2::FeatureVector &vFeatVec1 = pKF1->mFeatVec;
     const DBoW2::FeatureVector &vFeatVec2 = pKF2->mFeatVec;
 
@@ -824,6 +844,9 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
 
 int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const float th)
 {
+    vector<size_t> vIndices;
+    KeyFramePin pin(pKF);
+
     cv::Mat Rcw = pKF->GetRotation();
     cv::Mat tcw = pKF->GetTranslation();
 
@@ -889,7 +912,7 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
         // Search in a radius
         const float radius = th*pKF->mvScaleFactors[nPredictedLevel];
 
-        const vector<size_t> vIndices = pKF->GetFeaturesInArea(u,v,radius);
+        pKF->GetFeaturesInArea(u,v,radius,vIndices);
 
         if(vIndices.empty())
             continue;
@@ -976,6 +999,9 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
 
 int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoints, float th, vector<MapPoint *> &vpReplacePoint)
 {
+    vector<size_t> vIndices;
+    KeyFramePin pin(pKF);
+
     // Get Calibration Parameters for later projection
     const float &fx = pKF->fx;
     const float &fy = pKF->fy;
@@ -1048,7 +1074,7 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
         // Search in a radius
         const float radius = th*pKF->mvScaleFactors[nPredictedLevel];
 
-        const vector<size_t> vIndices = pKF->GetFeaturesInArea(u,v,radius);
+        pKF->GetFeaturesInArea(u,v,radius,vIndices);
 
         if(vIndices.empty())
             continue;
@@ -1102,6 +1128,10 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
 int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &vpMatches12,
                              const float &s12, const cv::Mat &R12, const cv::Mat &t12, const float th)
 {
+    vector<size_t> vIndices;
+    KeyFramePin pin1(pKF1);
+    KeyFramePin pin2(pKF2);
+
     const float &fx = pKF1->fx;
     const float &fy = pKF1->fy;
     const float &cx = pKF1->cx;
@@ -1188,7 +1218,7 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
         // Search in a radius
         const float radius = th*pKF2->mvScaleFactors[nPredictedLevel];
 
-        const vector<size_t> vIndices = pKF2->GetFeaturesInArea(u,v,radius);
+        pKF2->GetFeaturesInArea(u,v,radius,vIndices);
 
         if(vIndices.empty())
             continue;
@@ -1268,7 +1298,7 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
         // Search in a radius of 2.5*sigma(ScaleLevel)
         const float radius = th*pKF1->mvScaleFactors[nPredictedLevel];
 
-        const vector<size_t> vIndices = pKF1->GetFeaturesInArea(u,v,radius);
+        pKF1->GetFeaturesInArea(u,v,radius,vIndices);
 
         if(vIndices.empty())
             continue;
@@ -1327,6 +1357,7 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
 
 int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th, const bool bMono)
 {
+    vector<size_t> vIndices2;
     int nmatches = 0;
 
     // Rotation Histogram (to check rotation consistency)
@@ -1348,6 +1379,8 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
     const bool bForward = tlc.at<float>(2)>CurrentFrame.mb && !bMono;
     const bool bBackward = -tlc.at<float>(2)>CurrentFrame.mb && !bMono;
 
+    const bool bPoseCov = !CurrentFrame.mPoseCov.empty();
+
     for(int i=0; i<LastFrame.N; i++)
     {
         MapPoint* pMP = LastFrame.mvpMapPoints[i];
@@ -1380,14 +1413,21 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
                 // Search in a window. Size depends on scale
                 float radius = th*CurrentFrame.mvScaleFactors[nLastOctave];
 
-                vector<size_t> vIndices2;
+                // Narrower if the predicted pose uncertainty is known
+                if(bPoseCov)
+                {
+                    const float sigma = CurrentFrame.ProjectionSigma(xc,yc,x3Dc.at<float>(2));
+                    if(sigma>=0)
+                        radius = min(radius,TH_SIGMA*sqrt(sigma*sigma+CurrentFrame.mvLevelSigma2[nLastOctave]));
+                }
+
 
                 if(bForward)
-                    vIndices2 = CurrentFrame.GetFeaturesInArea(u,v, radius, nLastOctave);
+                    CurrentFrame.GetFeaturesInArea(u,v,radius,vIndices2,nLastOctave);
                 else if(bBackward)
-                    vIndices2 = CurrentFrame.GetFeaturesInArea(u,v, radius, 0, nLastOctave);
+                    CurrentFrame.GetFeaturesInArea(u,v,radius,vIndices2,0,nLastOctave);
                 else
-                    vIndices2 = CurrentFrame.GetFeaturesInArea(u,v, radius, nLastOctave-1, nLastOctave+1);
+                    CurrentFrame.GetFeaturesInArea(u,v,radius,vIndices2,nLastOctave-1,nLastOctave+1);
 
                 if(vIndices2.empty())
                     continue;
@@ -1415,6 +1455,7 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
                     const cv::Mat &d = CurrentFrame.mDescriptors.row(i2);
 
                     const int dist = DescriptorDistance(dMP,d);
+                    mnDescriptorComparisons++;
 
                     if(dist<bestDist)
                     {
@@ -1471,6 +1512,7 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
 
 int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set<MapPoint*> &sAlreadyFound, const float th , const int ORBdist)
 {
+    vector<size_t> vIndices2;
     int nmatches = 0;
 
     const cv::Mat Rcw = CurrentFrame.mTcw.rowRange(0,3).colRange(0,3);
@@ -1493,66 +1535,9 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
         {
             if(!pMP->isBad() && !sAlreadyFound.count(pMP))
             {
-                //Project
-                cv::Mat x3Dw = pMP->GetWorldPos();
-                cv::Mat x3Dc = Rcw*x3Dw+tcw;
-
-                const float xc = x3Dc.at<float>(0);
-                const float yc = x3Dc.at<float>(1);
-                const float invzc = 1.0/x3Dc.at<float>(2);
-
-                const float u = CurrentFrame.fx*xc*invzc+CurrentFrame.cx;
-                const float v = CurrentFrame.fy*yc*invzc+CurrentFrame.cy;
-
-                if(u<CurrentFrame.mnMinX || u>CurrentFrame.mnMaxX)
-                    continue;
-                if(v<CurrentFrame.mnMinY || v>CurrentFrame.mnMaxY)
-                    continue;
-
-                // Compute predicted scale level
-                cv::Mat PO = x3Dw-Ow;
-                float dist3D = cv::norm(PO);
-
-                const float maxDistance = pMP->GetMaxDistanceInvariance();
-                const float minDistance = pMP->GetMinDistanceInvariance();
-
-                // Depth must be inside the scale pyramid of the image
-                if(dist3D<minDistance || dist3D>maxDistance)
-                    continue;
-
-                int nPredictedLevel = pMP->PredictScale(dist3D,&CurrentFrame);
-
-                // Search in a window
-                const float radius = th*CurrentFrame.mvScaleFactors[nPredictedLevel];
-
-                const vector<size_t> vIndices2 = CurrentFrame.GetFeaturesInArea(u, v, radius, nPredictedLevel-1, nPredictedLevel+1);
-
-                if(vIndices2.empty())
-                    continue;
-
-                const cv::Mat dMP = pMP->GetDescriptor();
-
-                int bestDist = 256;
-                int bestIdx2 = -1;
-
-                for(vector<size_t>::const_iterator vit=vIndices2.begin(); vit!=vIndices2.end(); vit++)
-                {
-                    const size_t i2 = *vit;
-                    if(CurrentFrame.mvpMapPoints[i2])
-                        continue;
-
-                    const cv::Mat &d = CurrentFrame.mDescriptors.row(i2);
-
-                    const int dist = DescriptorDistance(dMP,d);
-
-                    if(dist<bestDist)
-                    {
-                        bestDist=dist;
-                        bestIdx2=i2;
-                    }
-                }
+                const int bestIdx2 = MatchProjectedPoint(CurrentFrame,pMP,Rcw,tcw,Ow,th,ORBdist,vIndices2);
 
-                if(bestDist<=ORBdist)
+                if(bestIdx2>=0)
                 {
                     CurrentFrame.mvpMapPoints[bestIdx2]=pMP;
                     nmatches++;
@@ -1598,6 +1583,99 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
     return nmatches;
 }
 
+int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const vector<MapPoint*> &vpMapPoints, const set<MapPoint*> &sAlreadyFound, const float th, const int ORBdist)
+{
+    vector<size_t> vIndices2;
+    int nmatches = 0;
+
+    const cv::Mat Rcw = CurrentFrame.mTcw.rowRange(0,3).colRange(0,3);
+    const cv::Mat tcw = CurrentFrame.mTcw.rowRange(0,3).col(3);
+    const cv::Mat Ow = -Rcw.t()*tcw;
+
+    for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+    {
+        MapPoint* pMP = vpMapPoints[i];
+
+        if(pMP->isBad() || sAlreadyFound.count(pMP))
+            continue;
+
+        const int bestIdx2 = MatchProjectedPoint(CurrentFrame,pMP,Rcw,tcw,Ow,th,ORBdist,vIndices2);
+
+        if(bestIdx2>=0)
+        {
+            CurrentFrame.mvpMapPoints[bestIdx2]=pMP;
+            nmatches++;
+        }
+    }
+
+    return nmatches;
+}
+
+int ORBmatcher::MatchProjectedPoint(Frame &CurrentFrame, MapPoint *pMP, const cv::Mat &Rcw, const cv::Mat &tcw, const cv::Mat &Ow,
+                                    const float th, const int ORBdist, vector<size_t> &vIndices2)
+{
+    //Project
+    cv::Mat x3Dw = pMP->GetWorldPos();
+    cv::Mat x3Dc = Rcw*x3Dw+tcw;
+
+    const float xc = x3Dc.at<float>(0);
+    const float yc = x3Dc.at<float>(1);
+    const float invzc = 1.0/x3Dc.at<float>(2);
+
+    const float u = CurrentFrame.fx*xc*invzc+CurrentFrame.cx;
+    const float v = CurrentFrame.fy*yc*invzc+CurrentFrame.cy;
+
+    if(u<CurrentFrame.mnMinX || u>CurrentFrame.mnMaxX)
+        return -1;
+    if(v<CurrentFrame.mnMinY || v>CurrentFrame.mnMaxY)
+        return -1;
+
+    // Compute predicted scale level
+    cv::Mat PO = x3Dw-Ow;
+    float dist3D = cv::norm(PO);
+
+    const float maxDistance = pMP->GetMaxDistanceInvariance();
+    const float minDistance = pMP->GetMinDistanceInvariance();
+
+    // Depth must be inside the scale pyramid of the image
+    if(dist3D<minDistance || dist3D>maxDistance)
+        return -1;
+
+    int nPredictedLevel = pMP->PredictScale(dist3D,&CurrentFrame);
+
+    // Search in a window
+    const float radius = th*CurrentFrame.mvScaleFactors[nPredictedLevel];
+
+    CurrentFrame.GetFeaturesInArea(u,v,radius,vIndices2,nPredictedLevel-1,nPredictedLevel+1);
+
+    if(vIndices2.empty())
+        return -1;
+
+    const cv::Mat dMP = pMP->GetDescriptor();
+
+    int bestDist = 256;
+    int bestIdx2 = -1;
+
+    for(vector<size_t>::const_iterator vit=vIndices2.begin(); vit!=vIndices2.end(); vit++)
+    {
+        const size_t i2 = *vit;
+        if(CurrentFrame.mvpMapPoints[i2])
+            continue;
+
+        const cv::Mat &d = CurrentFrame.mDescriptors.row(i2);
+
+        const int dist = DescriptorDistance(dMP,d);
+
+        if(dist<bestDist)
+        {
+            bestDist=dist;
+            bestIdx2=i2;
+        }
+    }
+
+    return bestDist<=ORBdist ? bestIdx2 : -1;
+}
+
 void ORBmatcher::ComputeThreeMaxima(vector<int>* histo, const int L, int &ind1, int &ind2, int &ind3)
 {
     int max1=0;
@@ -0,0 +1,104 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ObjectPool.h"
+
+#include <new>
+
+namespace ORB_SLAM2
+{
+
+// Every object keeps the alignment given by operator new
+static size_t AlignedSize(const size_t size)
+{
+    const size_t alignment = alignof(std::max_align_t);
+    return ((size+alignment-1)/alignment)*alignment;
+}
+
+ObjectPool::ObjectPool(const size_t nObjectSize, const size_t nObjectsPerSlab):
+    mnObjectSize(AlignedSize(nObjectSize<sizeof(FreeNode) ? sizeof(FreeNode) : nObjectSize)),
+    mnObjectsPerSlab(nObjectsPerSlab), mpFreeList(NULL), mnAllocated(0)
+{
+}
+
+ObjectPool::~ObjectPool()
+{
+    // Objects still alive at exit keep their memory
+    if(mnAllocated>0)
+        return;
+
+    for(size_t i=0; i<mvpSlabs.size(); i++)
+        ::operator delete(mvpSlabs[i]);
+}
+
+void ObjectPool::AddSlab()
+{
+    char* pSlab = static_cast<char*>(::operator new(mnObjectSize*mnObjectsPerSlab));
+    mvpSlabs.push_back(pSlab);
+
+    // Objects are handed out in address order
+    for(size_t i=mnObjectsPerSlab; i>0; i--)
+    {
+        FreeNode* pNode = reinterpret_cast<FreeNode*>(pSlab+(i-1)*mnObjectSize);
+        pNode->next = mpFreeList;
+        mpFreeList = pNode;
+    }
+}
+
+void* ObjectPool::Allocate()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    if(!mpFreeList)
+        AddSlab();
+
+    FreeNode* pNode = mpFreeList;
+    mpFreeList = pNode->next;
+    mnAllocated++;
+
+    return pNode;
+}
+
+void ObjectPool::Free(void *p)
+{
+    if(!p)
+        return;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    FreeNode* pNode = static_cast<FreeNode*>(p);
+    pNode->next = mpFreeList;
+    mpFreeList = pNode;
+    mnAllocated--;
+}
+
+size_t ObjectPool::GetAllocated()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mnAllocated;
+}
+
+size_t ObjectPool::GetCapacity()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mvpSlabs.size()*mnObjectsPerSlab;
+}
+
+} //namespace ORB_SLAM
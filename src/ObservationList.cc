@@ -0,0 +1,174 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ObservationList.h"
+#include "KeyFrame.h"
+
+namespace ORB_SLAM2
+{
+
+const size_t ObservationList::INLINE_SIZE;
+
+ObservationList::ObservationList(): mpData(mInline), mnSize(0), mnCapacity(INLINE_SIZE)
+{
+}
+
+ObservationList::ObservationList(const ObservationList &other): mpData(mInline), mnSize(0), mnCapacity(INLINE_SIZE)
+{
+    CopyFrom(other);
+}
+
+ObservationList::ObservationList(ObservationList &&other): mpData(mInline), mnSize(0), mnCapacity(INLINE_SIZE)
+{
+    MoveFrom(other);
+}
+
+ObservationList::~ObservationList()
+{
+    if(!IsInline())
+        delete[] mpData;
+}
+
+ObservationList& ObservationList::operator=(const ObservationList &other)
+{
+    if(this!=&other)
+    {
+        mnSize = 0;
+        CopyFrom(other);
+    }
+    return *this;
+}
+
+ObservationList& ObservationList::operator=(ObservationList &&other)
+{
+    if(this!=&other)
+    {
+        if(!IsInline())
+            delete[] mpData;
+        mpData = mInline;
+        mnSize = 0;
+        mnCapacity = INLINE_SIZE;
+        MoveFrom(other);
+    }
+    return *this;
+}
+
+void ObservationList::CopyFrom(const ObservationList &other)
+{
+    Reserve(other.mnSize);
+    for(size_t i=0; i<other.mnSize; i++)
+        mpData[i] = other.mpData[i];
+    mnSize = other.mnSize;
+}
+
+void ObservationList::MoveFrom(ObservationList &other)
+{
+    if(other.IsInline())
+    {
+        CopyFrom(other);
+    }
+    else
+    {
+        // Steal the heap buffer
+        mpData = other.mpData;
+        mnCapacity = other.mnCapacity;
+        mnSize = other.mnSize;
+        other.mpData = other.mInline;
+        other.mnCapacity = INLINE_SIZE;
+    }
+    other.mnSize = 0;
+}
+
+void ObservationList::Reserve(const size_t capacity)
+{
+    if(capacity<=mnCapacity)
+        return;
+
+    size_t newCapacity = 2*mnCapacity;
+    if(newCapacity<capacity)
+        newCapacity = capacity;
+
+    value_type* pData = new value_type[newCapacity];
+    for(size_t i=0; i<mnSize; i++)
+        pData[i] = mpData[i];
+
+    if(!IsInline())
+        delete[] mpData;
+
+    mpData = pData;
+    mnCapacity = newCapacity;
+}
+
+ObservationList::iterator ObservationList::find(KeyFrame *pKF)
+{
+    // Linear search: the list is short and contiguous
+    for(size_t i=0; i<mnSize; i++)
+        if(mpData[i].first==pKF)
+            return mpData+i;
+    return end();
+}
+
+ObservationList::const_iterator ObservationList::find(KeyFrame *pKF) const
+{
+    for(size_t i=0; i<mnSize; i++)
+        if(mpData[i].first==pKF)
+            return mpData+i;
+    return end();
+}
+
+void ObservationList::insert(KeyFrame *pKF, const size_t idx)
+{
+    iterator it = find(pKF);
+    if(it!=end())
+    {
+        it->second = idx;
+        return;
+    }
+
+    Reserve(mnSize+1);
+
+    size_t pos = mnSize;
+    while(pos>0 && mpData[pos-1].first->mnId>pKF->mnId)
+    {
+        mpData[pos] = mpData[pos-1];
+        pos--;
+    }
+    mpData[pos] = value_type(pKF,idx);
+    mnSize++;
+}
+
+size_t ObservationList::erase(KeyFrame *pKF)
+{
+    iterator it = find(pKF);
+    if(it==end())
+        return 0;
+
+    for(iterator next=it+1; next!=end(); it++, next++)
+        *it = *next;
+    mnSize--;
+    return 1;
+}
+
+void ObservationList::clear()
+{
+    mnSize = 0;
+}
+
+} //namespace ORB_SLAM
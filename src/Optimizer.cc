@@ -38,16 +38,18 @@ namespace ORB_SLAM2
 {
 
 
-void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust,
+                                       MarkerSet* pKFMarks, MarkerSet* pMPMarks)
 {
     vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
     vector<MapPoint*> vpMP = pMap->GetAllMapPoints();
-    BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag, nLoopKF, bRobust);
+    BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag, nLoopKF, bRobust, pKFMarks, pMPMarks);
 }
 
 
 void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
-                                 int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+                                 int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust,
+                                 MarkerSet* pKFMarks, MarkerSet* pMPMarks)
 {
     vector<bool> vbNotIncludedMP;
     vbNotIncludedMP.resize(vpMP.size());
@@ -98,11 +100,11 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
 
-       const map<KeyFrame*,size_t> observations = pMP->GetObservations();
+       const ObservationList observations = pMP->GetObservations();
 
         int nEdges = 0;
         //SET EDGES
-        for(map<KeyFrame*,size_t>::const_iterator mit=observations.begin(); mit!=observations.end(); mit++)
+        for(ObservationList::const_iterator mit=observations.begin(); mit!=observations.end(); mit++)
         {
 
             KeyFrame* pKF = mit->first;
@@ -205,7 +207,8 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         {
             pKF->mTcwGBA.create(4,4,CV_32F);
             Converter::toCvMat(SE3quat).copyTo(pKF->mTcwGBA);
-            pKF->mnBAGlobalForKF = nLoopKF;
+            if(pKFMarks)
+                pKFMarks->Mark(pKF->mnId);
         }
     }
 
@@ -230,13 +233,14 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         {
             pMP->mPosGBA.create(3,1,CV_32F);
             Converter::toCvMat(vPoint->estimate()).copyTo(pMP->mPosGBA);
-            pMP->mnBAGlobalForKF = nLoopKF;
+            if(pMPMarks)
+                pMPMarks->Mark(pMP->mnId);
         }
     }
 
 }
 
-int Optimizer::PoseOptimization(Frame *pFrame)
+int Optimizer::PoseOptimization(Frame *pFrame, const bool bComputeCov)
 {
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
@@ -274,9 +278,6 @@ int Optimizer::PoseOptimization(Frame *pFrame)
     const float deltaStereo = sqrt(7.815);
 
 
-    {
-    unique_lock<mutex> lock(MapPoint::mGlobalMutex);
-
     for(int i=0; i<N; i++)
     {
         MapPoint* pMP = pFrame->mvpMapPoints[i];
@@ -307,10 +308,11 @@ int Optimizer::PoseOptimization(Frame *pFrame)
                 e->fy = pFrame->fy;
                 e->cx = pFrame->cx;
                 e->cy = pFrame->cy;
-                cv::Mat Xw = pMP->GetWorldPos();
-                e->Xw[0] = Xw.at<float>(0);
-                e->Xw[1] = Xw.at<float>(1);
-                e->Xw[2] = Xw.at<float>(2);
+                float Xw[3];
+                pMP->GetWorldPos(Xw);
+                e->Xw[0] = Xw[0];
+                e->Xw[1] = Xw[1];
+                e->Xw[2] = Xw[2];
 
                 optimizer.addEdge(e);
 
@@ -345,10 +347,11 @@ int Optimizer::PoseOptimization(Frame *pFrame)
                 e->cx = pFrame->cx;
                 e->cy = pFrame->cy;
                 e->bf = pFrame->mbf;
-                cv::Mat Xw = pMP->GetWorldPos();
-                e->Xw[0] = Xw.at<float>(0);
-                e->Xw[1] = Xw.at<float>(1);
-                e->Xw[2] = Xw.at<float>(2);
+                float Xw[3];
+                pMP->GetWorldPos(Xw);
+                e->Xw[0] = Xw[0];
+                e->Xw[1] = Xw[1];
+                e->Xw[2] = Xw[2];
 
                 optimizer.addEdge(e);
 
@@ -358,7 +361,6 @@ int Optimizer::PoseOptimization(Frame *pFrame)
         }
 
     }
-    }
 
 
     if(nInitialCorrespondences<3)
@@ -447,22 +449,60 @@ int Optimizer::PoseOptimization(Frame *pFrame)
     cv::Mat pose = Converter::toCvMat(SE3quat_recov);
     pFrame->SetPose(pose);
 
+    if(!bComputeCov)
+    {
+        pFrame->mPoseCov.release();
+        return nInitialCorrespondences-nBad;
+    }
+
+    // Pose covariance, inverse of the Hessian of the inliers at the optimum
+    Eigen::Matrix<double,6,6> H = Eigen::Matrix<double,6,6>::Zero();
+    for(size_t i=0, iend=vpEdgesMono.size(); i<iend; i++)
+    {
+        if(pFrame->mvbOutlier[vnIndexEdgeMono[i]])
+            continue;
+        g2o::EdgeSE3ProjectXYZOnlyPose* e = vpEdgesMono[i];
+        e->linearizeOplus();
+        H += e->jacobianOplusXi().transpose()*e->information()*e->jacobianOplusXi();
+    }
+    for(size_t i=0, iend=vpEdgesStereo.size(); i<iend; i++)
+    {
+        if(pFrame->mvbOutlier[vnIndexEdgeStereo[i]])
+            continue;
+        g2o::EdgeStereoSE3ProjectXYZOnlyPose* e = vpEdgesStereo[i];
+        e->linearizeOplus();
+        H += e->jacobianOplusXi().transpose()*e->information()*e->jacobianOplusXi();
+    }
+
+    Eigen::FullPivLU<Eigen::Matrix<double,6,6> > lu(H);
+    if(lu.isInvertible())
+        pFrame->mPoseCov = Converter::toCvMat(Eigen::Matrix<double,6,6>(lu.inverse()));
+    else
+        pFrame->mPoseCov.release();
+
     return nInitialCorrespondences-nBad;
 }
 
-void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap)
+void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap,
+                                      vector<pair<KeyFrame*,MapPoint*> > &vOutliers)
 {    
+    // Scratch marks (by mnId) of the calling thread
+    static thread_local MarkerSet sLocalKFMarks, sFixedKFMarks, sLocalMPMarks;
+    sLocalKFMarks.NewGeneration();
+    sFixedKFMarks.NewGeneration();
+    sLocalMPMarks.NewGeneration();
+
     // Local KeyFrames: First Breath Search from Current Keyframe
     list<KeyFrame*> lLocalKeyFrames;
 
     lLocalKeyFrames.push_back(pKF);
-    pKF->mnBALocalForKF = pKF->mnId;
+    sLocalKFMarks.Mark(pKF->mnId);
 
     const vector<KeyFrame*> vNeighKFs = pKF->GetVectorCovisibleKeyFrames();
     for(int i=0, iend=vNeighKFs.size(); i<iend; i++)
     {
         KeyFrame* pKFi = vNeighKFs[i];
-        pKFi->mnBALocalForKF = pKF->mnId;
+        sLocalKFMarks.Mark(pKFi->mnId);
         if(!pKFi->isBad())
             lLocalKeyFrames.push_back(pKFi);
     }
@@ -477,11 +517,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
             MapPoint* pMP = *vit;
             if(pMP)
                 if(!pMP->isBad())
-                    if(pMP->mnBALocalForKF!=pKF->mnId)
-                    {
+                    if(sLocalMPMarks.Mark(pMP->mnId))
                         lLocalMapPoints.push_back(pMP);
-                        pMP->mnBALocalForKF=pKF->mnId;
-                    }
         }
     }
 
@@ -489,14 +526,13 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     list<KeyFrame*> lFixedCameras;
     for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
     {
-        map<KeyFrame*,size_t> observations = (*lit)->GetObservations();
-        for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        ObservationList observations = (*lit)->GetObservations();
+        for(ObservationList::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
 
-            if(pKFi->mnBALocalForKF!=pKF->mnId && pKFi->mnBAFixedForKF!=pKF->mnId)
-            {                
-                pKFi->mnBAFixedForKF=pKF->mnId;
+            if(!sLocalKFMarks.IsMarked(pKFi->mnId) && sFixedKFMarks.Mark(pKFi->mnId))
+            {
                 if(!pKFi->isBad())
                     lFixedCameras.push_back(pKFi);
             }
@@ -579,10 +615,10 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
         vPoint->setMarginalized(true);
         optimizer.addVertex(vPoint);
 
-        const map<KeyFrame*,size_t> observations = pMP->GetObservations();
+        const ObservationList observations = pMP->GetObservations();
 
         //Set edges
-        for(map<KeyFrame*,size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        for(ObservationList::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
 
@@ -742,19 +778,11 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
         }
     }
 
-    // Get Map Mutex
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+    vOutliers.swap(vToErase);
 
-    if(!vToErase.empty())
-    {
-        for(size_t i=0;i<vToErase.size();i++)
-        {
-            KeyFrame* pKFi = vToErase[i].first;
-            MapPoint* pMPi = vToErase[i].second;
-            pKFi->EraseMapPointMatch(pMPi);
-            pMPi->EraseObservation(pKFi);
-        }
-    }
+    // The results are published as a new map version, the tracking keeps reading the previous one
+    // until its next frame instead of waiting for the update
+    MapCommit commit(pMap->mSnapshots);
 
     // Recover optimized data
 
@@ -781,7 +809,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
 void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
-                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale)
+                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
+                                       const MarkerMap<long unsigned int> &CorrectedPointRefs, const bool &bFixScale)
 {
     // Setup optimizer
     g2o::SparseOptimizer optimizer;
@@ -986,7 +1015,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     optimizer.initializeOptimization();
     optimizer.optimize(20);
 
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+    unique_lock<SharedMutex> lock(pMap->mMutexMapUpdate);
 
     // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
     for(size_t i=0;i<vpKFs.size();i++)
@@ -1018,9 +1047,9 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
             continue;
 
         int nIDr;
-        if(pMP->mnCorrectedByKF==pCurKF->mnId)
+        if(CorrectedPointRefs.IsMarked(pMP->mnId))
         {
-            nIDr = pMP->mnCorrectedReference;
+            nIDr = CorrectedPointRefs.Get(pMP->mnId);
         }
         else
         {
@@ -0,0 +1,112 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SnapshotManager.h"
+
+#include <limits>
+
+namespace ORB_SLAM2
+{
+
+static const unsigned long UNPINNED = std::numeric_limits<unsigned long>::max();
+
+thread_local unsigned long SnapshotManager::mnThreadReadVersion = UNPINNED;
+thread_local unsigned long SnapshotManager::mnThreadCommitVersion = 0;
+
+SnapshotManager::SnapshotManager(): mnVersion(1)
+{
+}
+
+int SnapshotManager::RegisterReader()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    for(size_t i=0; i<mvbFreeSlots.size(); i++)
+    {
+        if(mvbFreeSlots[i])
+        {
+            mvbFreeSlots[i] = false;
+            mvnReaderVersions[i] = UNPINNED;
+            return i;
+        }
+    }
+
+    mvbFreeSlots.push_back(false);
+    mvnReaderVersions.push_back(UNPINNED);
+    return mvnReaderVersions.size()-1;
+}
+
+void SnapshotManager::UnregisterReader(const int nSlot)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mvbFreeSlots[nSlot] = true;
+    mvnReaderVersions[nSlot] = UNPINNED;
+    mcvUnpinned.notify_all();
+}
+
+void SnapshotManager::Pin(const int nSlot)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mvnReaderVersions[nSlot] = mnVersion;
+    mnThreadReadVersion = mnVersion;
+}
+
+void SnapshotManager::Unpin(const int nSlot)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mvnReaderVersions[nSlot] = UNPINNED;
+    mnThreadReadVersion = UNPINNED;
+    mcvUnpinned.notify_all();
+}
+
+void SnapshotManager::BeginCommit()
+{
+    mMutexCommit.lock();
+
+    // The commit overwrites the values older than the last version
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true)
+    {
+        bool bOldReader = false;
+        for(size_t i=0; i<mvnReaderVersions.size(); i++)
+            if(mvnReaderVersions[i]<mnVersion)
+                bOldReader = true;
+
+        if(!bOldReader)
+            break;
+
+        mcvUnpinned.wait(lock);
+    }
+
+    mnThreadCommitVersion = mnVersion+1;
+}
+
+void SnapshotManager::EndCommit()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mnVersion = mnThreadCommitVersion;
+        mnThreadCommitVersion = 0;
+    }
+
+    mMutexCommit.unlock();
+}
+
+} //namespace ORB_SLAM
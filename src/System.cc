@@ -31,8 +31,48 @@ namespace ORB_SLAM2
 {
 
 System::System(const string &strVocFile, const string &strSettingsFile, const eSensor sensor,
-               const bool bUseViewer):mSensor(sensor), mpViewer(static_cast<Viewer*>(NULL)), mbReset(false),mbActivateLocalizationMode(false),
-        mbDeactivateLocalizationMode(false)
+               const bool bUseViewer):mSensor(sensor), mpViewer(static_cast<Viewer*>(NULL)),
+        mpMapJournal(static_cast<MapJournal*>(NULL)), mptMapJournal(static_cast<thread*>(NULL)),
+        mpKeyFramePager(static_cast<KeyFramePager*>(NULL)), mptKeyFramePager(static_cast<thread*>(NULL)),
+        mptTrajectoryLog(static_cast<thread*>(NULL)), mbReset(false),
+        mbActivateLocalizationMode(false), mbDeactivateLocalizationMode(false)
+{
+    CheckSettings(strSettingsFile);
+
+    //Load ORB Vocabulary (or reuse it if another System already loaded it)
+    cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
+
+    mpVocabulary = VocabularyRegistry::Get(strVocFile);
+    if(!mpVocabulary)
+    {
+        cerr << "Wrong path to vocabulary. " << endl;
+        cerr << "Falied to open at: " << strVocFile << endl;
+        exit(-1);
+    }
+    cout << "Vocabulary loaded!" << endl << endl;
+
+    Initialize(strSettingsFile, bUseViewer);
+}
+
+System::System(const std::shared_ptr<const ORBVocabulary> &pVocabulary, const string &strSettingsFile, const eSensor sensor,
+               const bool bUseViewer):mSensor(sensor), mpVocabulary(pVocabulary), mpViewer(static_cast<Viewer*>(NULL)),
+        mpMapJournal(static_cast<MapJournal*>(NULL)), mptMapJournal(static_cast<thread*>(NULL)),
+        mpKeyFramePager(static_cast<KeyFramePager*>(NULL)), mptKeyFramePager(static_cast<thread*>(NULL)),
+        mptTrajectoryLog(static_cast<thread*>(NULL)), mbReset(false),
+        mbActivateLocalizationMode(false), mbDeactivateLocalizationMode(false)
+{
+    CheckSettings(strSettingsFile);
+
+    if(!mpVocabulary || mpVocabulary->empty())
+    {
+        cerr << "The given vocabulary is empty." << endl;
+        exit(-1);
+    }
+
+    Initialize(strSettingsFile, bUseViewer);
+}
+
+void System::CheckSettings(const string &strSettingsFile)
 {
     // Output welcome message
     cout << endl <<
@@ -57,42 +97,83 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
        cerr << "Failed to open settings file at: " << strSettingsFile << endl;
        exit(-1);
     }
+}
 
+void System::Initialize(const string &strSettingsFile, const bool bUseViewer)
+{
+    //Create KeyFrame Database
+    mpKeyFrameDatabase = new KeyFrameDatabase(*mpVocabulary);
 
-    //Load ORB Vocabulary
-    cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
-
-    mpVocabulary = new ORBVocabulary();
-    bool bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
-    if(!bVocLoad)
+    //Relocalization retrieval (exhaustive unless a top-k size is given)
+    cv::FileStorage fsSettings(strSettingsFile.c_str(), cv::FileStorage::READ);
+    int nRelocTopK = fsSettings["KeyFrameDatabase.RelocTopK"];
+    float fRelocThresholdFactor = fsSettings["KeyFrameDatabase.RelocThresholdFactor"];
+    if(fRelocThresholdFactor<1.0f)
+        fRelocThresholdFactor = 1.0f;
+    if(nRelocTopK>0)
     {
-        cerr << "Wrong path to vocabulary. " << endl;
-        cerr << "Falied to open at: " << strVocFile << endl;
-        exit(-1);
+        cout << "Relocalization retrieval: top " << nRelocTopK << " keyframes, threshold factor " << fRelocThresholdFactor << endl << endl;
+        mpKeyFrameDatabase->SetRelocalizationRetrieval(nRelocTopK,fRelocThresholdFactor);
     }
-    cout << "Vocabulary loaded!" << endl << endl;
-
-    //Create KeyFrame Database
-    mpKeyFrameDatabase = new KeyFrameDatabase(*mpVocabulary);
 
     //Create the Map
     mpMap = new Map();
 
+    float fVoxelSize = fsSettings["Map.VoxelSize"];
+    if(fVoxelSize>0)
+        mpMap->SetVoxelSize(fVoxelSize);
+
+    //Keyframe paging (only if a maximum of resident keyframes is given)
+    int nMaxResidentKFs = fsSettings["Map.MaxResidentKeyFrames"];
+    if(nMaxResidentKFs>0)
+    {
+        string strPagingFile = fsSettings["Map.PagingFile"];
+        if(strPagingFile.empty())
+            strPagingFile = "KeyFramePages.bin";
+
+        KeyFramePager* pPager = new KeyFramePager(strPagingFile,nMaxResidentKFs);
+        if(pPager->IsOpen())
+        {
+            cout << "Keyframe paging: at most " << nMaxResidentKFs << " resident keyframes, paging file " << strPagingFile << endl << endl;
+            mpKeyFramePager = pPager;
+            mpMap->SetKeyFramePager(mpKeyFramePager);
+            mptKeyFramePager = new thread(&ORB_SLAM2::KeyFramePager::Run, mpKeyFramePager);
+        }
+        else
+        {
+            cerr << "Failed to open the keyframe paging file at: " << strPagingFile << ", paging disabled." << endl;
+            delete pPager;
+        }
+    }
+
     //Create Drawers. These are used by the Viewer
     mpFrameDrawer = new FrameDrawer(mpMap);
     mpMapDrawer = new MapDrawer(mpMap, strSettingsFile);
 
     //Initialize the Tracking thread
     //(it will live in the main thread of execution, the one that called this constructor)
-    mpTracker = new Tracking(this, mpVocabulary, mpFrameDrawer, mpMapDrawer,
+    mpTracker = new Tracking(this, mpVocabulary.get(), mpFrameDrawer, mpMapDrawer,
                              mpMap, mpKeyFrameDatabase, strSettingsFile, mSensor);
 
+    //Trajectory spilling (only if a file is given)
+    string strTrajectoryFile = fsSettings["Tracking.TrajectorySpillFile"];
+    if(!strTrajectoryFile.empty())
+    {
+        if(mpTracker->mTrajectory.SetSpillFile(strTrajectoryFile))
+        {
+            cout << "Trajectory spilled to " << strTrajectoryFile << endl << endl;
+            mptTrajectoryLog = new thread(&ORB_SLAM2::TrajectoryLog::Run, &mpTracker->mTrajectory);
+        }
+        else
+            cerr << "Failed to open the trajectory spill file at: " << strTrajectoryFile << ", the trajectory is kept in memory." << endl;
+    }
+
     //Initialize the Local Mapping thread and launch
     mpLocalMapper = new LocalMapping(mpMap, mSensor==MONOCULAR);
     mptLocalMapping = new thread(&ORB_SLAM2::LocalMapping::Run,mpLocalMapper);
 
     //Initialize the Loop Closing thread and launch
-    mpLoopCloser = new LoopClosing(mpMap, mpKeyFrameDatabase, mpVocabulary, mSensor!=MONOCULAR);
+    mpLoopCloser = new LoopClosing(mpMap, mpKeyFrameDatabase, mpVocabulary.get(), mSensor!=MONOCULAR);
     mptLoopClosing = new thread(&ORB_SLAM2::LoopClosing::Run, mpLoopCloser);
 
     //Initialize the Viewer thread and launch
@@ -316,10 +397,137 @@ void System::Shutdown()
         usleep(5000);
     }
 
+    // The journal is closed once no thread can change the map anymore
+    if(mpMapJournal)
+    {
+        mpMap->SetJournal(static_cast<MapJournal*>(NULL));
+        mpMapJournal->RequestFinish();
+        while(!mpMapJournal->isFinished())
+            usleep(5000);
+    }
+
+    // Evicted keyframes can still be read back after the pager thread finishes (e.g. to save the map)
+    if(mpKeyFramePager)
+    {
+        mpKeyFramePager->RequestFinish();
+        while(!mpKeyFramePager->isFinished())
+            usleep(5000);
+    }
+
+    // The trajectory can still be saved after the spill thread finishes
+    if(mptTrajectoryLog)
+    {
+        mpTracker->mTrajectory.RequestFinish();
+        while(!mpTracker->mTrajectory.isFinished())
+            usleep(5000);
+    }
+
+    const Tracking::SearchWindowStats searchStats = mpTracker->GetSearchWindowStats();
+    cout << "Projection search, descriptor comparisons / matches: motion model "
+         << searchStats.nMotionModelComparisons << " / " << searchStats.nMotionModelMatches << ", local map "
+         << searchStats.nLocalMapComparisons << " / " << searchStats.nLocalMapMatches << endl;
+
     if(mpViewer)
         pangolin::BindToContext("ORB-SLAM2: Map Viewer");
 }
 
+bool System::SaveMap(const string &filename)
+{
+    cout << endl << "Saving map to " << filename << " ..." << endl;
+
+    // Local Mapping must not change the map while it is written.
+    // It is already stopped in localization mode or after Shutdown().
+    const bool bWasStopped = mpLocalMapper->isStopped();
+    if(!bWasStopped)
+    {
+        mpLocalMapper->RequestStop();
+        while(!mpLocalMapper->isStopped())
+        {
+            usleep(1000);
+        }
+    }
+
+    const bool bOK = MapSerializer::Save(filename, mpMap, mpKeyFrameDatabase);
+
+    if(!bWasStopped)
+        mpLocalMapper->Release();
+
+    if(bOK)
+        cout << endl << "map saved!" << endl;
+
+    return bOK;
+}
+
+bool System::LoadMap(const string &filename)
+{
+    if(mpMap->KeyFramesInMap()>0)
+    {
+        cerr << "ERROR: a map can only be loaded before tracking starts (the current map is not empty)." << endl;
+        return false;
+    }
+
+    if(mpMapJournal)
+    {
+        cerr << "ERROR: load the map before enabling the map journal." << endl;
+        return false;
+    }
+
+    cout << endl << "Loading map from " << filename << " ..." << endl;
+
+    if(!MapSerializer::Load(filename, mpMap, mpKeyFrameDatabase, mpVocabulary.get()))
+        return false;
+
+    mpTracker->InformMapLoaded();
+
+    cout << endl << "map loaded!" << endl;
+
+    return true;
+}
+
+bool System::EnableMapJournal(const string &filename)
+{
+    if(mpMapJournal)
+    {
+        cerr << "ERROR: the map journal is already enabled." << endl;
+        return false;
+    }
+
+    MapJournal* pJournal = new MapJournal(filename, mpVocabulary.get());
+    if(!pJournal->IsOpen())
+    {
+        cerr << "Failed to open map journal at: " << filename << endl;
+        delete pJournal;
+        return false;
+    }
+
+    // The current map is written while Local Mapping is stopped, later changes come from the hooks
+    const bool bWasStopped = mpLocalMapper->isStopped();
+    if(!bWasStopped)
+    {
+        mpLocalMapper->RequestStop();
+        while(!mpLocalMapper->isStopped())
+        {
+            usleep(1000);
+        }
+    }
+
+    {
+        unique_lock<SharedMutex> lock(mpMap->mMutexMapUpdate);
+        pJournal->WriteSnapshot(mpMap);
+        mpMap->SetJournal(pJournal);
+    }
+
+    if(!bWasStopped)
+        mpLocalMapper->Release();
+
+    mpMapJournal = pJournal;
+    mptMapJournal = new thread(&ORB_SLAM2::MapJournal::Run, mpMapJournal);
+
+    cout << "Map journal enabled: " << filename << endl;
+
+    return true;
+}
+
 void System::SaveTrajectoryTUM(const string &filename)
 {
     cout << endl << "Saving camera trajectory to " << filename << " ..." << endl;
@@ -330,6 +538,11 @@ void System::SaveTrajectoryTUM(const string &filename)
     }
 
     vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+    if(vpKFs.empty())
+    {
+        cerr << "ERROR: there is no map yet, no trajectory to save." << endl;
+        return;
+    }
     sort(vpKFs.begin(),vpKFs.end(),KeyFrame::lId);
 
     // Transform all keyframes so that the first keyframe is at the origin.
@@ -344,18 +557,14 @@ void System::SaveTrajectoryTUM(const string &filename)
     // We need to get first the keyframe pose and then concatenate the relative transformation.
     // Frames not localized (tracking failure) are not saved.
 
-    // For each frame we have a reference keyframe (lRit), the timestamp (lT) and a flag
-    // which is true when tracking failed (lbL).
-    list<ORB_SLAM2::KeyFrame*>::iterator lRit = mpTracker->mlpReferences.begin();
-    list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
-    list<bool>::iterator lbL = mpTracker->mlbLost.begin();
-    for(list<cv::Mat>::iterator lit=mpTracker->mlRelativeFramePoses.begin(),
-        lend=mpTracker->mlRelativeFramePoses.end();lit!=lend;lit++, lRit++, lT++, lbL++)
+    // For each frame we have a reference keyframe, the timestamp and a flag
+    // which is true when tracking failed.
+    mpTracker->mTrajectory.ForEach([&](const TrajectoryLog::Record &record)
     {
-        if(*lbL)
-            continue;
+        if(record.mbLost)
+            return;
 
-        KeyFrame* pKF = *lRit;
+        KeyFrame* pKF = record.mpReference;
 
         cv::Mat Trw = cv::Mat::eye(4,4,CV_32F);
 
@@ -368,14 +577,14 @@ void System::SaveTrajectoryTUM(const string &filename)
 
         Trw = Trw*pKF->GetPose()*Two;
 
-        cv::Mat Tcw = (*lit)*Trw;
+        cv::Mat Tcw = record.GetRelativePose()*Trw;
         cv::Mat Rwc = Tcw.rowRange(0,3).colRange(0,3).t();
         cv::Mat twc = -Rwc*Tcw.rowRange(0,3).col(3);
 
         vector<float> q = Converter::toQuaternion(Rwc);
 
-        f << setprecision(6) << *lT << " " <<  setprecision(9) << twc.at<float>(0) << " " << twc.at<float>(1) << " " << twc.at<float>(2) << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << endl;
-    }
+        f << setprecision(6) << record.mTimeStamp << " " <<  setprecision(9) << twc.at<float>(0) << " " << twc.at<float>(1) << " " << twc.at<float>(2) << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << endl;
+    });
     f.close();
     cout << endl << "trajectory saved!" << endl;
 }
@@ -427,6 +636,11 @@ void System::SaveTrajectoryKITTI(const string &filename)
     }
 
     vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+    if(vpKFs.empty())
+    {
+        cerr << "ERROR: there is no map yet, no trajectory to save." << endl;
+        return;
+    }
     sort(vpKFs.begin(),vpKFs.end(),KeyFrame::lId);
 
     // Transform all keyframes so that the first keyframe is at the origin.
@@ -441,13 +655,11 @@ void System::SaveTrajectoryKITTI(const string &filename)
     // We need to get first the keyframe pose and then concatenate the relative transformation.
     // Frames not localized (tracking failure) are not saved.
 
-    // For each frame we have a reference keyframe (lRit), the timestamp (lT) and a flag
-    // which is true when tracking failed (lbL).
-    list<ORB_SLAM2::KeyFrame*>::iterator lRit = mpTracker->mlpReferences.begin();
-    list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
-    for(list<cv::Mat>::iterator lit=mpTracker->mlRelativeFramePoses.begin(), lend=mpTracker->mlRelativeFramePoses.end();lit!=lend;lit++, lRit++, lT++)
+    // For each frame we have a reference keyframe, the timestamp and a flag
+    // which is true when tracking failed.
+    mpTracker->mTrajectory.ForEach([&](const TrajectoryLog::Record &record)
     {
-        ORB_SLAM2::KeyFrame* pKF = *lRit;
+        ORB_SLAM2::KeyFrame* pKF = record.mpReference;
 
         cv::Mat Trw = cv::Mat::eye(4,4,CV_32F);
 
@@ -460,14 +672,14 @@ void System::SaveTrajectoryKITTI(const string &filename)
 
         Trw = Trw*pKF->GetPose()*Two;
 
-        cv::Mat Tcw = (*lit)*Trw;
+        cv::Mat Tcw = record.GetRelativePose()*Trw;
         cv::Mat Rwc = Tcw.rowRange(0,3).colRange(0,3).t();
         cv::Mat twc = -Rwc*Tcw.rowRange(0,3).col(3);
 
         f << setprecision(9) << Rwc.at<float>(0,0) << " " << Rwc.at<float>(0,1)  << " " << Rwc.at<float>(0,2) << " "  << twc.at<float>(0) << " " <<
              Rwc.at<float>(1,0) << " " << Rwc.at<float>(1,1)  << " " << Rwc.at<float>(1,2) << " "  << twc.at<float>(1) << " " <<
              Rwc.at<float>(2,0) << " " << Rwc.at<float>(2,1)  << " " << Rwc.at<float>(2,2) << " "  << twc.at<float>(2) << endl;
-    }
+    });
     f.close();
     cout << endl << "trajectory saved!" << endl;
 }
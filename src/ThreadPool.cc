@@ -0,0 +1,111 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace ORB_SLAM2
+{
+
+ThreadPool::ThreadPool(const int nThreads) : mbFinish(false)
+{
+    for(int i=0; i<nThreads; i++)
+        mvThreads.push_back(std::thread(&ThreadPool::Run,this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutexQueue);
+        mbFinish = true;
+    }
+    mcvQueue.notify_all();
+    for(size_t i=0; i<mvThreads.size(); i++)
+        mvThreads[i].join();
+}
+
+int ThreadPool::GetNumThreads() const
+{
+    return mvThreads.size();
+}
+
+void ThreadPool::Work(Job* pJob)
+{
+    for(size_t i=pJob->next++; i<pJob->n; i=pJob->next++)
+        (*pJob->pf)(i);
+}
+
+void ThreadPool::ParallelFor(const size_t n, const std::function<void(size_t)> &f)
+{
+    if(n==0)
+        return;
+
+    Job job;
+    job.pf = &f;
+    job.n = n;
+    job.next = 0;
+    job.nRunning = 0;
+
+    const size_t nHelpers = std::min(mvThreads.size(),n-1);
+    if(nHelpers>0)
+    {
+        std::unique_lock<std::mutex> lock(mMutexQueue);
+        for(size_t i=0; i<nHelpers; i++)
+            mlpQueue.push_back(&job);
+    }
+    mcvQueue.notify_all();
+
+    Work(&job);
+
+    // Workers busy with other jobs are not waited for: take back the entries nobody picked up
+    std::unique_lock<std::mutex> lock(mMutexQueue);
+    mlpQueue.erase(std::remove(mlpQueue.begin(),mlpQueue.end(),&job),mlpQueue.end());
+    while(job.nRunning>0)
+        mcvDone.wait(lock);
+}
+
+void ThreadPool::Run()
+{
+    while(1)
+    {
+        Job* pJob;
+        {
+            std::unique_lock<std::mutex> lock(mMutexQueue);
+            while(mlpQueue.empty() && !mbFinish)
+                mcvQueue.wait(lock);
+            if(mbFinish)
+                return;
+            pJob = mlpQueue.front();
+            mlpQueue.pop_front();
+            pJob->nRunning++;
+        }
+
+        Work(pJob);
+
+        {
+            std::unique_lock<std::mutex> lock(mMutexQueue);
+            pJob->nRunning--;
+        }
+        mcvDone.notify_all();
+    }
+}
+
+} //namespace ORB_SLAM
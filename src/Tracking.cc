@@ -23,6 +23,7 @@
 
 #include<opencv2/core/core.hpp>
 #include<opencv2/features2d/features2d.hpp>
+#include<opencv2/video/tracking.hpp>
 
 #include"ORBmatcher.h"
 #include"FrameDrawer.h"
@@ -32,8 +33,10 @@
 
 #include"Optimizer.h"
 #include"PnPsolver.h"
+#include"KeyFramePager.h"
 
 #include<iostream>
+#include<algorithm>
 
 #include<mutex>
 
@@ -44,9 +47,10 @@ using namespace std;
 namespace ORB_SLAM2
 {
 
-Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer, MapDrawer *pMapDrawer, Map *pMap, KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor):
+Tracking::Tracking(System *pSys, const ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer, MapDrawer *pMapDrawer, Map *pMap, KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor):
     mState(NO_IMAGES_YET), mSensor(sensor), mbOnlyTracking(false), mbVO(false), mpORBVocabulary(pVoc),
-    mpKeyFrameDB(pKFDB), mpInitializer(static_cast<Initializer*>(NULL)), mpSystem(pSys), mpViewer(NULL),
+    mpKeyFrameDB(pKFDB), mpInitializer(static_cast<Initializer*>(NULL)),
+    mnLocalMapKFsVersion(0), mnLocalMapBigChangeIdx(0), mbLocalMapChanged(false), mpSystem(pSys), mpViewer(NULL),
     mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpMap(pMap), mnLastRelocFrameId(0)
 {
     // Load camera parameters from settings file
@@ -147,6 +151,52 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
             mDepthMapFactor = 1.0f/mDepthMapFactor;
     }
 
+    // Local map search budget (unbounded unless a deadline or a match quota is given)
+    mfFrameDeadline = fSettings["Tracking.FrameDeadline"];
+    mnLocalMapMatchQuota = fSettings["Tracking.LocalMapMatchQuota"];
+    mnMaxLocalMapCandidates = fSettings["Tracking.MaxLocalMapCandidates"];
+    if(mfFrameDeadline>0 || mnLocalMapMatchQuota>0 || mnMaxLocalMapCandidates>0)
+    {
+        cout << endl << "Local Map Search Budget: " << endl;
+        cout << "- Frame Deadline (ms): " << mfFrameDeadline << endl;
+        cout << "- Match Quota: " << mnLocalMapMatchQuota << endl;
+        cout << "- Max Candidates: " << mnMaxLocalMapCandidates << endl;
+    }
+    mLocalMapSearchStats = LocalMapSearchStats();
+    mSearchWindowStats = SearchWindowStats();
+
+    // Search windows from the pose uncertainty
+    mbAdaptiveSearch = static_cast<int>(fSettings["Tracking.AdaptiveSearch"])!=0;
+    mnMotionModelSamples = 0;
+    if(mbAdaptiveSearch)
+        cout << endl << "Search windows from the pose uncertainty" << endl;
+
+    // Local map completed with the mappoints that the spatial index finds in the frustum
+    mbFrustumLocalMap = static_cast<int>(fSettings["Tracking.FrustumLocalMap"])!=0;
+    if(mbFrustumLocalMap)
+        cout << endl << "Local map completed with the mappoints in the frustum" << endl;
+
+    // Frames tracked by optical flow between fully processed frames
+    mnMaxFlowFrames = max(0,static_cast<int>(fSettings["Tracking.FlowFrames"]));
+    mnFlowFramesInRow = 0;
+    if(mnMaxFlowFrames>0)
+        cout << endl << "Frames tracked by optical flow between extracted frames: " << mnMaxFlowFrames << endl;
+
+    // Extraction around the predicted projections of the local map
+    mbGuidedExtraction = static_cast<int>(fSettings["Tracking.GuidedExtraction"])!=0;
+    mfGuidedExploreRatio = fSettings["Tracking.GuidedExploreRatio"];
+    if(mfGuidedExploreRatio<=0 || mfGuidedExploreRatio>1)
+        mfGuidedExploreRatio = 0.3f;
+    if(mbGuidedExtraction)
+        cout << endl << "Extraction guided by the local map, exploration ratio: " << mfGuidedExploreRatio << endl;
+    mnMatchesInliers = 0;
+
+    mpReferenceKF = static_cast<KeyFrame*>(NULL);
+    mpLastKeyFrame = static_cast<KeyFrame*>(NULL);
+
+    // Tracking runs in the thread of the caller, it takes part in the reclamation of mappoints
+    mnEpochSlot = mpMap->mEpochManager.RegisterThread();
+    mnSnapshotSlot = mpMap->mSnapshots.RegisterReader();
 }
 
 void Tracking::SetLocalMapper(LocalMapping *pLocalMapper)
@@ -167,6 +217,7 @@ void Tracking::SetViewer(Viewer *pViewer)
 
 cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp)
 {
+    mFrameStart = chrono::steady_clock::now();
     mImGray = imRectLeft;
     cv::Mat imGrayRight = imRectRight;
 
@@ -197,9 +248,24 @@ cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRe
         }
     }
 
-    mCurrentFrame = Frame(mImGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+    if(TrackFlowFrame(timestamp))
+        mnFlowFramesInRow++;
+    else
+    {
+        PredictKeyPoints();
 
-    Track();
+        // The new frame reuses the containers of the previous one
+        mCurrentFrame = Frame(mImGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,&mCurrentFrame);
+
+        Track();
+        mnFlowFramesInRow = 0;
+    }
+
+    ReleaseBadMapPoints();
+
+    // The next frame may be tracked by optical flow from this image
+    if(mnMaxFlowFrames>0)
+        mImGray.copyTo(mPrevImGray);
 
     return mCurrentFrame.mTcw.clone();
 }
@@ -207,6 +273,7 @@ cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRe
 
 cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp)
 {
+    mFrameStart = chrono::steady_clock::now();
     mImGray = imRGB;
     cv::Mat imDepth = imD;
 
@@ -228,9 +295,24 @@ cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const d
     if((fabs(mDepthMapFactor-1.0f)>1e-5) || imDepth.type()!=CV_32F)
         imDepth.convertTo(imDepth,CV_32F,mDepthMapFactor);
 
-    mCurrentFrame = Frame(mImGray,imDepth,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+    if(TrackFlowFrame(timestamp))
+        mnFlowFramesInRow++;
+    else
+    {
+        PredictKeyPoints();
 
-    Track();
+        // The new frame reuses the containers of the previous one
+        mCurrentFrame = Frame(mImGray,imDepth,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,&mCurrentFrame);
+
+        Track();
+        mnFlowFramesInRow = 0;
+    }
+
+    ReleaseBadMapPoints();
+
+    // The next frame may be tracked by optical flow from this image
+    if(mnMaxFlowFrames>0)
+        mImGray.copyTo(mPrevImGray);
 
     return mCurrentFrame.mTcw.clone();
 }
@@ -238,6 +320,7 @@ cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const d
 
 cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp)
 {
+    mFrameStart = chrono::steady_clock::now();
     mImGray = im;
 
     if(mImGray.channels()==3)
@@ -255,12 +338,27 @@ cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp)
             cvtColor(mImGray,mImGray,CV_BGRA2GRAY);
     }
 
-    if(mState==NOT_INITIALIZED || mState==NO_IMAGES_YET)
-        mCurrentFrame = Frame(mImGray,timestamp,mpIniORBextractor,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+    if(TrackFlowFrame(timestamp))
+        mnFlowFramesInRow++;
     else
-        mCurrentFrame = Frame(mImGray,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+    {
+        PredictKeyPoints();
+
+        // The new frame reuses the containers of the previous one
+        if(mState==NOT_INITIALIZED || mState==NO_IMAGES_YET)
+            mCurrentFrame = Frame(mImGray,timestamp,mpIniORBextractor,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,&mCurrentFrame);
+        else
+            mCurrentFrame = Frame(mImGray,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,&mCurrentFrame);
+
+        Track();
+        mnFlowFramesInRow = 0;
+    }
 
-    Track();
+    ReleaseBadMapPoints();
+
+    // The next frame may be tracked by optical flow from this image
+    if(mnMaxFlowFrames>0)
+        mImGray.copyTo(mPrevImGray);
 
     return mCurrentFrame.mTcw.clone();
 }
@@ -274,8 +372,12 @@ void Tracking::Track()
 
     mLastProcessedState=mState;
 
-    // Get Map Mutex -> Map cannot be changed
-    unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+    mSeenPointMarks.NewGeneration();
+
+    // Get Map Mutex -> Map cannot be changed (structurally). Poses and positions are read as of
+    // the last commit of the local BA, later commits are seen in the next frame.
+    SharedLock lock(mpMap->mMutexMapUpdate);
+    SnapshotPin pin(mpMap->mSnapshots,mnSnapshotSlot);
 
     if(mState==NOT_INITIALIZED)
     {
@@ -293,6 +395,7 @@ void Tracking::Track()
     {
         // System is initialized. Track Frame.
         bool bOK;
+        mPredictedTcw.release();
 
         // Initial camera pose estimation using motion model or relocalization (if tracking is lost)
         if(!mbOnlyTracking)
@@ -413,7 +516,11 @@ void Tracking::Track()
         if(bOK)
             mState = OK;
         else
+        {
             mState=LOST;
+            // The prediction error is learnt again once tracking is recovered
+            mnMotionModelSamples = 0;
+        }
 
         // Update drawer
         mpFrameDrawer->Update(this);
@@ -421,16 +528,12 @@ void Tracking::Track()
         // If tracking were good, check if we insert a keyframe
         if(bOK)
         {
+            // Error of the motion model prediction
+            if(mbAdaptiveSearch && !mPredictedTcw.empty())
+                UpdateMotionModelCovariance();
+
             // Update motion model
-            if(!mLastFrame.mTcw.empty())
-            {
-                cv::Mat LastTwc = cv::Mat::eye(4,4,CV_32F);
-                mLastFrame.GetRotationInverse().copyTo(LastTwc.rowRange(0,3).colRange(0,3));
-                mLastFrame.GetCameraCenter().copyTo(LastTwc.rowRange(0,3).col(3));
-                mVelocity = mCurrentFrame.mTcw*LastTwc;
-            }
-            else
-                mVelocity = cv::Mat();
+            UpdateMotionModel();
 
             mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
 
@@ -483,27 +586,243 @@ void Tracking::Track()
         if(!mCurrentFrame.mpReferenceKF)
             mCurrentFrame.mpReferenceKF = mpReferenceKF;
 
-        mLastFrame = Frame(mCurrentFrame);
+        mLastFrame = mCurrentFrame;
     }
 
     // Store frame pose information to retrieve the complete camera trajectory afterwards.
-    if(!mCurrentFrame.mTcw.empty())
+    StoreFramePose();
+}
+
+bool Tracking::TrackFlowFrame(const double &timestamp)
+{
+    if(mnMaxFlowFrames==0 || mnFlowFramesInRow>=mnMaxFlowFrames || mState!=OK || (mbOnlyTracking && mbVO))
+        return false;
+
+    // Right after relocalization the frames are fully processed, as by the motion model
+    if(mPrevImGray.empty() || mPrevImGray.rows!=mImGray.rows || mPrevImGray.cols!=mImGray.cols || mLastFrame.mTcw.empty() || mLastFrame.mnId<mnLastRelocFrameId+2)
+        return false;
+
+    const size_t nMinPoints = 50;
+    const int nMinInliers = 30;
+
+    vector<cv::Point2f> vLastPts;
+    vector<int> vLastIdx;
+    vLastPts.reserve(mLastFrame.N);
+    vLastIdx.reserve(mLastFrame.N);
+
+    // The map is not locked during the optical flow, the points are checked again afterwards
     {
-        cv::Mat Tcr = mCurrentFrame.mTcw*mCurrentFrame.mpReferenceKF->GetPoseInverse();
-        mlRelativeFramePoses.push_back(Tcr);
-        mlpReferences.push_back(mpReferenceKF);
-        mlFrameTimes.push_back(mCurrentFrame.mTimeStamp);
-        mlbLost.push_back(mState==LOST);
+        SharedLock lock(mpMap->mMutexMapUpdate);
+
+        // Local Mapping might have changed some MapPoints tracked in last frame
+        CheckReplacedInLastFrame();
+
+        for(int i=0; i<mLastFrame.N; i++)
+        {
+            MapPoint* pMP = mLastFrame.mvpMapPoints[i];
+            if(pMP && !mLastFrame.mvbOutlier[i] && !pMP->isBad())
+            {
+                vLastPts.push_back(mLastFrame.mvKeys[i].pt);
+                vLastIdx.push_back(i);
+            }
+        }
+    }
+
+    if(vLastPts.size()<nMinPoints)
+        return false;
+
+    // Pyramidal Lucas-Kanade, keeping the points tracked back to where they started
+    vector<cv::Point2f> vPts, vBackPts;
+    vector<unsigned char> vStatus, vBackStatus;
+    vector<float> vError;
+    const cv::Size winSize(21,21);
+    cv::calcOpticalFlowPyrLK(mPrevImGray,mImGray,vLastPts,vPts,vStatus,vError,winSize,3);
+    cv::calcOpticalFlowPyrLK(mImGray,mPrevImGray,vPts,vBackPts,vBackStatus,vError,winSize,3);
+
+    SharedLock lock(mpMap->mMutexMapUpdate);
+    SnapshotPin pin(mpMap->mSnapshots,mnSnapshotSlot);
+
+    vector<cv::KeyPoint> vKeys;
+    vector<MapPoint*> vpMapPoints;
+    vKeys.reserve(vPts.size());
+    vpMapPoints.reserve(vPts.size());
+    for(size_t i=0; i<vPts.size(); i++)
+    {
+        if(!vStatus[i] || !vBackStatus[i])
+            continue;
+
+        const cv::Point2f d = vBackPts[i]-vLastPts[i];
+        if(d.x*d.x+d.y*d.y>1.0f)
+            continue;
+
+        const cv::Point2f &pt = vPts[i];
+        if(pt.x<0 || pt.y<0 || pt.x>=mImGray.cols || pt.y>=mImGray.rows)
+            continue;
+
+        // Points culled during the optical flow are still alive (see ReleaseBadMapPoints), but dropped
+        MapPoint* pMP = mLastFrame.mvpMapPoints[vLastIdx[i]];
+        if(pMP->isBad())
+            continue;
+
+        // The keypoint keeps its scale level, used for the uncertainty and by the next search
+        cv::KeyPoint kp = mLastFrame.mvKeys[vLastIdx[i]];
+        kp.pt = pt;
+        vKeys.push_back(kp);
+        vpMapPoints.push_back(pMP);
     }
+
+    if(vKeys.size()<nMinPoints)
+        return false;
+
+    // The frame reuses the containers of the previous one
+    mCurrentFrame = Frame(timestamp,mLastFrame,vKeys,vpMapPoints,&mCurrentFrame);
+
+    if(!mVelocity.empty())
+        mCurrentFrame.SetPose(mVelocity*mLastFrame.mTcw);
     else
+        mCurrentFrame.SetPose(mLastFrame.mTcw);
+
+    Optimizer::PoseOptimization(&mCurrentFrame);
+
+    // Discard outliers
+    int nInliers = 0;
+    for(int i=0; i<mCurrentFrame.N; i++)
+    {
+        if(mCurrentFrame.mvbOutlier[i])
+        {
+            mCurrentFrame.mvpMapPoints[i]=static_cast<MapPoint*>(NULL);
+            mCurrentFrame.mvbOutlier[i]=false;
+        }
+        else
+            nInliers++;
+    }
+
+    if(nInliers<nMinInliers)
+        return false;
+
+    mLastProcessedState = mState;
+    mCurrentFrame.mpReferenceKF = mpReferenceKF;
+
+    mpFrameDrawer->Update(this);
+
+    UpdateMotionModel();
+
+    mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
+
+    mLastFrame = mCurrentFrame;
+
+    StoreFramePose();
+
+    return true;
+}
+
+void Tracking::PredictKeyPoints()
+{
+    // The whole image is extracted until tracking is stable again (this also covers the frames
+    // right after a failed guided frame, which are lost or have few inliers)
+    if(!mbGuidedExtraction || mState!=OK || mVelocity.empty() || mLastFrame.mTcw.empty() || (mbOnlyTracking && mbVO))
+        return;
+    if(Frame::nNextId<mnLastRelocFrameId+2 || mnMatchesInliers<50)
+        return;
+
+    const int nMinPredictions = 100;
+
+    SharedLock lock(mpMap->mMutexMapUpdate);
+    SnapshotPin pin(mpMap->mSnapshots,mnSnapshotSlot);
+
+    // Keyframes keep the features of their frame, and guided frames miss the new points of the
+    // unexplored parts of the image
+    if(KeyFrameLikely())
+        return;
+
+    const cv::Mat Tcw = mVelocity*mLastFrame.mTcw;
+    const cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
+    const cv::Mat tcw = Tcw.rowRange(0,3).col(3);
+    const cv::Mat Ow = -Rcw.t()*tcw;
+
+    // The extractor works on the distorted image
+    const bool bDistorted = mDistCoef.at<float>(0)!=0.0;
+    const float k1 = mDistCoef.at<float>(0);
+    const float k2 = mDistCoef.at<float>(1);
+    const float p1 = mDistCoef.at<float>(2);
+    const float p2 = mDistCoef.at<float>(3);
+    const float k3 = mDistCoef.total()>4 ? mDistCoef.at<float>(4) : 0.0f;
+
+    mvPredictedKeys.clear();
+    for(vector<MapPoint*>::iterator vit=mvpLocalMapPoints.begin(), vend=mvpLocalMapPoints.end(); vit!=vend; vit++)
+    {
+        MapPoint* pMP = *vit;
+        if(!pMP || pMP->isBad())
+            continue;
+
+        float x3Dw[3];
+        pMP->GetWorldPos(x3Dw);
+
+        float x3Dc[3];
+        for(int i=0; i<3; i++)
+            x3Dc[i] = Rcw.at<float>(i,0)*x3Dw[0]+Rcw.at<float>(i,1)*x3Dw[1]+Rcw.at<float>(i,2)*x3Dw[2]+tcw.at<float>(i);
+        if(x3Dc[2]<=0.0f)
+            continue;
+
+        const float invz = 1.0f/x3Dc[2];
+        float x = x3Dc[0]*invz;
+        float y = x3Dc[1]*invz;
+        const float u = Frame::fx*x+Frame::cx;
+        const float v = Frame::fy*y+Frame::cy;
+        if(u<Frame::mnMinX || u>Frame::mnMaxX || v<Frame::mnMinY || v>Frame::mnMaxY)
+            continue;
+
+        // Scale invariance region
+        const float dx = x3Dw[0]-Ow.at<float>(0);
+        const float dy = x3Dw[1]-Ow.at<float>(1);
+        const float dz = x3Dw[2]-Ow.at<float>(2);
+        const float dist = sqrt(dx*dx+dy*dy+dz*dz);
+        if(dist<pMP->GetMinDistanceInvariance() || dist>pMP->GetMaxDistanceInvariance())
+            continue;
+
+        if(bDistorted)
+        {
+            const float r2 = x*x+y*y;
+            const float radial = 1.0f+r2*(k1+r2*(k2+r2*k3));
+            const float xd = x*radial+2.0f*p1*x*y+p2*(r2+2.0f*x*x);
+            const float yd = y*radial+p1*(r2+2.0f*y*y)+2.0f*p2*x*y;
+            x = xd;
+            y = yd;
+        }
+
+        const int nLevel = pMP->PredictScale(dist,&mLastFrame);
+        mvPredictedKeys.push_back(cv::KeyPoint(Frame::fx*x+Frame::cx,Frame::fy*y+Frame::cy,1.0f,-1.0f,0.0f,nLevel));
+    }
+
+    if((int)mvPredictedKeys.size()>=nMinPredictions)
+        mpORBextractorLeft->SetPredictions(mvPredictedKeys,mfGuidedExploreRatio);
+}
+
+void Tracking::UpdateMotionModel()
+{
+    if(!mLastFrame.mTcw.empty())
     {
-        // This can happen if tracking is lost
-        mlRelativeFramePoses.push_back(mlRelativeFramePoses.back());
-        mlpReferences.push_back(mlpReferences.back());
-        mlFrameTimes.push_back(mlFrameTimes.back());
-        mlbLost.push_back(mState==LOST);
+        cv::Mat LastTwc = cv::Mat::eye(4,4,CV_32F);
+        mLastFrame.GetRotationInverse().copyTo(LastTwc.rowRange(0,3).colRange(0,3));
+        mLastFrame.GetCameraCenter().copyTo(LastTwc.rowRange(0,3).col(3));
+        mVelocity = mCurrentFrame.mTcw*LastTwc;
     }
+    else
+        mVelocity = cv::Mat();
+}
 
+void Tracking::StoreFramePose()
+{
+    if(!mCurrentFrame.mTcw.empty())
+    {
+        cv::Mat Tcr = mCurrentFrame.mTcw*mCurrentFrame.mpReferenceKF->GetPoseInverse();
+        mTrajectory.Add(Tcr,mpReferenceKF,mCurrentFrame.mTimeStamp,mState==LOST);
+    }
+    else if(!mTrajectory.empty())
+    {
+        // This can happen if tracking is lost (frames before relocalizing in a loaded map are not stored)
+        mTrajectory.AddRepeat(mState==LOST);
+    }
 }
 
 
@@ -542,12 +861,13 @@ void Tracking::StereoInitialization()
 
         mpLocalMapper->InsertKeyFrame(pKFini);
 
-        mLastFrame = Frame(mCurrentFrame);
+        mLastFrame = mCurrentFrame;
         mnLastKeyFrameId=mCurrentFrame.mnId;
         mpLastKeyFrame = pKFini;
 
         mvpLocalKeyFrames.push_back(pKFini);
-        mvpLocalMapPoints=mpMap->GetAllMapPoints();
+        ResetLocalMap();
+        UpdateLocalPoints();
         mpReferenceKF = pKFini;
         mCurrentFrame.mpReferenceKF = pKFini;
 
@@ -569,8 +889,8 @@ void Tracking::MonocularInitialization()
         // Set Reference Frame
         if(mCurrentFrame.mvKeys.size()>100)
         {
-            mInitialFrame = Frame(mCurrentFrame);
-            mLastFrame = Frame(mCurrentFrame);
+            mInitialFrame = mCurrentFrame;
+            mLastFrame = mCurrentFrame;
             mvbPrevMatched.resize(mCurrentFrame.mvKeysUn.size());
             for(size_t i=0; i<mCurrentFrame.mvKeysUn.size(); i++)
                 mvbPrevMatched[i]=mCurrentFrame.mvKeysUn[i].pt;
@@ -722,11 +1042,12 @@ void Tracking::CreateInitialMapMonocular()
 
     mvpLocalKeyFrames.push_back(pKFcur);
     mvpLocalKeyFrames.push_back(pKFini);
-    mvpLocalMapPoints=mpMap->GetAllMapPoints();
+    ResetLocalMap();
+    UpdateLocalPoints();
     mpReferenceKF = pKFcur;
     mCurrentFrame.mpReferenceKF = pKFcur;
 
-    mLastFrame = Frame(mCurrentFrame);
+    mLastFrame = mCurrentFrame;
 
     mpMap->SetReferenceMapPoints(mvpLocalMapPoints);
 
@@ -755,6 +1076,75 @@ void Tracking::CheckReplacedInLastFrame()
 }
 
 
+void Tracking::ReleaseBadMapPoints()
+{
+    // Points retired while scrubbing are not seen as bad here, they must stay alive until the next frame
+    const unsigned long nEpoch = mpMap->mEpochManager.BeginQuiescent();
+
+    // Replaced mappoints are kept in the last frame (see CheckReplacedInLastFrame)
+    for(size_t i=0; i<mLastFrame.mvpMapPoints.size(); i++)
+    {
+        MapPoint* pMP = mLastFrame.mvpMapPoints[i];
+        if(pMP && pMP->isBad())
+        {
+            MapPoint* pRep = pMP->GetReplaced();
+            mLastFrame.mvpMapPoints[i] = (pRep && !pRep->isBad()) ? pRep : static_cast<MapPoint*>(NULL);
+        }
+    }
+
+    for(size_t i=0; i<mCurrentFrame.mvpMapPoints.size(); i++)
+    {
+        MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
+        if(pMP && pMP->isBad())
+            mCurrentFrame.mvpMapPoints[i] = static_cast<MapPoint*>(NULL);
+    }
+
+    // Mappoints become bad only after being erased from their keyframes, so refreshing the
+    // local keyframes whose matches have changed drops them from the local map.
+    UpdateLocalPoints();
+
+    // This is for visualization
+    if(mbLocalMapChanged)
+    {
+        mpMap->SetReferenceMapPoints(mvpLocalMapPoints);
+        mbLocalMapChanged = false;
+    }
+
+    // A keyframe inserted in this frame is handed to Local Mapping with the matches of the frame
+    if(mpLastKeyFrame && mpLastKeyFrame->mnFrameId==mCurrentFrame.mnId)
+    {
+        const vector<MapPoint*> vpMapPoints = mpLastKeyFrame->GetMapPointMatches();
+        for(size_t i=0; i<vpMapPoints.size(); i++)
+        {
+            MapPoint* pMP = vpMapPoints[i];
+            if(pMP && pMP->isBad())
+                mpLastKeyFrame->EraseMapPointMatch(i);
+        }
+    }
+
+    // Bad keyframes are not deleted, but they do not keep their mappoints
+    while(mpReferenceKF && mpReferenceKF->isBad() && mpReferenceKF->GetParent())
+        mpReferenceKF = mpReferenceKF->GetParent();
+
+    mpMap->mEpochManager.EndQuiescent(mnEpochSlot,nEpoch);
+}
+
+void Tracking::UpdateMotionModelCovariance()
+{
+    // Left perturbation taking the predicted pose to the tracked one
+    const Eigen::Matrix<double,6,1> err = (Converter::toSE3Quat(mCurrentFrame.mTcw)*Converter::toSE3Quat(mPredictedTcw).inverse()).log();
+
+    cv::Mat E(6,1,CV_32F);
+    for(int i=0; i<6; i++)
+        E.at<float>(i) = err(i);
+
+    if(mnMotionModelSamples==0)
+        mMotionModelCov = E*E.t();
+    else
+        mMotionModelCov = 0.9f*mMotionModelCov+0.1f*E*E.t();
+    mnMotionModelSamples++;
+}
+
 bool Tracking::TrackReferenceKeyFrame()
 {
     // Compute Bag of Words vector
@@ -773,7 +1163,7 @@ bool Tracking::TrackReferenceKeyFrame()
     mCurrentFrame.mvpMapPoints = vpMapPointMatches;
     mCurrentFrame.SetPose(mLastFrame.mTcw);
 
-    Optimizer::PoseOptimization(&mCurrentFrame);
+    Optimizer::PoseOptimization(&mCurrentFrame,mbAdaptiveSearch);
 
     // Discard outliers
     int nmatchesMap = 0;
@@ -787,8 +1177,7 @@ bool Tracking::TrackReferenceKeyFrame()
 
                 mCurrentFrame.mvpMapPoints[i]=static_cast<MapPoint*>(NULL);
                 mCurrentFrame.mvbOutlier[i]=false;
-                pMP->mbTrackInView = false;
-                pMP->mnLastFrameSeen = mCurrentFrame.mnId;
+                mSeenPointMarks.Mark(pMP->mnId);
                 nmatches--;
             }
             else if(mCurrentFrame.mvpMapPoints[i]->Observations()>0)
@@ -803,7 +1192,7 @@ void Tracking::UpdateLastFrame()
 {
     // Update pose according to reference keyframe
     KeyFrame* pRef = mLastFrame.mpReferenceKF;
-    cv::Mat Tlr = mlRelativeFramePoses.back();
+    cv::Mat Tlr = mTrajectory.GetLastRelativePose();
 
     mLastFrame.SetPose(Tlr*pRef->GetPose());
 
@@ -874,6 +1263,13 @@ bool Tracking::TrackWithMotionModel()
     UpdateLastFrame();
 
     mCurrentFrame.SetPose(mVelocity*mLastFrame.mTcw);
+    mPredictedTcw = mCurrentFrame.mTcw.clone();
+
+    // Windows from the uncertainty of the prediction, once it has been observed for some frames
+    if(mbAdaptiveSearch && mnMotionModelSamples>=5)
+        mCurrentFrame.mPoseCov = mMotionModelCov.clone();
+    else
+        mCurrentFrame.mPoseCov.release();
 
     fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
 
@@ -888,15 +1284,19 @@ bool Tracking::TrackWithMotionModel()
     // If few matches, uses a wider window search
     if(nmatches<20)
     {
+        mCurrentFrame.mPoseCov.release();
         fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
         nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,2*th,mSensor==System::MONOCULAR);
     }
 
+    mSearchWindowStats.nMotionModelComparisons += matcher.mnDescriptorComparisons;
+    mSearchWindowStats.nMotionModelMatches += nmatches;
+
     if(nmatches<20)
         return false;
 
     // Optimize frame pose with all matches
-    Optimizer::PoseOptimization(&mCurrentFrame);
+    Optimizer::PoseOptimization(&mCurrentFrame,mbAdaptiveSearch);
 
     // Discard outliers
     int nmatchesMap = 0;
@@ -910,8 +1310,7 @@ bool Tracking::TrackWithMotionModel()
 
                 mCurrentFrame.mvpMapPoints[i]=static_cast<MapPoint*>(NULL);
                 mCurrentFrame.mvbOutlier[i]=false;
-                pMP->mbTrackInView = false;
-                pMP->mnLastFrameSeen = mCurrentFrame.mnId;
+                mSeenPointMarks.Mark(pMP->mnId);
                 nmatches--;
             }
             else if(mCurrentFrame.mvpMapPoints[i]->Observations()>0)
@@ -975,6 +1374,27 @@ bool Tracking::TrackLocalMap()
 }
 
 
+float Tracking::KeyFrameRefRatio(const int nKFs)
+{
+    if(mSensor==System::MONOCULAR)
+        return 0.9f;
+    if(nKFs<2)
+        return 0.4f;
+    return 0.75f;
+}
+
+bool Tracking::KeyFrameLikely()
+{
+    if(mbOnlyTracking || !mpReferenceKF)
+        return false;
+
+    // Same reference as NeedNewKeyFrame, with a margin since the inliers change from frame to frame
+    const int nKFs = mpMap->KeyFramesInMap();
+    const int nRefMatches = mpReferenceKF->TrackedMapPoints(nKFs<=2 ? 2 : 3);
+
+    return mnMatchesInliers<1.2f*KeyFrameRefRatio(nKFs)*nRefMatches;
+}
+
 bool Tracking::NeedNewKeyFrame()
 {
     if(mbOnlyTracking)
@@ -1019,12 +1439,7 @@ bool Tracking::NeedNewKeyFrame()
     bool bNeedToInsertClose = (nTrackedClose<100) && (nNonTrackedClose>70);
 
     // Thresholds
-    float thRefRatio = 0.75f;
-    if(nKFs<2)
-        thRefRatio = 0.4f;
-
-    if(mSensor==System::MONOCULAR)
-        thRefRatio = 0.9f;
+    const float thRefRatio = KeyFrameRefRatio(nKFs);
 
     // Condition 1a: More than "MaxFrames" have passed from last keyframe insertion
     const bool c1a = mCurrentFrame.mnId>=mnLastKeyFrameId+mMaxFrames;
@@ -1143,6 +1558,8 @@ void Tracking::CreateNewKeyFrame()
 
 void Tracking::SearchLocalPoints()
 {
+    int nTracked=0;
+
     // Do not search map points already matched
     for(vector<MapPoint*>::iterator vit=mCurrentFrame.mvpMapPoints.begin(), vend=mCurrentFrame.mvpMapPoints.end(); vit!=vend; vit++)
     {
@@ -1156,29 +1573,77 @@ void Tracking::SearchLocalPoints()
             else
             {
                 pMP->IncreaseVisible();
-                pMP->mnLastFrameSeen = mCurrentFrame.mnId;
-                pMP->mbTrackInView = false;
+                mSeenPointMarks.Mark(pMP->mnId);
+                nTracked++;
             }
         }
     }
 
+    // Windows from the covariance of the last pose optimization, unless just relocalised
+    if(!mbAdaptiveSearch || mCurrentFrame.mnId<mnLastRelocFrameId+2)
+        mCurrentFrame.mPoseCov.release();
+
     int nToMatch=0;
+    const bool bBudget = mfFrameDeadline>0 || mnLocalMapMatchQuota>0 || mnMaxLocalMapCandidates>0;
+    vector<pair<float,size_t> > vScoredPoints;
 
-    // Project points in frame and check its visibility
-    for(vector<MapPoint*>::iterator vit=mvpLocalMapPoints.begin(), vend=mvpLocalMapPoints.end(); vit!=vend; vit++)
+    mLocalMapSearchStats = LocalMapSearchStats();
+
+    // Mappoints seen at the current pose that the covisibility graph did not bring into the local map
+    // (e.g. a revisited place before the loop is closed). They are searched like the local ones.
+    vector<MapPoint*> vpFrustumPoints;
+    if(mbFrustumLocalMap && mpReferenceKF)
     {
-        MapPoint* pMP = *vit;
-        if(pMP->mnLastFrameSeen == mCurrentFrame.mnId)
+        const float maxDepth = 2.0f*mpReferenceKF->ComputeSceneMedianDepth(2);
+        if(maxDepth>0)
+        {
+            const vector<MapPoint*> vpInFrustum = mpMap->GetMapPointsInFrustum(mCurrentFrame,maxDepth);
+            for(vector<MapPoint*>::const_iterator vit=vpInFrustum.begin(), vend=vpInFrustum.end(); vit!=vend; vit++)
+            {
+                const long unsigned int nId = (*vit)->mnId;
+                if(nId<mvnLocalPointRefs.size() && mvnLocalPointRefs[nId]>0)
+                    continue;
+                vpFrustumPoints.push_back(*vit);
+            }
+        }
+    }
+    mLocalMapSearchStats.nFrustumPoints = vpFrustumPoints.size();
+
+    // Project points in frame and check its visibility. The deadline is also checked here,
+    // projecting and scoring a large local map is not free.
+    const size_t nLocal = mvpLocalMapPoints.size();
+    mvLocalProjections.resize(nLocal+vpFrustumPoints.size());
+    for(size_t iMP=0, iend=nLocal+vpFrustumPoints.size(); iMP<iend; iMP++)
+    {
+        if(mfFrameDeadline>0 && (iMP%32)==0 &&
+           chrono::duration<float,milli>(chrono::steady_clock::now()-mFrameStart).count()>=mfFrameDeadline)
+        {
+            mLocalMapSearchStats.bDeadline = true;
+            mLocalMapSearchStats.nUnprojected = iend-iMP;
+            break;
+        }
+
+        MapPoint* pMP = iMP<nLocal ? mvpLocalMapPoints[iMP] : vpFrustumPoints[iMP-nLocal];
+        if(mSeenPointMarks.IsMarked(pMP->mnId))
             continue;
         if(pMP->isBad())
             continue;
-        // Project (this fills MapPoint variables for matching)
-        if(mCurrentFrame.isInFrustum(pMP,0.5))
+        // Project (this fills the projection used for matching)
+        MapPointProjection &proj = mvLocalProjections[nToMatch];
+        if(mCurrentFrame.isInFrustum(pMP,0.5,proj))
         {
-            pMP->IncreaseVisible();
+            // Expected usefulness: how often it was found when visible, how many keyframes observe it
+            // and how close to its mean viewing direction it is seen
+            if(bBudget)
+                vScoredPoints.push_back(make_pair(pMP->GetFoundRatio()*min(pMP->Observations(),10)*proj.viewCos,(size_t)nToMatch));
+            else
+                pMP->IncreaseVisible();
             nToMatch++;
         }
     }
+    mvLocalProjections.resize(nToMatch);
+
+    mLocalMapSearchStats.nCandidates = nToMatch;
 
     if(nToMatch>0)
     {
@@ -1189,15 +1654,77 @@ void Tracking::SearchLocalPoints()
         // If the camera has been relocalised recently, perform a coarser search
         if(mCurrentFrame.mnId<mnLastRelocFrameId+2)
             th=5;
-        matcher.SearchByProjection(mCurrentFrame,mvpLocalMapPoints,th);
+
+        if(!bBudget)
+        {
+            mLocalMapSearchStats.nMatches = matcher.SearchByProjection(mCurrentFrame,mvLocalProjections,th);
+            mLocalMapSearchStats.nSearched = nToMatch;
+            mLocalMapSearchStats.nComparisons = matcher.mnDescriptorComparisons;
+            mSearchWindowStats.nLocalMapComparisons += mLocalMapSearchStats.nComparisons;
+            mSearchWindowStats.nLocalMapMatches += mLocalMapSearchStats.nMatches;
+            return;
+        }
+
+        // Most useful points first, in batches until the deadline or the match quota is reached.
+        // Dropped points are not counted as visible, so that their found ratio is not penalized.
+        // Only the candidates kept by the cap are ordered.
+        const auto moreUseful = [](const pair<float,size_t> &a, const pair<float,size_t> &b){return a.first>b.first;};
+        size_t nKept = vScoredPoints.size();
+        if(mnMaxLocalMapCandidates>0 && nKept>(size_t)mnMaxLocalMapCandidates)
+        {
+            nKept = mnMaxLocalMapCandidates;
+            nth_element(vScoredPoints.begin(),vScoredPoints.begin()+nKept,vScoredPoints.end(),moreUseful);
+        }
+        sort(vScoredPoints.begin(),vScoredPoints.begin()+nKept,moreUseful);
+
+        const size_t nBatch = 50;
+        vector<MapPointProjection> vBatch;
+        vBatch.reserve(nBatch);
+        size_t i=0;
+        while(i<nKept)
+        {
+            if(mnLocalMapMatchQuota>0 && nTracked+mLocalMapSearchStats.nMatches>=mnLocalMapMatchQuota)
+            {
+                mLocalMapSearchStats.bQuota = true;
+                break;
+            }
+
+            if(mfFrameDeadline>0 && chrono::duration<float,milli>(chrono::steady_clock::now()-mFrameStart).count()>=mfFrameDeadline)
+            {
+                mLocalMapSearchStats.bDeadline = true;
+                break;
+            }
+
+            vBatch.clear();
+            for(const size_t iend=min(i+nBatch,nKept); i<iend; i++)
+            {
+                const MapPointProjection &proj = mvLocalProjections[vScoredPoints[i].second];
+                proj.pMP->IncreaseVisible();
+                vBatch.push_back(proj);
+            }
+            mLocalMapSearchStats.nMatches += matcher.SearchByProjection(mCurrentFrame,vBatch,th);
+        }
+
+        mLocalMapSearchStats.nSearched = i;
+        mLocalMapSearchStats.nDropped = vScoredPoints.size()-i;
+        mLocalMapSearchStats.nComparisons = matcher.mnDescriptorComparisons;
+        mSearchWindowStats.nLocalMapComparisons += mLocalMapSearchStats.nComparisons;
+        mSearchWindowStats.nLocalMapMatches += mLocalMapSearchStats.nMatches;
     }
 }
 
-void Tracking::UpdateLocalMap()
+Tracking::LocalMapSearchStats Tracking::GetLocalMapSearchStats() const
 {
-    // This is for visualization
-    mpMap->SetReferenceMapPoints(mvpLocalMapPoints);
+    return mLocalMapSearchStats;
+}
+
+Tracking::SearchWindowStats Tracking::GetSearchWindowStats() const
+{
+    return mSearchWindowStats;
+}
 
+void Tracking::UpdateLocalMap()
+{
     // Update
     UpdateLocalKeyFrames();
     UpdateLocalPoints();
@@ -1205,34 +1732,119 @@ void Tracking::UpdateLocalMap()
 
 void Tracking::UpdateLocalPoints()
 {
-    mvpLocalMapPoints.clear();
+    // Drop the mappoints of the keyframes that left the local map
+    mLocalKeyFrameMarks.NewGeneration();
+    for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
+        mLocalKeyFrameMarks.Mark((*itKF)->mnId);
+
+    for(unordered_map<KeyFrame*,LocalKeyFrame>::iterator it=mmLocalKeyFrames.begin(); it!=mmLocalKeyFrames.end(); )
+    {
+        if(mLocalKeyFrameMarks.IsMarked(it->first->mnId))
+        {
+            it++;
+            continue;
+        }
 
+        const vector<long unsigned int> &vnIds = it->second.mvnMapPointIds;
+        for(size_t i=0; i<vnIds.size(); i++)
+            RemoveLocalPoint(vnIds[i]);
+        it = mmLocalKeyFrames.erase(it);
+    }
+
+    // Add the mappoints of the new local keyframes, and of those whose matches have changed
     for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
     {
         KeyFrame* pKF = *itKF;
+
+        // Read the version first, a change while copying the matches is seen on the next update
+        const unsigned long nVersion = pKF->GetMapPointsVersion();
+        pair<unordered_map<KeyFrame*,LocalKeyFrame>::iterator,bool> ins = mmLocalKeyFrames.insert(make_pair(pKF,LocalKeyFrame()));
+        LocalKeyFrame &localKF = ins.first->second;
+        if(!ins.second && localKF.mnMapPointsVersion==nVersion)
+            continue;
+
         const vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+        vector<long unsigned int> vnIds;
+        vnIds.reserve(vpMPs.size());
+        mLocalPointMarks.NewGeneration();
 
         for(vector<MapPoint*>::const_iterator itMP=vpMPs.begin(), itEndMP=vpMPs.end(); itMP!=itEndMP; itMP++)
         {
             MapPoint* pMP = *itMP;
             if(!pMP)
                 continue;
-            if(pMP->mnTrackReferenceForFrame==mCurrentFrame.mnId)
+            if(pMP->isBad())
                 continue;
-            if(!pMP->isBad())
-            {
-                mvpLocalMapPoints.push_back(pMP);
-                pMP->mnTrackReferenceForFrame=mCurrentFrame.mnId;
-            }
+            if(!mLocalPointMarks.Mark(pMP->mnId))
+                continue;
+            AddLocalPoint(pMP);
+            vnIds.push_back(pMP->mnId);
         }
+
+        // Points still matched were counted twice
+        for(size_t i=0; i<localKF.mvnMapPointIds.size(); i++)
+            RemoveLocalPoint(localKF.mvnMapPointIds[i]);
+
+        localKF.mnMapPointsVersion = nVersion;
+        localKF.mvnMapPointIds.swap(vnIds);
     }
 }
 
+void Tracking::AddLocalPoint(MapPoint *pMP)
+{
+    const long unsigned int nId = pMP->mnId;
+    if(nId>=mvnLocalPointRefs.size())
+    {
+        const size_t nSize = max(static_cast<size_t>(nId+1),2*mvnLocalPointRefs.size());
+        mvnLocalPointRefs.resize(nSize,0);
+        mvnLocalPointIdx.resize(nSize,-1);
+    }
+
+    if(mvnLocalPointRefs[nId]++==0)
+    {
+        mvnLocalPointIdx[nId] = mvpLocalMapPoints.size();
+        mvpLocalMapPoints.push_back(pMP);
+        mvnLocalMapPointIds.push_back(nId);
+        mbLocalMapChanged = true;
+    }
+}
+
+void Tracking::RemoveLocalPoint(const long unsigned int nId)
+{
+    if(--mvnLocalPointRefs[nId]==0 && mvnLocalPointIdx[nId]>=0)
+        EraseLocalPointAt(mvnLocalPointIdx[nId],nId);
+}
+
+void Tracking::EraseLocalPointAt(const size_t idx, const long unsigned int nId)
+{
+    const long unsigned int nBackId = mvnLocalMapPointIds.back();
+    mvpLocalMapPoints[idx] = mvpLocalMapPoints.back();
+    mvnLocalMapPointIds[idx] = nBackId;
+    mvnLocalPointIdx[nBackId] = idx;
+    mvpLocalMapPoints.pop_back();
+    mvnLocalMapPointIds.pop_back();
+    mvnLocalPointIdx[nId] = -1;
+    mbLocalMapChanged = true;
+}
+
+void Tracking::ResetLocalMap()
+{
+    mmLocalKeyFrames.clear();
+    mvnLocalPointRefs.clear();
+    mvnLocalPointIdx.clear();
+    mvnLocalMapPointIds.clear();
+    mvpLocalMapPoints.clear();
+    mvpLocalVotingKFs.clear();
+    mbLocalMapChanged = true;
+}
+
 
 void Tracking::UpdateLocalKeyFrames()
 {
     // Each map point vote for the keyframes in which it has been observed
-    map<KeyFrame*,int> keyframeCounter;
+    mKeyFrameVotes.NewGeneration();
+    vector<KeyFrame*> vpVotingKFs;
+    vpVotingKFs.reserve(mvpLocalVotingKFs.size());
     for(int i=0; i<mCurrentFrame.N; i++)
     {
         if(mCurrentFrame.mvpMapPoints[i])
@@ -1240,9 +1852,20 @@ void Tracking::UpdateLocalKeyFrames()
             MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
             if(!pMP->isBad())
             {
-                const map<KeyFrame*,size_t> observations = pMP->GetObservations();
-                for(map<KeyFrame*,size_t>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                    keyframeCounter[it->first]++;
+                const ObservationList observations = pMP->GetObservations();
+                for(ObservationList::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
+                {
+                    KeyFrame* pKF = it->first;
+                    if(mKeyFrameVotes.IsMarked(pKF->mnId))
+                    {
+                        mKeyFrameVotes.Set(pKF->mnId,mKeyFrameVotes.Get(pKF->mnId)+1);
+                    }
+                    else
+                    {
+                        mKeyFrameVotes.Set(pKF->mnId,1);
+                        vpVotingKFs.push_back(pKF);
+                    }
+                }
             }
             else
             {
@@ -1251,85 +1874,103 @@ void Tracking::UpdateLocalKeyFrames()
         }
     }
 
-    if(keyframeCounter.empty())
+    if(vpVotingKFs.empty())
         return;
 
+    // Check which keyframe shares most points
     int max=0;
     KeyFrame* pKFmax= static_cast<KeyFrame*>(NULL);
+    sort(vpVotingKFs.begin(),vpVotingKFs.end());
 
-    mvpLocalKeyFrames.clear();
-    mvpLocalKeyFrames.reserve(3*keyframeCounter.size());
-
-    // All keyframes that observe a map point are included in the local map. Also check which keyframe shares most points
-    for(map<KeyFrame*,int>::const_iterator it=keyframeCounter.begin(), itEnd=keyframeCounter.end(); it!=itEnd; it++)
+    for(vector<KeyFrame*>::const_iterator it=vpVotingKFs.begin(), itEnd=vpVotingKFs.end(); it!=itEnd; it++)
     {
-        KeyFrame* pKF = it->first;
+        KeyFrame* pKF = *it;
 
         if(pKF->isBad())
             continue;
 
-        if(it->second>max)
+        const int nVotes = mKeyFrameVotes.Get(pKF->mnId);
+        if(nVotes>max)
         {
-            max=it->second;
+            max=nVotes;
             pKFmax=pKF;
         }
-
-        mvpLocalKeyFrames.push_back(it->first);
-        pKF->mnTrackReferenceForFrame = mCurrentFrame.mnId;
     }
 
-
-    // Include also some not-already-included keyframes that are neighbors to already-included keyframes
-    for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
+    // The local keyframes only change when other keyframes vote or the map keyframes have changed
+    const unsigned long nKFsVersion = mpMap->GetKeyFramesVersion();
+    const int nBigChangeIdx = mpMap->GetLastBigChangeIdx();
+    if(vpVotingKFs!=mvpLocalVotingKFs || nKFsVersion!=mnLocalMapKFsVersion || nBigChangeIdx!=mnLocalMapBigChangeIdx)
     {
-        // Limit the number of keyframes
-        if(mvpLocalKeyFrames.size()>80)
-            break;
+        mvpLocalVotingKFs.swap(vpVotingKFs);
+        mnLocalMapKFsVersion = nKFsVersion;
+        mnLocalMapBigChangeIdx = nBigChangeIdx;
 
-        KeyFrame* pKF = *itKF;
+        mvpLocalKeyFrames.clear();
+        mvpLocalKeyFrames.reserve(3*mvpLocalVotingKFs.size());
+        mLocalKeyFrameMarks.NewGeneration();
+
+        // All keyframes that observe a map point are included in the local map
+        for(vector<KeyFrame*>::const_iterator it=mvpLocalVotingKFs.begin(), itEnd=mvpLocalVotingKFs.end(); it!=itEnd; it++)
+        {
+            KeyFrame* pKF = *it;
 
-        const vector<KeyFrame*> vNeighs = pKF->GetBestCovisibilityKeyFrames(10);
+            if(pKF->isBad())
+                continue;
+
+            mvpLocalKeyFrames.push_back(pKF);
+            mLocalKeyFrameMarks.Mark(pKF->mnId);
+        }
 
-        for(vector<KeyFrame*>::const_iterator itNeighKF=vNeighs.begin(), itEndNeighKF=vNeighs.end(); itNeighKF!=itEndNeighKF; itNeighKF++)
+        // Include also some not-already-included keyframes that are neighbors to already-included keyframes
+        for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
         {
-            KeyFrame* pNeighKF = *itNeighKF;
-            if(!pNeighKF->isBad())
+            // Limit the number of keyframes
+            if(mvpLocalKeyFrames.size()>80)
+                break;
+
+            KeyFrame* pKF = *itKF;
+
+            const vector<KeyFrame*> vNeighs = pKF->GetBestCovisibilityKeyFrames(10);
+
+            for(vector<KeyFrame*>::const_iterator itNeighKF=vNeighs.begin(), itEndNeighKF=vNeighs.end(); itNeighKF!=itEndNeighKF; itNeighKF++)
             {
-                if(pNeighKF->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
+                KeyFrame* pNeighKF = *itNeighKF;
+                if(!pNeighKF->isBad())
                 {
-                    mvpLocalKeyFrames.push_back(pNeighKF);
-                    pNeighKF->mnTrackReferenceForFrame=mCurrentFrame.mnId;
-                    break;
+                    if(mLocalKeyFrameMarks.Mark(pNeighKF->mnId))
+                    {
+                        mvpLocalKeyFrames.push_back(pNeighKF);
+                        break;
+                    }
                 }
             }
-        }
 
-        const set<KeyFrame*> spChilds = pKF->GetChilds();
-        for(set<KeyFrame*>::const_iterator sit=spChilds.begin(), send=spChilds.end(); sit!=send; sit++)
-        {
-            KeyFrame* pChildKF = *sit;
-            if(!pChildKF->isBad())
+            const set<KeyFrame*> spChilds = pKF->GetChilds();
+            for(set<KeyFrame*>::const_iterator sit=spChilds.begin(), send=spChilds.end(); sit!=send; sit++)
             {
-                if(pChildKF->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
+                KeyFrame* pChildKF = *sit;
+                if(!pChildKF->isBad())
                 {
-                    mvpLocalKeyFrames.push_back(pChildKF);
-                    pChildKF->mnTrackReferenceForFrame=mCurrentFrame.mnId;
-                    break;
+                    if(mLocalKeyFrameMarks.Mark(pChildKF->mnId))
+                    {
+                        mvpLocalKeyFrames.push_back(pChildKF);
+                        break;
+                    }
                 }
             }
-        }
 
-        KeyFrame* pParent = pKF->GetParent();
-        if(pParent)
-        {
-            if(pParent->mnTrackReferenceForFrame!=mCurrentFrame.mnId)
+            KeyFrame* pParent = pKF->GetParent();
+            if(pParent)
             {
-                mvpLocalKeyFrames.push_back(pParent);
-                pParent->mnTrackReferenceForFrame=mCurrentFrame.mnId;
-                break;
+                if(mLocalKeyFrameMarks.Mark(pParent->mnId))
+                {
+                    mvpLocalKeyFrames.push_back(pParent);
+                    break;
+                }
             }
-        }
 
+        }
     }
 
     if(pKFmax)
@@ -1337,6 +1978,14 @@ void Tracking::UpdateLocalKeyFrames()
         mpReferenceKF = pKFmax;
         mCurrentFrame.mpReferenceKF = mpReferenceKF;
     }
+
+    // Local Mapping will match the new keyframes against the local keyframes
+    KeyFramePager* pPager = mpMap->GetKeyFramePager();
+    if(pPager)
+    {
+        pPager->SetReferenceKeyFrame(mpReferenceKF);
+        pPager->Prefetch(mvpLocalKeyFrames);
+    }
 }
 
 bool Tracking::Relocalization()
@@ -1351,155 +2000,196 @@ bool Tracking::Relocalization()
     if(vpCandidateKFs.empty())
         return false;
 
+    // Evicted candidates are read back while the first ones are matched
+    KeyFramePager* pPager = mpMap->GetKeyFramePager();
+    if(pPager)
+        pPager->Prefetch(vpCandidateKFs);
+
     const int nKFs = vpCandidateKFs.size();
+    ThreadPool* pPool = mpKeyFrameDB->GetThreadPool();
 
-    // We perform first an ORB matching with each candidate
-    // If enough matches are found we setup a PnP solver
-    ORBmatcher matcher(0.75,true);
+    // The workers read the map version pinned by this frame
+    const unsigned long nReadVersion = SnapshotManager::GetReadVersion();
 
-    vector<PnPsolver*> vpPnPsolvers;
-    vpPnPsolvers.resize(nKFs);
+    // We perform first an ORB matching with each candidate (in parallel)
+    // If enough matches are found we setup a PnP solver
+    vector<RelocCandidate> vCandidates(nKFs);
+    pPool->ParallelFor(nKFs, [&](size_t i)
+    {
+        RelocCandidate &candidate = vCandidates[i];
+        candidate.pKF = vpCandidateKFs[i];
+        candidate.nMatches = 0;
+        if(candidate.pKF->isBad())
+            return;
 
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nKFs);
+        SnapshotReadScope scope(nReadVersion);
 
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nKFs);
+        ORBmatcher matcher(0.75,true);
+        candidate.nMatches = matcher.SearchByBoW(candidate.pKF,mCurrentFrame,candidate.vpMatches);
+        if(candidate.nMatches<15)
+            return;
 
-    int nCandidates=0;
+        candidate.pSolver.reset(new PnPsolver(mCurrentFrame,candidate.vpMatches));
+        candidate.pSolver->SetRansacParameters(0.99,10,300,4,0.5,5.991);
+    });
 
+    // Candidates with more matches are verified first
+    vector<RelocCandidate*> vpCandidates;
     for(int i=0; i<nKFs; i++)
+        if(vCandidates[i].pSolver)
+            vpCandidates.push_back(&vCandidates[i]);
+
+    sort(vpCandidates.begin(),vpCandidates.end(),[](const RelocCandidate* p1, const RelocCandidate* p2)
     {
-        KeyFrame* pKF = vpCandidateKFs[i];
-        if(pKF->isBad())
-            vbDiscarded[i] = true;
-        else
-        {
-            int nmatches = matcher.SearchByBoW(pKF,mCurrentFrame,vvpMapPointMatches[i]);
-            if(nmatches<15)
-            {
-                vbDiscarded[i] = true;
-                continue;
-            }
-            else
-            {
-                PnPsolver* pSolver = new PnPsolver(mCurrentFrame,vvpMapPointMatches[i]);
-                pSolver->SetRansacParameters(0.99,10,300,4,0.5,5.991);
-                vpPnPsolvers[i] = pSolver;
-                nCandidates++;
-            }
-        }
-    }
+        return p1->nMatches>p2->nMatches;
+    });
 
-    // Alternatively perform some iterations of P4P RANSAC
-    // Until we found a camera pose supported by enough inliers
+    // Each candidate performs P4P RANSAC on its own copy of the frame until a camera pose supported
+    // by enough inliers is found. The first accepted candidate stops the others.
     bool bMatch = false;
-    ORBmatcher matcher2(0.9,true);
+    atomic<bool> bStop(false);
+    mutex mutexResult;
+    cv::Mat Tcw;
+    vector<MapPoint*> vpMapPoints;
+    vector<bool> vbOutlier;
 
-    while(nCandidates>0 && !bMatch)
+    pPool->ParallelFor(vpCandidates.size(), [&](size_t i)
     {
-        for(int i=0; i<nKFs; i++)
-        {
-            if(vbDiscarded[i])
-                continue;
+        if(bStop)
+            return;
 
-            // Perform 5 Ransac Iterations
-            vector<bool> vbInliers;
-            int nInliers;
-            bool bNoMore;
+        SnapshotReadScope scope(nReadVersion);
+        Frame F(mCurrentFrame);
+        if(!VerifyRelocCandidate(*vpCandidates[i],F,bStop))
+            return;
 
-            PnPsolver* pSolver = vpPnPsolvers[i];
-            cv::Mat Tcw = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
+        unique_lock<mutex> lock(mutexResult);
+        if(bMatch)
+            return;
+        bMatch = true;
+        bStop = true;
+        Tcw = F.mTcw.clone();
+        vpMapPoints = F.mvpMapPoints;
+        vbOutlier = F.mvbOutlier;
+    });
+
+    if(bMatch)
+    {
+        mCurrentFrame.SetPose(Tcw);
+        mCurrentFrame.mvpMapPoints = vpMapPoints;
+        mCurrentFrame.mvbOutlier = vbOutlier;
+    }
 
-            // If Ransac reachs max. iterations discard keyframe
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
+    if(!bMatch)
+    {
+        return false;
+    }
+    else
+    {
+        mnLastRelocFrameId = mCurrentFrame.mnId;
+        return true;
+    }
 
-            // If a Camera Pose is computed, optimize
-            if(!Tcw.empty())
-            {
-                Tcw.copyTo(mCurrentFrame.mTcw);
+}
+
+bool Tracking::VerifyRelocCandidate(RelocCandidate &candidate, Frame &F, const atomic<bool> &bStop)
+{
+    ORBmatcher matcher2(0.9,true);
+
+    while(!bStop)
+    {
+        // Perform 5 Ransac Iterations
+        vector<bool> vbInliers;
+        int nInliers;
+        bool bNoMore;
+
+        cv::Mat Tcw = candidate.pSolver->iterate(5,bNoMore,vbInliers,nInliers);
+
+        // If a Camera Pose is computed, optimize
+        if(!Tcw.empty())
+        {
+            Tcw.copyTo(F.mTcw);
 
-                set<MapPoint*> sFound;
+            set<MapPoint*> sFound;
 
-                const int np = vbInliers.size();
+            const int np = vbInliers.size();
 
-                for(int j=0; j<np; j++)
+            for(int j=0; j<np; j++)
+            {
+                if(vbInliers[j])
                 {
-                    if(vbInliers[j])
-                    {
-                        mCurrentFrame.mvpMapPoints[j]=vvpMapPointMatches[i][j];
-                        sFound.insert(vvpMapPointMatches[i][j]);
-                    }
-                    else
-                        mCurrentFrame.mvpMapPoints[j]=NULL;
+                    F.mvpMapPoints[j]=candidate.vpMatches[j];
+                    sFound.insert(candidate.vpMatches[j]);
                 }
+                else
+                    F.mvpMapPoints[j]=NULL;
+            }
 
-                int nGood = Optimizer::PoseOptimization(&mCurrentFrame);
-
-                if(nGood<10)
-                    continue;
+            int nGood = Optimizer::PoseOptimization(&F);
 
-                for(int io =0; io<mCurrentFrame.N; io++)
-                    if(mCurrentFrame.mvbOutlier[io])
-                        mCurrentFrame.mvpMapPoints[io]=static_cast<MapPoint*>(NULL);
+            if(nGood>=10)
+            {
+                for(int io =0; io<F.N; io++)
+                    if(F.mvbOutlier[io])
+                        F.mvpMapPoints[io]=static_cast<MapPoint*>(NULL);
 
                 // If few inliers, search by projection in a coarse window and optimize again
                 if(nGood<50)
                 {
-                    int nadditional =matcher2.SearchByProjection(mCurrentFrame,vpCandidateKFs[i],sFound,10,100);
+                    int nadditional =matcher2.SearchByProjection(F,candidate.pKF,sFound,10,100);
+
+                    // Then the mappoints around the candidate that the estimated pose sees (spatial index)
+                    if(nadditional+nGood<50)
+                    {
+                        const float maxDepth = 2.0f*candidate.pKF->ComputeSceneMedianDepth(2);
+                        if(maxDepth>0)
+                        {
+                            for(int ip =0; ip<F.N; ip++)
+                                if(F.mvpMapPoints[ip])
+                                    sFound.insert(F.mvpMapPoints[ip]);
+                            nadditional += matcher2.SearchByProjection(F,mpMap->GetMapPointsInFrustum(F,maxDepth),sFound,10,100);
+                        }
+                    }
 
                     if(nadditional+nGood>=50)
                     {
-                        nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+                        nGood = Optimizer::PoseOptimization(&F);
 
                         // If many inliers but still not enough, search by projection again in a narrower window
                         // the camera has been already optimized with many points
                         if(nGood>30 && nGood<50)
                         {
                             sFound.clear();
-                            for(int ip =0; ip<mCurrentFrame.N; ip++)
-                                if(mCurrentFrame.mvpMapPoints[ip])
-                                    sFound.insert(mCurrentFrame.mvpMapPoints[ip]);
-                            nadditional =matcher2.SearchByProjection(mCurrentFrame,vpCandidateKFs[i],sFound,3,64);
+                            for(int ip =0; ip<F.N; ip++)
+                                if(F.mvpMapPoints[ip])
+                                    sFound.insert(F.mvpMapPoints[ip]);
+                            nadditional =matcher2.SearchByProjection(F,candidate.pKF,sFound,3,64);
 
                             // Final optimization
                             if(nGood+nadditional>=50)
                             {
-                                nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+                                nGood = Optimizer::PoseOptimization(&F);
 
-                                for(int io =0; io<mCurrentFrame.N; io++)
-                                    if(mCurrentFrame.mvbOutlier[io])
-                                        mCurrentFrame.mvpMapPoints[io]=NULL;
+                                for(int io =0; io<F.N; io++)
+                                    if(F.mvbOutlier[io])
+                                        F.mvpMapPoints[io]=NULL;
                             }
                         }
                     }
                 }
 
-
                 // If the pose is supported by enough inliers stop ransacs and continue
                 if(nGood>=50)
-                {
-                    bMatch = true;
-                    break;
-                }
+                    return true;
             }
         }
-    }
 
-    if(!bMatch)
-    {
-        return false;
-    }
-    else
-    {
-        mnLastRelocFrameId = mCurrentFrame.mnId;
-        return true;
+        // If Ransac reachs max. iterations discard keyframe
+        if(bNoMore)
+            return false;
     }
 
+    return false;
 }
 
 void Tracking::Reset()
@@ -1531,6 +2221,15 @@ void Tracking::Reset()
     // Clear Map (this erase MapPoints and KeyFrames)
     mpMap->clear();
 
+    // Drop the pointers to the deleted objects
+    fill(mLastFrame.mvpMapPoints.begin(),mLastFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+    fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+    mvpLocalKeyFrames.clear();
+    ResetLocalMap();
+    mnMotionModelSamples = 0;
+    mpReferenceKF = static_cast<KeyFrame*>(NULL);
+    mpLastKeyFrame = static_cast<KeyFrame*>(NULL);
+
     KeyFrame::nNextId = 0;
     Frame::nNextId = 0;
     mState = NO_IMAGES_YET;
@@ -1541,10 +2240,7 @@ void Tracking::Reset()
         mpInitializer = static_cast<Initializer*>(NULL);
     }
 
-    mlRelativeFramePoses.clear();
-    mlpReferences.clear();
-    mlFrameTimes.clear();
-    mlbLost.clear();
+    mTrajectory.Clear();
 
     if(mpViewer)
         mpViewer->Release();
@@ -1563,7 +2259,8 @@ void Tracking::ChangeCalibration(const string &strSettingPath)
     K.at<float>(1,1) = fy;
     K.at<float>(0,2) = cx;
     K.at<float>(1,2) = cy;
-    K.copyTo(mK);
+    // Frames and keyframes share the calibration matrices, they are replaced and not overwritten
+    mK = K;
 
     cv::Mat DistCoef(4,1,CV_32F);
     DistCoef.at<float>(0) = fSettings["Camera.k1"];
@@ -1576,7 +2273,7 @@ void Tracking::ChangeCalibration(const string &strSettingPath)
         DistCoef.resize(5);
         DistCoef.at<float>(4) = k3;
     }
-    DistCoef.copyTo(mDistCoef);
+    mDistCoef = DistCoef;
 
     mbf = fSettings["Camera.bf"];
 
@@ -1588,6 +2285,15 @@ void Tracking::InformOnlyTracking(const bool &flag)
     mbOnlyTracking = flag;
 }
 
+void Tracking::InformMapLoaded()
+{
+    mState = LOST;
+    mpReferenceKF = static_cast<KeyFrame*>(NULL);
+    mpLastKeyFrame = static_cast<KeyFrame*>(NULL);
+    mVelocity = cv::Mat();
+    mnMotionModelSamples = 0;
+}
+
 
 
 } //namespace ORB_SLAM
@@ -0,0 +1,245 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TrajectoryLog.h"
+
+#include <unistd.h>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+const size_t TrajectoryLog::CHUNK_SIZE;
+
+cv::Mat TrajectoryLog::Record::GetRelativePose() const
+{
+    cv::Mat Tcr = cv::Mat::eye(4,4,CV_32F);
+    for(int i=0; i<3; i++)
+        for(int j=0; j<4; j++)
+            Tcr.at<float>(i,j) = mTcr[4*i+j];
+    return Tcr;
+}
+
+TrajectoryLog::TrajectoryLog():
+    mnRecords(0), mnSpilled(0), mbSpillError(false), mbFinishRequested(false), mbFinished(false)
+{
+    mvCurrent.reserve(CHUNK_SIZE);
+}
+
+bool TrajectoryLog::SetSpillFile(const string &filename)
+{
+    unique_lock<mutex> lock(mMutexFile);
+    mFile.open(filename.c_str(), ios::out | ios::binary | ios::trunc);
+    if(!mFile.is_open() || !mFile.good())
+    {
+        mFile.close();
+        return false;
+    }
+    mSpillFile = filename;
+    return true;
+}
+
+void TrajectoryLog::Run()
+{
+    while(1)
+    {
+        if(!Spill())
+            cerr << "Error writing the trajectory spill file, the trajectory is kept in memory." << endl;
+
+        if(CheckFinish())
+            break;
+
+        usleep(5000);
+    }
+
+    SetFinish();
+}
+
+bool TrajectoryLog::Spill()
+{
+    unique_lock<mutex> lock(mMutexFile);
+    if(!mFile.is_open() || mbSpillError)
+        return true;
+
+    while(1)
+    {
+        shared_ptr<const Chunk> pChunk;
+        {
+            unique_lock<mutex> lock2(mMutexChunks);
+            if(mdFullChunks.empty())
+                return true;
+            pChunk = mdFullChunks.front();
+        }
+
+        // The tracking thread keeps adding records while the chunk is written
+        mFile.write(reinterpret_cast<const char*>(pChunk->data()),pChunk->size()*sizeof(Record));
+        mFile.flush();
+        if(!mFile.good())
+        {
+            mbSpillError = true;
+            return false;
+        }
+
+        unique_lock<mutex> lock2(mMutexChunks);
+        mdFullChunks.pop_front();
+        mnSpilled += pChunk->size();
+    }
+}
+
+void TrajectoryLog::RequestFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mbFinishRequested = true;
+}
+
+bool TrajectoryLog::CheckFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinishRequested;
+}
+
+void TrajectoryLog::SetFinish()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    mbFinished = true;
+}
+
+bool TrajectoryLog::isFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    return mbFinished;
+}
+
+void TrajectoryLog::Add(const cv::Mat &Tcr, KeyFrame *pReference, const double timeStamp, const bool bLost)
+{
+    Record record;
+    for(int i=0; i<3; i++)
+        for(int j=0; j<4; j++)
+            record.mTcr[4*i+j] = Tcr.at<float>(i,j);
+    record.mpReference = pReference;
+    record.mTimeStamp = timeStamp;
+    record.mbLost = bLost;
+
+    Push(record);
+}
+
+void TrajectoryLog::AddRepeat(const bool bLost)
+{
+    Record record = mLast;
+    record.mbLost = bLost;
+
+    Push(record);
+}
+
+void TrajectoryLog::Push(const Record &record)
+{
+    mLast = record;
+
+    unique_lock<mutex> lock(mMutexChunks);
+    mvCurrent.push_back(record);
+    mnRecords++;
+
+    if(mvCurrent.size()>=CHUNK_SIZE)
+    {
+        mdFullChunks.push_back(make_shared<const Chunk>(std::move(mvCurrent)));
+        mvCurrent = Chunk();
+        mvCurrent.reserve(CHUNK_SIZE);
+    }
+}
+
+bool TrajectoryLog::empty()
+{
+    unique_lock<mutex> lock(mMutexChunks);
+    return mnRecords==0;
+}
+
+cv::Mat TrajectoryLog::GetLastRelativePose()
+{
+    return mLast.GetRelativePose();
+}
+
+void TrajectoryLog::Clear()
+{
+    unique_lock<mutex> lock(mMutexFile);
+    unique_lock<mutex> lock2(mMutexChunks);
+
+    mvCurrent.clear();
+    mdFullChunks.clear();
+    mnRecords = 0;
+
+    if(mFile.is_open() && mnSpilled>0)
+    {
+        mFile.close();
+        mFile.open(mSpillFile.c_str(), ios::out | ios::binary | ios::trunc);
+    }
+    mnSpilled = 0;
+}
+
+bool TrajectoryLog::ForEach(const function<void(const Record&)> &f)
+{
+    // Spilling waits, so that the file and the chunks in memory do not change
+    unique_lock<mutex> lock(mMutexFile);
+
+    size_t nSpilled;
+    deque<shared_ptr<const Chunk> > dFullChunks;
+    Chunk vCurrent;
+    {
+        unique_lock<mutex> lock2(mMutexChunks);
+        nSpilled = mnSpilled;
+        dFullChunks = mdFullChunks;
+        vCurrent = mvCurrent;
+    }
+
+    bool bOK = true;
+    if(nSpilled>0)
+    {
+        ifstream file(mSpillFile.c_str(), ios::in | ios::binary);
+        Chunk vBuffer(CHUNK_SIZE);
+        for(size_t nRead=0; nRead<nSpilled; )
+        {
+            const size_t n = min(CHUNK_SIZE,nSpilled-nRead);
+            file.read(reinterpret_cast<char*>(vBuffer.data()),n*sizeof(Record));
+            if(!file.good())
+            {
+                cerr << "Error reading the trajectory spill file, " << nSpilled-nRead << " frames are missing." << endl;
+                bOK = false;
+                break;
+            }
+
+            for(size_t i=0; i<n; i++)
+                f(vBuffer[i]);
+            nRead += n;
+        }
+    }
+
+    for(size_t i=0; i<dFullChunks.size(); i++)
+        for(size_t j=0; j<dFullChunks[i]->size(); j++)
+            f((*dFullChunks[i])[j]);
+
+    for(size_t i=0; i<vCurrent.size(); i++)
+        f(vCurrent[i]);
+
+    return bOK;
+}
+
+} //namespace ORB_SLAM
@@ -56,6 +56,9 @@ void Viewer::Run()
     mbFinished = false;
     mbStopped = false;
 
+    Map* pMap = mpMapDrawer->mpMap;
+    const int nEpochSlot = pMap->mEpochManager.RegisterThread();
+
     pangolin::CreateWindowAndBind("ORB-SLAM2: Map Viewer",1024,768);
 
     // 3D Mouse handler requires depth testing to be enabled
@@ -68,6 +71,7 @@ void Viewer::Run()
     pangolin::CreatePanel("menu").SetBounds(0.0,1.0,0.0,pangolin::Attach::Pix(175));
     pangolin::Var<bool> menuFollowCamera("menu.Follow Camera",true,true);
     pangolin::Var<bool> menuShowPoints("menu.Show Points",true,true);
+    pangolin::Var<bool> menuPointsInView("menu.Only Points In View",false,true);
     pangolin::Var<bool> menuShowKeyFrames("menu.Show KeyFrames",true,true);
     pangolin::Var<bool> menuShowGraph("menu.Show Graph",true,true);
     pangolin::Var<bool> menuLocalizationMode("menu.Localization Mode",false,true);
@@ -130,7 +134,7 @@ void Viewer::Run()
         if(menuShowKeyFrames || menuShowGraph)
             mpMapDrawer->DrawKeyFrames(menuShowKeyFrames,menuShowGraph);
         if(menuShowPoints)
-            mpMapDrawer->DrawMapPoints();
+            mpMapDrawer->DrawMapPoints(menuPointsInView);
 
         pangolin::FinishFrame();
 
@@ -143,6 +147,7 @@ void Viewer::Run()
             menuShowGraph = true;
             menuShowKeyFrames = true;
             menuShowPoints = true;
+            menuPointsInView = false;
             menuLocalizationMode = false;
             if(bLocalizationMode)
                 mpSystem->DeactivateLocalizationMode();
@@ -153,10 +158,14 @@ void Viewer::Run()
             menuReset = false;
         }
 
+        // The mappoints drawn are taken from the map at each iteration
+        pMap->mEpochManager.Quiescent(nEpochSlot);
+
         if(Stop())
         {
             while(isStopped())
             {
+                pMap->mEpochManager.Quiescent(nEpochSlot);
                 usleep(3000);
             }
         }
@@ -165,6 +174,8 @@ void Viewer::Run()
             break;
     }
 
+    pMap->mEpochManager.UnregisterThread(nEpochSlot);
+
     SetFinish();
 }
 
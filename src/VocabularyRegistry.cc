@@ -0,0 +1,99 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "VocabularyRegistry.h"
+
+#include <stdlib.h>
+#include <limits.h>
+
+namespace ORB_SLAM2
+{
+
+std::map<std::string, std::shared_ptr<VocabularyRegistry::Entry> > VocabularyRegistry::msEntries;
+std::mutex VocabularyRegistry::mMutexEntries;
+
+std::shared_ptr<const ORBVocabulary> VocabularyRegistry::Get(const std::string &strVocFile)
+{
+    std::shared_ptr<Entry> pEntry;
+    {
+        unique_lock<mutex> lock(mMutexEntries);
+        std::shared_ptr<Entry> &pSlot = msEntries[Canonical(strVocFile)];
+        if(!pSlot)
+            pSlot = std::make_shared<Entry>();
+        pEntry = pSlot;
+    }
+
+    // The registry lock is released while loading, so different files load in parallel
+    unique_lock<mutex> lock(pEntry->mMutexLoad);
+    if(!pEntry->mpVoc)
+    {
+        std::shared_ptr<ORBVocabulary> pVoc = std::make_shared<ORBVocabulary>();
+        if(!pVoc->loadFromTextFile(strVocFile))
+            return std::shared_ptr<const ORBVocabulary>();
+        pEntry->mpVoc = pVoc;
+    }
+
+    return pEntry->mpVoc;
+}
+
+bool VocabularyRegistry::Register(const std::string &strVocFile, const std::shared_ptr<const ORBVocabulary> &pVoc)
+{
+    std::shared_ptr<Entry> pEntry;
+    {
+        unique_lock<mutex> lock(mMutexEntries);
+        std::shared_ptr<Entry> &pSlot = msEntries[Canonical(strVocFile)];
+        if(!pSlot)
+            pSlot = std::make_shared<Entry>();
+        pEntry = pSlot;
+    }
+
+    unique_lock<mutex> lock(pEntry->mMutexLoad);
+    if(pEntry->mpVoc && pEntry->mpVoc!=pVoc)
+        return false;
+    pEntry->mpVoc = pVoc;
+    return true;
+}
+
+void VocabularyRegistry::Purge()
+{
+    unique_lock<mutex> lock(mMutexEntries);
+    for(std::map<std::string, std::shared_ptr<Entry> >::iterator it=msEntries.begin(); it!=msEntries.end(); )
+    {
+        unique_lock<mutex> lockEntry(it->second->mMutexLoad);
+        if(!it->second->mpVoc || it->second->mpVoc.unique())
+        {
+            lockEntry.unlock();
+            it = msEntries.erase(it);
+        }
+        else
+            it++;
+    }
+}
+
+std::string VocabularyRegistry::Canonical(const std::string &strVocFile)
+{
+    // Different relative paths to the same file must share the same entry
+    char buf[PATH_MAX];
+    if(realpath(strVocFile.c_str(),buf))
+        return std::string(buf);
+    return strVocFile;
+}
+
+} //namespace ORB_SLAM